@@ -18,7 +18,11 @@
 #include "include/msgr.h"
 
 #include <list>
+#include <set>
 #include <functional>
+#include <utility>
+#include <type_traits>
+#include <boost/optional.hpp>
 
 namespace ceph {
   class Formatter;
@@ -60,4 +64,31 @@ class OpQueue {
     virtual ~OpQueue() {}; 
 };
 
+/**
+ * Dequeue up to max_scan items from q and return the first one whose
+ * key can be try-locked.  Once an item has been passed over, later
+ * items with the same key are passed over as well without trying the
+ * lock, so the caller never runs an item ahead of an earlier one for
+ * that key.  Passed-over items are pushed to the front of *passed, so
+ * requeueing them at the front in list order restores their order.
+ */
+template <typename T, typename K, typename GetKey, typename TryLock>
+boost::optional<T> opqueue_dequeue_unlocked(
+  OpQueue<T, K>& q, int max_scan, GetKey get_key, TryLock try_lock,
+  std::list<T> *passed)
+{
+  typedef typename std::decay<
+    decltype(get_key(std::declval<const T&>()))>::type Key;
+  std::set<Key> passed_keys;
+  for (int n = 0; n < max_scan && !q.empty(); ++n) {
+    T next = q.dequeue();
+    Key k = get_key(next);
+    if (!passed_keys.count(k) && try_lock(next))
+      return next;
+    passed_keys.insert(k);
+    passed->push_front(next);
+  }
+  return boost::none;
+}
+
 #endif
@@ -300,6 +300,7 @@ void ShardedThreadPool::shardedthreadpool_worker(uint32_t thread_index)
   ss << name << " thread " << (void*)pthread_self();
   heartbeat_handle_d *hb = cct->get_heartbeat_map()->add_worker(ss.str());
 
+  wq->_thread_start(thread_index);
   while (!stop_threads.read()) {
     if(pause_threads.read()) {
       shardedpool_lock.Lock();
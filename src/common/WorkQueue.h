@@ -633,6 +633,8 @@ public:
     virtual ~BaseShardedWQ() {}
 
     virtual void _process(uint32_t thread_index, heartbeat_handle_d *hb ) = 0;
+    /// called once in each worker thread before it processes anything
+    virtual void _thread_start(uint32_t thread_index) {}
     virtual void return_waiting_threads() = 0;
     virtual bool is_shard_empty(uint32_t thread_index) = 0;
   };      
@@ -214,6 +214,8 @@ OPTION(mon_compact_on_start, OPT_BOOL, false)  // compact leveldb on ceph-mon st
 OPTION(mon_compact_on_bootstrap, OPT_BOOL, false)  // trigger leveldb compaction on bootstrap
 OPTION(mon_compact_on_trim, OPT_BOOL, true)       // compact (a prefix) when we trim old states
 OPTION(mon_osd_cache_size, OPT_INT, 10)  // the size of osdmaps cache, not to rely on underlying store's cache
+OPTION(mon_osd_mapping_threads, OPT_INT, 2)  // threads that precompute the pg mapping table for each osdmap epoch; 0 maps inline
+OPTION(mon_osd_mapping_pgs_per_chunk, OPT_INT, 4096)  // pgs mapped per work item
 
 OPTION(mon_tick_interval, OPT_INT, 5)
 OPTION(mon_session_timeout, OPT_INT, 300)    // must send keepalive or subscribe
@@ -669,7 +671,9 @@ OPTION(osd_tier_default_cache_hit_set_search_last_n, OPT_INT, 1)
 
 OPTION(osd_map_dedup, OPT_BOOL, true)
 OPTION(osd_map_max_advance, OPT_INT, 150) // make this < cache_size!
-OPTION(osd_map_cache_size, OPT_INT, 200)
+OPTION(osd_map_cache_size, OPT_INT, 200)   // encoded maps kept in memory
+OPTION(osd_map_cache_max_bytes, OPT_U64, 128 << 20)   // decoded checkpoint maps and incrementals kept in memory
+OPTION(osd_map_cache_checkpoint_interval, OPT_INT, 16)   // keep full maps every this many epochs; rebuild the rest from incrementals
 OPTION(osd_map_message_max, OPT_INT, 100)  // max maps per MOSDMap message
 OPTION(osd_map_share_max_epochs, OPT_INT, 100)  // cap on # of inc maps we send to peers, clients
 OPTION(osd_inject_bad_map_crc_probability, OPT_FLOAT, 0)
@@ -689,8 +693,23 @@ OPTION(osd_recovery_threads, OPT_INT, 1)
 OPTION(osd_recover_clone_overlap, OPT_BOOL, true)   // preserve clone_overlap during recovery/migration
 OPTION(osd_op_num_threads_per_shard, OPT_INT, 2)
 OPTION(osd_op_num_shards, OPT_INT, 5)
-OPTION(osd_op_queue, OPT_STR, "prio") // PrioritzedQueue (prio), Weighted Priority Queue (wpq), or debug_random
+OPTION(osd_op_queue, OPT_STR, "prio") // PrioritzedQueue (prio), Weighted Priority Queue (wpq), mClock QoS queue (mclock), or debug_random
+// mclock op queue: reservation and limit in ops/sec (0 = none), weight relative to the other classes
+OPTION(osd_op_queue_mclock_client_op_res, OPT_DOUBLE, 1000.0)
+OPTION(osd_op_queue_mclock_client_op_wgt, OPT_DOUBLE, 500.0)
+OPTION(osd_op_queue_mclock_client_op_lim, OPT_DOUBLE, 0.0)
+OPTION(osd_op_queue_mclock_recov_res, OPT_DOUBLE, 10.0)
+OPTION(osd_op_queue_mclock_recov_wgt, OPT_DOUBLE, 1.0)
+OPTION(osd_op_queue_mclock_recov_lim, OPT_DOUBLE, 0.0)
+OPTION(osd_op_queue_mclock_scrub_res, OPT_DOUBLE, 1.0)
+OPTION(osd_op_queue_mclock_scrub_wgt, OPT_DOUBLE, 1.0)
+OPTION(osd_op_queue_mclock_scrub_lim, OPT_DOUBLE, 0.0)
+OPTION(osd_op_queue_mclock_snap_res, OPT_DOUBLE, 1.0)
+OPTION(osd_op_queue_mclock_snap_wgt, OPT_DOUBLE, 1.0)
+OPTION(osd_op_queue_mclock_snap_lim, OPT_DOUBLE, 0.0)
 OPTION(osd_op_queue_cut_off, OPT_STR, "low") // Min priority to go to strict queue. (low, high, debug_random)
+OPTION(osd_op_queue_steal_min_depth, OPT_INT, 2) // idle shard threads run ops from shards with at least this many queued; 0 disables
+OPTION(osd_op_queue_steal_max_scan, OPT_INT, 4) // queued ops examined per steal attempt looking for one whose pg is idle
 
 // Set to true for testing.  Users should NOT set this.
 // If set to true even after reading enough shards to
@@ -836,6 +855,9 @@ OPTION(rocksdb_db_paths, OPT_STR, "")   // path,size( path,size)*
 OPTION(rocksdb_log_to_ceph_log, OPT_BOOL, true)  // log to ceph log
 OPTION(rocksdb_cache_size, OPT_INT, 128*1024*1024)  // default leveldb cache size
 OPTION(rocksdb_block_size, OPT_INT, 4*1024)  // default rocksdb block size
+// compact a range once a single transaction deletes this many keys from
+// it, so that later scans don't have to skip the tombstones (0 = never)
+OPTION(rocksdb_compact_on_range_delete, OPT_U64, 10000)
 // rocksdb options that will be used for omap(if omap_backend is rocksdb)
 OPTION(filestore_rocksdb_options, OPT_STR, "")
 // rocksdb options that will be used in monstore
@@ -889,6 +911,8 @@ OPTION(osd_bench_duration, OPT_U32, 30) // duration of 'osd bench', capped at 30
 OPTION(memstore_device_bytes, OPT_U64, 1024*1024*1024)
 OPTION(memstore_page_set, OPT_BOOL, true)
 OPTION(memstore_page_size, OPT_U64, 64 << 10)
+OPTION(memstore_page_pool_bytes, OPT_U64, 16 << 20) // freed pages each thread keeps for reuse
+OPTION(memstore_object_shards, OPT_INT, 16) // object lookup shards per collection
 
 OPTION(bdev_debug_inflight_ios, OPT_BOOL, false)
 OPTION(bdev_inject_crash, OPT_INT, 0)  // if N>0, then ~ 1/N IOs will complete before we crash on flush.
@@ -903,6 +927,10 @@ OPTION(bdev_block_size, OPT_INT, 4096)
 // NVMe driver is loaded while osd is running.
 OPTION(bdev_nvme_unbind_from_kernel, OPT_BOOL, false)
 OPTION(bdev_nvme_retry_count, OPT_INT, -1) // -1 means by default which is 4
+// osd op shard worker threads 0..n-1 each get their own nvme queue pair,
+// submitting and polling for completions inline; other op threads, and
+// all other threads, hand io to the shared driver thread instead
+OPTION(bdev_nvme_polled_queues, OPT_INT, 8)
 
 OPTION(bluefs_alloc_size, OPT_U64, 1048576)
 OPTION(bluefs_max_prefetch, OPT_U64, 1048576)
@@ -911,6 +939,10 @@ OPTION(bluefs_max_log_runway, OPT_U64, 4194304)  // alloc this much at a time
 OPTION(bluefs_log_compact_min_ratio, OPT_FLOAT, 5.0)      // before we consider
 OPTION(bluefs_log_compact_min_size, OPT_U64, 16*1048576)  // before we consider
 OPTION(bluefs_min_flush_size, OPT_U64, 65536)  // ignore flush until its this big
+OPTION(bluefs_tier_interval, OPT_DOUBLE, 5)  // seconds between tiering passes; 0 to disable
+OPTION(bluefs_tier_high_ratio, OPT_FLOAT, .90)  // demote cold files when db device is this full
+OPTION(bluefs_tier_low_ratio, OPT_FLOAT, .75)   // ... down to this; promote hot files while below
+OPTION(bluefs_tier_max_bytes, OPT_U64, 256*1048576)  // max bytes moved per tiering pass
 
 OPTION(bluestore_bluefs, OPT_BOOL, true)
 OPTION(bluestore_bluefs_env_mirror, OPT_BOOL, false) // mirror to normal Env for debug
@@ -936,12 +968,39 @@ OPTION(bluestore_block_wal_size, OPT_U64, 96 * 1024*1024) // rocksdb wal
 OPTION(bluestore_block_wal_create, OPT_BOOL, false)
 OPTION(bluestore_max_dir_size, OPT_U32, 1000000)
 OPTION(bluestore_min_alloc_size, OPT_U32, 64*1024)
-OPTION(bluestore_onode_map_size, OPT_U32, 1024)   // onodes per collection
-OPTION(bluestore_cache_tails, OPT_BOOL, true)   // cache tail blocks in Onode
+OPTION(bluestore_allocator, OPT_STR, "stupid")  // stupid | bitmap
+OPTION(bluestore_freelist_type, OPT_STR, "bitmap") // extent | bitmap; set at mkfs
+OPTION(bluestore_freelist_blocks_per_key, OPT_INT, 128)
+OPTION(bluestore_bitmapallocator_blocks_per_zone, OPT_INT, 1024) // rounded to a multiple of 512, max 4096
+OPTION(bluestore_csum_type, OPT_STR, "crc32c") // none|crc32c|xxhash32|xxhash64
+OPTION(bluestore_csum_chunk_size, OPT_U32, 4096) // bytes per checksum
+OPTION(bluestore_compression, OPT_STR, "none")  // none|passive|aggressive|force
+OPTION(bluestore_compression_algorithm, OPT_STR, "snappy") // snappy|zlib
+OPTION(bluestore_compression_required_ratio, OPT_DOUBLE, .875) // store compressed only if size <= this * original
+OPTION(bluestore_compression_blob_size, OPT_U32, 256*1024) // compression unit; rounded to a multiple of min_alloc_size
+OPTION(bluestore_onode_map_size, OPT_U32, 1024)   // enode hash buckets per collection
+OPTION(bluestore_cache_type, OPT_STR, "2q")   // lru, 2q
+OPTION(bluestore_cache_size, OPT_U64, 512*1024*1024)  // total onode + data cache, in bytes
+OPTION(bluestore_cache_shards, OPT_U32, 8)   // collections hash to a shard
+OPTION(bluestore_cache_meta_ratio, OPT_DOUBLE, .25)  // share of cache_size for onodes
+OPTION(bluestore_cache_onode_bytes, OPT_U32, 4096)  // assumed memory per cached onode
+OPTION(bluestore_2q_cache_kin_ratio, OPT_DOUBLE, .5)    // 2Q paper suggests .25
+OPTION(bluestore_2q_cache_kout_ratio, OPT_DOUBLE, .5)   // 2Q paper suggests .5
 OPTION(bluestore_kvbackend, OPT_STR, "rocksdb")
 OPTION(bluestore_rocksdb_options, OPT_STR, "compression=kNoCompression,max_write_buffer_number=16,min_write_buffer_number_to_merge=3,recycle_log_file_num=16")
+// prefixes to keep in their own rocksdb column families, as
+// "prefix[:opt=val,...] ...".  options are rocksdb column family options
+// plus cache_share (fraction of rocksdb_cache_size for a private block
+// cache), bloom_bits and block_size.  only applied at mkfs.  e.g.
+// "L:write_buffer_size=16777216,level0_file_num_compaction_trigger=2
+//  O:bloom_bits=10,cache_share=.25 M:bloom_bits=10"
+OPTION(bluestore_rocksdb_cfs, OPT_STR, "")
 OPTION(bluestore_fsck_on_mount, OPT_BOOL, false)
 OPTION(bluestore_fsck_on_umount, OPT_BOOL, false)
+OPTION(bluestore_fsck_online_batch, OPT_INT, 64)  // objects checked per kv snapshot
+OPTION(bluestore_fsck_online_objects_per_sec, OPT_DOUBLE, 1000)  // 0 = unthrottled
+OPTION(bluestore_fsck_online_busy_ops, OPT_INT, 64)  // back off while this many ops are in the bluestore_max_ops throttle (0 = never)
+OPTION(bluestore_fsck_online_busy_sleep, OPT_DOUBLE, .1)  // seconds
 OPTION(bluestore_fail_eio, OPT_BOOL, true)
 OPTION(bluestore_sync_io, OPT_BOOL, false)  // perform initial io synchronously
 OPTION(bluestore_sync_transaction, OPT_BOOL, false)  // perform kv txn synchronously
@@ -954,6 +1013,9 @@ OPTION(bluestore_max_ops, OPT_U64, 512)
 OPTION(bluestore_max_bytes, OPT_U64, 64*1024*1024)
 OPTION(bluestore_wal_max_ops, OPT_U64, 512)
 OPTION(bluestore_wal_max_bytes, OPT_U64, 128*1024*1024)
+OPTION(bluestore_wal_batch_ops, OPT_U32, 32)       // small wal txns per batched write (0 = no batching)
+OPTION(bluestore_wal_batch_bytes, OPT_U64, 1024*1024) // write a wal batch once it holds this much data
+OPTION(bluestore_wal_batch_max_age, OPT_DOUBLE, .002) // max seconds a small wal txn waits for its batch
 OPTION(bluestore_fid_prealloc, OPT_INT, 1024)
 OPTION(bluestore_nid_prealloc, OPT_INT, 1024)
 OPTION(bluestore_overlay_max_length, OPT_INT, 65536)
@@ -981,6 +1043,9 @@ OPTION(kstore_sync_submit_transaction, OPT_BOOL, false)
 OPTION(kstore_onode_map_size, OPT_U64, 1024)
 OPTION(kstore_cache_tails, OPT_BOOL, true)
 OPTION(kstore_default_stripe_size, OPT_INT, 65536)
+OPTION(kstore_extent_layout, OPT_BOOL, true) // new objects use extents rather than stripes
+OPTION(kstore_max_blob_size, OPT_U64, 65536)
+OPTION(kstore_max_extents, OPT_INT, 64) // extents past the minimum before an object is rewritten
 
 OPTION(filestore_omap_backend, OPT_STR, "leveldb")
 
@@ -1014,6 +1079,8 @@ OPTION(filestore_debug_inject_read_err, OPT_BOOL, false)
 
 OPTION(filestore_debug_omap_check, OPT_BOOL, 0) // Expensive debugging check on sync
 OPTION(filestore_omap_header_cache_size, OPT_INT, 1024)
+// the header cache and the per-object omap locks are split this many ways
+OPTION(filestore_omap_header_cache_shards, OPT_INT, 16)
 
 // Use omap for xattrs for attrs over
 // filestore_max_inline_xattr_size or
@@ -1096,6 +1163,10 @@ OPTION(filestore_commit_timeout, OPT_FLOAT, 600)
 OPTION(filestore_fiemap_threshold, OPT_INT, 4096)
 OPTION(filestore_merge_threshold, OPT_INT, 10)
 OPTION(filestore_split_multiple, OPT_INT, 2)
+// queue a background split once a subdir reaches this fraction of the
+// split threshold (0 to split only inline, on the write path)
+OPTION(filestore_split_ahead_ratio, OPT_DOUBLE, .8)
+OPTION(filestore_split_rate, OPT_INT, 2000)   // max objects/sec moved by background splits, 0 for no limit
 OPTION(filestore_update_to, OPT_INT, 1000)
 OPTION(filestore_blackhole, OPT_BOOL, false)     // drop any new transactions on the floor
 OPTION(filestore_fd_cache_size, OPT_INT, 128)    // FD lru size
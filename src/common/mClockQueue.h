@@ -0,0 +1,400 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef MCLOCK_QUEUE_H
+#define MCLOCK_QUEUE_H
+
+#include "OpQueue.h"
+#include "common/ceph_time.h"
+#include "common/Formatter.h"
+
+#include <cassert>
+#include <deque>
+#include <limits>
+#include <map>
+#include <vector>
+
+/**
+ * QoS parameters of one mClockQueue class
+ *
+ * reservation and limit are in ops per second; 0 means none.  weight
+ * is relative to the other classes and shares whatever capacity is
+ * left once reservations are met.
+ */
+struct mClockClassInfo {
+  double reservation;
+  double weight;
+  double limit;
+  mClockClassInfo(double r = 0, double w = 1, double l = 0)
+    : reservation(r), weight(w), limit(l) {}
+};
+
+/**
+ * mClockQueue -- an OpQueue that schedules by mClock tags
+ *
+ * Items are sorted into a fixed set of classes by a classifier.  Every
+ * item is tagged on arrival with a reservation, proportional-share and
+ * limit tag, as in mClock (Gulati et al, OSDI '10).  dequeue() then
+ * serves, in order of preference:
+ *
+ *  - the strict queue, highest priority first;
+ *  - the class with the earliest reservation tag that is due, so every
+ *    class gets its reservation however busy the others are;
+ *  - among classes under their limit, the one with the earliest
+ *    proportional-share tag, so spare capacity is split by weight.
+ *
+ * Since dequeue() must return something while the queue is not empty,
+ * a limit is only honoured while some other class has work: if every
+ * class is over its limit the one that will be under it soonest is
+ * served.
+ *
+ * Items within a class are served in order; the priority passed to
+ * enqueue() only matters for the strict queue.
+ */
+template <typename T, typename K>
+class mClockQueue : public OpQueue <T, K>
+{
+public:
+  typedef std::function<unsigned (const T&)> Classifier;
+  typedef std::function<double ()> Clock;
+
+private:
+  struct Request {
+    K cl;
+    T item;
+    double r_tag, p_tag, l_tag;
+    Request(const K& cl, const T& item, double r, double p, double l)
+      : cl(cl), item(item), r_tag(r), p_tag(p), l_tag(l) {}
+  };
+
+  struct Class {
+    mClockClassInfo info;
+    std::deque<Request> requests;
+    double prev_r_tag, prev_p_tag, prev_l_tag;
+    /// reservation credit given back for ops served by weight; the
+    /// effective reservation tag is r_tag - r_adjust
+    double r_adjust;
+
+    explicit Class(const mClockClassInfo& i)
+      : info(i), prev_r_tag(0), prev_p_tag(0), prev_l_tag(0),
+	r_adjust(0) {}
+
+    double head_r_tag() const {
+      return requests.front().r_tag - r_adjust;
+    }
+  };
+
+  Classifier classify;
+  Clock clock;
+  std::vector<Class> classes;
+  std::map<unsigned, std::deque<std::pair<K, T> > > strict;
+  unsigned strict_size;
+  unsigned size;
+  /// the p tag of the last op served by weight.  it only moves
+  /// forward and never looks at wall time, so it keeps its place while
+  /// the queue is drained.
+  double vclock;
+
+  static double inf() {
+    return std::numeric_limits<double>::infinity();
+  }
+
+  static double now_mono() {
+    return std::chrono::duration<double>(
+      ceph::mono_clock::now().time_since_epoch()).count();
+  }
+
+  /// where an idle class starts: the busy classes' proportional-share
+  /// position, and never behind what has already been served
+  double virtual_time() const {
+    double vt = inf();
+    for (typename std::vector<Class>::const_iterator c = classes.begin();
+	 c != classes.end();
+	 ++c) {
+      if (!c->requests.empty() && c->requests.front().p_tag < vt)
+	vt = c->requests.front().p_tag;
+    }
+    return vt == inf() ? vclock : std::max(vt, vclock);
+  }
+
+  void tag(Class& c, const K& cl, const T& item, bool front) {
+    if (front && !c.requests.empty()) {
+      // a requeued op goes ahead of everything else in its class
+      const Request& head = c.requests.front();
+      c.requests.push_front(Request(cl, item, head.r_tag, head.p_tag,
+				    head.l_tag));
+      return;
+    }
+    double now = clock();
+    double r = inf(), l = 0;
+    if (c.info.reservation > 0) {
+      r = std::max(c.prev_r_tag - c.r_adjust + 1.0 / c.info.reservation,
+		   now) + c.r_adjust;
+      c.prev_r_tag = r;
+    }
+    // an idle class starts no earlier than the virtual clock, so it
+    // can neither bank credit while idle nor starve the busy classes
+    // when it comes back
+    double p = inf();
+    if (c.info.weight > 0) {
+      p = c.prev_p_tag + 1.0 / c.info.weight;
+      if (c.requests.empty())
+	p = std::max(p, virtual_time());
+    }
+    c.prev_p_tag = p;
+    if (c.info.limit > 0) {
+      l = std::max(c.prev_l_tag + 1.0 / c.info.limit, now);
+      c.prev_l_tag = l;
+    }
+    if (front)
+      c.requests.push_front(Request(cl, item, r, p, l));
+    else
+      c.requests.push_back(Request(cl, item, r, p, l));
+  }
+
+  void insert(const K& cl, const T& item, bool front) {
+    unsigned i = classify(item);
+    assert(i < classes.size());
+    tag(classes[i], cl, item, front);
+    ++size;
+  }
+
+  /// a class with nothing queued keeps no reservation credit
+  static void emptied(Class& c) {
+    c.prev_r_tag -= c.r_adjust;
+    c.r_adjust = 0;
+  }
+
+  T pop(Class& c, bool by_weight) {
+    const Request& head = c.requests.front();
+    T ret = head.item;
+    if (by_weight) {
+      if (head.p_tag != inf() && head.p_tag > vclock)
+	vclock = head.p_tag;
+      // ops served out of spare capacity don't count against the
+      // class's reservation
+      if (c.info.reservation > 0)
+	c.r_adjust += 1.0 / c.info.reservation;
+    }
+    c.requests.pop_front();
+    --size;
+    if (c.requests.empty())
+      emptied(c);
+    return ret;
+  }
+
+public:
+  /**
+   * @param classify maps an item to an index into @p info
+   * @param info QoS parameters of each class
+   * @param clock seconds on a monotonic clock; defaults to mono_clock
+   */
+  mClockQueue(Classifier classify,
+	      const std::vector<mClockClassInfo>& info,
+	      Clock clock = Clock())
+    : classify(classify), clock(clock ? clock : Clock(now_mono)),
+      strict_size(0), size(0), vclock(0) {
+    for (typename std::vector<mClockClassInfo>::const_iterator i =
+	   info.begin();
+	 i != info.end();
+	 ++i)
+      classes.push_back(Class(*i));
+  }
+
+  unsigned length() const override final {
+    return strict_size + size;
+  }
+
+  void remove_by_filter(
+      std::function<bool (T)> f,
+      std::list<T> *removed = 0) override final {
+    for (typename std::map<unsigned, std::deque<std::pair<K, T> > >::iterator
+	   p = strict.begin();
+	 p != strict.end();
+	 ) {
+      for (typename std::deque<std::pair<K, T> >::iterator q =
+	     p->second.begin();
+	   q != p->second.end();
+	   ) {
+	if (f(q->second)) {
+	  if (removed)
+	    removed->push_back(q->second);
+	  q = p->second.erase(q);
+	  --strict_size;
+	} else {
+	  ++q;
+	}
+      }
+      if (p->second.empty())
+	strict.erase(p++);
+      else
+	++p;
+    }
+    for (typename std::vector<Class>::iterator c = classes.begin();
+	 c != classes.end();
+	 ++c) {
+      for (typename std::deque<Request>::iterator q = c->requests.begin();
+	   q != c->requests.end();
+	   ) {
+	if (f(q->item)) {
+	  if (removed)
+	    removed->push_back(q->item);
+	  q = c->requests.erase(q);
+	  --size;
+	} else {
+	  ++q;
+	}
+      }
+      if (c->requests.empty())
+	emptied(*c);
+    }
+  }
+
+  void remove_by_class(K cl, std::list<T> *removed = 0) override final {
+    for (typename std::map<unsigned, std::deque<std::pair<K, T> > >::iterator
+	   p = strict.begin();
+	 p != strict.end();
+	 ) {
+      for (typename std::deque<std::pair<K, T> >::iterator q =
+	     p->second.begin();
+	   q != p->second.end();
+	   ) {
+	if (q->first == cl) {
+	  if (removed)
+	    removed->push_back(q->second);
+	  q = p->second.erase(q);
+	  --strict_size;
+	} else {
+	  ++q;
+	}
+      }
+      if (p->second.empty())
+	strict.erase(p++);
+      else
+	++p;
+    }
+    for (typename std::vector<Class>::iterator c = classes.begin();
+	 c != classes.end();
+	 ++c) {
+      for (typename std::deque<Request>::iterator q = c->requests.begin();
+	   q != c->requests.end();
+	   ) {
+	if (q->cl == cl) {
+	  if (removed)
+	    removed->push_back(q->item);
+	  q = c->requests.erase(q);
+	  --size;
+	} else {
+	  ++q;
+	}
+      }
+      if (c->requests.empty())
+	emptied(*c);
+    }
+  }
+
+  bool empty() const override final {
+    return !(strict_size + size);
+  }
+
+  void enqueue_strict(K cl, unsigned priority, T item) override final {
+    strict[priority].push_back(std::make_pair(cl, item));
+    ++strict_size;
+  }
+
+  void enqueue_strict_front(K cl, unsigned priority, T item) override final {
+    strict[priority].push_front(std::make_pair(cl, item));
+    ++strict_size;
+  }
+
+  void enqueue(K cl, unsigned priority, unsigned cost, T item) override final {
+    insert(cl, item, false);
+  }
+
+  void enqueue_front(K cl, unsigned priority, unsigned cost, T item) override final {
+    insert(cl, item, true);
+  }
+
+  T dequeue() override final {
+    assert(!empty());
+    if (strict_size) {
+      typename std::map<unsigned, std::deque<std::pair<K, T> > >::iterator p =
+	--strict.end();
+      T ret = p->second.front().second;
+      p->second.pop_front();
+      if (p->second.empty())
+	strict.erase(p);
+      --strict_size;
+      return ret;
+    }
+
+    double now = clock();
+    Class *reserved = NULL, *weighted = NULL, *limited = NULL;
+    for (typename std::vector<Class>::iterator c = classes.begin();
+	 c != classes.end();
+	 ++c) {
+      if (c->requests.empty())
+	continue;
+      const Request& head = c->requests.front();
+      double r = c->head_r_tag();
+      if (r <= now && (!reserved || r < reserved->head_r_tag()))
+	reserved = &*c;
+      if (head.l_tag <= now) {
+	if (!weighted || head.p_tag < weighted->requests.front().p_tag)
+	  weighted = &*c;
+      } else if (!limited ||
+		 head.l_tag < limited->requests.front().l_tag) {
+	limited = &*c;
+      }
+    }
+    if (reserved)
+      return pop(*reserved, false);
+    if (weighted)
+      return pop(*weighted, true);
+    assert(limited);
+    return pop(*limited, true);
+  }
+
+  void dump(ceph::Formatter *f) const override final {
+    f->dump_int("strict_queue_size", strict_size);
+    f->open_array_section("strict_queues");
+    for (typename std::map<unsigned, std::deque<std::pair<K, T> > >::const_iterator
+	   p = strict.begin();
+	 p != strict.end();
+	 ++p) {
+      f->open_object_section("subqueue");
+      f->dump_int("priority", p->first);
+      f->dump_int("size", p->second.size());
+      f->close_section();
+    }
+    f->close_section();
+    f->open_array_section("classes");
+    for (unsigned i = 0; i < classes.size(); ++i) {
+      const Class& c = classes[i];
+      f->open_object_section("class");
+      f->dump_int("id", i);
+      f->dump_float("reservation", c.info.reservation);
+      f->dump_float("weight", c.info.weight);
+      f->dump_float("limit", c.info.limit);
+      f->dump_int("size", c.requests.size());
+      if (!c.requests.empty()) {
+	f->dump_float("r_tag", c.head_r_tag());
+	f->dump_float("p_tag", c.requests.front().p_tag);
+	f->dump_float("l_tag", c.requests.front().l_tag);
+      }
+      f->close_section();
+    }
+    f->close_section();
+  }
+};
+
+#endif
@@ -223,6 +223,8 @@ void PerfCounters::tinc(int idx, utime_t amt)
   } else {
     data.u64.add(amt.to_nsec());
   }
+  if (data.type & PERFCOUNTER_HISTOGRAM)
+    data.histogram_add(amt.to_nsec());
 }
 
 void PerfCounters::tinc(int idx, ceph::timespan amt)
@@ -242,6 +244,8 @@ void PerfCounters::tinc(int idx, ceph::timespan amt)
   } else {
     data.u64.add(amt.count());
   }
+  if (data.type & PERFCOUNTER_HISTOGRAM)
+    data.histogram_add(amt.count());
 }
 
 void PerfCounters::tset(int idx, utime_t amt)
@@ -343,6 +347,12 @@ void PerfCounters::dump_formatted(Formatter *f, bool schema,
 	} else {
 	  assert(0);
 	}
+	if (d->type & PERFCOUNTER_HISTOGRAM) {
+	  f->open_array_section("histogram");
+	  for (unsigned i = 0; i < PERFCOUNTER_HISTOGRAM_BUCKETS; ++i)
+	    f->dump_unsigned("count", d->histogram[i].read());
+	  f->close_section();
+	}
 	f->close_section();
       } else {
 	uint64_t v = d->u64.read();
@@ -421,6 +431,13 @@ void PerfCountersBuilder::add_time_avg(int idx, const char *name,
   add_impl(idx, name, description, nick, PERFCOUNTER_TIME | PERFCOUNTER_LONGRUNAVG);
 }
 
+void PerfCountersBuilder::add_time_hist(int idx, const char *name,
+    const char *description, const char *nick)
+{
+  add_impl(idx, name, description, nick,
+	   PERFCOUNTER_TIME | PERFCOUNTER_LONGRUNAVG | PERFCOUNTER_HISTOGRAM);
+}
+
 void PerfCountersBuilder::add_impl(int idx, const char *name,
     const char *description, const char *nick, int ty)
 {
@@ -434,6 +451,10 @@ void PerfCountersBuilder::add_impl(int idx, const char *name,
   data.description = description;
   data.nick = nick;
   data.type = (enum perfcounter_type_d)ty;
+  if (ty & PERFCOUNTER_HISTOGRAM) {
+    assert(ty & PERFCOUNTER_TIME);
+    data.histogram.reset(new atomic64_t[PERFCOUNTER_HISTOGRAM_BUCKETS]);
+  }
 }
 
 PerfCounters *PerfCountersBuilder::create_perf_counters()
@@ -25,6 +25,7 @@
 #include "common/ceph_time.h"
 
 #include <stdint.h>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -39,8 +40,12 @@ enum perfcounter_type_d
   PERFCOUNTER_U64 = 0x2,
   PERFCOUNTER_LONGRUNAVG = 0x4,
   PERFCOUNTER_COUNTER = 0x8,
+  PERFCOUNTER_HISTOGRAM = 0x10,
 };
 
+/// number of log2 buckets kept by a PERFCOUNTER_HISTOGRAM time counter
+#define PERFCOUNTER_HISTOGRAM_BUCKETS 24
+
 /*
  * A PerfCounters object is usually associated with a single subsystem.
  * It contains counters which we modify to track performance and throughput
@@ -64,6 +69,11 @@ enum perfcounter_type_d
  * For the time average, it returns the current value and
  * the "avgcount" member when read off. avgcount is incremented when you call
  * tinc. Calling tset on an average is an error and will assert out.
+ *
+ * A time histogram is a time average that also counts each tinc() in
+ * a bucket by magnitude: bucket 0 holds samples under 1us, bucket i
+ * holds samples in [2^(i-1), 2^i) us, and the last bucket holds
+ * everything longer.
  */
 class PerfCounters
 {
@@ -135,6 +145,7 @@ private:
       u64.set(a.first);
       avgcount.set(a.second);
       avgcount2.set(a.second);
+      copy_histogram(other);
     }
 
     const char *name;
@@ -144,6 +155,7 @@ private:
     atomic64_t u64;
     atomic64_t avgcount;
     atomic64_t avgcount2;
+    std::unique_ptr<atomic64_t[]> histogram;  ///< if PERFCOUNTER_HISTOGRAM
 
     void reset()
     {
@@ -152,6 +164,31 @@ private:
 	avgcount.set(0);
 	avgcount2.set(0);
       }
+      if (histogram) {
+	for (unsigned i = 0; i < PERFCOUNTER_HISTOGRAM_BUCKETS; ++i)
+	  histogram[i].set(0);
+      }
+    }
+
+    void copy_histogram(const perf_counter_data_any_d& other) {
+      if (!other.histogram) {
+	histogram.reset();
+	return;
+      }
+      histogram.reset(new atomic64_t[PERFCOUNTER_HISTOGRAM_BUCKETS]);
+      for (unsigned i = 0; i < PERFCOUNTER_HISTOGRAM_BUCKETS; ++i)
+	histogram[i].set(other.histogram[i].read());
+    }
+
+    /// count a sample of @nsec nanoseconds in its histogram bucket
+    void histogram_add(uint64_t nsec) {
+      uint64_t usec = nsec / 1000;
+      unsigned b = 0;
+      while (usec && b < PERFCOUNTER_HISTOGRAM_BUCKETS - 1) {
+	usec >>= 1;
+	++b;
+      }
+      histogram[b].inc();
     }
 
     perf_counter_data_any_d& operator=(const perf_counter_data_any_d& other) {
@@ -163,6 +200,7 @@ private:
       u64.set(a.first);
       avgcount.set(a.second);
       avgcount2.set(a.second);
+      copy_histogram(other);
       return *this;
     }
 
@@ -253,6 +291,8 @@ public:
       const char *description=NULL, const char *nick = NULL);
   void add_time_avg(int key, const char *name,
       const char *description=NULL, const char *nick = NULL);
+  void add_time_hist(int key, const char *name,
+      const char *description=NULL, const char *nick = NULL);
   PerfCounters* create_perf_counters();
 private:
   PerfCountersBuilder(const PerfCountersBuilder &rhs);
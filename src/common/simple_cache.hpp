@@ -38,6 +38,10 @@ class SimpleLRU {
   }
 
   void _add(K key, V value) {
+    typename ceph::unordered_map<K, typename list<pair<K, V> >::iterator, H>::iterator i =
+      contents.find(key);
+    if (i != contents.end())
+      lru.erase(i->second);
     lru.push_front(make_pair(key, value));
     contents[key] = lru.begin();
     trim_cache();
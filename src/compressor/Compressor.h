@@ -15,6 +15,8 @@
 #ifndef CEPH_COMPRESSOR_H
 #define CEPH_COMPRESSOR_H
 
+#include <errno.h>
+#include <string>
 #include "include/int_types.h"
 #include "include/Context.h"
 
@@ -24,6 +26,53 @@ typedef shared_ptr<Compressor> CompressorRef;
 
 class Compressor {
  public:
+  /// when a store should try to compress data
+  enum CompressionMode {
+    COMP_NONE,        ///< never compress
+    COMP_PASSIVE,     ///< compress if hinted COMPRESSIBLE
+    COMP_AGGRESSIVE,  ///< compress unless hinted INCOMPRESSIBLE
+    COMP_FORCE,       ///< always compress
+  };
+  static const char *get_comp_mode_name(int m) {
+    switch (m) {
+    case COMP_NONE: return "none";
+    case COMP_PASSIVE: return "passive";
+    case COMP_AGGRESSIVE: return "aggressive";
+    case COMP_FORCE: return "force";
+    default: return "???";
+    }
+  }
+  static int get_comp_mode_type(const std::string& s) {
+    for (int m = COMP_NONE; m <= COMP_FORCE; ++m) {
+      if (s == get_comp_mode_name(m))
+	return m;
+    }
+    return -EINVAL;
+  }
+
+  /// compression plugins, by the id we persist
+  enum CompressionAlgorithm {
+    COMP_ALG_NONE = 0,
+    COMP_ALG_SNAPPY = 1,
+    COMP_ALG_ZLIB = 2,
+    COMP_ALG_LAST,
+  };
+  static const char *get_comp_alg_name(int a) {
+    switch (a) {
+    case COMP_ALG_NONE: return "none";
+    case COMP_ALG_SNAPPY: return "snappy";
+    case COMP_ALG_ZLIB: return "zlib";
+    default: return "???";
+    }
+  }
+  static int get_comp_alg_type(const std::string& s) {
+    for (int a = COMP_ALG_SNAPPY; a < COMP_ALG_LAST; ++a) {
+      if (s == get_comp_alg_name(a))
+	return a;
+    }
+    return -EINVAL;
+  }
+
   virtual ~Compressor() {}
   virtual int compress(const bufferlist &in, bufferlist &out) = 0;
   virtual int decompress(const bufferlist &in, bufferlist &out) = 0;
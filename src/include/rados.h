@@ -418,6 +418,12 @@ enum {
 	CEPH_OSD_OP_FLAG_FADVISE_NOCACHE   = 0x40, /* data will be accessed only once by this client */
 };
 
+/* alloc hint flags */
+enum {
+	CEPH_OSD_ALLOC_HINT_FLAG_COMPRESSIBLE   = 0x1, /* data compresses well */
+	CEPH_OSD_ALLOC_HINT_FLAG_INCOMPRESSIBLE = 0x2, /* don't bother compressing */
+};
+
 #define EOLDSNAPC    85  /* ORDERSNAP flag set; writer has old snapc*/
 #define EBLACKLISTED 108 /* blacklisted */
 
@@ -532,6 +538,7 @@ struct ceph_osd_op {
 		struct {
 			__le64 expected_object_size;
 			__le64 expected_write_size;
+			__le32 flags;  /* CEPH_OSD_ALLOC_HINT_FLAG_* */
 		} __attribute__ ((packed)) alloc_hint;
 	};
 	__le32 payload_len;
@@ -81,6 +81,17 @@ enum {
   LIBRADOS_OP_FLAG_FADVISE_NOCACHE    = 0x40,
 };
 
+/*
+ * Flags that can be passed with an allocation hint via
+ * ObjectWriteOperation::set_alloc_hint2().
+ */
+enum {
+  // data is expected to compress well
+  LIBRADOS_ALLOC_HINT_FLAG_COMPRESSIBLE   = 0x1,
+  // data is not expected to compress (e.g., already compressed)
+  LIBRADOS_ALLOC_HINT_FLAG_INCOMPRESSIBLE = 0x2,
+};
+
 #if __GNUC__ >= 4
   #define CEPH_RADOS_API  __attribute__ ((visibility ("default")))
 #else
@@ -450,6 +450,17 @@ namespace librados
     void set_alloc_hint(uint64_t expected_object_size,
                         uint64_t expected_write_size);
 
+    /**
+     * Set allocation hint for an object, with flags
+     *
+     * @param expected_object_size expected size of the object, in bytes
+     * @param expected_write_size expected size of writes to the object, in bytes
+     * @param flags LIBRADOS_ALLOC_HINT_FLAG_* hints about the data
+     */
+    void set_alloc_hint2(uint64_t expected_object_size,
+                         uint64_t expected_write_size,
+                         uint32_t flags);
+
     /**
      * Pin/unpin an object in cache tier
      *
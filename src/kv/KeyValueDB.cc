@@ -2,6 +2,7 @@
 // vim: ts=8 sw=2 smarttab
 
 #include "KeyValueDB.h"
+#include "include/str_list.h"
 #include "LevelDBStore.h"
 #ifdef HAVE_LIBROCKSDB
 #include "RocksDBStore.h"
@@ -49,3 +50,25 @@ int KeyValueDB::test_init(const string& type, const string& dir)
 #endif
   return -EINVAL;
 }
+
+int KeyValueDB::parse_column_families(const string& spec,
+				      std::vector<ColumnFamily> *cfs)
+{
+  list<string> items;
+  get_str_list(spec, " \t\n", items);
+  for (auto& i : items) {
+    size_t pos = i.find(':');
+    string prefix = i.substr(0, pos);
+    string options;
+    if (pos != string::npos)
+      options = i.substr(pos + 1);
+    if (prefix.empty())
+      return -EINVAL;
+    for (auto& cf : *cfs) {
+      if (cf.prefix == prefix)
+	return -EINVAL;
+    }
+    cfs->push_back(ColumnFamily(prefix, options));
+  }
+  return 0;
+}
@@ -8,6 +8,7 @@
 #include <set>
 #include <map>
 #include <string>
+#include <vector>
 #include "include/memory.h"
 #include <boost/scoped_ptr.hpp>
 #include "include/encoding.h"
@@ -93,6 +94,22 @@ public:
       const std::string &prefix ///< [in] Prefix by which to remove keys
       ) = 0;
 
+    /// Removes keys in [start, end) within prefix
+    virtual void rm_range_keys(
+      const std::string &prefix,    ///< [in] Prefix by which to remove keys
+      const std::string &start,     ///< [in] The start bound of remove keys
+      const std::string &end        ///< [in] The end bound of remove keys
+      ) = 0;
+
+    /// Merge value into key, using the prefix's merge operator
+    virtual void merge(
+      const std::string &prefix,   ///< [in] Prefix ==> MUST match some established merge operator
+      const std::string &key,      ///< [in] Key to be merged
+      const bufferlist  &value     ///< [in] value to be merged into key
+    ) {
+      assert(0 == "Not implemented");
+    }
+
     virtual ~TransactionImpl() {}
   };
   typedef ceph::shared_ptr< TransactionImpl > Transaction;
@@ -108,6 +125,57 @@ public:
   virtual int open(std::ostream &out) = 0;
   virtual int create_and_open(std::ostream &out) = 0;
 
+  /**
+   * An associative merge operator.  Merges are applied by the backend
+   * when the key is read or compacted, so a transaction can update a
+   * value without reading it first.  Backends without native support
+   * (leveldb) apply them when the transaction is submitted instead.
+   */
+  class MergeOperator {
+  public:
+    /// Merge into a key that doesn't exist
+    virtual void merge_nonexistent(
+      const char *rdata, size_t rlen,
+      std::string *new_value) = 0;
+    /// Merge into a key that does exist
+    virtual void merge(
+      const char *ldata, size_t llen,
+      const char *rdata, size_t rlen,
+      std::string *new_value) = 0;
+    /// We use each operator name and each prefix to construct the
+    /// overall RocksDB operator name for consistency check at open time.
+    virtual string name() const = 0;
+
+    virtual ~MergeOperator() {}
+  };
+
+  /// Setup one or more operators, this needs to be done BEFORE the DB is opened.
+  virtual int set_merge_operator(const std::string& prefix,
+				 std::shared_ptr<MergeOperator> mop) {
+    return -EOPNOTSUPP;
+  }
+
+  /**
+   * A prefix kept in a keyspace (column family) of its own, so that it
+   * can be compacted and cached independently of everything else.
+   * options are backend specific.
+   */
+  struct ColumnFamily {
+    std::string prefix;
+    std::string options;
+    ColumnFamily(const std::string& p, const std::string& o)
+      : prefix(p), options(o) {}
+  };
+
+  /// parse "prefix[:options] ..." into cfs; return -EINVAL on a bad spec
+  static int parse_column_families(const std::string& spec,
+				   std::vector<ColumnFamily> *cfs);
+
+  /// Setup column families, this needs to be done BEFORE the DB is opened.
+  virtual int set_column_families(const std::vector<ColumnFamily>& cfs) {
+    return -EOPNOTSUPP;
+  }
+
   virtual Transaction get_transaction() = 0;
   virtual int submit_transaction(Transaction) = 0;
   virtual int submit_transaction_sync(Transaction t) {
@@ -179,16 +247,21 @@ public:
 
   class IteratorImpl : public GenericIteratorImpl {
     const std::string prefix;
+    const std::string bound;  ///< keys must sort before this, if not empty
     WholeSpaceIterator generic_iter;
   public:
     IteratorImpl(const std::string &prefix, WholeSpaceIterator iter) :
       prefix(prefix), generic_iter(iter) { }
+    IteratorImpl(const std::string &prefix, const std::string &bound,
+		 WholeSpaceIterator iter) :
+      prefix(prefix), bound(bound), generic_iter(iter) { }
     virtual ~IteratorImpl() { }
 
     int seek_to_first() {
       return generic_iter->seek_to_first(prefix);
     }
     int seek_to_last() {
+      assert(bound.empty());  // only forward iteration is bounded
       return generic_iter->seek_to_last(prefix);
     }
     int upper_bound(const std::string &after) {
@@ -200,7 +273,9 @@ public:
     bool valid() {
       if (!generic_iter->valid())
 	return false;
-      return generic_iter->raw_key_is_prefixed(prefix);
+      if (!generic_iter->raw_key_is_prefixed(prefix))
+	return false;
+      return bound.empty() || generic_iter->key() < bound;
     }
     // Note that next() and prev() shouldn't validate iters,
     // it's responsibility of caller to ensure they're valid.
@@ -247,7 +322,20 @@ public:
   }
 
   Iterator get_iterator(const std::string &prefix) {
-    return std::make_shared<IteratorImpl>(prefix, get_iterator());
+    return std::make_shared<IteratorImpl>(
+      prefix, _get_prefix_iterator(prefix, std::string()));
+  }
+
+  /**
+   * An iterator over the keys in prefix that sort before bound.  Backends
+   * that can (rocksdb) stop the underlying scan at bound, so walking off
+   * the end of a range doesn't wade through the tombstones of whatever
+   * was deleted after it.  Only forward iteration is supported.
+   */
+  Iterator get_iterator(const std::string &prefix, const std::string &bound) {
+    assert(!bound.empty());
+    return std::make_shared<IteratorImpl>(
+      prefix, bound, _get_prefix_iterator(prefix, bound));
   }
 
   WholeSpaceIterator get_snapshot_iterator() {
@@ -280,6 +368,12 @@ public:
 protected:
   virtual WholeSpaceIterator _get_iterator() = 0;
   virtual WholeSpaceIterator _get_snapshot_iterator() = 0;
+  /// a whole-space iterator that need only be valid within prefix, and
+  /// before bound (if not empty)
+  virtual WholeSpaceIterator _get_prefix_iterator(const std::string &prefix,
+						  const std::string &bound) {
+    return _get_iterator();
+  }
 };
 
 #endif
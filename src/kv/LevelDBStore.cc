@@ -171,7 +171,7 @@ int LevelDBStore::submit_transaction(KeyValueDB::Transaction t)
   utime_t start = ceph_clock_now(g_ceph_context);
   LevelDBTransactionImpl * _t =
     static_cast<LevelDBTransactionImpl *>(t.get());
-  leveldb::Status s = db->Write(leveldb::WriteOptions(), &(_t->bat));
+  leveldb::Status s = _write(leveldb::WriteOptions(), _t);
   utime_t lat = ceph_clock_now(g_ceph_context) - start;
   logger->inc(l_leveldb_txns);
   logger->tinc(l_leveldb_submit_latency, lat);
@@ -185,18 +185,42 @@ int LevelDBStore::submit_transaction_sync(KeyValueDB::Transaction t)
     static_cast<LevelDBTransactionImpl *>(t.get());
   leveldb::WriteOptions options;
   options.sync = true;
-  leveldb::Status s = db->Write(options, &(_t->bat));
+  leveldb::Status s = _write(options, _t);
   utime_t lat = ceph_clock_now(g_ceph_context) - start;
   logger->inc(l_leveldb_txns);
   logger->tinc(l_leveldb_submit_sync_latency, lat);
   return s.ok() ? 0 : -1;
 }
 
+leveldb::Status LevelDBStore::_write(const leveldb::WriteOptions& options,
+				     LevelDBTransactionImpl *t)
+{
+  if (!t->needs_merge_lock())
+    return db->Write(options, &(t->bat));
+  // hold merge_lock from reading the current values until the results
+  // are written so that concurrent merges into the same key compose, and
+  // a plain set or rm of a merged key can't land in between
+  Mutex::Locker l(merge_lock);
+  t->resolve_merges();
+  return db->Write(options, &(t->bat));
+}
+
+int LevelDBStore::set_merge_operator(
+  const string& prefix,
+  std::shared_ptr<KeyValueDB::MergeOperator> mop)
+{
+  // operators must be in place before anyone can submit a merge
+  assert(db == nullptr);
+  merge_ops[prefix] = mop;
+  return 0;
+}
+
 void LevelDBStore::LevelDBTransactionImpl::set(
   const string &prefix,
   const string &k,
   const bufferlist &to_set_bl)
 {
+  _note_write(prefix);
   string key = combine_strings(prefix, k);
   size_t bllen = to_set_bl.length();
   // bufferlist::c_str() is non-constant, so we can't call c_str()
@@ -221,17 +245,23 @@ void LevelDBStore::LevelDBTransactionImpl::set(
     bufferlist val = to_set_bl;
     bat.Put(leveldb::Slice(key), leveldb::Slice(val.c_str(), val.length()));
   }
+  if (!merges.empty())
+    _resolved(key, true, &to_set_bl);
 }
 
 void LevelDBStore::LevelDBTransactionImpl::rmkey(const string &prefix,
 					         const string &k)
 {
+  _note_write(prefix);
   string key = combine_strings(prefix, k);
   bat.Delete(leveldb::Slice(key));
+  if (!merges.empty())
+    _resolved(key, false, nullptr);
 }
 
 void LevelDBStore::LevelDBTransactionImpl::rmkeys_by_prefix(const string &prefix)
 {
+  _note_write(prefix);
   KeyValueDB::Iterator it = db->get_iterator(prefix);
   for (it->seek_to_first();
        it->valid();
@@ -239,6 +269,103 @@ void LevelDBStore::LevelDBTransactionImpl::rmkeys_by_prefix(const string &prefix
     string key = combine_strings(prefix, it->key());
     bat.Delete(key);
   }
+  // keys merged earlier in this txn may not exist in the db yet
+  for (auto& p : merges) {
+    if (p.second.prefix == prefix)
+      _resolved(p.first, false, nullptr);
+  }
+}
+
+void LevelDBStore::LevelDBTransactionImpl::rm_range_keys(const string &prefix,
+							 const string &start,
+							 const string &end)
+{
+  _note_write(prefix);
+  if (start >= end)
+    return;
+  KeyValueDB::Iterator it = db->get_iterator(prefix, end);
+  for (it->lower_bound(start);
+       it->valid();
+       it->next()) {
+    string key = combine_strings(prefix, it->key());
+    bat.Delete(key);
+  }
+  for (auto& p : merges) {
+    if (p.second.prefix == prefix && p.second.key >= start &&
+	p.second.key < end)
+      _resolved(p.first, false, nullptr);
+  }
+}
+
+void LevelDBStore::LevelDBTransactionImpl::merge(
+  const string &prefix,
+  const string &k,
+  const bufferlist &bl)
+{
+  std::shared_ptr<KeyValueDB::MergeOperator> mop =
+    db->get_merge_operator(prefix);
+  assert(mop);  // prefix must have a registered operator
+  string key = combine_strings(prefix, k);
+  merge_state_t& m = merges[key];
+  m.prefix = prefix;
+  m.key = k;
+  if (m.resolved)
+    m.apply(mop.get(), bl);
+  else
+    m.ops.push_back(bl);
+}
+
+void LevelDBStore::LevelDBTransactionImpl::_resolved(
+  const string &key, bool exists, const bufferlist *bl)
+{
+  auto p = merges.find(key);
+  if (p == merges.end())
+    return;
+  merge_state_t& m = p->second;
+  m.resolved = true;
+  m.exists = exists;
+  m.value.clear();
+  if (exists)
+    bl->copy(0, bl->length(), m.value);
+  m.ops.clear();
+}
+
+void LevelDBStore::LevelDBTransactionImpl::merge_state_t::apply(
+  KeyValueDB::MergeOperator *mop, const bufferlist& bl)
+{
+  string r;
+  bl.copy(0, bl.length(), r);
+  string v;
+  if (exists)
+    mop->merge(value.data(), value.size(), r.data(), r.size(), &v);
+  else
+    mop->merge_nonexistent(r.data(), r.size(), &v);
+  value.swap(v);
+  exists = true;
+}
+
+void LevelDBStore::LevelDBTransactionImpl::resolve_merges()
+{
+  // called under merge_lock.  the results go at the end of the batch,
+  // after any set/rmkey of the same keys, and so win.
+  for (auto& p : merges) {
+    merge_state_t& m = p.second;
+    std::shared_ptr<KeyValueDB::MergeOperator> mop =
+      db->get_merge_operator(m.prefix);
+    if (!m.resolved) {
+      bufferlist cur;
+      m.exists = db->get(m.prefix, m.key, &cur) == 0;
+      if (m.exists)
+	cur.copy(0, cur.length(), m.value);
+      m.resolved = true;
+      for (auto& op : m.ops)
+	m.apply(mop.get(), op);
+      m.ops.clear();
+    }
+    if (m.exists)
+      bat.Put(leveldb::Slice(p.first), leveldb::Slice(m.value));
+  }
+  merges.clear();
 }
 
 int LevelDBStore::get(
@@ -65,6 +65,22 @@ class LevelDBStore : public KeyValueDB {
 
   int do_open(ostream &out, bool create_if_missing);
 
+  // leveldb has no merge operators, so we resolve merges ourselves at
+  // submit time.  merge_lock is held by every submitter that merges or
+  // writes under a prefix with a merge operator, so that the read of the
+  // current value and the write of the result are atomic with respect to
+  // any other write of that key.
+  std::map<string, std::shared_ptr<KeyValueDB::MergeOperator> > merge_ops;
+  Mutex merge_lock;
+
+  std::shared_ptr<KeyValueDB::MergeOperator> get_merge_operator(
+    const string& prefix) {
+    auto p = merge_ops.find(prefix);
+    if (p == merge_ops.end())
+      return nullptr;
+    return p->second;
+  }
+
   // manage async compactions
   Mutex compact_queue_lock;
   Cond compact_queue_cond;
@@ -159,6 +175,7 @@ public:
 #ifdef HAVE_LEVELDB_FILTER_POLICY
     filterpolicy(NULL),
 #endif
+    merge_lock("LevelDBStore::merge_lock"),
     compact_queue_lock("LevelDBStore::compact_thread_lock"),
     compact_queue_stop(false),
     compact_thread(this),
@@ -182,10 +199,38 @@ public:
   void close();
 
   class LevelDBTransactionImpl : public KeyValueDB::TransactionImpl {
+    /// pending merges for one key
+    struct merge_state_t {
+      string prefix, key;
+      bool resolved = false;   ///< value is known (set/rm in this txn)
+      bool exists = false;     ///< if resolved, whether the key exists
+      string value;            ///< if resolved and exists, the value
+      vector<bufferlist> ops;  ///< merges to apply to the stored value
+
+      void apply(KeyValueDB::MergeOperator *mop, const bufferlist& bl);
+    };
+    map<string, merge_state_t> merges;  ///< by combined key
+    bool writes_merge_prefix = false;   ///< set/rm under a merge prefix
+
+    void _note_write(const string &prefix) {
+      if (!writes_merge_prefix && db->get_merge_operator(prefix))
+	writes_merge_prefix = true;
+    }
+
+    void _resolved(const string &key, bool exists, const bufferlist *bl);
+
   public:
     leveldb::WriteBatch bat;
     LevelDBStore *db;
     explicit LevelDBTransactionImpl(LevelDBStore *db) : db(db) {}
+    bool has_merges() const {
+      return !merges.empty();
+    }
+    /// true if submitting this txn must hold merge_lock
+    bool needs_merge_lock() const {
+      return has_merges() || writes_merge_prefix;
+    }
+    void resolve_merges();
     void set(
       const string &prefix,
       const string &k,
@@ -196,14 +241,27 @@ public:
     void rmkeys_by_prefix(
       const string &prefix
       );
+    void rm_range_keys(
+      const string &prefix,
+      const string &start,
+      const string &end);
+    void merge(
+      const string &prefix,
+      const string &k,
+      const bufferlist &bl);
   };
 
+  int set_merge_operator(const string& prefix,
+			 std::shared_ptr<KeyValueDB::MergeOperator> mop);
+
   KeyValueDB::Transaction get_transaction() {
     return std::make_shared<LevelDBTransactionImpl>(this);
   }
 
   int submit_transaction(KeyValueDB::Transaction t);
   int submit_transaction_sync(KeyValueDB::Transaction t);
+  leveldb::Status _write(const leveldb::WriteOptions& options,
+			 LevelDBTransactionImpl *t);
   int get(
     const string &prefix,
     const std::set<string> &key,
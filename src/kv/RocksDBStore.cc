@@ -5,6 +5,7 @@
 #include <map>
 #include <string>
 #include <memory>
+#include <algorithm>
 #include <errno.h>
 #include <unistd.h>
 #include <sys/types.h>
@@ -17,12 +18,14 @@
 #include "rocksdb/slice.h"
 #include "rocksdb/cache.h"
 #include "rocksdb/filter_policy.h"
+#include "rocksdb/merge_operator.h"
 #include "rocksdb/utilities/convenience.h"
 using std::string;
 #include "common/perf_counters.h"
 #include "common/debug.h"
 #include "include/str_list.h"
 #include "include/str_map.h"
+#include "common/strtol.h"
 #include "KeyValueDB.h"
 #include "RocksDBStore.h"
 
@@ -171,6 +174,127 @@ int RocksDBStore::create_and_open(ostream &out)
   return do_open(out, true);
 }
 
+//
+// One of these per rocksdb instance, implements the merge operator
+// by dispatching on the key prefix to the registered KeyValueDB
+// merge operators.
+//
+class RocksDBStore::MergeOperatorRouter : public rocksdb::AssociativeMergeOperator {
+  RocksDBStore& store;
+public:
+  const char *Name() const {
+    // Construct a name that rocksDB will validate against. We want to
+    // do this in a way that doesn't constrain the ordering of calls
+    // to set_merge_operator, so sort the merge operators and then
+    // construct a name from all of those parts.
+    store.assoc_name.clear();
+    map<std::string,std::string> names;
+    for (auto& p : store.merge_ops) {
+      names[p.first] = p.second->name();
+    }
+    for (auto& p : names) {
+      store.assoc_name += '.';
+      store.assoc_name += p.first;
+      store.assoc_name += ':';
+      store.assoc_name += p.second;
+    }
+    return store.assoc_name.c_str();
+  }
+
+  explicit MergeOperatorRouter(RocksDBStore &_store) : store(_store) {}
+
+  bool Merge(const rocksdb::Slice& key,
+	     const rocksdb::Slice* existing_value,
+	     const rocksdb::Slice& value,
+	     std::string* new_value,
+	     rocksdb::Logger* logger) const {
+    // Check each prefix
+    for (auto& p : store.merge_ops) {
+      if (p.first.compare(0, p.first.length(),
+			  key.data(), p.first.length()) == 0 &&
+	  key.size() > p.first.length() &&
+	  key.data()[p.first.length()] == 0) {
+	if (existing_value) {
+	  p.second->merge(existing_value->data(), existing_value->size(),
+			  value.data(), value.size(),
+			  new_value);
+	} else {
+	  p.second->merge_nonexistent(value.data(), value.size(), new_value);
+	}
+	break;
+      }
+    }
+    return true; // OK :)
+  }
+};
+
+int RocksDBStore::set_merge_operator(
+  const string& prefix,
+  std::shared_ptr<KeyValueDB::MergeOperator> mop)
+{
+  // If you fail here, it's because you can't do this on an open database
+  assert(db == nullptr);
+  merge_ops.push_back(std::make_pair(prefix, mop));
+  return 0;
+}
+
+int RocksDBStore::set_column_families(
+  const std::vector<KeyValueDB::ColumnFamily>& cfs)
+{
+  // like merge operators, these can't change under an open database
+  assert(db == nullptr);
+  for (auto& cf : cfs) {
+    if (cf.prefix == rocksdb::kDefaultColumnFamilyName)
+      return -EINVAL;
+    // catch bad options now rather than at mkfs
+    rocksdb::ColumnFamilyOptions cfo;
+    rocksdb::BlockBasedTableOptions bbt;
+    double share = 0;
+    int r = _get_cf_options(cf, &cfo, &bbt, &share);
+    if (r < 0)
+      return r;
+  }
+  cf_specs = cfs;
+  return 0;
+}
+
+int RocksDBStore::_get_cf_options(const KeyValueDB::ColumnFamily& cf,
+				  rocksdb::ColumnFamilyOptions *cfo,
+				  rocksdb::BlockBasedTableOptions *bbt,
+				  double *cache_share)
+{
+  map<string, string> str_map;
+  int r = get_str_map(cf.options, &str_map, ",;");
+  if (r < 0)
+    return r;
+  for (auto& p : str_map) {
+    string err;
+    if (p.first == "cache_share") {
+      // fraction of rocksdb_cache_size for a block cache of its own
+      *cache_share = strict_strtod(p.second.c_str(), &err);
+      if (err.empty() && (*cache_share <= 0 || *cache_share >= 1))
+	err = "must be between 0 and 1";
+    } else if (p.first == "bloom_bits") {
+      int bits = strict_strtol(p.second.c_str(), 10, &err);
+      if (err.empty() && bits > 0)
+	bbt->filter_policy.reset(rocksdb::NewBloomFilterPolicy(bits));
+    } else if (p.first == "block_size") {
+      bbt->block_size = strict_sistrtoll(p.second.c_str(), &err);
+    } else {
+      rocksdb::Status status = rocksdb::GetColumnFamilyOptionsFromString(
+	*cfo, p.first + "=" + p.second, cfo);
+      if (!status.ok())
+	err = status.ToString();
+    }
+    if (!err.empty()) {
+      derr << __func__ << " column family " << cf.prefix << " option "
+	   << p.first << "=" << p.second << ": " << err << dendl;
+      return -EINVAL;
+    }
+  }
+  return 0;
+}
+
 int RocksDBStore::do_open(ostream &out, bool create_if_missing)
 {
   rocksdb::Options opt;
@@ -218,18 +342,108 @@ int RocksDBStore::do_open(ostream &out, bool create_if_missing)
     opt.env = static_cast<rocksdb::Env*>(priv);
   }
 
-  auto cache = rocksdb::NewLRUCache(g_conf->rocksdb_cache_size);
+  if (!merge_ops.empty()) {
+    opt.merge_operator.reset(new MergeOperatorRouter(*this));
+  }
+
+  // column families are set up when the db is created.  after that we
+  // open whatever the db has, and cf_specs only supplies their options.
+  std::vector<string> cf_names;
+  {
+    std::vector<string> existing;
+    status = rocksdb::DB::ListColumnFamilies(rocksdb::DBOptions(opt), path,
+					     &existing);
+    if (status.ok()) {
+      for (auto& n : existing) {
+	if (n != rocksdb::kDefaultColumnFamilyName)
+	  cf_names.push_back(n);
+      }
+      for (auto& cf : cf_specs) {
+	if (std::find(cf_names.begin(), cf_names.end(), cf.prefix) ==
+	    cf_names.end())
+	  dout(1) << __func__ << " prefix " << cf.prefix << " has no column"
+		  << " family in this db; it stays in the default one" << dendl;
+      }
+    } else if (create_if_missing) {
+      for (auto& cf : cf_specs)
+	cf_names.push_back(cf.prefix);
+      opt.create_missing_column_families = true;
+    }
+  }
+
   rocksdb::BlockBasedTableOptions bbt_opts;
   bbt_opts.block_size = g_conf->rocksdb_block_size;
+
+  // parse column family options first; those with a cache_share get a
+  // block cache of their own, carved out of rocksdb_cache_size.
+  std::vector<rocksdb::ColumnFamilyOptions> cf_opts;
+  std::vector<rocksdb::BlockBasedTableOptions> cf_bbt_opts;
+  std::vector<double> cf_cache_shares;
+  double default_share = 1.0;
+  for (auto& name : cf_names) {
+    KeyValueDB::ColumnFamily cf(name, string());
+    for (auto& spec : cf_specs) {
+      if (spec.prefix == name)
+	cf = spec;
+    }
+    rocksdb::ColumnFamilyOptions cfo(opt);
+    rocksdb::BlockBasedTableOptions bbt = bbt_opts;
+    double share = 0;
+    int r = _get_cf_options(cf, &cfo, &bbt, &share);
+    if (r < 0)
+      return r;
+    default_share -= share;
+    cf_opts.push_back(cfo);
+    cf_bbt_opts.push_back(bbt);
+    cf_cache_shares.push_back(share);
+  }
+  if (default_share <= 0) {
+    derr << __func__ << " column family cache shares leave nothing for the"
+	 << " default column family" << dendl;
+    return -EINVAL;
+  }
+
+  auto cache = rocksdb::NewLRUCache(g_conf->rocksdb_cache_size * default_share);
   bbt_opts.block_cache = cache;
   opt.table_factory.reset(rocksdb::NewBlockBasedTableFactory(bbt_opts));
   dout(10) << __func__ << " set block size to " << g_conf->rocksdb_block_size
            << " cache size to " << g_conf->rocksdb_cache_size << dendl;
 
-  status = rocksdb::DB::Open(opt, path, &db);
-  if (!status.ok()) {
-    derr << status.ToString() << dendl;
-    return -EINVAL;
+  if (cf_names.empty()) {
+    status = rocksdb::DB::Open(opt, path, &db);
+    if (!status.ok()) {
+      derr << status.ToString() << dendl;
+      return -EINVAL;
+    }
+    default_cf = db->DefaultColumnFamily();
+    cf_handle_list.push_back(default_cf);
+  } else {
+    std::vector<rocksdb::ColumnFamilyDescriptor> cfds;
+    cfds.push_back(rocksdb::ColumnFamilyDescriptor(
+		     rocksdb::kDefaultColumnFamilyName,
+		     rocksdb::ColumnFamilyOptions(opt)));
+    for (unsigned i = 0; i < cf_names.size(); ++i) {
+      rocksdb::BlockBasedTableOptions& bbt = cf_bbt_opts[i];
+      if (cf_cache_shares[i] > 0)
+	bbt.block_cache = rocksdb::NewLRUCache(g_conf->rocksdb_cache_size *
+					       cf_cache_shares[i]);
+      else
+	bbt.block_cache = cache;
+      cf_opts[i].table_factory.reset(rocksdb::NewBlockBasedTableFactory(bbt));
+      cfds.push_back(rocksdb::ColumnFamilyDescriptor(cf_names[i], cf_opts[i]));
+      dout(10) << __func__ << " column family " << cf_names[i]
+	       << " cache share " << cf_cache_shares[i] << dendl;
+    }
+    status = rocksdb::DB::Open(rocksdb::DBOptions(opt), path, cfds,
+			       &cf_handle_list, &db);
+    if (!status.ok()) {
+      derr << status.ToString() << dendl;
+      return -EINVAL;
+    }
+    assert(cf_handle_list.size() == cf_names.size() + 1);
+    default_cf = cf_handle_list[0];
+    for (unsigned i = 0; i < cf_names.size(); ++i)
+      cf_handles[cf_names[i]] = cf_handle_list[i + 1];
   }
 
   PerfCountersBuilder plb(g_ceph_context, "rocksdb", l_rocksdb_first, l_rocksdb_last);
@@ -268,6 +482,11 @@ RocksDBStore::~RocksDBStore()
   close();
   delete logger;
 
+  // handles we got from DB::Open are ours, and must go before the db
+  if (!cf_handles.empty()) {
+    for (auto h : cf_handle_list)
+      delete h;
+  }
   // Ensure db is destroyed before dependent db_cache and filterpolicy
   delete db;
 
@@ -304,7 +523,10 @@ int RocksDBStore::submit_transaction(KeyValueDB::Transaction t)
   utime_t lat = ceph_clock_now(g_ceph_context) - start;
   logger->inc(l_rocksdb_txns);
   logger->tinc(l_rocksdb_submit_latency, lat);
-  return s.ok() ? 0 : -1;
+  if (!s.ok())
+    return -1;
+  _compact_deleted_ranges(_t);
+  return 0;
 }
 
 int RocksDBStore::submit_transaction_sync(KeyValueDB::Transaction t)
@@ -319,7 +541,18 @@ int RocksDBStore::submit_transaction_sync(KeyValueDB::Transaction t)
   utime_t lat = ceph_clock_now(g_ceph_context) - start;
   logger->inc(l_rocksdb_txns);
   logger->tinc(l_rocksdb_submit_sync_latency, lat);
-  return s.ok() ? 0 : -1;
+  if (!s.ok())
+    return -1;
+  _compact_deleted_ranges(_t);
+  return 0;
+}
+
+void RocksDBStore::_compact_deleted_ranges(RocksDBTransactionImpl *t)
+{
+  // rocksdb has to skip over tombstones until compaction drops them, so
+  // get rid of a large run of them before readers start tripping on it.
+  for (auto& r : t->compact_ranges)
+    compact_range_async(r.first, r.second);
 }
 int RocksDBStore::get_info_log_level(string info_log_level)
 {
@@ -356,31 +589,80 @@ void RocksDBStore::RocksDBTransactionImpl::set(
 
   // bufferlist::c_str() is non-constant, so we can't call c_str()
   if (to_set_bl.is_contiguous() && to_set_bl.length() > 0) {
-    bat->Put(rocksdb::Slice(key),
+    bat->Put(db->get_cf_handle(prefix),
+	     rocksdb::Slice(key),
 	     rocksdb::Slice(to_set_bl.buffers().front().c_str(),
 			    to_set_bl.length()));
   } else {
     // make a copy
     bufferlist val = to_set_bl;
-    bat->Put(rocksdb::Slice(key),
+    bat->Put(db->get_cf_handle(prefix),
+	     rocksdb::Slice(key),
 	     rocksdb::Slice(val.c_str(), val.length()));
   }
 }
 
+void RocksDBStore::RocksDBTransactionImpl::merge(
+  const string &prefix,
+  const string &k,
+  const bufferlist &to_set_bl)
+{
+  string key = combine_strings(prefix, k);
+
+  // bufferlist::c_str() is non-constant, so we can't call c_str()
+  if (to_set_bl.is_contiguous() && to_set_bl.length() > 0) {
+    bat->Merge(db->get_cf_handle(prefix),
+	       rocksdb::Slice(key),
+	       rocksdb::Slice(to_set_bl.buffers().front().c_str(),
+			      to_set_bl.length()));
+  } else {
+    // make a copy
+    bufferlist val = to_set_bl;
+    bat->Merge(db->get_cf_handle(prefix),
+	       rocksdb::Slice(key),
+	       rocksdb::Slice(val.c_str(), val.length()));
+  }
+}
+
 void RocksDBStore::RocksDBTransactionImpl::rmkey(const string &prefix,
 					         const string &k)
 {
-  bat->Delete(combine_strings(prefix, k));
+  bat->Delete(db->get_cf_handle(prefix), combine_strings(prefix, k));
 }
 
 void RocksDBStore::RocksDBTransactionImpl::rmkeys_by_prefix(const string &prefix)
 {
-  KeyValueDB::Iterator it = db->get_iterator(prefix);
-  for (it->seek_to_first();
-       it->valid();
-       it->next()) {
-    bat->Delete(combine_strings(prefix, it->key()));
+  _rm_range(db->get_cf_handle(prefix), combine_strings(prefix, string()),
+	    past_prefix(prefix));
+}
+
+void RocksDBStore::RocksDBTransactionImpl::rm_range_keys(const string &prefix,
+							 const string &start,
+							 const string &end)
+{
+  _rm_range(db->get_cf_handle(prefix), combine_strings(prefix, start),
+	    combine_strings(prefix, end));
+}
+
+void RocksDBStore::RocksDBTransactionImpl::_rm_range(
+  rocksdb::ColumnFamilyHandle *cf,
+  const string &start,
+  const string &end)
+{
+  // the upper bound stops the scan at end instead of at the next live
+  // key, which may be behind any number of tombstones.
+  rocksdb::ReadOptions options;
+  rocksdb::Slice upper(end);
+  options.iterate_upper_bound = &upper;
+  std::unique_ptr<rocksdb::Iterator> it(db->db->NewIterator(options, cf));
+  uint64_t n = 0;
+  for (it->Seek(start); it->Valid(); it->Next()) {
+    bat->Delete(cf, it->key());
+    ++n;
   }
+  uint64_t threshold = db->cct->_conf->rocksdb_compact_on_range_delete;
+  if (threshold && n >= threshold)
+    compact_ranges.push_back(make_pair(start, end));
 }
 
 int RocksDBStore::get(
@@ -465,7 +747,19 @@ void RocksDBStore::compact()
 {
   logger->inc(l_rocksdb_compact);
   rocksdb::CompactRangeOptions options;
-  db->CompactRange(options, nullptr, nullptr);
+  for (auto cf : cf_handle_list)
+    db->CompactRange(options, cf, nullptr, nullptr);
+}
+
+uint64_t RocksDBStore::get_int_property(const string& property)
+{
+  uint64_t total = 0;
+  for (auto cf : cf_handle_list) {
+    uint64_t v = 0;
+    if (db->GetIntProperty(cf, property, &v))
+      total += v;
+  }
+  return total;
 }
 
 
@@ -541,40 +835,71 @@ void RocksDBStore::compact_range(const string& start, const string& end)
   rocksdb::CompactRangeOptions options;
   rocksdb::Slice cstart(start);
   rocksdb::Slice cend(end);
-  db->CompactRange(options, &cstart, &cend);
+  // a range rarely spans column families, but compacting one that has
+  // nothing in the range is cheap
+  for (auto cf : cf_handle_list)
+    db->CompactRange(options, cf, &cstart, &cend);
 }
 RocksDBStore::RocksDBWholeSpaceIteratorImpl::~RocksDBWholeSpaceIteratorImpl()
 {
-  delete dbiter;
+  for (auto i : iters)
+    delete i;
+}
+void RocksDBStore::RocksDBWholeSpaceIteratorImpl::_pick()
+{
+  // with a single column family dbiter never changes
+  if (iters.size() == 1)
+    return;
+  dbiter = NULL;
+  for (auto i : iters) {
+    if (!i->Valid())
+      continue;
+    if (!dbiter ||
+	(forward && i->key().compare(dbiter->key()) < 0) ||
+	(!forward && i->key().compare(dbiter->key()) > 0))
+      dbiter = i;
+  }
 }
 int RocksDBStore::RocksDBWholeSpaceIteratorImpl::seek_to_first()
 {
-  dbiter->SeekToFirst();
-  return dbiter->status().ok() ? 0 : -1;
+  for (auto i : iters)
+    i->SeekToFirst();
+  forward = true;
+  _pick();
+  return status();
 }
 int RocksDBStore::RocksDBWholeSpaceIteratorImpl::seek_to_first(const string &prefix)
 {
   rocksdb::Slice slice_prefix(prefix);
-  dbiter->Seek(slice_prefix);
-  return dbiter->status().ok() ? 0 : -1;
+  for (auto i : iters)
+    i->Seek(slice_prefix);
+  forward = true;
+  _pick();
+  return status();
 }
 int RocksDBStore::RocksDBWholeSpaceIteratorImpl::seek_to_last()
 {
-  dbiter->SeekToLast();
-  return dbiter->status().ok() ? 0 : -1;
+  for (auto i : iters)
+    i->SeekToLast();
+  forward = false;
+  _pick();
+  return status();
 }
 int RocksDBStore::RocksDBWholeSpaceIteratorImpl::seek_to_last(const string &prefix)
 {
   string limit = past_prefix(prefix);
   rocksdb::Slice slice_limit(limit);
-  dbiter->Seek(slice_limit);
-
-  if (!dbiter->Valid()) {
-    dbiter->SeekToLast();
-  } else {
-    dbiter->Prev();
+  for (auto i : iters) {
+    i->Seek(slice_limit);
+    if (!i->Valid()) {
+      i->SeekToLast();
+    } else {
+      i->Prev();
+    }
   }
-  return dbiter->status().ok() ? 0 : -1;
+  forward = false;
+  _pick();
+  return status();
 }
 int RocksDBStore::RocksDBWholeSpaceIteratorImpl::upper_bound(const string &prefix, const string &after)
 {
@@ -584,30 +909,60 @@ int RocksDBStore::RocksDBWholeSpaceIteratorImpl::upper_bound(const string &prefi
     if (key.first == prefix && key.second == after)
       next();
   }
-  return dbiter->status().ok() ? 0 : -1;
+  return status();
 }
 int RocksDBStore::RocksDBWholeSpaceIteratorImpl::lower_bound(const string &prefix, const string &to)
 {
   string bound = combine_strings(prefix, to);
   rocksdb::Slice slice_bound(bound);
-  dbiter->Seek(slice_bound);
-  return dbiter->status().ok() ? 0 : -1;
+  for (auto i : iters)
+    i->Seek(slice_bound);
+  forward = true;
+  _pick();
+  return status();
 }
 bool RocksDBStore::RocksDBWholeSpaceIteratorImpl::valid()
 {
-  return dbiter->Valid();
+  return dbiter && dbiter->Valid();
 }
 int RocksDBStore::RocksDBWholeSpaceIteratorImpl::next()
 {
-  if (valid())
+  if (!valid())
+    return status();
+  if (!forward && iters.size() > 1) {
+    // bring the other children from before the current key to after it
+    string cur = dbiter->key().ToString();
+    for (auto i : iters) {
+      if (i != dbiter)
+	i->Seek(cur);
+    }
+    forward = true;
+  }
   dbiter->Next();
-  return dbiter->status().ok() ? 0 : -1;
+  _pick();
+  return status();
 }
 int RocksDBStore::RocksDBWholeSpaceIteratorImpl::prev()
 {
-  if (valid())
-    dbiter->Prev();
-    return dbiter->status().ok() ? 0 : -1;
+  if (!valid())
+    return status();
+  if (forward && iters.size() > 1) {
+    // and the other way around
+    string cur = dbiter->key().ToString();
+    for (auto i : iters) {
+      if (i == dbiter)
+	continue;
+      i->Seek(cur);
+      if (i->Valid())
+	i->Prev();
+      else
+	i->SeekToLast();
+    }
+    forward = false;
+  }
+  dbiter->Prev();
+  _pick();
+  return status();
 }
 string RocksDBStore::RocksDBWholeSpaceIteratorImpl::key()
 {
@@ -645,7 +1000,11 @@ bufferptr RocksDBStore::RocksDBWholeSpaceIteratorImpl::value_as_ptr()
 
 int RocksDBStore::RocksDBWholeSpaceIteratorImpl::status()
 {
-  return dbiter->status().ok() ? 0 : -1;
+  for (auto i : iters) {
+    if (!i->status().ok())
+      return -1;
+  }
+  return 0;
 }
 
 string RocksDBStore::past_prefix(const string &prefix)
@@ -657,8 +1016,12 @@ string RocksDBStore::past_prefix(const string &prefix)
 
 RocksDBStore::WholeSpaceIterator RocksDBStore::_get_iterator()
 {
-  return std::make_shared<RocksDBWholeSpaceIteratorImpl>(
-        db->NewIterator(rocksdb::ReadOptions()));
+  if (cf_handles.empty())
+    return std::make_shared<RocksDBWholeSpaceIteratorImpl>(
+      db->NewIterator(rocksdb::ReadOptions()));
+  std::vector<rocksdb::Iterator*> iters;
+  db->NewIterators(rocksdb::ReadOptions(), cf_handle_list, &iters);
+  return std::make_shared<RocksDBWholeSpaceIteratorImpl>(iters);
 }
 
 RocksDBStore::WholeSpaceIterator RocksDBStore::_get_snapshot_iterator()
@@ -669,8 +1032,43 @@ RocksDBStore::WholeSpaceIterator RocksDBStore::_get_snapshot_iterator()
   snapshot = db->GetSnapshot();
   options.snapshot = snapshot;
 
+  std::vector<rocksdb::Iterator*> iters;
+  db->NewIterators(options, cf_handle_list, &iters);
   return std::make_shared<RocksDBSnapshotIteratorImpl>(
-          db, snapshot, db->NewIterator(options));
+          db, snapshot, iters);
+}
+
+RocksDBStore::WholeSpaceIterator RocksDBStore::_get_prefix_iterator(
+  const string &prefix,
+  const string &bound)
+{
+  // a prefix lives in exactly one column family
+  if (!bound.empty())
+    return std::make_shared<RocksDBBoundedIteratorImpl>(
+      db, get_cf_handle(prefix), combine_strings(prefix, bound));
+  return std::make_shared<RocksDBWholeSpaceIteratorImpl>(
+    db->NewIterator(rocksdb::ReadOptions(), get_cf_handle(prefix)));
+}
+
+RocksDBStore::RocksDBBoundedIteratorImpl::RocksDBBoundedIteratorImpl(
+  rocksdb::DB *db,
+  rocksdb::ColumnFamilyHandle *cf,
+  const std::string &b)
+  : RocksDBWholeSpaceIteratorImpl(static_cast<rocksdb::Iterator*>(NULL)),
+    bound(b),
+    bound_slice(new rocksdb::Slice(bound))
+{
+  rocksdb::ReadOptions options;
+  options.iterate_upper_bound = bound_slice.get();
+  iters[0] = dbiter = db->NewIterator(options, cf);
+}
+
+RocksDBStore::RocksDBBoundedIteratorImpl::~RocksDBBoundedIteratorImpl()
+{
+  // delete the iterator while the bound it points to is still around
+  for (auto i : iters)
+    delete i;
+  iters.clear();
 }
 
 RocksDBStore::RocksDBSnapshotIteratorImpl::~RocksDBSnapshotIteratorImpl()
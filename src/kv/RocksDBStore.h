@@ -9,6 +9,7 @@
 #include <set>
 #include <map>
 #include <string>
+#include <vector>
 #include <memory>
 #include <boost/scoped_ptr.hpp>
 
@@ -46,7 +47,10 @@ namespace rocksdb{
   class WriteBatch;
   class Iterator;
   class Logger;
+  class ColumnFamilyHandle;
   struct Options;
+  struct ColumnFamilyOptions;
+  struct BlockBasedTableOptions;
 }
 
 extern rocksdb::Logger *create_rocksdb_ceph_logger();
@@ -62,6 +66,27 @@ class RocksDBStore : public KeyValueDB {
   rocksdb::DB *db;
   rocksdb::Env *env;
   string options_str;
+  /// prefix -> merge operator, registered before open
+  std::vector<std::pair<std::string,
+			std::shared_ptr<KeyValueDB::MergeOperator> > > merge_ops;
+  std::string assoc_name; ///< name of the combined merge operator
+  class MergeOperatorRouter;
+  friend class MergeOperatorRouter;
+
+  /// prefixes to put in their own column families at create time
+  std::vector<KeyValueDB::ColumnFamily> cf_specs;
+  /// prefix -> column family; everything else is in the default one.
+  /// keys keep their prefix in every column family, so key order (and
+  /// the merge operator router) is the same as with a single keyspace.
+  std::map<std::string, rocksdb::ColumnFamilyHandle*> cf_handles;
+  rocksdb::ColumnFamilyHandle *default_cf;
+  /// every column family, default first
+  std::vector<rocksdb::ColumnFamilyHandle*> cf_handle_list;
+
+  int _get_cf_options(const KeyValueDB::ColumnFamily& cf,
+		      rocksdb::ColumnFamilyOptions *cfo,
+		      rocksdb::BlockBasedTableOptions *bbt,
+		      double *cache_share);
   int do_open(ostream &out, bool create_if_missing);
 
   // manage async compactions
@@ -111,6 +136,20 @@ public:
   }
   int get_info_log_level(string info_log_level);
 
+  int set_merge_operator(const std::string& prefix,
+			 std::shared_ptr<KeyValueDB::MergeOperator> mop);
+  int set_column_families(const std::vector<KeyValueDB::ColumnFamily>& cfs);
+
+  rocksdb::ColumnFamilyHandle *get_cf_handle(const std::string& prefix) {
+    auto p = cf_handles.find(prefix);
+    if (p == cf_handles.end())
+      return default_cf;
+    return p->second;
+  }
+  /// sum an integer property (e.g., "rocksdb.estimate-live-data-size")
+  /// over all column families
+  uint64_t get_int_property(const std::string& property);
+
   RocksDBStore(CephContext *c, const string &path, void *p) :
     cct(c),
     logger(NULL),
@@ -118,6 +157,7 @@ public:
     priv(p),
     db(NULL),
     env(static_cast<rocksdb::Env*>(p)),
+    default_cf(NULL),
     compact_queue_lock("RocksDBStore::compact_thread_lock"),
     compact_queue_stop(false),
     compact_thread(this),
@@ -141,6 +181,8 @@ public:
   public:
     rocksdb::WriteBatch *bat;
     RocksDBStore *db;
+    /// ranges that lost enough keys to compact once this txn commits
+    std::vector<std::pair<std::string,std::string> > compact_ranges;
 
     explicit RocksDBTransactionImpl(RocksDBStore *_db);
     ~RocksDBTransactionImpl();
@@ -154,6 +196,17 @@ public:
     void rmkeys_by_prefix(
       const string &prefix
       );
+    void rm_range_keys(
+      const string &prefix,
+      const string &start,
+      const string &end);
+    void merge(
+      const string& prefix,
+      const string& k,
+      const bufferlist &bl);
+  private:
+    void _rm_range(rocksdb::ColumnFamilyHandle *cf,
+		   const string &start, const string &end);
   };
 
   KeyValueDB::Transaction get_transaction() {
@@ -162,6 +215,9 @@ public:
 
   int submit_transaction(KeyValueDB::Transaction t);
   int submit_transaction_sync(KeyValueDB::Transaction t);
+private:
+  void _compact_deleted_ranges(RocksDBTransactionImpl *t);
+public:
   int get(
     const string &prefix,
     const std::set<string> &key,
@@ -173,14 +229,27 @@ public:
     bufferlist *out
     );
 
+  /**
+   * Iterates over one or more column families in key order.  Keys in
+   * different column families never collide (each prefix lives in
+   * exactly one), so this is a simple merge: when moving forward every
+   * child sits at or after the current key, when moving backward at or
+   * before it, and the current child is the closest one.
+   */
   class RocksDBWholeSpaceIteratorImpl :
     public KeyValueDB::WholeSpaceIteratorImpl {
   protected:
-    rocksdb::Iterator *dbiter;
+    std::vector<rocksdb::Iterator*> iters;
+    rocksdb::Iterator *dbiter;  ///< current child, or NULL if at end
+    bool forward;
+
+    void _pick();
   public:
     explicit RocksDBWholeSpaceIteratorImpl(rocksdb::Iterator *iter) :
-      dbiter(iter) { }
-    //virtual ~RocksDBWholeSpaceIteratorImpl() { }
+      iters(1, iter), dbiter(iter), forward(true) { }
+    explicit RocksDBWholeSpaceIteratorImpl(
+      const std::vector<rocksdb::Iterator*>& i) :
+      iters(i), dbiter(iters.front()), forward(true) { }
     ~RocksDBWholeSpaceIteratorImpl();
 
     int seek_to_first();
@@ -205,12 +274,23 @@ public:
     const rocksdb::Snapshot *snapshot;
   public:
     RocksDBSnapshotIteratorImpl(rocksdb::DB *db, const rocksdb::Snapshot *s,
-				rocksdb::Iterator *iter) :
-      RocksDBWholeSpaceIteratorImpl(iter), db(db), snapshot(s) { }
+				const std::vector<rocksdb::Iterator*>& iters) :
+      RocksDBWholeSpaceIteratorImpl(iters), db(db), snapshot(s) { }
 
     ~RocksDBSnapshotIteratorImpl();
   };
 
+  /// iterates over a single column family, stopping before bound
+  class RocksDBBoundedIteratorImpl : public RocksDBWholeSpaceIteratorImpl {
+    std::string bound;
+    std::unique_ptr<rocksdb::Slice> bound_slice;  ///< must outlive iters
+  public:
+    RocksDBBoundedIteratorImpl(rocksdb::DB *db,
+			       rocksdb::ColumnFamilyHandle *cf,
+			       const std::string &bound);
+    ~RocksDBBoundedIteratorImpl();
+  };
+
   /// Utility
   static string combine_strings(const string &prefix, const string &value);
   static int split_key(rocksdb::Slice in, string *prefix, string *key);
@@ -288,6 +368,8 @@ protected:
   WholeSpaceIterator _get_iterator();
 
   WholeSpaceIterator _get_snapshot_iterator();
+  WholeSpaceIterator _get_prefix_iterator(const string &prefix,
+					  const string &bound);
 
 };
 
@@ -548,6 +548,15 @@ void librados::ObjectWriteOperation::set_alloc_hint(
   o->set_alloc_hint(expected_object_size, expected_write_size);
 }
 
+void librados::ObjectWriteOperation::set_alloc_hint2(
+                                            uint64_t expected_object_size,
+                                            uint64_t expected_write_size,
+                                            uint32_t flags)
+{
+  ::ObjectOperation *o = &impl->o;
+  o->set_alloc_hint(expected_object_size, expected_write_size, flags);
+}
+
 void librados::ObjectWriteOperation::cache_pin()
 {
   ::ObjectOperation *o = &impl->o;
@@ -587,6 +587,10 @@ int Monitor::preinit()
     pcb.add_u64_counter(l_mon_election_call, "election_call", "Elections started");
     pcb.add_u64_counter(l_mon_election_win, "election_win", "Elections won");
     pcb.add_u64_counter(l_mon_election_lose, "election_lose", "Elections lost");
+    pcb.add_time_avg(l_mon_osdmap_mapping_lat, "osdmap_mapping_latency",
+		     "Time to precompute the pg mapping of an osdmap");
+    pcb.add_u64(l_mon_osdmap_mapping_pgs, "osdmap_mapping_pgs",
+		"PGs in the precomputed osdmap mapping");
     logger = pcb.create_perf_counters();
     cct->get_perfcounters_collection()->add(logger);
   }
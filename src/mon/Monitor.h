@@ -100,6 +100,8 @@ enum {
   l_mon_election_call,
   l_mon_election_win,
   l_mon_election_lose,
+  l_mon_osdmap_mapping_lat,
+  l_mon_osdmap_mapping_pgs,
   l_mon_last,
 };
 
@@ -55,6 +55,7 @@
 #include "common/errno.h"
 
 #include "erasure-code/ErasureCodePlugin.h"
+#include "compressor/Compressor.h"
 
 #include "include/compat.h"
 #include "include/assert.h"
@@ -77,6 +78,10 @@ OSDMonitor::OSDMonitor(CephContext *cct, Monitor *mn, Paxos *p, const string& se
  : PaxosService(mn, p, service_name),
    inc_osd_cache(g_conf->mon_osd_cache_size),
    full_osd_cache(g_conf->mon_osd_cache_size),
+   mapping_tp(cct, "OSDMonitor::mapping_tp", "tp_osdmon_map",
+	      g_conf->mon_osd_mapping_threads),
+   mapping_tp_started(false),
+   mapper(&mapping_tp),
    thrash_map(0), thrash_last_up_osd(-1),
    op_tracker(cct, true, 1)
 {}
@@ -283,6 +288,8 @@ void OSDMonitor::update_from_paxos(bool *need_bootstrap)
     mon->store->apply_transaction(t);
   }
 
+  update_mapping();
+
   for (int o = 0; o < osdmap.get_max_osd(); o++) {
     if (osdmap.is_down(o)) {
       // populate down -> out map
@@ -461,6 +468,33 @@ void OSDMonitor::on_shutdown()
   while (!ls.empty()) {
     ls.pop_front();
   }
+
+  if (mapping_tp_started) {
+    mapping_tp.stop();
+    mapping_tp_started = false;
+  }
+}
+
+void OSDMonitor::update_mapping()
+{
+  utime_t start = ceph_clock_now(g_ceph_context);
+  ceph::shared_ptr<OSDMapMapping> m(new OSDMapMapping);
+  if (g_conf->mon_osd_mapping_threads > 0) {
+    if (!mapping_tp_started) {
+      mapping_tp.start();
+      mapping_tp_started = true;
+    }
+    mapper.map(osdmap, m.get(),
+	       MAX(1, g_conf->mon_osd_mapping_pgs_per_chunk));
+  } else {
+    m->update(osdmap);
+  }
+  osdmap.set_mapping(m);
+  utime_t lat = ceph_clock_now(g_ceph_context) - start;
+  mon->logger->tinc(l_mon_osdmap_mapping_lat, lat);
+  mon->logger->set(l_mon_osdmap_mapping_pgs, m->get_num_pgs());
+  dout(10) << __func__ << " mapped " << m->get_num_pgs() << " pgs for e"
+	   << osdmap.get_epoch() << " in " << lat << dendl;
 }
 
 void OSDMonitor::update_logger()
@@ -3033,7 +3067,8 @@ namespace {
     MIN_WRITE_RECENCY_FOR_PROMOTE, FAST_READ,
     HIT_SET_GRADE_DECAY_RATE, HIT_SET_SEARCH_LAST_N,
     SCRUB_MIN_INTERVAL, SCRUB_MAX_INTERVAL, DEEP_SCRUB_INTERVAL,
-    RECOVERY_PRIORITY, RECOVERY_OP_PRIORITY, SCRUB_PRIORITY};
+    RECOVERY_PRIORITY, RECOVERY_OP_PRIORITY, SCRUB_PRIORITY,
+    COMPRESSION_MODE, COMPRESSION_ALGORITHM, COMPRESSION_REQUIRED_RATIO};
 
   std::set<osd_pool_get_choices>
     subtract_second_from_first(const std::set<osd_pool_get_choices>& first,
@@ -3524,7 +3559,10 @@ bool OSDMonitor::preprocess_command(MonOpRequestRef op)
       ("deep_scrub_interval", DEEP_SCRUB_INTERVAL)
       ("recovery_priority", RECOVERY_PRIORITY)
       ("recovery_op_priority", RECOVERY_OP_PRIORITY)
-      ("scrub_priority", SCRUB_PRIORITY);
+      ("scrub_priority", SCRUB_PRIORITY)
+      ("compression_mode", COMPRESSION_MODE)
+      ("compression_algorithm", COMPRESSION_ALGORITHM)
+      ("compression_required_ratio", COMPRESSION_REQUIRED_RATIO);
 
     typedef std::set<osd_pool_get_choices> choices_set_t;
 
@@ -3709,6 +3747,9 @@ bool OSDMonitor::preprocess_command(MonOpRequestRef op)
           case RECOVERY_PRIORITY:
           case RECOVERY_OP_PRIORITY:
           case SCRUB_PRIORITY:
+	  case COMPRESSION_MODE:
+	  case COMPRESSION_ALGORITHM:
+	  case COMPRESSION_REQUIRED_RATIO:
 	    for (i = ALL_CHOICES.begin(); i != ALL_CHOICES.end(); ++i) {
 	      if (i->second == *it)
 		break;
@@ -3843,6 +3884,9 @@ bool OSDMonitor::preprocess_command(MonOpRequestRef op)
           case RECOVERY_PRIORITY:
           case RECOVERY_OP_PRIORITY:
           case SCRUB_PRIORITY:
+	  case COMPRESSION_MODE:
+	  case COMPRESSION_ALGORITHM:
+	  case COMPRESSION_REQUIRED_RATIO:
 	    for (i = ALL_CHOICES.begin(); i != ALL_CHOICES.end(); ++i) {
 	      if (i->second == *it)
 		break;
@@ -5287,6 +5331,19 @@ int OSDMonitor::prepare_command_pool_set(map<string,cmd_vartype> &cmdmap,
       p.fast_read = false;
     }
   } else if (pool_opts_t::is_opt_name(var)) {
+    if (var == "compression_mode" && !val.empty() &&
+	Compressor::get_comp_mode_type(val) < 0) {
+      ss << "unrecognized compression mode '" << val << "'";
+      return -EINVAL;
+    } else if (var == "compression_algorithm" && !val.empty() &&
+	       Compressor::get_comp_alg_type(val) < 0) {
+      ss << "unrecognized compression algorithm '" << val << "'";
+      return -EINVAL;
+    } else if (var == "compression_required_ratio" &&
+	       floaterr.empty() && (f < 0 || f > 1)) {
+      ss << "compression_required_ratio must be between 0 and 1";
+      return -EINVAL;
+    }
     pool_opts_t::opt_desc_t desc = pool_opts_t::get_opt_desc(var);
     switch (desc.type) {
     case pool_opts_t::STR:
@@ -6507,6 +6564,86 @@ bool OSDMonitor::prepare_command_impl(MonOpRequestRef op,
     pending_inc.new_primary_temp[pgid] = osd;
     ss << "set " << pgid << " primary_temp mapping to " << osd;
     goto update;
+  } else if (prefix == "osd pg-upmap-items" ||
+	     prefix == "osd rm-pg-upmap-items") {
+    string pgidstr;
+    if (!cmd_getval(g_ceph_context, cmdmap, "pgid", pgidstr)) {
+      ss << "unable to parse 'pgid' value '"
+         << cmd_vartype_stringify(cmdmap["pgid"]) << "'";
+      err = -EINVAL;
+      goto reply;
+    }
+    pg_t pgid;
+    if (!pgid.parse(pgidstr.c_str())) {
+      ss << "invalid pgid '" << pgidstr << "'";
+      err = -EINVAL;
+      goto reply;
+    }
+    const pg_pool_t *pi = osdmap.get_pg_pool(pgid.pool());
+    if (!pi || pgid.ps() >= pi->get_pg_num()) {
+      ss << "pg " << pgid << " does not exist";
+      err = -ENOENT;
+      goto reply;
+    }
+    if (pending_inc.new_pg_upmap_items.count(pgid) ||
+	pending_inc.old_pg_upmap_items.count(pgid)) {
+      dout(10) << __func__ << " waiting for pending update on " << pgid << dendl;
+      wait_for_finished_proposal(op, new C_RetryMessage(this, op));
+      return true;
+    }
+    err = check_cluster_features(CEPH_FEATURE_OSDMAP_PG_UPMAP, ss);
+    if (err == -EAGAIN)
+      goto wait;
+    if (err < 0)
+      goto reply;
+
+    if (prefix == "osd rm-pg-upmap-items") {
+      if (!osdmap.get_pg_upmap_items().count(pgid)) {
+	ss << "no pg_upmap_items mapping for " << pgid;
+	err = 0;
+	goto reply;
+      }
+      pending_inc.old_pg_upmap_items.insert(pgid);
+      ss << "clear " << pgid << " pg_upmap_items mapping";
+      goto update;
+    }
+
+    vector<string> id_vec;
+    if (!cmd_getval(g_ceph_context, cmdmap, "id", id_vec)) {
+      ss << "unable to parse 'id' value(s) '"
+         << cmd_vartype_stringify(cmdmap["id"]) << "'";
+      err = -EINVAL;
+      goto reply;
+    }
+    if (id_vec.empty() || id_vec.size() % 2) {
+      ss << "you must specify pairs of osds to remap from and to";
+      err = -EINVAL;
+      goto reply;
+    }
+    vector<pair<int32_t,int32_t> > items;
+    for (unsigned i = 0; i < id_vec.size(); i += 2) {
+      int32_t from = parse_osd_id(id_vec[i].c_str(), &ss);
+      int32_t to = parse_osd_id(id_vec[i + 1].c_str(), &ss);
+      if (from < 0 || to < 0) {
+        err = -EINVAL;
+        goto reply;
+      }
+      if (!osdmap.exists(to)) {
+        ss << "osd." << to << " does not exist";
+        err = -ENOENT;
+        goto reply;
+      }
+      if (from == to) {
+	ss << "cannot remap osd." << from << " to itself";
+	err = -EINVAL;
+	goto reply;
+      }
+      items.push_back(make_pair(from, to));
+    }
+
+    pending_inc.new_pg_upmap_items[pgid] = items;
+    ss << "set " << pgid << " pg_upmap_items mapping to " << items;
+    goto update;
   } else if (prefix == "osd primary-affinity") {
     int64_t id;
     if (!cmd_getval(g_ceph_context, cmdmap, "id", id)) {
@@ -30,6 +30,7 @@ using namespace std;
 #include "msg/Messenger.h"
 
 #include "osd/OSDMap.h"
+#include "osd/OSDMapMapping.h"
 
 #include "PaxosService.h"
 #include "Session.h"
@@ -134,6 +135,12 @@ private:
   SimpleLRU<version_t, bufferlist> inc_osd_cache;
   SimpleLRU<version_t, bufferlist> full_osd_cache;
 
+  // pg mapping table for the current osdmap, shared with its readers
+  ThreadPool mapping_tp;
+  bool mapping_tp_started;
+  ParallelPGMapper mapper;
+  void update_mapping();
+
   void check_failures(utime_t now);
   bool check_failure(utime_t now, int target_osd, failure_info_t& fi);
 
@@ -63,6 +63,14 @@ public:
     const SequencerPosition *spos=0     ///< [in] sequencer position
     ) = 0;
 
+  /// Clear all map keys and values in [first, last) from oid
+  virtual int rm_key_range(
+    const ghobject_t &oid,              ///< [in] object containing map
+    const string &first,                ///< [in] first key to clear
+    const string &last,                 ///< [in] key to stop clearing at
+    const SequencerPosition *spos=0     ///< [in] sequencer position
+    ) = 0;
+
   /// Clear all omap keys and the header
   virtual int clear_keys_header(
     const ghobject_t &oid,              ///< [in] oid to clear
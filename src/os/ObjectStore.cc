@@ -192,3 +192,33 @@ int ObjectStore::queue_transactions(
   return queue_transactions(osr, tls, _onreadable, _oncommit,
 			    onreadable_sync, op);
 }
+
+int ObjectStore::read_multi(
+  const coll_t& cid,
+  vector<read_multi_op_t>& ops,
+  bool allow_eio)
+{
+  for (auto& op : ops) {
+    op.r = 0;
+    op.bls.clear();
+    op.bls.resize(op.extents.size());
+    for (unsigned i = 0; i < op.extents.size(); ++i) {
+      const read_extent_t& e = op.extents[i];
+      int r = read(cid, op.oid, e.offset, e.length, op.bls[i], e.op_flags,
+		   allow_eio);
+      if (r < 0) {
+	op.r = r;
+	break;
+      }
+    }
+  }
+  return 0;
+}
+
+int ObjectStore::read_multi(
+  CollectionHandle &c,
+  vector<read_multi_op_t>& ops,
+  bool allow_eio)
+{
+  return read_multi(c->get_cid(), ops, allow_eio);
+}
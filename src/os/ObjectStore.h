@@ -26,6 +26,7 @@
 #include <sys/stat.h>
 #include <vector>
 #include <map>
+#include "include/unordered_map.h"
 
 #if defined(DARWIN) || defined(__FreeBSD__) || defined(__sun)
 #include <sys/statvfs.h>
@@ -34,6 +35,9 @@
 #endif /* DARWIN */
 
 #define OPS_PER_PTR 32
+// past this many objects a transaction keeps a hash index next to the
+// flat object vector; below it a linear scan is cheaper than a lookup
+#define OBJECT_INDEX_LINEAR_MAX 16
 
 class CephContext;
 
@@ -426,7 +430,7 @@ public:
       __le32 dest_cid;
       __le32 dest_oid;                  //OP_CLONE, OP_CLONERANGE
       __le64 dest_off;                  //OP_CLONERANGE
-      __le32 hint_type;                 //OP_COLL_HINT
+      __le32 hint_type;                 //OP_COLL_HINT, OP_SETALLOCHINT flags
       __le64 expected_object_size;      //OP_SETALLOCHINT
       __le64 expected_write_size;       //OP_SETALLOCHINT
       __le32 split_bits;                //OP_SPLIT_COLLECTION2
@@ -493,11 +497,11 @@ public:
     bool use_tbl {false};   //use_tbl for encode/decode
     bufferlist tbl;
 
-    map<coll_t, __le32> coll_index;
-    map<ghobject_t, __le32, ghobject_t::BitwiseComparator> object_index;
-
-    __le32 coll_id {0};
-    __le32 object_id {0};
+    /// collections and objects referenced by the ops, indexed by id
+    vector<coll_t> coll_index;
+    vector<ghobject_t> object_index;
+    /// object -> id, only kept once object_index outgrows a linear scan
+    ceph::unordered_map<ghobject_t, __le32> object_lookup;
 
     bufferlist data_bl;
     bufferlist op_bl;
@@ -527,8 +531,7 @@ public:
       tbl(std::move(other.tbl)),
       coll_index(std::move(other.coll_index)),
       object_index(std::move(other.object_index)),
-      coll_id(other.coll_id),
-      object_id(other.object_id),
+      object_lookup(std::move(other.object_lookup)),
       data_bl(std::move(other.data_bl)),
       op_bl(std::move(other.op_bl)),
       op_ptr(std::move(other.op_ptr)),
@@ -537,8 +540,9 @@ public:
       on_applied_sync(std::move(other.on_applied_sync)) {
       other.osr = nullptr;
       other.use_tbl = false;
-      other.coll_id = 0;
-      other.object_id = 0;
+      other.coll_index.clear();
+      other.object_index.clear();
+      other.object_lookup.clear();
     }
 
     Transaction& operator=(Transaction&& other) noexcept {
@@ -548,8 +552,7 @@ public:
       tbl = std::move(other.tbl);
       coll_index = std::move(other.coll_index);
       object_index = std::move(other.object_index);
-      coll_id = other.coll_id;
-      object_id = other.object_id;
+      object_lookup = std::move(other.object_lookup);
       data_bl = std::move(other.data_bl);
       op_bl = std::move(other.op_bl);
       op_ptr = std::move(other.op_ptr);
@@ -558,8 +561,9 @@ public:
       on_applied_sync = std::move(other.on_applied_sync);
       other.osr = nullptr;
       other.use_tbl = false;
-      other.coll_id = 0;
-      other.object_id = 0;
+      other.coll_index.clear();
+      other.object_index.clear();
+      other.object_lookup.clear();
       return *this;
     }
 
@@ -641,12 +645,12 @@ public:
       std::swap(use_tbl, other.use_tbl);
       tbl.swap(other.tbl);
 
-      std::swap(coll_index, other.coll_index);
-      std::swap(object_index, other.object_index);
-      std::swap(coll_id, other.coll_id);
-      std::swap(object_id, other.object_id);
+      coll_index.swap(other.coll_index);
+      object_index.swap(other.object_index);
+      object_lookup.swap(other.object_lookup);
       op_bl.swap(other.op_bl);
       data_bl.swap(other.data_bl);
+      op_ptr.swap(other.op_ptr);
     }
 
     void _update_op(Op* op,
@@ -775,37 +779,40 @@ public:
       on_applied_sync.splice(on_applied_sync.end(), other.on_applied_sync);
 
       //append coll_index & object_index
+      bool remapped = false;
       vector<__le32> cm(other.coll_index.size());
-      map<coll_t, __le32>::iterator coll_index_p;
-      for (coll_index_p = other.coll_index.begin();
-           coll_index_p != other.coll_index.end();
-           ++coll_index_p) {
-        cm[coll_index_p->second] = _get_coll_id(coll_index_p->first);
+      for (unsigned i = 0; i < other.coll_index.size(); ++i) {
+        cm[i] = _get_coll_id(other.coll_index[i]);
+        remapped |= (cm[i] != i);
       }
 
       vector<__le32> om(other.object_index.size());
-      map<ghobject_t, __le32, ghobject_t::BitwiseComparator>::iterator object_index_p;
-      for (object_index_p = other.object_index.begin();
-           object_index_p != other.object_index.end();
-           ++object_index_p) {
-        om[object_index_p->second] = _get_object_id(object_index_p->first);
-      }      
-
-      //the other.op_bl SHOULD NOT be changes during append operation,
-      //we use additional bufferlist to avoid this problem
-      bufferptr other_op_bl_ptr(other.op_bl.length());
-      other.op_bl.copy(0, other.op_bl.length(), other_op_bl_ptr.c_str());
-      bufferlist other_op_bl;
-      other_op_bl.append(other_op_bl_ptr);
-
-      //update other_op_bl with cm & om
-      //When the other is appended to current transaction, all coll_index and
-      //object_index in other.op_buffer should be updated by new index of the
-      //combined transaction
-      _update_op_bl(other_op_bl, cm, om);
-
-      //append op_bl
-      op_bl.append(other_op_bl);
+      for (unsigned i = 0; i < other.object_index.size(); ++i) {
+        om[i] = _get_object_id(other.object_index[i]);
+        remapped |= (om[i] != i);
+      }
+
+      if (!remapped) {
+        //the ids already line up (e.g. we were empty), so the ops can be
+        //shared with other as they are
+        op_bl.append(other.op_bl);
+      } else {
+        //the other.op_bl SHOULD NOT be changes during append operation,
+        //we use additional bufferlist to avoid this problem
+        bufferptr other_op_bl_ptr(other.op_bl.length());
+        other.op_bl.copy(0, other.op_bl.length(), other_op_bl_ptr.c_str());
+        bufferlist other_op_bl;
+        other_op_bl.append(other_op_bl_ptr);
+
+        //update other_op_bl with cm & om
+        //When the other is appended to current transaction, all coll_index and
+        //object_index in other.op_buffer should be updated by new index of the
+        //combined transaction
+        _update_op_bl(other_op_bl, cm, om);
+
+        //append op_bl
+        op_bl.append(other_op_bl);
+      }
       //append data_bl
       data_bl.append(other.data_bl);
     }
@@ -828,12 +835,12 @@ public:
 
         // coll_index first
         for (auto p = coll_index.begin(); p != coll_index.end(); ++p) {
-          final_size += p->first.encoded_size();
+          final_size += p->encoded_size();
         }
 
         // object_index first
         for (auto p = object_index.begin(); p != object_index.end(); ++p) {
-          final_size += p->first.encoded_size();
+          final_size += p->encoded_size();
         }
         
         return data_bl.length() +
@@ -850,8 +857,8 @@ public:
         //layout: data_bl + op_bl + coll_index + object_index + data
 
         bufferlist bl;
-        ::encode(coll_index, bl);
-        ::encode(object_index, bl);
+        _encode_index(coll_index, bl);
+        _encode_index(object_index, bl);
 
         return data_bl.length() +
           op_bl.length() +
@@ -932,32 +939,19 @@ public:
       bufferlist::iterator data_bl_p;
 
     public:
-      vector<coll_t> colls;
-      vector<ghobject_t> objects;
+      /// the transaction's own index vectors, already ordered by id
+      vector<coll_t> &colls;
+      vector<ghobject_t> &objects;
 
     private:
       explicit iterator(Transaction *t)
         : t(t),
 	  data_bl_p(t->data_bl.begin()),
-          colls(t->coll_index.size()),
-          objects(t->object_index.size()) {
+          colls(t->coll_index),
+          objects(t->object_index) {
 
         ops = t->data.ops;
         op_buffer_p = t->op_bl.get_contiguous(0, t->data.ops * sizeof(Op));
-
-        map<coll_t, __le32>::iterator coll_index_p;
-        for (coll_index_p = t->coll_index.begin();
-             coll_index_p != t->coll_index.end();
-             ++coll_index_p) {
-          colls[coll_index_p->second] = coll_index_p->first;
-        }
-
-        map<ghobject_t, __le32, ghobject_t::BitwiseComparator>::iterator object_index_p;
-        for (object_index_p = t->object_index.begin();
-             object_index_p != t->object_index.end();
-             ++object_index_p) {
-          objects[object_index_p->second] = object_index_p->first;
-        }
       }
 
       friend class Transaction;
@@ -1035,32 +1029,73 @@ private:
       if (op_ptr.length() == 0 || op_ptr.offset() >= op_ptr.length()) {
         op_ptr = bufferptr(sizeof(Op) * OPS_PER_PTR);
       }
-      bufferptr ptr(op_ptr, 0, sizeof(Op));
-      op_bl.append(ptr);
+      // ops carved out of the same op_ptr stay one contiguous segment
+      // of op_bl, so only a new op_ptr costs an allocation
+      op_bl.append(op_ptr, 0, sizeof(Op));
 
+      char* p = op_ptr.c_str();
       op_ptr.set_offset(op_ptr.offset() + sizeof(Op));
 
-      char* p = ptr.c_str();
       memset(p, 0, sizeof(Op));
       return reinterpret_cast<Op*>(p);
     }
     __le32 _get_coll_id(const coll_t& coll) {
-      map<coll_t, __le32>::iterator c = coll_index.find(coll);
-      if (c != coll_index.end())
-        return c->second;
-
-      __le32 index_id = coll_id++;
-      coll_index[coll] = index_id;
-      return index_id;
+      // there are rarely more than a couple collections in a transaction
+      for (unsigned i = 0; i < coll_index.size(); ++i) {
+        if (coll_index[i] == coll)
+          return i;
+      }
+      coll_index.push_back(coll);
+      return coll_index.size() - 1;
     }
     __le32 _get_object_id(const ghobject_t& oid) {
-      map<ghobject_t, __le32, ghobject_t::BitwiseComparator>::iterator o = object_index.find(oid);
-      if (o != object_index.end())
-        return o->second;
-
-      __le32 index_id = object_id++;
-      object_index[oid] = index_id;
-      return index_id;
+      if (object_index.size() < OBJECT_INDEX_LINEAR_MAX) {
+        // most recently added objects are the likeliest to be reused
+        for (unsigned i = object_index.size(); i > 0; --i) {
+          if (object_index[i - 1] == oid)
+            return i - 1;
+        }
+      } else {
+        if (object_lookup.empty()) {
+          for (unsigned i = 0; i < object_index.size(); ++i)
+            object_lookup[object_index[i]] = i;
+        }
+        ceph::unordered_map<ghobject_t, __le32>::iterator o =
+          object_lookup.find(oid);
+        if (o != object_lookup.end())
+          return o->second;
+        object_lookup[oid] = object_index.size();
+      }
+      object_index.push_back(oid);
+      return object_index.size() - 1;
+    }
+
+    /// encoded the way map<T, __le32> used to be, so the wire format is unchanged
+    template<typename T>
+    static void _encode_index(const vector<T> &index, bufferlist &bl) {
+      __u32 n = index.size();
+      ::encode(n, bl);
+      for (__u32 i = 0; i < n; ++i) {
+        ::encode(index[i], bl);
+        __le32 id = i;
+        ::encode(id, bl);
+      }
+    }
+    template<typename T>
+    static void _decode_index(vector<T> &index, bufferlist::iterator &bl) {
+      __u32 n;
+      ::decode(n, bl);
+      index.clear();
+      index.resize(n);
+      for (__u32 i = 0; i < n; ++i) {
+        T v;
+        __le32 id;
+        ::decode(v, bl);
+        ::decode(id, bl);
+        if (id >= n)
+          throw buffer::malformed_input("transaction index id out of range");
+        index[id] = v;
+      }
     }
 
 public:
@@ -1722,7 +1757,8 @@ public:
       coll_t cid,
       const ghobject_t &oid,
       uint64_t expected_object_size,
-      uint64_t expected_write_size
+      uint64_t expected_write_size,
+      uint32_t flags = 0   ///< CEPH_OSD_ALLOC_HINT_FLAG_*; lost with use_tbl
     ) {
       if (use_tbl) {
         __u32 op = OP_SETALLOCHINT;
@@ -1738,6 +1774,7 @@ public:
         _op->oid = _get_object_id(oid);
         _op->expected_object_size = expected_object_size;
         _op->expected_write_size = expected_write_size;
+        _op->hint_type = flags;
       }
       data.ops++;
     }
@@ -1766,8 +1803,8 @@ public:
         ENCODE_START(9, 9, bl);
         ::encode(data_bl, bl);
         ::encode(op_bl, bl);
-        ::encode(coll_index, bl);
-        ::encode(object_index, bl);
+        _encode_index(coll_index, bl);
+        _encode_index(object_index, bl);
         data.encode(bl);
         ENCODE_FINISH(bl);
       }
@@ -1798,12 +1835,11 @@ public:
       if (!decoded && struct_v >= 8) {
         ::decode(data_bl, bl);
         ::decode(op_bl, bl);
-        ::decode(coll_index, bl);
-        ::decode(object_index, bl);
+        _decode_index(coll_index, bl);
+        _decode_index(object_index, bl);
+        object_lookup.clear();
         data.decode(bl);
         use_tbl = false;
-        coll_id = coll_index.size();
-        object_id = object_index.size();
 	decoded = true;
       }
 
@@ -1948,6 +1984,18 @@ public:
     return false;   // assume a backend cannot, unless it says otherwise
   }
 
+  /**
+   * has_builtin_csum -- whether reads of an object are fully verified
+   *
+   * @param c collection for object
+   * @param oid oid of object
+   * @returns true if every byte a read of oid returns is checked against
+   *          a checksum kept by the store, false if any of it may not be
+   */
+  virtual bool has_builtin_csum(CollectionHandle& c, const ghobject_t& oid) {
+    return false;
+  }
+
   virtual int statfs(struct statfs *buf) = 0;
 
   virtual void collect_metadata(map<string,string> *pm) { }
@@ -2074,6 +2122,49 @@ public:
      return read(c->get_cid(), oid, offset, len, bl, op_flags, allow_eio);
    }
 
+  /// one byte range of a read_multi() request
+  struct read_extent_t {
+    uint64_t offset;
+    uint64_t length;
+    uint32_t op_flags;   ///< CEPH_OSD_OP_FLAG_*
+    read_extent_t(uint64_t o = 0, uint64_t l = 0, uint32_t f = 0)
+      : offset(o), length(l), op_flags(f) {}
+  };
+
+  /// one object's worth of a read_multi() request, and its results
+  struct read_multi_op_t {
+    ghobject_t oid;
+    vector<read_extent_t> extents;
+    vector<bufferlist> bls;   ///< [out] data, one per extent
+    int r;                    ///< [out] 0, or the first error for this object
+    read_multi_op_t() : r(0) {}
+    explicit read_multi_op_t(const ghobject_t& o) : oid(o), r(0) {}
+  };
+
+  /**
+   * read_multi -- read byte ranges from many objects in one call
+   *
+   * Each extent behaves as it would for read(): 0~0 reads the whole
+   * object, and reads past the end are short.  Per-object results go
+   * in ops[i].r and ops[i].bls; an object that fails keeps the buffers
+   * of the extents read before the error.  Backends override this to
+   * share lookups and batch io across the whole request.
+   *
+   * @param cid collection for the objects
+   * @param ops objects and extents to read, updated with the results
+   * @param allow_eio if false, assert on -EIO operation failure
+   * @returns 0 on success, or negative error code if the collection
+   *          could not be read at all.
+   */
+  virtual int read_multi(
+    const coll_t& cid,
+    vector<read_multi_op_t>& ops,
+    bool allow_eio = false);
+  virtual int read_multi(
+    CollectionHandle &c,
+    vector<read_multi_op_t>& ops,
+    bool allow_eio = false);
+
   /**
    * fiemap -- get extent map of data of an object
    *
@@ -2271,6 +2362,23 @@ public:
     return -EOPNOTSUPP;
   }
 
+  /**
+   * pass the options of the owning pool down to a collection
+   *
+   * Not persisted; the caller is expected to repeat this after mount and
+   * whenever the pool changes.  Backends that have no use for them
+   * ignore them.
+   *
+   * @param cid collection
+   * @param opts pool options
+   * @return 0 on success, or negative error code
+   */
+  virtual int set_collection_opts(
+    const coll_t& cid,
+    const pool_opts_t& opts) {
+    return -EOPNOTSUPP;
+  }
+
   /**
    * list contents of a collection that fall in the range [start, end) and no more than a specified many result
    *
@@ -2400,6 +2508,13 @@ public:
 
   virtual int snapshot(const string& name) { return -EOPNOTSUPP; }
 
+  /**
+   * Called by each OSD op shard worker thread when it starts, with an
+   * index unique among them, so that the store may set aside per-thread
+   * resources (e.g. a device queue) for the threads doing most io.
+   */
+  virtual void bind_op_thread(unsigned index) {}
+
   /**
    * Set and get internal fsid for this instance. No external data is modified
    */
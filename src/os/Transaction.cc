@@ -15,8 +15,6 @@ void ObjectStore::Transaction::_build_actions_from_tbl()
   //Now we assert each transaction should only be iterated once
   assert(coll_index.size() == 0);
   assert(object_index.size() == 0);
-  assert(coll_id == 0);
-  assert(object_id == 0);
   assert(data_bl.length() == 0);
   assert(op_bl.length() == 0);
 
@@ -944,6 +942,7 @@ void ObjectStore::Transaction::dump(ceph::Formatter *f)
         f->dump_stream("oid") << oid;
         f->dump_stream("expected_object_size") << expected_object_size;
         f->dump_stream("expected_write_size") << expected_write_size;
+        f->dump_unsigned("flags", op->hint_type);
       }
       break;
 
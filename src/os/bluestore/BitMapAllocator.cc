@@ -0,0 +1,398 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "BitMapAllocator.h"
+#include "bluestore_types.h"
+#include "BlueStore.h"
+
+#define dout_subsys ceph_subsys_bluestore
+#undef dout_prefix
+#define dout_prefix *_dout << "bitmapalloc:" << this << " "
+
+/// pick a zone size that is a whole number of cache lines and whose
+/// per-word summary fits in a single uint64_t
+static uint64_t choose_blocks_per_zone()
+{
+  uint64_t min_blocks = 64 * 8;    // one cache line of bitmap words
+  uint64_t max_blocks = 64 * 64;   // one summary bit per word
+  uint64_t n = MAX(1, g_conf->bluestore_bitmapallocator_blocks_per_zone);
+  n = ROUND_UP_TO(n, min_blocks);
+  return MIN(n, max_blocks);
+}
+
+BitMapAllocator::BitMapAllocator(int64_t device_size, uint64_t bs)
+  : block_size(bs),
+    num_blocks(device_size / bs),
+    blocks_per_zone(choose_blocks_per_zone()),
+    words_per_zone(blocks_per_zone / BITS_PER_WORD),
+    num_zones(MAX(1, (num_blocks + blocks_per_zone - 1) / blocks_per_zone)),
+    bitmap(NULL),
+    zones(num_zones),
+    num_free(0),
+    num_reserved(0),
+    last_alloc(0),
+    num_uncommitted(0),
+    num_committing(0)
+{
+  assert(block_size > 0);
+  assert(words_per_zone % WORDS_PER_CACHE_LINE == 0);
+  size_t bytes = num_zones * words_per_zone * sizeof(uint64_t);
+  void *p = NULL;
+  int r = ::posix_memalign(&p, WORDS_PER_CACHE_LINE * sizeof(uint64_t), bytes);
+  assert(r == 0);
+  bitmap = static_cast<uint64_t*>(p);
+  // everything starts out in use; init_add_free() clears what is free.
+  memset(bitmap, 0xff, bytes);
+  for (uint64_t i = 0; i < num_zones; ++i) {
+    zones[i].words = bitmap + i * words_per_zone;
+  }
+  dout(10) << __func__ << " " << num_blocks << " blocks of " << block_size
+	   << " in " << num_zones << " zones of " << blocks_per_zone
+	   << " blocks, " << bytes << " bytes of bitmap" << dendl;
+}
+
+BitMapAllocator::~BitMapAllocator()
+{
+  ::free(bitmap);
+}
+
+uint64_t BitMapAllocator::_zone_next_free(Zone& z, uint64_t b)
+{
+  uint64_t w = b / BITS_PER_WORD;
+  if (w >= words_per_zone)
+    return blocks_per_zone;
+  uint64_t free_bits = ~z.words[w] & (~0ull << (b % BITS_PER_WORD));
+  if (free_bits)
+    return w * BITS_PER_WORD + __builtin_ctzll(free_bits);
+  if (w + 1 >= words_per_zone)
+    return blocks_per_zone;
+  uint64_t mask = z.nonfull & (~0ull << (w + 1));
+  if (!mask)
+    return blocks_per_zone;
+  w = __builtin_ctzll(mask);
+  return w * BITS_PER_WORD + __builtin_ctzll(~z.words[w]);
+}
+
+uint64_t BitMapAllocator::_zone_free_run(Zone& z, uint64_t b, uint64_t max)
+{
+  uint64_t run = 0;
+  while (run < max && b < blocks_per_zone) {
+    unsigned bit = b % BITS_PER_WORD;
+    uint64_t used = z.words[b / BITS_PER_WORD] >> bit;
+    if (used) {
+      run += __builtin_ctzll(used);
+      break;
+    }
+    run += BITS_PER_WORD - bit;
+    b += BITS_PER_WORD - bit;
+  }
+  return MIN(run, max);
+}
+
+void BitMapAllocator::_zone_mark(Zone& z, uint64_t b, uint64_t len, bool used,
+				 uint64_t *changed)
+{
+  uint64_t n = 0;
+  while (len) {
+    uint64_t w = b / BITS_PER_WORD;
+    unsigned bit = b % BITS_PER_WORD;
+    uint64_t count = MIN(BITS_PER_WORD - bit, len);
+    uint64_t mask = count == BITS_PER_WORD ?
+      ~0ull : ((1ull << count) - 1) << bit;
+    if (used) {
+      n += __builtin_popcountll(~z.words[w] & mask);
+      z.words[w] |= mask;
+    } else {
+      n += __builtin_popcountll(z.words[w] & mask);
+      z.words[w] &= ~mask;
+    }
+    if (z.words[w] == ~0ull)
+      z.nonfull &= ~(1ull << w);
+    else
+      z.nonfull |= 1ull << w;
+    b += count;
+    len -= count;
+  }
+  if (used) {
+    z.num_free -= n;
+  } else {
+    z.num_free += n;
+    z.max_run = blocks_per_zone;
+  }
+  *changed += n;
+}
+
+bool BitMapAllocator::_zone_allocate(
+  Zone& z, uint64_t zone_index, uint64_t start,
+  uint64_t want, uint64_t unit, bool partial,
+  uint64_t *block, uint64_t *len)
+{
+  uint64_t base = zone_index * blocks_per_zone;
+  uint64_t best = 0, best_len = 0, longest = 0;
+  uint64_t b = start;
+  while (true) {
+    b = _zone_next_free(z, b);
+    if (b >= blocks_per_zone)
+      break;
+    uint64_t skew = (base + b) % unit;
+    if (skew) {
+      b += unit - skew;
+      continue;
+    }
+    uint64_t run = _zone_free_run(z, b, want);
+    if (run >= want) {
+      best = b;
+      best_len = want;
+      break;
+    }
+    longest = MAX(longest, run);
+    uint64_t aligned = run - run % unit;
+    if (aligned > best_len) {
+      best = b;
+      best_len = aligned;
+    }
+    b += run;
+  }
+  if (best_len < want) {
+    if (start == 0 && unit == 1) {
+      // we looked at every free run in the zone
+      z.max_run = longest;
+    }
+    if (!partial || best_len == 0)
+      return false;
+  }
+  uint64_t changed = 0;
+  _zone_mark(z, best, best_len, true, &changed);
+  assert(changed == best_len);
+  *block = base + best;
+  *len = best_len;
+  return true;
+}
+
+uint64_t BitMapAllocator::_mark(uint64_t block, uint64_t len, bool used)
+{
+  uint64_t changed = 0;
+  while (len) {
+    uint64_t zi = block / blocks_per_zone;
+    uint64_t b = block % blocks_per_zone;
+    uint64_t n = MIN(blocks_per_zone - b, len);
+    Zone& z = zones[zi];
+    std::lock_guard<std::mutex> l(z.lock);
+    _zone_mark(z, b, n, used, &changed);
+    block += n;
+    len -= n;
+  }
+  return changed;
+}
+
+int BitMapAllocator::reserve(uint64_t need)
+{
+  std::lock_guard<std::mutex> l(lock);
+  dout(10) << __func__ << " need " << need << " num_free " << num_free
+	   << " num_reserved " << num_reserved << dendl;
+  if ((int64_t)need > num_free - num_reserved)
+    return -ENOSPC;
+  num_reserved += need;
+  return 0;
+}
+
+void BitMapAllocator::unreserve(uint64_t unused)
+{
+  std::lock_guard<std::mutex> l(lock);
+  dout(10) << __func__ << " unused " << unused << " num_free " << num_free
+	   << " num_reserved " << num_reserved << dendl;
+  assert(num_reserved >= (int64_t)unused);
+  num_reserved -= unused;
+}
+
+int BitMapAllocator::allocate(
+  uint64_t want_size, uint64_t alloc_unit, int64_t hint,
+  uint64_t *offset, uint32_t *length)
+{
+  dout(10) << __func__ << " want_size " << want_size
+	   << " alloc_unit " << alloc_unit
+	   << " hint " << hint
+	   << dendl;
+  uint64_t unit = MAX(1, alloc_unit / block_size);
+  if (unit > blocks_per_zone) {
+    derr << __func__ << " alloc_unit " << alloc_unit << " exceeds zone size "
+	 << blocks_per_zone * block_size << dendl;
+    return -EINVAL;
+  }
+  uint64_t want = ROUND_UP_TO(MAX(alloc_unit, want_size), block_size) /
+    block_size;
+  want = ROUND_UP_TO(want, unit);
+
+  // an extent never spans zones, and must fit in *length
+  uint64_t max = MIN(blocks_per_zone, (uint64_t)UINT32_MAX / block_size);
+  max -= max % unit;
+  if (want > max)
+    want = max;
+  if (g_conf->bluestore_debug_small_allocations) {
+    uint64_t small =
+      unit * (rand() % g_conf->bluestore_debug_small_allocations);
+    if (small && want > small) {
+      dout(10) << __func__ << " shortening allocation of " << want
+	       << " blocks -> " << small << " due to debug_small_allocations"
+	       << dendl;
+      want = small;
+    }
+  }
+
+  if (!hint)
+    hint = last_alloc;
+  uint64_t start_block = (uint64_t)hint / block_size;
+  if (start_block >= num_blocks)
+    start_block = 0;
+  uint64_t first_zone = start_block / blocks_per_zone;
+  uint64_t first_start = start_block % blocks_per_zone;
+
+  // pass 0: contiguous, skipping zones another thread is working in
+  // pass 1: contiguous, waiting for busy zones
+  // pass 2: take the longest aligned run we can find
+  uint64_t block = 0, len = 0;
+  bool found = false;
+  for (int pass = 0; pass < 3 && !found; ++pass) {
+    bool partial = pass == 2;
+    uint64_t need = partial ? unit : want;
+    for (uint64_t i = 0; i <= num_zones; ++i) {
+      uint64_t zi = (first_zone + i) % num_zones;
+      uint64_t start = i == 0 ? first_start : 0;
+      if (i == num_zones && first_start == 0)
+	break;  // we already scanned the first zone from the beginning
+      Zone& z = zones[zi];
+      if (z.num_free < need || z.max_run < need)
+	continue;
+      std::unique_lock<std::mutex> l(z.lock, std::defer_lock);
+      if (pass == 0) {
+	if (!l.try_lock())
+	  continue;
+      } else {
+	l.lock();
+      }
+      if (_zone_allocate(z, zi, start, want, unit, partial, &block, &len)) {
+	found = true;
+	break;
+      }
+    }
+  }
+  if (!found) {
+    assert(0 == "caller didn't reserve?");
+    return -ENOSPC;
+  }
+
+  *offset = block * block_size;
+  *length = len * block_size;
+  dout(30) << __func__ << " got " << *offset << "~" << *length
+	   << " from zone " << block / blocks_per_zone << dendl;
+
+  num_free -= *length;
+  num_reserved -= *length;
+  assert(num_free >= 0);
+  assert(num_reserved >= 0);
+  last_alloc = *offset + *length;
+  return 0;
+}
+
+int BitMapAllocator::release(
+  uint64_t offset, uint64_t length)
+{
+  std::lock_guard<std::mutex> l(lock);
+  dout(10) << __func__ << " " << offset << "~" << length << dendl;
+  uncommitted.insert(offset, length);
+  num_uncommitted += length;
+  return 0;
+}
+
+uint64_t BitMapAllocator::get_free()
+{
+  return num_free;
+}
+
+void BitMapAllocator::dump(ostream& out)
+{
+  for (uint64_t zi = 0; zi < num_zones; ++zi) {
+    Zone& z = zones[zi];
+    std::lock_guard<std::mutex> l(z.lock);
+    if (z.num_free == 0)
+      continue;
+    dout(30) << __func__ << " zone " << zi << ": " << z.num_free
+	     << " free blocks, max run <= " << z.max_run << dendl;
+  }
+  std::lock_guard<std::mutex> l(lock);
+  dout(30) << __func__ << " committing: "
+	   << committing.num_intervals() << " extents" << dendl;
+  for (auto p = committing.begin();
+       p != committing.end();
+       ++p) {
+    dout(30) << __func__ << "  " << p.get_start() << "~" << p.get_len() << dendl;
+  }
+  dout(30) << __func__ << " uncommitted: "
+	   << uncommitted.num_intervals() << " extents" << dendl;
+  for (auto p = uncommitted.begin();
+       p != uncommitted.end();
+       ++p) {
+    dout(30) << __func__ << "  " << p.get_start() << "~" << p.get_len() << dendl;
+  }
+}
+
+void BitMapAllocator::init_add_free(uint64_t offset, uint64_t length)
+{
+  dout(10) << __func__ << " " << offset << "~" << length << dendl;
+  uint64_t start = ROUND_UP_TO(offset, block_size) / block_size;
+  uint64_t end = MIN((offset + length) / block_size, num_blocks);
+  if (end <= start)
+    return;
+  uint64_t changed = _mark(start, end - start, false);
+  num_free += changed * block_size;
+}
+
+void BitMapAllocator::init_rm_free(uint64_t offset, uint64_t length)
+{
+  dout(10) << __func__ << " " << offset << "~" << length << dendl;
+  uint64_t start = offset / block_size;
+  uint64_t end = MIN(ROUND_UP_TO(offset + length, block_size) / block_size,
+		     num_blocks);
+  if (end <= start)
+    return;
+  uint64_t changed = _mark(start, end - start, true);
+  num_free -= changed * block_size;
+  assert(num_free >= 0);
+}
+
+void BitMapAllocator::shutdown()
+{
+  dout(1) << __func__ << dendl;
+}
+
+void BitMapAllocator::commit_start()
+{
+  std::lock_guard<std::mutex> l(lock);
+  dout(10) << __func__ << " releasing " << num_uncommitted
+	   << " in extents " << uncommitted.num_intervals() << dendl;
+  assert(committing.empty());
+  committing.swap(uncommitted);
+  num_committing = num_uncommitted;
+  num_uncommitted = 0;
+}
+
+void BitMapAllocator::commit_finish()
+{
+  std::lock_guard<std::mutex> l(lock);
+  dout(10) << __func__ << " released " << num_committing
+	   << " in extents " << committing.num_intervals() << dendl;
+  uint64_t changed = 0;
+  for (auto p = committing.begin();
+       p != committing.end();
+       ++p) {
+    // extents handed back by bluefs need not be block aligned; only
+    // whole blocks become allocatable.
+    uint64_t start = ROUND_UP_TO(p.get_start(), block_size) / block_size;
+    uint64_t end = (p.get_start() + p.get_len()) / block_size;
+    if (end > start)
+      changed += _mark(start, end - start, false);
+  }
+  committing.clear();
+  num_free += changed * block_size;
+  num_committing = 0;
+}
@@ -0,0 +1,99 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_OS_BLUESTORE_BITMAPALLOCATOR_H
+#define CEPH_OS_BLUESTORE_BITMAPALLOCATOR_H
+
+#include <atomic>
+#include <mutex>
+
+#include "Allocator.h"
+#include "include/btree_interval_set.h"
+
+/**
+ * BitMapAllocator
+ *
+ * The device is carved into blocks of block_size bytes, and each block
+ * is tracked by a single bit (set == in use).  Blocks are grouped into
+ * zones that start on a cache line boundary and carry their own lock,
+ * so allocations that land in different zones do not contend.
+ *
+ * The bitmap is a three level hierarchy:
+ *
+ *  - a per-zone count of free blocks, read without the zone lock to
+ *    skip zones that cannot satisfy a request,
+ *  - a per-zone summary word with one bit per bitmap word that still
+ *    has at least one free block, and
+ *  - the bitmap words themselves.
+ *
+ * Memory use is fixed at mount time (one bit per block plus a small
+ * per-zone header) and does not grow with fragmentation.
+ */
+class BitMapAllocator : public Allocator {
+  static const unsigned BITS_PER_WORD = 64;
+  static const unsigned WORDS_PER_CACHE_LINE = 8;
+
+  struct Zone {
+    std::mutex lock;
+    uint64_t *words = nullptr;            ///< bitmap; bit set => used
+    uint64_t nonfull = 0;                 ///< words with >= 1 free bit
+    std::atomic<uint64_t> num_free = {0}; ///< free blocks in this zone
+    std::atomic<uint64_t> max_run = {0};  ///< upper bound on longest free run
+  };
+
+  uint64_t block_size;
+  uint64_t num_blocks;
+  uint64_t blocks_per_zone;
+  uint64_t words_per_zone;
+  uint64_t num_zones;
+
+  uint64_t *bitmap;         ///< words for all zones, cache line aligned
+  std::vector<Zone> zones;
+
+  std::atomic<int64_t> num_free;   ///< total bytes in freelist
+  std::atomic<int64_t> num_reserved; ///< reserved bytes
+  std::atomic<uint64_t> last_alloc;
+
+  std::mutex lock;  ///< protects reservations and release lists
+  int64_t num_uncommitted;
+  int64_t num_committing;
+  btree_interval_set<uint64_t> uncommitted; ///< released but not yet usable
+  btree_interval_set<uint64_t> committing;  ///< released but not yet usable
+
+  uint64_t _zone_next_free(Zone& z, uint64_t b);
+  uint64_t _zone_free_run(Zone& z, uint64_t b, uint64_t max);
+  void _zone_mark(Zone& z, uint64_t b, uint64_t len, bool used,
+		  uint64_t *changed);
+  bool _zone_allocate(Zone& z, uint64_t zone_index, uint64_t start,
+		      uint64_t want, uint64_t unit, bool partial,
+		      uint64_t *block, uint64_t *len);
+  uint64_t _mark(uint64_t block, uint64_t len, bool used);
+
+public:
+  BitMapAllocator(int64_t device_size, uint64_t block_size);
+  ~BitMapAllocator();
+
+  int reserve(uint64_t need);
+  void unreserve(uint64_t unused);
+
+  int allocate(
+    uint64_t want_size, uint64_t alloc_unit, int64_t hint,
+    uint64_t *offset, uint32_t *length);
+
+  int release(
+    uint64_t offset, uint64_t length);
+
+  void commit_start();
+  void commit_finish();
+
+  uint64_t get_free();
+
+  void dump(std::ostream& out);
+
+  void init_add_free(uint64_t offset, uint64_t length);
+  void init_rm_free(uint64_t offset, uint64_t length);
+
+  void shutdown();
+};
+
+#endif
@@ -0,0 +1,414 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "BitmapFreelistManager.h"
+#include "kv/KeyValueDB.h"
+#include "kv.h"
+
+#include "common/debug.h"
+
+#define dout_subsys ceph_subsys_bluestore
+#undef dout_prefix
+#define dout_prefix *_dout << "freelist "
+
+struct XorMergeOperator : public KeyValueDB::MergeOperator {
+  void merge_nonexistent(
+    const char *rdata, size_t rlen, std::string *new_value) override {
+    *new_value = std::string(rdata, rlen);
+  }
+  void merge(
+    const char *ldata, size_t llen,
+    const char *rdata, size_t rlen,
+    std::string *new_value) override {
+    assert(llen == rlen);
+    *new_value = std::string(ldata, llen);
+    for (size_t i = 0; i < rlen; ++i) {
+      (*new_value)[i] ^= rdata[i];
+    }
+  }
+  string name() const override {
+    return "bitwise_xor";
+  }
+};
+
+int BitmapFreelistManager::setup_merge_operator(KeyValueDB *db, string prefix)
+{
+  std::shared_ptr<XorMergeOperator> merge_op(new XorMergeOperator);
+  return db->set_merge_operator(prefix, merge_op);
+}
+
+BitmapFreelistManager::BitmapFreelistManager(KeyValueDB *db,
+					     string meta_prefix,
+					     string bitmap_prefix)
+  : kvdb(db),
+    meta_prefix(meta_prefix),
+    bitmap_prefix(bitmap_prefix),
+    size(0),
+    bytes_per_block(0),
+    blocks_per_key(0),
+    bytes_per_key(0),
+    block_mask(0),
+    key_mask(0),
+    total_free(0),
+    enumerate_offset(0),
+    enumerate_bl_pos(0)
+{
+}
+
+int BitmapFreelistManager::create(uint64_t new_size, uint64_t block_size,
+				  KeyValueDB::Transaction txn)
+{
+  bytes_per_block = block_size;
+  assert((bytes_per_block & (bytes_per_block - 1)) == 0);
+  size = new_size;
+  blocks_per_key = g_conf->bluestore_freelist_blocks_per_key;
+  if (blocks_per_key < 8 || (blocks_per_key & (blocks_per_key - 1))) {
+    derr << __func__ << " bluestore_freelist_blocks_per_key "
+	 << blocks_per_key << " must be a power of 2 >= 8" << dendl;
+    return -EINVAL;
+  }
+
+  _init_misc();
+
+  // no keys means nothing is free; mkfs releases the usable space.
+  dout(1) << __func__ << " size 0x" << std::hex << size
+	  << " bytes_per_block 0x" << bytes_per_block
+	  << " blocks_per_key 0x" << blocks_per_key << std::dec << dendl;
+  {
+    bufferlist bl;
+    ::encode(bytes_per_block, bl);
+    txn->set(meta_prefix, "bytes_per_block", bl);
+  }
+  {
+    bufferlist bl;
+    ::encode(blocks_per_key, bl);
+    txn->set(meta_prefix, "blocks_per_key", bl);
+  }
+  {
+    bufferlist bl;
+    ::encode(size, bl);
+    txn->set(meta_prefix, "size", bl);
+  }
+  return 0;
+}
+
+int BitmapFreelistManager::init()
+{
+  dout(1) << __func__ << dendl;
+
+  KeyValueDB::Iterator it = kvdb->get_iterator(meta_prefix);
+  it->lower_bound(string());
+
+  // load meta
+  while (it->valid()) {
+    string k = it->key();
+    if (k == "bytes_per_block") {
+      bufferlist bl = it->value();
+      bufferlist::iterator p = bl.begin();
+      ::decode(bytes_per_block, p);
+      dout(10) << __func__ << " bytes_per_block 0x" << std::hex
+	       << bytes_per_block << std::dec << dendl;
+    } else if (k == "blocks_per_key") {
+      bufferlist bl = it->value();
+      bufferlist::iterator p = bl.begin();
+      ::decode(blocks_per_key, p);
+      dout(10) << __func__ << " blocks_per_key 0x" << std::hex
+	       << blocks_per_key << std::dec << dendl;
+    } else if (k == "size") {
+      bufferlist bl = it->value();
+      bufferlist::iterator p = bl.begin();
+      ::decode(size, p);
+      dout(10) << __func__ << " size 0x" << std::hex << size << std::dec
+	       << dendl;
+    } else {
+      derr << __func__ << " unrecognized meta " << k << dendl;
+      return -EIO;
+    }
+    it->next();
+  }
+  if (!bytes_per_block || !blocks_per_key || !size) {
+    derr << __func__ << " missing freelist meta" << dendl;
+    return -EIO;
+  }
+
+  dout(10) << __func__ << std::hex
+	   << " size 0x" << size
+	   << " bytes_per_block 0x" << bytes_per_block
+	   << " blocks_per_key 0x" << blocks_per_key
+	   << std::dec << dendl;
+  _init_misc();
+
+  // a single pass over the bitmap to count free space
+  uint64_t offset, length;
+  enumerate_reset();
+  while (enumerate_next(&offset, &length)) {
+    total_free += length;
+  }
+  enumerate_reset();
+  dout(10) << __func__ << " total_free 0x" << std::hex << total_free
+	   << std::dec << dendl;
+  return 0;
+}
+
+void BitmapFreelistManager::_init_misc()
+{
+  bufferptr z(blocks_per_key >> 3);
+  memset(z.c_str(), 0xff, z.length());
+  all_set_bl.clear();
+  all_set_bl.append(z);
+
+  block_mask = ~(bytes_per_block - 1);
+
+  bytes_per_key = bytes_per_block * blocks_per_key;
+  key_mask = ~(bytes_per_key - 1);
+  dout(10) << __func__ << std::hex << " bytes_per_key 0x" << bytes_per_key
+	   << ", key_mask 0x" << key_mask << std::dec
+	   << dendl;
+}
+
+void BitmapFreelistManager::shutdown()
+{
+  dout(1) << __func__ << dendl;
+}
+
+void BitmapFreelistManager::enumerate_reset()
+{
+  std::lock_guard<std::mutex> l(lock);
+  enumerate_p.reset();
+  enumerate_bl.clear();
+  enumerate_offset = 0;
+  enumerate_bl_pos = 0;
+}
+
+bool BitmapFreelistManager::_enumerate_load()
+{
+  enumerate_bl.clear();
+  enumerate_bl_pos = 0;
+  if (!enumerate_p->valid())
+    return false;
+  string k = enumerate_p->key();
+  _key_decode_u64(k.c_str(), &enumerate_offset);
+  enumerate_bl = enumerate_p->value();
+  assert(enumerate_bl.length() == blocks_per_key >> 3);
+  enumerate_bl.rebuild();
+  return true;
+}
+
+bool BitmapFreelistManager::_enumerate_find(bool set)
+{
+  const unsigned char *p = (const unsigned char *)enumerate_bl.c_str();
+  uint64_t pos = enumerate_bl_pos;
+  while (pos < blocks_per_key) {
+    unsigned char byte = set ? p[pos >> 3] : ~p[pos >> 3];
+    if ((pos & 7) == 0 && byte == 0) {
+      pos += 8;
+      continue;
+    }
+    if (byte & (1 << (pos & 7))) {
+      enumerate_bl_pos = pos;
+      return true;
+    }
+    ++pos;
+  }
+  enumerate_bl_pos = blocks_per_key;
+  return false;
+}
+
+bool BitmapFreelistManager::enumerate_next(uint64_t *offset, uint64_t *length)
+{
+  std::lock_guard<std::mutex> l(lock);
+
+  if (!enumerate_p) {
+    enumerate_p = kvdb->get_iterator(bitmap_prefix);
+    enumerate_p->lower_bound(string());
+    _enumerate_load();
+  }
+  if (enumerate_bl.length() == 0) {
+    dout(30) << __func__ << " end" << dendl;
+    return false;
+  }
+
+  // find the start of the next free run
+  while (!_enumerate_find(true)) {
+    enumerate_p->next();
+    if (!_enumerate_load()) {
+      dout(30) << __func__ << " end" << dendl;
+      return false;
+    }
+  }
+  uint64_t start = enumerate_offset + enumerate_bl_pos * bytes_per_block;
+  if (start >= size) {
+    enumerate_bl.clear();
+    dout(30) << __func__ << " end" << dendl;
+    return false;
+  }
+
+  // find the end; a run may continue into the next key
+  uint64_t end;
+  while (true) {
+    if (_enumerate_find(false)) {
+      end = enumerate_offset + enumerate_bl_pos * bytes_per_block;
+      break;
+    }
+    end = enumerate_offset + bytes_per_key;
+    enumerate_p->next();
+    if (!_enumerate_load() || enumerate_offset != end)
+      break;
+  }
+  if (end > size)
+    end = size;
+
+  *offset = start;
+  *length = end - start;
+  dout(30) << __func__ << std::hex << " 0x" << *offset << "~" << *length
+	   << std::dec << dendl;
+  return true;
+}
+
+void BitmapFreelistManager::dump()
+{
+  uint64_t offset, length;
+  enumerate_reset();
+  while (enumerate_next(&offset, &length)) {
+    dout(30) << __func__ << "  0x" << std::hex << offset << "~" << length
+	     << std::dec << dendl;
+  }
+  enumerate_reset();
+}
+
+void BitmapFreelistManager::_verify_range(uint64_t offset, uint64_t length,
+					  bool expect_set)
+{
+  unsigned errors = 0;
+  uint64_t end = offset + length;
+  for (uint64_t k = offset & key_mask; k < end; k += bytes_per_key) {
+    string key;
+    _key_encode_u64(k, &key);
+    bufferlist bl;
+    kvdb->get(bitmap_prefix, key, &bl);
+    const char *p = bl.length() ? bl.c_str() : NULL;
+    uint64_t first = (MAX(offset, k) - k) / bytes_per_block;
+    uint64_t last = (MIN(end, k + bytes_per_key) - k + bytes_per_block - 1) /
+      bytes_per_block;
+    for (uint64_t i = first; i < last; ++i) {
+      bool is_set = p && (p[i >> 3] & (1 << (i & 7)));
+      if (is_set != expect_set) {
+	derr << __func__ << " key 0x" << std::hex << k << " bit 0x" << i
+	     << " offset 0x" << (k + i * bytes_per_block) << std::dec
+	     << " is " << (is_set ? "free" : "allocated") << dendl;
+	++errors;
+      }
+    }
+  }
+  if (errors) {
+    derr << __func__ << " saw " << errors << " errors in 0x" << std::hex
+	 << offset << "~" << length << std::dec << dendl;
+    assert(0 == "bitmap freelist errors");
+  }
+}
+
+bool BitmapFreelistManager::is_any_free(KeyValueDB::WholeSpaceIterator it,
+					uint64_t offset, uint64_t length)
+{
+  uint64_t end = offset + length;
+  for (uint64_t k = offset & key_mask; k < end; k += bytes_per_key) {
+    string key;
+    _key_encode_u64(k, &key);
+    it->lower_bound(bitmap_prefix, key);
+    if (!it->valid() || !it->raw_key_is_prefixed(bitmap_prefix) ||
+	it->key() != key)
+      continue;  // missing key: all allocated
+    bufferlist bl = it->value();
+    const char *p = bl.c_str();
+    uint64_t first = (MAX(offset, k) - k) / bytes_per_block;
+    uint64_t last = (MIN(end, k + bytes_per_key) - k + bytes_per_block - 1) /
+      bytes_per_block;
+    for (uint64_t i = first; i < last; ++i) {
+      if (p[i >> 3] & (1 << (i & 7)))
+	return true;
+    }
+  }
+  return false;
+}
+
+int BitmapFreelistManager::allocate(
+  uint64_t offset, uint64_t length,
+  KeyValueDB::Transaction txn)
+{
+  dout(10) << __func__ << " 0x" << std::hex << offset << "~" << length
+	   << std::dec << dendl;
+  if (g_conf->bluestore_debug_freelist)
+    _verify_range(offset, length, true);
+  _xor(offset, length, txn);
+  std::lock_guard<std::mutex> l(lock);
+  assert(total_free >= length);
+  total_free -= length;
+  return 0;
+}
+
+int BitmapFreelistManager::release(
+  uint64_t offset, uint64_t length,
+  KeyValueDB::Transaction txn)
+{
+  dout(10) << __func__ << " 0x" << std::hex << offset << "~" << length
+	   << std::dec << dendl;
+  if (g_conf->bluestore_debug_freelist)
+    _verify_range(offset, length, false);
+  _xor(offset, length, txn);
+  std::lock_guard<std::mutex> l(lock);
+  total_free += length;
+  return 0;
+}
+
+void BitmapFreelistManager::_xor(
+  uint64_t offset, uint64_t length,
+  KeyValueDB::Transaction txn)
+{
+  // the extent must start on a block boundary; it may end mid-block
+  // only at the end of the device.
+  assert((offset & block_mask) == offset);
+  assert(offset + length <= ROUND_UP_TO(size, bytes_per_block));
+  if (!length)
+    return;
+
+  uint64_t end = offset + length;
+  uint64_t first_key = offset & key_mask;
+  uint64_t last_key = (end - 1) & key_mask;
+  dout(20) << __func__ << " first_key 0x" << std::hex << first_key
+	   << " last_key 0x" << last_key << std::dec << dendl;
+
+  for (uint64_t k = first_key; k <= last_key; k += bytes_per_key) {
+    string key;
+    _key_encode_u64(k, &key);
+    uint64_t s = MAX(offset, k);
+    uint64_t e = MIN(end, k + bytes_per_key);
+    if (s == k && e == k + bytes_per_key) {
+      txn->merge(bitmap_prefix, key, all_set_bl);
+      continue;
+    }
+    uint64_t b = (s - k) / bytes_per_block;
+    uint64_t eb = (e - k + bytes_per_block - 1) / bytes_per_block;
+    bufferptr p(blocks_per_key >> 3);
+    p.zero();
+    char *d = p.c_str();
+    while (b < eb && (b & 7)) {
+      d[b >> 3] |= 1 << (b & 7);
+      ++b;
+    }
+    uint64_t n = (eb - b) >> 3;
+    if (n) {
+      memset(d + (b >> 3), 0xff, n);
+      b += n << 3;
+    }
+    while (b < eb) {
+      d[b >> 3] |= 1 << (b & 7);
+      ++b;
+    }
+    bufferlist bl;
+    bl.append(p);
+    dout(30) << __func__ << " 0x" << std::hex << k << std::dec << ": ";
+    bl.hexdump(*_dout);
+    *_dout << dendl;
+    txn->merge(bitmap_prefix, key, bl);
+  }
+}
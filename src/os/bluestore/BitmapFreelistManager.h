@@ -0,0 +1,90 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_OS_BLUESTORE_BITMAPFREELISTMANAGER_H
+#define CEPH_OS_BLUESTORE_BITMAPFREELISTMANAGER_H
+
+#include <string>
+#include <mutex>
+#include <ostream>
+#include "FreelistManager.h"
+
+/**
+ * BitmapFreelistManager
+ *
+ * The device is carved into blocks of bytes_per_block bytes, and each
+ * block is tracked by a single bit (set == free).  Bits are grouped
+ * blocks_per_key at a time into kv values keyed by the (big-endian)
+ * offset of the first block.  A missing key means all of its blocks
+ * are allocated.
+ *
+ * allocate and release never read the bitmap: they queue an xor merge
+ * of the affected bits, so the cost of a freelist update does not
+ * depend on fragmentation, and loading the freelist at mount is a
+ * sequential scan of size / bytes_per_block bits.
+ */
+class BitmapFreelistManager : public FreelistManager {
+  KeyValueDB *kvdb;
+  std::string meta_prefix, bitmap_prefix;
+
+  uint64_t size;            ///< size of device (bytes)
+  uint64_t bytes_per_block; ///< bytes per block (bdev_block_size)
+  uint64_t blocks_per_key;  ///< blocks (bits) per key/value pair
+  uint64_t bytes_per_key;   ///< bytes per key/value pair
+  uint64_t block_mask;      ///< mask to convert byte offset to block offset
+  uint64_t key_mask;        ///< mask to convert offset to key offset
+
+  bufferlist all_set_bl;
+
+  std::mutex lock;
+  uint64_t total_free;
+
+  KeyValueDB::Iterator enumerate_p;
+  uint64_t enumerate_offset; ///< logical offset of enumerate_bl; position
+  bufferlist enumerate_bl;   ///< current key/value being enumerated
+  uint64_t enumerate_bl_pos; ///< bit position within enumerate_bl
+
+  void _init_misc();
+
+  bool _enumerate_load();
+  bool _enumerate_find(bool set);
+
+  void _verify_range(uint64_t offset, uint64_t length, bool expect_set);
+  void _xor(
+    uint64_t offset, uint64_t length,
+    KeyValueDB::Transaction txn);
+
+public:
+  BitmapFreelistManager(KeyValueDB *db, std::string meta_prefix,
+			std::string bitmap_prefix);
+
+  static int setup_merge_operator(KeyValueDB *db, std::string prefix);
+
+  int create(uint64_t size, uint64_t block_size,
+	     KeyValueDB::Transaction txn) override;
+
+  int init() override;
+  void shutdown() override;
+
+  void dump() override;
+
+  uint64_t get_total_free() override {
+    std::lock_guard<std::mutex> l(lock);
+    return total_free;
+  }
+
+  void enumerate_reset() override;
+  bool enumerate_next(uint64_t *offset, uint64_t *length) override;
+
+  bool is_any_free(KeyValueDB::WholeSpaceIterator it,
+		   uint64_t offset, uint64_t length) override;
+
+  int allocate(
+    uint64_t offset, uint64_t length,
+    KeyValueDB::Transaction txn) override;
+  int release(
+    uint64_t offset, uint64_t length,
+    KeyValueDB::Transaction txn) override;
+};
+
+#endif
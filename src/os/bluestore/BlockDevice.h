@@ -96,6 +96,10 @@ public:
   virtual int aio_zero(uint64_t off, uint64_t len, IOContext *ioc) = 0;
   virtual int flush() = 0;
 
+  /// the calling thread is long-lived io thread index (an osd op shard
+  /// worker); give it a device queue of its own if we have them
+  virtual void bind_op_thread(unsigned index) {}
+
   void queue_reap_ioc(IOContext *ioc);
   void reap_ioc();
 
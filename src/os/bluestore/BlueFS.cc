@@ -3,9 +3,14 @@
 
 #include "BlueFS.h"
 
+#include <algorithm>
+#include <thread>
+
 #include "common/debug.h"
 #include "common/errno.h"
 #include "common/perf_counters.h"
+#include "common/admin_socket.h"
+#include "common/Formatter.h"
 #include "BlockDevice.h"
 #include "Allocator.h"
 #include "StupidAllocator.h"
@@ -23,7 +28,10 @@ BlueFS::BlueFS()
     bdev(MAX_BDEV),
     ioc(MAX_BDEV),
     block_all(MAX_BDEV),
-    block_total(MAX_BDEV, 0)
+    block_total(MAX_BDEV, 0),
+    tier_thread(this),
+    tier_stop(false),
+    asok_hook(NULL)
 {
 }
 
@@ -56,6 +64,16 @@ void BlueFS::_init_logger()
   b.add_u64(l_bluefs_log_bytes, "log_bytes", "Size of the metadata log");
   b.add_u64_counter(l_bluefs_log_compactions, "log_compactions", "Compactions of the metadata log");
   b.add_u64_counter(l_bluefs_logged_bytes, "logged_bytes", "Bytes written to the metadata log");
+  b.add_u64_counter(l_bluefs_spillover_bytes, "spillover_bytes",
+		    "Bytes allocated off of the preferred device");
+  b.add_u64_counter(l_bluefs_demote_files, "demote_files",
+		    "Cold files moved from the db device to the slow device");
+  b.add_u64_counter(l_bluefs_demote_bytes, "demote_bytes",
+		    "Bytes moved from the db device to the slow device");
+  b.add_u64_counter(l_bluefs_promote_files, "promote_files",
+		    "Hot files moved from the slow device to the db device");
+  b.add_u64_counter(l_bluefs_promote_bytes, "promote_bytes",
+		    "Bytes moved from the slow device to the db device");
   logger = b.create_perf_counters();
   g_ceph_context->get_perfcounters_collection()->add(logger);
 }
@@ -207,6 +225,90 @@ void BlueFS::get_usage(vector<pair<uint64_t,uint64_t>> *usage)
   }
 }
 
+void BlueFS::dump_stats(Formatter *f)
+{
+  static const char *names[MAX_BDEV] = { "wal", "db", "slow" };
+  std::lock_guard<std::mutex> l(lock);
+  vector<uint64_t> num_files(MAX_BDEV, 0), file_bytes(MAX_BDEV, 0);
+  for (auto& p : file_map) {
+    vector<bool> on(MAX_BDEV, false);
+    for (auto& e : p.second->fnode.extents) {
+      on[e.bdev] = true;
+      file_bytes[e.bdev] += e.length;
+    }
+    for (unsigned id = 0; id < MAX_BDEV; ++id) {
+      if (on[id])
+	++num_files[id];
+    }
+  }
+  f->open_array_section("devices");
+  for (unsigned id = 0; id < MAX_BDEV; ++id) {
+    if (!bdev[id])
+      continue;
+    f->open_object_section("device");
+    f->dump_unsigned("id", id);
+    f->dump_string("name", names[id]);
+    f->dump_unsigned("total_bytes", block_total[id]);
+    f->dump_unsigned("free_bytes", alloc[id]->get_free());
+    f->dump_unsigned("file_bytes", file_bytes[id]);
+    f->dump_unsigned("num_files", num_files[id]);
+    f->close_section();
+  }
+  f->close_section();
+  f->open_object_section("tiering");
+  f->dump_bool("enabled", tier_thread.is_started());
+  f->dump_unsigned("spillover_bytes", logger->get(l_bluefs_spillover_bytes));
+  f->dump_unsigned("demote_files", logger->get(l_bluefs_demote_files));
+  f->dump_unsigned("demote_bytes", logger->get(l_bluefs_demote_bytes));
+  f->dump_unsigned("promote_files", logger->get(l_bluefs_promote_files));
+  f->dump_unsigned("promote_bytes", logger->get(l_bluefs_promote_bytes));
+  f->close_section();
+}
+
+class BlueFS::SocketHook : public AdminSocketHook {
+  BlueFS *fs;
+public:
+  explicit SocketHook(BlueFS *f) : fs(f) {}
+  bool call(std::string command, cmdmap_t& cmdmap, std::string format,
+	    bufferlist& out) {
+    Formatter *f = Formatter::create(format, "json-pretty", "json-pretty");
+    f->open_object_section("bluefs");
+    fs->dump_stats(f);
+    f->close_section();
+    f->flush(out);
+    delete f;
+    return true;
+  }
+};
+
+void BlueFS::_register_admin_socket()
+{
+  asok_hook = new SocketHook(this);
+  AdminSocket *admin_socket = g_ceph_context->get_admin_socket();
+  int r = admin_socket->register_command("bluefs stats", "bluefs stats",
+					 asok_hook,
+					 "show bluefs device usage and tiering");
+  // another instance in this process may already own the command
+  if (r < 0 && r != -EEXIST) {
+    derr << __func__ << " error registering admin socket command: "
+	 << cpp_strerror(r) << dendl;
+  }
+  if (r < 0) {
+    delete asok_hook;
+    asok_hook = NULL;
+  }
+}
+
+void BlueFS::_unregister_admin_socket()
+{
+  if (asok_hook) {
+    AdminSocket *admin_socket = g_ceph_context->get_admin_socket();
+    admin_socket->unregister_command("bluefs stats");
+    delete asok_hook;
+    asok_hook = NULL;
+  }
+}
+
 int BlueFS::get_block_extents(unsigned id, interval_set<uint64_t> *extents)
 {
   std::lock_guard<std::mutex> l(lock);
@@ -337,6 +439,8 @@ int BlueFS::mount()
   dout(10) << __func__ << " log write pos set to " << log_writer->pos << dendl;
 
   _init_logger();
+  _register_admin_socket();
+  _tier_start();
   return 0;
 
  out:
@@ -348,6 +452,8 @@ void BlueFS::umount()
 {
   dout(1) << __func__ << dendl;
 
+  _tier_stop();
+  _unregister_admin_socket();
   sync_metadata();
 
   _close_writer(log_writer);
@@ -712,7 +818,7 @@ int BlueFS::_read_random(
   dout(10) << __func__ << " h " << h << " " << off << "~" << len
 	   << " from " << h->file->fnode << dendl;
 
-  ++h->file->num_reading;
+  _start_reading(h->file.get());
 
   if (!h->ignore_eof &&
       off + len > h->file->fnode.size) {
@@ -744,10 +850,25 @@ int BlueFS::_read_random(
   }
 
   dout(20) << __func__ << " got " << ret << dendl;
+  h->file->heat += ret;
   --h->file->num_reading;
   return ret;
 }
 
+void BlueFS::_start_reading(File *f)
+{
+  // pairs with the swapping_extents/num_reading handshake in
+  // _migrate_file: either the migrator sees us reading and waits, or
+  // we see it swapping and back off until it is done.
+  ++f->num_reading;
+  while (f->swapping_extents.load()) {
+    --f->num_reading;
+    while (f->swapping_extents.load())
+      std::this_thread::yield();
+    ++f->num_reading;
+  }
+}
+
 int BlueFS::_read(
   FileReader *h,         ///< [in] read from here
   FileReaderBuffer *buf, ///< [in] reader state
@@ -759,7 +880,7 @@ int BlueFS::_read(
   dout(10) << __func__ << " h " << h << " " << off << "~" << len
 	   << " from " << h->file->fnode << dendl;
 
-  ++h->file->num_reading;
+  _start_reading(h->file.get());
 
   if (!h->ignore_eof &&
       off + len > h->file->fnode.size) {
@@ -826,6 +947,7 @@ int BlueFS::_read(
 
   dout(20) << __func__ << " got " << ret << dendl;
   assert(!outbl || (int)outbl->length() == ret);
+  h->file->heat += ret;
   --h->file->num_reading;
   return ret;
 }
@@ -1228,25 +1350,49 @@ int BlueFS::_allocate(unsigned id, uint64_t len, vector<bluefs_extent_t> *ev)
   dout(10) << __func__ << " len " << len << " from " << id << dendl;
   assert(id < alloc.size());
 
+  int r = _allocate_on(id, len, ev);
+  if (r == 0)
+    return 0;
+
+  // spill over to the slower devices first, then to the faster ones
+  uint64_t want = ROUND_UP_TO(len, g_conf->bluefs_alloc_size);
+  vector<unsigned> order;
+  for (unsigned i = id + 1; i < MAX_BDEV; ++i)
+    order.push_back(i);
+  for (unsigned i = id; i > 0; --i)
+    order.push_back(i - 1);
+  for (auto i : order) {
+    if (!bdev[i])
+      continue;
+    r = _allocate_on(i, len, ev);
+    if (r == 0) {
+      dout(1) << __func__ << " spilled " << want << " from bdev " << id
+	      << " to bdev " << i << dendl;
+      if (logger)
+	logger->inc(l_bluefs_spillover_bytes, want);
+      return 0;
+    }
+  }
+  derr << __func__ << " failed to allocate " << want << " on any bdev"
+       << dendl;
+  return r;
+}
+
+int BlueFS::_allocate_on(unsigned id, uint64_t len,
+			 vector<bluefs_extent_t> *ev)
+{
   uint64_t left = ROUND_UP_TO(len, g_conf->bluefs_alloc_size);
   int r = -ENOSPC;
   if (alloc[id]) {
     r = alloc[id]->reserve(left);
   }
   if (r < 0) {
-    if (id != BDEV_SLOW) {
-      if (bdev[id])
-	derr << __func__ << " failed to allocate " << left << " on bdev " << id
-	     << ", free " << alloc[id]->get_free()
-	     << "; fallback to bdev " << id + 1 << dendl;
-      return _allocate(id + 1, len, ev);
-    }
     if (bdev[id])
       derr << __func__ << " failed to allocate " << left << " on bdev " << id
 	   << ", free " << alloc[id]->get_free() << dendl;
     else
-      derr << __func__ << " failed to allocate " << left << " on bdev " << id
-	   << ", dne" << dendl;
+      dout(20) << __func__ << " failed to allocate " << left << " on bdev "
+	       << id << ", dne" << dendl;
     return r;
   }
 
@@ -1293,6 +1439,11 @@ int BlueFS::_preallocate(FileRef f, uint64_t off, uint64_t len)
 void BlueFS::sync_metadata()
 {
   std::lock_guard<std::mutex> l(lock);
+  _sync_metadata();
+}
+
+void BlueFS::_sync_metadata()
+{
   if (log_t.empty()) {
     dout(10) << __func__ << " - no pending log events" << dendl;
     return;
@@ -1316,6 +1467,237 @@ void BlueFS::sync_metadata()
   dout(10) << __func__ << " done in " << dur << dendl;
 }
 
+void BlueFS::_tier_start()
+{
+  if (g_conf->bluefs_tier_interval <= 0 ||
+      !bdev[BDEV_DB] || !bdev[BDEV_SLOW]) {
+    dout(10) << __func__ << " tiering disabled" << dendl;
+    return;
+  }
+  tier_stop = false;
+  tier_thread.create("bluefs_tier");
+}
+
+void BlueFS::_tier_stop()
+{
+  if (!tier_thread.is_started())
+    return;
+  {
+    std::lock_guard<std::mutex> l(lock);
+    tier_stop = true;
+    tier_cond.notify_all();
+  }
+  tier_thread.join();
+  tier_stop = false;
+}
+
+void BlueFS::_tier_thread()
+{
+  std::unique_lock<std::mutex> l(lock);
+  dout(10) << __func__ << " start" << dendl;
+  while (!tier_stop) {
+    tier_cond.wait_for(
+      l, std::chrono::duration<double>(g_conf->bluefs_tier_interval));
+    if (tier_stop)
+      break;
+    // age access heat so that only recent reads keep a file hot
+    for (auto& p : file_map) {
+      p.second->heat.store(p.second->heat.load() / 2);
+    }
+    _tier_balance(l);
+  }
+  dout(10) << __func__ << " finish" << dendl;
+}
+
+bool BlueFS::_tier_movable(File *f)
+{
+  // closed, fully written files only.  the log and the rocksdb wal
+  // stay where they are.
+  return f->fnode.ino != 1 &&
+    f->fnode.size > 0 &&
+    f->fnode.prefer_bdev != BDEV_WAL &&
+    !f->deleted &&
+    !f->dirty &&
+    !f->locked &&
+    f->num_writers.load() == 0;
+}
+
+void BlueFS::_tier_balance(std::unique_lock<std::mutex>& l)
+{
+  uint64_t total = block_total[BDEV_DB];
+  if (!total)
+    return;
+  uint64_t used = total - alloc[BDEV_DB]->get_free();
+  uint64_t high = total * g_conf->bluefs_tier_high_ratio;
+  uint64_t low = total * g_conf->bluefs_tier_low_ratio;
+  int64_t budget = g_conf->bluefs_tier_max_bytes;
+  dout(20) << __func__ << " db used " << used << "/" << total
+	   << " high " << high << " low " << low << dendl;
+
+  // (heat, mtime) -> file, for files with data on the device we
+  // are moving off of
+  unsigned from = used > high ? BDEV_DB : BDEV_SLOW;
+  unsigned to = used > high ? BDEV_SLOW : BDEV_DB;
+  vector<pair<pair<uint64_t,utime_t>,FileRef> > cands;
+  for (auto& p : file_map) {
+    File *f = p.second.get();
+    if (!_tier_movable(f))
+      continue;
+    if (from == BDEV_SLOW && f->heat.load() == 0)
+      continue;
+    for (auto& e : f->fnode.extents) {
+      if (e.bdev == from) {
+	cands.push_back(make_pair(make_pair(f->heat.load(), f->fnode.mtime),
+				  p.second));
+	break;
+      }
+    }
+  }
+  if (cands.empty())
+    return;
+  // demote the coldest (then oldest) first; promote the hottest first
+  std::sort(cands.begin(), cands.end(),
+	    [](const pair<pair<uint64_t,utime_t>,FileRef>& a,
+	       const pair<pair<uint64_t,utime_t>,FileRef>& b) {
+	      return a.first < b.first;
+	    });
+  if (from == BDEV_SLOW)
+    std::reverse(cands.begin(), cands.end());
+
+  bool moved = false;
+  for (auto& c : cands) {
+    if (tier_stop || budget <= 0)
+      break;
+    FileRef f = c.second;
+    if (!_tier_movable(f.get()))
+      continue;
+    uint64_t on_db = 0;
+    for (auto& e : f->fnode.extents) {
+      if (e.bdev == BDEV_DB)
+	on_db += e.length;
+    }
+    uint64_t len = ROUND_UP_TO(ROUND_UP_TO(f->fnode.size, super.block_size),
+			       g_conf->bluefs_alloc_size);
+    if (from == BDEV_DB) {
+      if (used <= low)
+	break;
+    } else {
+      if (used - on_db + len > low)
+	continue;
+    }
+    int r = _migrate_file(l, f, to);
+    if (r < 0) {
+      dout(10) << __func__ << " failed to move " << f->fnode << " to bdev "
+	       << to << ": " << cpp_strerror(r) << dendl;
+      if (r == -ENOSPC)
+	break;
+      continue;
+    }
+    moved = true;
+    budget -= len;
+    if (from == BDEV_DB) {
+      used -= on_db;
+      logger->inc(l_bluefs_demote_files);
+      logger->inc(l_bluefs_demote_bytes, len);
+    } else {
+      used += len - on_db;
+      logger->inc(l_bluefs_promote_files);
+      logger->inc(l_bluefs_promote_bytes, len);
+    }
+  }
+  if (moved) {
+    // persist the new extents and make the old ones reusable
+    _sync_metadata();
+    _update_logger_stats();
+  }
+}
+
+int BlueFS::_copy_extents(const vector<bluefs_extent_t>& from,
+			  const vector<bluefs_extent_t>& to,
+			  uint64_t length)
+{
+  IOContext *wioc = new IOContext(NULL);
+  set<unsigned> dirty;
+  auto p = from.begin();
+  auto q = to.begin();
+  uint64_t p_off = 0, q_off = 0;
+  int r = 0;
+  while (length > 0) {
+    assert(p != from.end());
+    assert(q != to.end());
+    uint64_t l = MIN(p->length - p_off, q->length - q_off);
+    l = MIN(l, g_conf->bluefs_max_prefetch);
+    l = MIN(l, length);
+    bufferlist bl;
+    r = bdev[p->bdev]->read(p->offset + p_off, l, &bl, ioc[p->bdev], true);
+    if (r < 0)
+      break;
+    bdev[q->bdev]->aio_write(q->offset + q_off, bl, wioc, true);
+    if (wioc->has_aios()) {
+      bdev[q->bdev]->aio_submit(wioc);
+      wioc->aio_wait();
+    }
+    dirty.insert(q->bdev);
+    length -= l;
+    p_off += l;
+    q_off += l;
+    if (p_off == p->length) {
+      ++p;
+      p_off = 0;
+    }
+    if (q_off == q->length) {
+      ++q;
+      q_off = 0;
+    }
+  }
+  for (auto id : dirty) {
+    bdev[id]->flush();
+  }
+  bdev[to.front().bdev]->queue_reap_ioc(wioc);
+  return r;
+}
+
+int BlueFS::_migrate_file(std::unique_lock<std::mutex>& l, FileRef f,
+			  unsigned to)
+{
+  dout(10) << __func__ << " " << f->fnode << " to bdev " << to << dendl;
+  vector<bluefs_extent_t> old = f->fnode.extents;
+  uint64_t len = ROUND_UP_TO(f->fnode.size, super.block_size);
+  vector<bluefs_extent_t> ev;
+  int r = _allocate_on(to, len, &ev);
+  if (r < 0)
+    return r;
+
+  // the file is immutable, so copy without the lock
+  l.unlock();
+  r = _copy_extents(old, ev, len);
+  l.lock();
+
+  if (r < 0 || !_tier_movable(f.get()) || f->fnode.extents != old) {
+    dout(10) << __func__ << " " << f->fnode << " changed or failed ("
+	     << r << "), aborting" << dendl;
+    for (auto& e : ev) {
+      alloc[e.bdev]->release(e.offset, e.length);
+    }
+    return r < 0 ? r : -EAGAIN;
+  }
+
+  // wait out in-flight reads and hold off new ones while we swap
+  f->swapping_extents = true;
+  while (f->num_reading.load())
+    std::this_thread::yield();
+  f->fnode.extents.swap(ev);
+  f->fnode.prefer_bdev = to;
+  f->swapping_extents = false;
+
+  log_t.op_file_update(f->fnode);
+  for (auto& e : ev) {
+    alloc[e.bdev]->release(e.offset, e.length);
+  }
+  dout(10) << __func__ << " now " << f->fnode << dendl;
+  return 0;
+}
+
 int BlueFS::open_for_write(
   const string& dirname,
   const string& filename,
@@ -4,10 +4,12 @@
 #define CEPH_OS_BLUESTORE_BLUEFS_H
 
 #include <atomic>
+#include <condition_variable>
 #include <mutex>
 
 #include "bluefs_types.h"
 #include "common/RefCountedObj.h"
+#include "common/Thread.h"
 #include "BlockDevice.h"
 
 #include "boost/intrusive/list.hpp"
@@ -31,6 +33,11 @@ enum {
   l_bluefs_log_bytes,
   l_bluefs_log_compactions,
   l_bluefs_logged_bytes,
+  l_bluefs_spillover_bytes,
+  l_bluefs_demote_files,
+  l_bluefs_demote_bytes,
+  l_bluefs_promote_files,
+  l_bluefs_promote_bytes,
   l_bluefs_last,
 };
 
@@ -52,6 +59,11 @@ public:
     std::atomic_int num_readers, num_writers;
     std::atomic_int num_reading;
 
+    /// set while the tiering thread swaps fnode.extents; readers back off
+    std::atomic_bool swapping_extents;
+    /// bytes read, halved every bluefs_tier_interval
+    std::atomic<uint64_t> heat;
+
     File()
       : RefCountedObject(NULL, 0),
 	refs(0),
@@ -60,7 +72,9 @@ public:
 	deleted(false),
 	num_readers(0),
 	num_writers(0),
-	num_reading(0)
+	num_reading(0),
+	swapping_extents(false),
+	heat(0)
       {}
     ~File() {
       assert(num_readers.load() == 0);
@@ -206,6 +220,27 @@ private:
   vector<uint64_t> block_total;               ///< sum of block_all
   vector<Allocator*> alloc;                   ///< allocators for bdevs
 
+  /*
+   * Tiering.  Files are allocated on their preferred device and spill
+   * over to the others when it is full.  When both BDEV_DB and
+   * BDEV_SLOW are present, a background thread demotes the coldest
+   * files off of BDEV_DB once it is bluefs_tier_high_ratio full, and
+   * promotes hot files that spilled to BDEV_SLOW when there is room.
+   */
+  struct TierThread : public Thread {
+    BlueFS *fs;
+    explicit TierThread(BlueFS *f) : fs(f) {}
+    void *entry() {
+      fs->_tier_thread();
+      return NULL;
+    }
+  } tier_thread;
+  std::condition_variable tier_cond;
+  bool tier_stop;
+
+  class SocketHook;
+  SocketHook *asok_hook;
+
   void _init_logger();
   void _shutdown_logger();
   void _update_logger_stats();
@@ -218,6 +253,7 @@ private:
   FileRef _get_file(uint64_t ino);
   void _drop_link(FileRef f);
 
+  int _allocate_on(unsigned bdev, uint64_t len, vector<bluefs_extent_t> *ev);
   int _allocate(unsigned bdev, uint64_t len, vector<bluefs_extent_t> *ev);
   int _flush_range(FileWriter *h, uint64_t offset, uint64_t length);
   int _flush(FileWriter *h, bool force);
@@ -232,6 +268,22 @@ private:
   //void _aio_finish(void *priv);
 
   void _flush_bdev();
+  void _sync_metadata();
+
+  void _tier_thread();
+  void _tier_start();
+  void _tier_stop();
+  bool _tier_movable(File *f);
+  void _tier_balance(std::unique_lock<std::mutex>& l);
+  int _copy_extents(const vector<bluefs_extent_t>& from,
+		    const vector<bluefs_extent_t>& to,
+		    uint64_t length);
+  int _migrate_file(std::unique_lock<std::mutex>& l, FileRef f, unsigned to);
+
+  void _start_reading(File *f);
+
+  void _register_admin_socket();
+  void _unregister_admin_socket();
 
   int _preallocate(FileRef f, uint64_t off, uint64_t len);
   int _truncate(FileWriter *h, uint64_t off);
@@ -282,6 +334,9 @@ public:
   uint64_t get_free(unsigned id);
   void get_usage(vector<pair<uint64_t,uint64_t>> *usage); // [<free,total> ...]
 
+  /// per-device usage and tiering stats
+  void dump_stats(Formatter *f);
+
   /// get current extents that we own for given block device
   int get_block_extents(unsigned id, interval_set<uint64_t> *extents);
 
@@ -25,6 +25,8 @@
 #include "include/stringify.h"
 #include "common/errno.h"
 #include "common/safe_io.h"
+#include "common/admin_socket.h"
+#include "common/Formatter.h"
 #include "Allocator.h"
 #include "FreelistManager.h"
 #include "BlueFS.h"
@@ -39,6 +41,7 @@ const string PREFIX_OVERLAY = "V"; // u64 + offset -> data
 const string PREFIX_OMAP = "M";    // u64 + keyname -> value
 const string PREFIX_WAL = "L";     // id -> wal_transaction_t
 const string PREFIX_ALLOC = "B";   // u64 offset -> u64 length (freelist)
+const string PREFIX_ALLOC_BITMAP = "b"; // u64 offset -> bitmap (freelist)
 
 // write a label in the first block.  always use this size.  note that
 // bluefs makes a matching assumption about the location of its
@@ -455,6 +458,16 @@ void BlueStore::Enode::put()
 #undef dout_prefix
 #define dout_prefix *_dout << "bluestore.onode(" << this << ") "
 
+BlueStore::Onode::Onode(OnodeSpace *s, const ghobject_t& o, const string& k)
+  : nref(0),
+    space(s),
+    oid(o),
+    key(k),
+    exists(false),
+    bc(s->cache)
+{
+}
+
 void BlueStore::Onode::flush()
 {
   std::unique_lock<std::mutex> l(flush_lock);
@@ -464,55 +477,509 @@ void BlueStore::Onode::flush()
   dout(20) << __func__ << " done" << dendl;
 }
 
-// OnodeHashLRU
+// Cache
+
+#undef dout_prefix
+#define dout_prefix *_dout << "bluestore.cache(" << this << ") "
+
+BlueStore::Cache *BlueStore::Cache::create(string type, PerfCounters *logger)
+{
+  if (type == "lru")
+    return new LRUCache(logger);
+  if (type == "2q")
+    return new TwoQCache(logger);
+  return NULL;
+}
+
+template<class L>
+void BlueStore::Cache::_trim_onodes(L& lru, uint64_t onode_max)
+{
+  dout(20) << __func__ << " max " << onode_max << " size " << lru.size()
+	   << dendl;
+  uint64_t num = lru.size();
+  if (num <= onode_max)
+    return;
+  num -= onode_max;
+  auto p = lru.end();
+  while (num > 0 && p != lru.begin()) {
+    --p;
+    Onode *o = &*p;
+    int refs = o->nref.load();
+    if (refs > 1) {
+      dout(20) << __func__ << "  " << o->oid << " has " << refs
+	       << " refs; skipping" << dendl;
+      continue;
+    }
+    dout(30) << __func__ << "  trim " << o->oid << dendl;
+    p = lru.erase(p);
+    logger->dec(l_bluestore_onodes);
+    logger->inc(l_bluestore_onode_evictions);
+    o->get();  // paranoia
+    o->space->onode_map.erase(o->oid);
+    o->put();
+    --num;
+  }
+}
+
+// LRUCache
+
+void BlueStore::LRUCache::_add_onode(OnodeRef& o, int level)
+{
+  if (level > 0)
+    onode_lru.push_front(*o);
+  else
+    onode_lru.push_back(*o);
+  logger->inc(l_bluestore_onodes);
+}
+
+void BlueStore::LRUCache::_rm_onode(OnodeRef& o)
+{
+  onode_lru.erase(onode_lru.iterator_to(*o));
+  logger->dec(l_bluestore_onodes);
+}
+
+void BlueStore::LRUCache::_touch_onode(OnodeRef& o)
+{
+  onode_lru.erase(onode_lru.iterator_to(*o));
+  onode_lru.push_front(*o);
+}
+
+void BlueStore::LRUCache::_add_buffer(Buffer *b, int level, Buffer *near)
+{
+  if (near)
+    buffer_lru.insert(buffer_lru.iterator_to(*near), *b);
+  else if (level > 0)
+    buffer_lru.push_front(*b);
+  else
+    buffer_lru.push_back(*b);
+  buffer_size += b->length;
+  logger->inc(l_bluestore_buffers);
+  logger->inc(l_bluestore_buffer_bytes, b->length);
+}
+
+void BlueStore::LRUCache::_rm_buffer(Buffer *b)
+{
+  assert(buffer_size >= b->length);
+  buffer_size -= b->length;
+  buffer_lru.erase(buffer_lru.iterator_to(*b));
+  logger->dec(l_bluestore_buffers);
+  logger->dec(l_bluestore_buffer_bytes, b->length);
+}
+
+void BlueStore::LRUCache::_touch_buffer(Buffer *b)
+{
+  buffer_lru.erase(buffer_lru.iterator_to(*b));
+  buffer_lru.push_front(*b);
+}
+
+void BlueStore::LRUCache::_adjust_buffer_size(Buffer *b, int64_t delta)
+{
+  assert((int64_t)buffer_size + delta >= 0);
+  buffer_size += delta;
+  if (delta > 0)
+    logger->inc(l_bluestore_buffer_bytes, delta);
+  else
+    logger->dec(l_bluestore_buffer_bytes, -delta);
+}
+
+void BlueStore::LRUCache::_trim(uint64_t onode_max, uint64_t buffer_max)
+{
+  dout(20) << __func__ << " onodes " << onode_lru.size() << " / " << onode_max
+	   << " buffers " << buffer_size << " / " << buffer_max << dendl;
+
+  while (buffer_size > buffer_max && !buffer_lru.empty()) {
+    Buffer *b = &buffer_lru.back();
+    dout(20) << __func__ << " rm " << b->offset << "~" << b->length << dendl;
+    logger->inc(l_bluestore_buffer_evicted_bytes, b->length);
+    b->space->_rm_buffer(b->space->buffer_map.find(b->offset));
+  }
+
+  _trim_onodes(onode_lru, onode_max);
+}
+
+// TwoQCache
+
+void BlueStore::TwoQCache::_add_onode(OnodeRef& o, int level)
+{
+  if (level > 0)
+    onode_lru.push_front(*o);
+  else
+    onode_lru.push_back(*o);
+  logger->inc(l_bluestore_onodes);
+}
+
+void BlueStore::TwoQCache::_rm_onode(OnodeRef& o)
+{
+  onode_lru.erase(onode_lru.iterator_to(*o));
+  logger->dec(l_bluestore_onodes);
+}
+
+void BlueStore::TwoQCache::_touch_onode(OnodeRef& o)
+{
+  onode_lru.erase(onode_lru.iterator_to(*o));
+  onode_lru.push_front(*o);
+}
+
+void BlueStore::TwoQCache::_add_buffer(Buffer *b, int level, Buffer *near)
+{
+  if (near) {
+    // a piece of near; keep it in the same queue
+    b->cache_private = near->cache_private;
+    switch (b->cache_private) {
+    case BUFFER_WARM_IN:
+      buffer_warm_in.insert(buffer_warm_in.iterator_to(*near), *b);
+      break;
+    case BUFFER_WARM_OUT:
+      assert(b->is_empty());
+      buffer_warm_out.insert(buffer_warm_out.iterator_to(*near), *b);
+      break;
+    case BUFFER_HOT:
+      buffer_hot.insert(buffer_hot.iterator_to(*near), *b);
+      break;
+    default:
+      assert(0 == "bad cache_private");
+    }
+  } else if (b->cache_private == BUFFER_WARM_OUT ||
+	     b->cache_private == BUFFER_HOT) {
+    // we remember this range; it is hot now
+    b->cache_private = BUFFER_HOT;
+    buffer_hot.push_front(*b);
+  } else {
+    b->cache_private = BUFFER_WARM_IN;
+    if (level > 0)
+      buffer_warm_in.push_front(*b);
+    else
+      buffer_warm_in.push_back(*b);
+  }
+  if (b->cache_private == BUFFER_WARM_IN)
+    buffer_warm_in_bytes += b->length;
+  else if (b->cache_private == BUFFER_WARM_OUT)
+    buffer_warm_out_bytes += b->length;
+  if (!b->is_empty()) {
+    buffer_bytes += b->length;
+    logger->inc(l_bluestore_buffers);
+    logger->inc(l_bluestore_buffer_bytes, b->length);
+  }
+}
+
+void BlueStore::TwoQCache::_rm_buffer(Buffer *b)
+{
+  if (!b->is_empty()) {
+    assert(buffer_bytes >= b->length);
+    buffer_bytes -= b->length;
+    logger->dec(l_bluestore_buffers);
+    logger->dec(l_bluestore_buffer_bytes, b->length);
+  }
+  switch (b->cache_private) {
+  case BUFFER_WARM_IN:
+    assert(buffer_warm_in_bytes >= b->length);
+    buffer_warm_in_bytes -= b->length;
+    buffer_warm_in.erase(buffer_warm_in.iterator_to(*b));
+    break;
+  case BUFFER_WARM_OUT:
+    assert(buffer_warm_out_bytes >= b->length);
+    buffer_warm_out_bytes -= b->length;
+    buffer_warm_out.erase(buffer_warm_out.iterator_to(*b));
+    break;
+  case BUFFER_HOT:
+    buffer_hot.erase(buffer_hot.iterator_to(*b));
+    break;
+  default:
+    assert(0 == "bad cache_private");
+  }
+}
+
+void BlueStore::TwoQCache::_touch_buffer(Buffer *b)
+{
+  switch (b->cache_private) {
+  case BUFFER_WARM_IN:
+    // do nothing; a second hit while still in warm_in does not make
+    // a buffer hot.
+    break;
+  case BUFFER_HOT:
+    buffer_hot.erase(buffer_hot.iterator_to(*b));
+    buffer_hot.push_front(*b);
+    break;
+  default:
+    assert(0 == "touched ghost buffer");
+  }
+}
+
+void BlueStore::TwoQCache::_adjust_buffer_size(Buffer *b, int64_t delta)
+{
+  if (b->cache_private == BUFFER_WARM_IN) {
+    assert((int64_t)buffer_warm_in_bytes + delta >= 0);
+    buffer_warm_in_bytes += delta;
+  } else if (b->cache_private == BUFFER_WARM_OUT) {
+    assert((int64_t)buffer_warm_out_bytes + delta >= 0);
+    buffer_warm_out_bytes += delta;
+  }
+  if (!b->is_empty()) {
+    assert((int64_t)buffer_bytes + delta >= 0);
+    buffer_bytes += delta;
+    if (delta > 0)
+      logger->inc(l_bluestore_buffer_bytes, delta);
+    else
+      logger->dec(l_bluestore_buffer_bytes, -delta);
+  }
+}
+
+void BlueStore::TwoQCache::_trim(uint64_t onode_max, uint64_t buffer_max)
+{
+  dout(20) << __func__ << " onodes " << onode_lru.size() << " / " << onode_max
+	   << " buffers " << buffer_bytes << " / " << buffer_max
+	   << " (warm_in " << buffer_warm_in_bytes
+	   << " warm_out " << buffer_warm_out_bytes << ")" << dendl;
+
+  if (buffer_bytes > buffer_max) {
+    uint64_t kin = buffer_max * g_conf->bluestore_2q_cache_kin_ratio;
+    uint64_t khot = buffer_max - kin;
+    uint64_t hot_bytes = buffer_bytes - buffer_warm_in_bytes;
+    if (hot_bytes < khot) {
+      // hot is small; give the slack to warm_in
+      kin += khot - hot_bytes;
+    } else if (buffer_warm_in_bytes < kin) {
+      // warm_in is small; give the slack to hot
+      khot += kin - buffer_warm_in_bytes;
+    }
+
+    // age warm_in buffers out, leaving a ghost behind
+    while (buffer_warm_in_bytes > kin && !buffer_warm_in.empty()) {
+      Buffer *b = &buffer_warm_in.back();
+      dout(20) << __func__ << " warm_in -> out " << b->offset << "~"
+	       << b->length << dendl;
+      assert(buffer_bytes >= b->length);
+      buffer_bytes -= b->length;
+      buffer_warm_in_bytes -= b->length;
+      buffer_warm_out_bytes += b->length;
+      logger->dec(l_bluestore_buffers);
+      logger->dec(l_bluestore_buffer_bytes, b->length);
+      logger->inc(l_bluestore_buffer_evicted_bytes, b->length);
+      b->data.clear();
+      buffer_warm_in.erase(buffer_warm_in.iterator_to(*b));
+      buffer_warm_out.push_front(*b);
+      b->cache_private = BUFFER_WARM_OUT;
+    }
+
+    // then trim hot
+    while (buffer_bytes - buffer_warm_in_bytes > khot && !buffer_hot.empty()) {
+      Buffer *b = &buffer_hot.back();
+      dout(20) << __func__ << " rm hot " << b->offset << "~" << b->length
+	       << dendl;
+      logger->inc(l_bluestore_buffer_evicted_bytes, b->length);
+      b->space->_rm_buffer(b->space->buffer_map.find(b->offset));
+    }
+  }
+
+  // only remember so many ghosts
+  uint64_t kout = buffer_max * g_conf->bluestore_2q_cache_kout_ratio;
+  while (buffer_warm_out_bytes > kout && !buffer_warm_out.empty()) {
+    Buffer *b = &buffer_warm_out.back();
+    assert(b->is_empty());
+    dout(20) << __func__ << " rm warm_out " << b->offset << "~" << b->length
+	     << dendl;
+    b->space->_rm_buffer(b->space->buffer_map.find(b->offset));
+  }
+
+  _trim_onodes(onode_lru, onode_max);
+}
+
+// BufferSpace
 
 #undef dout_prefix
-#define dout_prefix *_dout << "bluestore.lru(" << this << ") "
+#define dout_prefix *_dout << "bluestore.BufferSpace(" << this << ") "
+
+void BlueStore::BufferSpace::_add_buffer(Buffer *b, int level, Buffer *near)
+{
+  cache->_add_buffer(b, level, near);
+  buffer_map[b->offset].reset(b);
+}
+
+void BlueStore::BufferSpace::_rm_buffer(
+  map<uint64_t,std::unique_ptr<Buffer>>::iterator p)
+{
+  cache->_rm_buffer(p->second.get());
+  buffer_map.erase(p);
+}
+
+map<uint64_t,std::unique_ptr<BlueStore::Buffer>>::iterator
+BlueStore::BufferSpace::_data_lower_bound(uint64_t offset)
+{
+  auto i = buffer_map.lower_bound(offset);
+  if (i != buffer_map.begin()) {
+    --i;
+    if (i->first + i->second->length <= offset)
+      ++i;
+  }
+  return i;
+}
+
+int BlueStore::BufferSpace::_discard(uint64_t offset, uint64_t length)
+{
+  dout(20) << __func__ << " " << offset << "~" << length << dendl;
+  int cache_private = 0;
+  uint64_t end = offset + length;
+  auto i = _data_lower_bound(offset);
+  while (i != buffer_map.end()) {
+    Buffer *b = i->second.get();
+    if (b->offset >= end)
+      break;
+    if (b->cache_private > cache_private)
+      cache_private = b->cache_private;
+    if (b->offset < offset) {
+      uint64_t front = offset - b->offset;
+      if (b->end() > end) {
+	// drop middle; keep the tail as a new buffer
+	uint64_t tail = b->end() - end;
+	Buffer *nb;
+	if (b->is_empty()) {
+	  nb = new Buffer(this, b->seq, end, tail);
+	} else {
+	  bufferlist t;
+	  t.substr_of(b->data, b->length - tail, tail);
+	  nb = new Buffer(this, b->seq, end, t);
+	}
+	_add_buffer(nb, 0, b);
+      }
+      cache->_adjust_buffer_size(b, (int64_t)front - (int64_t)b->length);
+      b->truncate(front);
+      ++i;
+      continue;
+    }
+    if (b->end() <= end) {
+      // drop entire buffer
+      _rm_buffer(i++);
+      continue;
+    }
+    // drop front
+    uint64_t keep = b->end() - end;
+    Buffer *nb;
+    if (b->is_empty()) {
+      nb = new Buffer(this, b->seq, end, keep);
+    } else {
+      bufferlist t;
+      t.substr_of(b->data, b->length - keep, keep);
+      nb = new Buffer(this, b->seq, end, t);
+    }
+    _add_buffer(nb, 0, b);
+    _rm_buffer(i);
+    break;
+  }
+  return cache_private;
+}
+
+void BlueStore::BufferSpace::discard(uint64_t offset, uint64_t length)
+{
+  std::lock_guard<std::recursive_mutex> l(cache->lock);
+  _discard(offset, length);
+}
+
+void BlueStore::BufferSpace::write(uint64_t seq, uint64_t offset,
+				   const bufferlist& bl)
+{
+  if (bl.length() == 0)
+    return;
+  std::lock_guard<std::recursive_mutex> l(cache->lock);
+  int cache_private = _discard(offset, bl.length());
+  Buffer *b = new Buffer(this, seq, offset, bl);
+  b->cache_private = cache_private;
+  _add_buffer(b, 1, nullptr);
+}
+
+void BlueStore::BufferSpace::did_read(uint64_t offset, const bufferlist& bl)
+{
+  if (bl.length() == 0)
+    return;
+  std::lock_guard<std::recursive_mutex> l(cache->lock);
+  int cache_private = _discard(offset, bl.length());
+  Buffer *b = new Buffer(this, 0, offset, bl);
+  b->cache_private = cache_private;
+  _add_buffer(b, 1, nullptr);
+}
+
+void BlueStore::BufferSpace::read(
+  uint64_t offset, uint64_t length,
+  map<uint64_t,bufferlist>& res,
+  interval_set<uint64_t>& res_intervals,
+  uint64_t *seq)
+{
+  std::lock_guard<std::recursive_mutex> l(cache->lock);
+  uint64_t end = offset + length;
+  for (auto i = _data_lower_bound(offset);
+       i != buffer_map.end() && i->first < end;
+       ++i) {
+    Buffer *b = i->second.get();
+    if (b->is_empty())
+      continue;
+    uint64_t b_off = MAX(b->offset, offset);
+    uint64_t b_end = MIN(b->end(), end);
+    res[b_off].substr_of(b->data, b_off - b->offset, b_end - b_off);
+    res_intervals.insert(b_off, b_end - b_off);
+    if (seq && b->seq > *seq)
+      *seq = b->seq;
+    cache->_touch_buffer(b);
+  }
+}
 
-void BlueStore::OnodeHashLRU::_touch(OnodeRef o)
+void BlueStore::BufferSpace::clear()
 {
-  lru_list_t::iterator p = lru.iterator_to(*o);
-  lru.erase(p);
-  lru.push_front(*o);
+  std::lock_guard<std::recursive_mutex> l(cache->lock);
+  while (!buffer_map.empty()) {
+    _rm_buffer(buffer_map.begin());
+  }
 }
 
-void BlueStore::OnodeHashLRU::add(const ghobject_t& oid, OnodeRef o)
+// OnodeSpace
+
+#undef dout_prefix
+#define dout_prefix *_dout << "bluestore.OnodeSpace(" << this << ") "
+
+BlueStore::OnodeRef BlueStore::OnodeSpace::add(const ghobject_t& oid,
+					       OnodeRef o)
 {
-  std::lock_guard<std::mutex> l(lock);
+  std::lock_guard<std::recursive_mutex> l(cache->lock);
+  auto p = onode_map.find(oid);
+  if (p != onode_map.end()) {
+    dout(30) << __func__ << " " << oid << " " << o
+	     << " raced, returning existing " << p->second << dendl;
+    return p->second;
+  }
   dout(30) << __func__ << " " << oid << " " << o << dendl;
-  assert(onode_map.count(oid) == 0);
   onode_map[oid] = o;
-  lru.push_front(*o);
-  _trim(max_size);
+  cache->_add_onode(o, 1);
+  return o;
 }
 
-BlueStore::OnodeRef BlueStore::OnodeHashLRU::lookup(const ghobject_t& oid)
+BlueStore::OnodeRef BlueStore::OnodeSpace::lookup(const ghobject_t& oid)
 {
-  std::lock_guard<std::mutex> l(lock);
-  dout(30) << __func__ << dendl;
-  ceph::unordered_map<ghobject_t,OnodeRef>::iterator p = onode_map.find(oid);
+  std::lock_guard<std::recursive_mutex> l(cache->lock);
+  auto p = onode_map.find(oid);
   if (p == onode_map.end()) {
     dout(30) << __func__ << " " << oid << " miss" << dendl;
+    cache->logger->inc(l_bluestore_onode_misses);
     return OnodeRef();
   }
   dout(30) << __func__ << " " << oid << " hit " << p->second << dendl;
-  _touch(p->second);
+  cache->logger->inc(l_bluestore_onode_hits);
+  cache->_touch_onode(p->second);
   return p->second;
 }
 
-void BlueStore::OnodeHashLRU::clear()
+void BlueStore::OnodeSpace::clear()
 {
-  std::lock_guard<std::mutex> l(lock);
+  std::lock_guard<std::recursive_mutex> l(cache->lock);
   dout(10) << __func__ << dendl;
-  lru.clear();
+  for (auto& p : onode_map) {
+    cache->_rm_onode(p.second);
+  }
   onode_map.clear();
 }
 
-void BlueStore::OnodeHashLRU::rename(OnodeRef& oldo,
-				     const ghobject_t& old_oid,
-				     const ghobject_t& new_oid)
+void BlueStore::OnodeSpace::rename(OnodeRef& oldo,
+				   const ghobject_t& old_oid,
+				   const ghobject_t& new_oid)
 {
-  std::lock_guard<std::mutex> l(lock);
+  std::lock_guard<std::recursive_mutex> l(cache->lock);
   dout(30) << __func__ << " " << old_oid << " -> " << new_oid << dendl;
   ceph::unordered_map<ghobject_t,OnodeRef>::iterator po, pn;
   po = onode_map.find(old_oid);
@@ -522,96 +989,33 @@ void BlueStore::OnodeHashLRU::rename(OnodeRef& oldo,
   assert(po != onode_map.end());
   if (pn != onode_map.end()) {
     dout(30) << __func__ << "  removing target " << pn->second << dendl;
-    lru_list_t::iterator p = lru.iterator_to(*pn->second);
-    lru.erase(p);
+    cache->_rm_onode(pn->second);
     onode_map.erase(pn);
   }
   OnodeRef o = po->second;
 
   // install a non-existent onode at old location
-  oldo.reset(new Onode(old_oid, o->key));
+  oldo.reset(new Onode(this, old_oid, o->key));
   po->second = oldo;
-  lru.push_back(*po->second);
+  cache->_add_onode(po->second, 0);
 
   // add at new position and fix oid, key
   onode_map.insert(make_pair(new_oid, o));
-  _touch(o);
+  cache->_touch_onode(o);
   o->oid = new_oid;
   get_object_key(new_oid, &o->key);
 }
 
-bool BlueStore::OnodeHashLRU::get_next(
-  const ghobject_t& after,
-  pair<ghobject_t,OnodeRef> *next)
+bool BlueStore::OnodeSpace::map_any(std::function<bool(OnodeRef)> f)
 {
-  std::lock_guard<std::mutex> l(lock);
-  dout(20) << __func__ << " after " << after << dendl;
-
-  if (after == ghobject_t()) {
-    if (lru.empty()) {
-      return false;
-    }
-    ceph::unordered_map<ghobject_t,OnodeRef>::iterator p = onode_map.begin();
-    assert(p != onode_map.end());
-    next->first = p->first;
-    next->second = p->second;
-    return true;
-  }
-
-  ceph::unordered_map<ghobject_t,OnodeRef>::iterator p = onode_map.find(after);
-  assert(p != onode_map.end()); // for now
-  lru_list_t::iterator pi = lru.iterator_to(*p->second);
-  ++pi;
-  if (pi == lru.end()) {
-    return false;
-  }
-  next->first = pi->oid;
-  next->second = onode_map[pi->oid];
-  return true;
-}
-
-int BlueStore::OnodeHashLRU::trim(int max)
-{
-  std::lock_guard<std::mutex> l(lock);
-  if (max < 0) {
-    max = max_size;
-  }
-  return _trim(max);
-}
-
-int BlueStore::OnodeHashLRU::_trim(int max)
-{
-  dout(20) << __func__ << " max " << max << " size " << onode_map.size() << dendl;
-  int trimmed = 0;
-  int num = onode_map.size() - max;
-  if (onode_map.size() == 0 || num <= 0)
-    return 0; // don't even try
-  
-  lru_list_t::iterator p = lru.end();
-  if (num)
-    --p;
-  while (num > 0) {
-    Onode *o = &*p;
-    int refs = o->nref.load();
-    if (refs > 1) {
-      dout(20) << __func__ << "  " << o->oid << " has " << refs
-	       << " refs; stopping with " << num << " left to trim" << dendl;
-      break;
-    }
-    dout(30) << __func__ << "  trim " << o->oid << dendl;
-    if (p != lru.begin()) {
-      lru.erase(p--);
-    } else {
-      lru.erase(p);
-      assert(num == 1);
+  std::lock_guard<std::recursive_mutex> l(cache->lock);
+  dout(20) << __func__ << dendl;
+  for (auto& i : onode_map) {
+    if (f(i.second)) {
+      return true;
     }
-    o->get();  // paranoia
-    onode_map.erase(o->oid);
-    o->put();
-    --num;
-    ++trimmed;
   }
-  return trimmed;
+  return false;
 }
 
 // =======================================================
@@ -621,13 +1025,14 @@ int BlueStore::OnodeHashLRU::_trim(int max)
 #undef dout_prefix
 #define dout_prefix *_dout << "bluestore(" << store->path << ").collection(" << cid << ") "
 
-BlueStore::Collection::Collection(BlueStore *ns, coll_t c)
+BlueStore::Collection::Collection(BlueStore *ns, Cache *ca, coll_t c)
   : store(ns),
+    cache(ca),
     cid(c),
     lock("BlueStore::Collection::lock", true, false),
     exists(true),
     enode_set(g_conf->bluestore_onode_map_size),
-    onode_map(g_conf->bluestore_onode_map_size)
+    onode_map(ca)
 {
 }
 
@@ -704,18 +1109,17 @@ BlueStore::OnodeRef BlueStore::Collection::get_onode(
       return OnodeRef();
 
     // new
-    on = new Onode(oid, key);
+    on = new Onode(&onode_map, oid, key);
   } else {
     // loaded
     assert(r >=0);
-    on = new Onode(oid, key);
+    on = new Onode(&onode_map, oid, key);
     on->exists = true;
     bufferlist::iterator p = v.begin();
     ::decode(on->onode, p);
   }
   o.reset(on);
-  onode_map.add(oid, o);
-  return o;
+  return onode_map.add(oid, o);
 }
 
 
@@ -765,16 +1169,46 @@ BlueStore::BlueStore(CephContext *cct, const string& path)
 	     cct->_conf->bluestore_wal_thread_timeout,
 	     cct->_conf->bluestore_wal_thread_suicide_timeout,
 	     &wal_tp),
+    wal_batch_thread(this),
+    wal_batch_stop(false),
+    wal_batch(NULL),
     finisher(cct),
     kv_sync_thread(this),
     kv_stop(false),
-    logger(NULL)
+    kv_finalize_thread(this),
+    kv_finalize_stop(false),
+    kv_finalizing(false),
+    logger(NULL),
+    csum_type(bluestore_csum_t::CSUM_NONE),
+    csum_chunk_order(0),
+    comp_mode(Compressor::COMP_NONE),
+    comp_alg(Compressor::COMP_ALG_NONE),
+    comp_required_ratio(1.0),
+    comp_blob_size(0),
+    online_fsck_thread(this),
+    online_fsck_running(false),
+    online_fsck_stop(false),
+    asok_hook(NULL)
 {
   _init_logger();
+  unsigned num_shards = MAX(1, cct->_conf->bluestore_cache_shards);
+  for (unsigned i = 0; i < num_shards; ++i) {
+    Cache *c = Cache::create(cct->_conf->bluestore_cache_type, logger);
+    if (!c) {
+      derr << __func__ << " unrecognized bluestore_cache_type '"
+	   << cct->_conf->bluestore_cache_type << "', using 2q" << dendl;
+      c = Cache::create("2q", logger);
+    }
+    cache_shards.push_back(c);
+  }
 }
 
 BlueStore::~BlueStore()
 {
+  for (auto i : cache_shards) {
+    delete i;
+  }
+  cache_shards.clear();
   _shutdown_logger();
   assert(!mounted);
   assert(db == NULL);
@@ -786,19 +1220,43 @@ void BlueStore::_init_logger()
 {
   PerfCountersBuilder b(g_ceph_context, "BlueStore",
                         l_bluestore_first, l_bluestore_last);
-  b.add_time_avg(l_bluestore_state_prepare_lat, "state_prepare_lat", "Average prepare state latency");
-  b.add_time_avg(l_bluestore_state_aio_wait_lat, "state_aio_wait_lat", "Average aio_wait state latency");
-  b.add_time_avg(l_bluestore_state_io_done_lat, "state_io_done_lat", "Average io_done state latency");
-  b.add_time_avg(l_bluestore_state_kv_queued_lat, "state_kv_queued_lat", "Average kv_queued state latency");
-  b.add_time_avg(l_bluestore_state_kv_committing_lat, "state_kv_commiting_lat", "Average kv_commiting state latency");
-  b.add_time_avg(l_bluestore_state_kv_done_lat, "state_kv_done_lat", "Average kv_done state latency");
-  b.add_time_avg(l_bluestore_state_wal_queued_lat, "state_wal_queued_lat", "Average wal_queued state latency");
-  b.add_time_avg(l_bluestore_state_wal_applying_lat, "state_wal_applying_lat", "Average wal_applying state latency");
-  b.add_time_avg(l_bluestore_state_wal_aio_wait_lat, "state_wal_aio_wait_lat", "Average aio_wait state latency");
-  b.add_time_avg(l_bluestore_state_wal_cleanup_lat, "state_wal_cleanup_lat", "Average cleanup state latency");
-  b.add_time_avg(l_bluestore_state_wal_done_lat, "state_wal_done_lat", "Average wal_done state latency");
-  b.add_time_avg(l_bluestore_state_finishing_lat, "state_finishing_lat", "Average finishing state latency");
-  b.add_time_avg(l_bluestore_state_done_lat, "state_done_lat", "Average done state latency");
+  b.add_time_hist(l_bluestore_state_prepare_lat, "state_prepare_lat", "Average prepare state latency");
+  b.add_time_hist(l_bluestore_state_aio_wait_lat, "state_aio_wait_lat", "Average aio_wait state latency");
+  b.add_time_hist(l_bluestore_state_io_done_lat, "state_io_done_lat", "Average io_done state latency");
+  b.add_time_hist(l_bluestore_state_kv_queued_lat, "state_kv_queued_lat", "Average kv_queued state latency");
+  b.add_time_hist(l_bluestore_state_kv_committing_lat, "state_kv_commiting_lat", "Average kv_commiting state latency");
+  b.add_time_hist(l_bluestore_state_kv_done_lat, "state_kv_done_lat", "Average kv_done state latency");
+  b.add_time_hist(l_bluestore_state_wal_queued_lat, "state_wal_queued_lat", "Average wal_queued state latency");
+  b.add_time_hist(l_bluestore_state_wal_applying_lat, "state_wal_applying_lat", "Average wal_applying state latency");
+  b.add_time_hist(l_bluestore_state_wal_aio_wait_lat, "state_wal_aio_wait_lat", "Average aio_wait state latency");
+  b.add_time_hist(l_bluestore_state_wal_cleanup_lat, "state_wal_cleanup_lat", "Average cleanup state latency");
+  b.add_time_hist(l_bluestore_state_wal_done_lat, "state_wal_done_lat", "Average wal_done state latency");
+  b.add_time_hist(l_bluestore_state_finishing_lat, "state_finishing_lat", "Average finishing state latency");
+  b.add_time_hist(l_bluestore_state_done_lat, "state_done_lat", "Average done state latency");
+  b.add_time_hist(l_bluestore_kv_flush_lat, "kv_flush_lat", "Block device flush before each kv commit");
+  b.add_time_hist(l_bluestore_kv_commit_lat, "kv_commit_lat", "Synchronous kv commit of a batch");
+  b.add_u64_avg(l_bluestore_kv_batch_txcs, "kv_batch_txcs", "Transactions per kv commit batch");
+  b.add_u64_counter(l_bluestore_csum_errors, "csum_errors", "Data checksum mismatches on read");
+  b.add_u64_counter(l_bluestore_compress_success_count, "compress_success_count", "Blobs stored compressed");
+  b.add_u64_counter(l_bluestore_compress_rejected_count, "compress_rejected_count", "Blobs stored uncompressed because they did not compress well enough");
+  b.add_u64_counter(l_bluestore_compressed_original_bytes, "compressed_original", "Logical bytes stored compressed");
+  b.add_u64_counter(l_bluestore_compressed_allocated_bytes, "compressed_allocated", "Device bytes allocated for compressed data");
+  b.add_u64(l_bluestore_onodes, "bluestore_onodes", "Number of onodes in cache");
+  b.add_u64_counter(l_bluestore_onode_hits, "bluestore_onode_hits", "Onode cache hits");
+  b.add_u64_counter(l_bluestore_onode_misses, "bluestore_onode_misses", "Onode cache misses");
+  b.add_u64_counter(l_bluestore_onode_evictions, "bluestore_onode_evictions", "Onodes trimmed from cache");
+  b.add_u64(l_bluestore_buffers, "bluestore_buffers", "Number of buffers in cache");
+  b.add_u64(l_bluestore_buffer_bytes, "bluestore_buffer_bytes", "Bytes of data in cache");
+  b.add_u64_counter(l_bluestore_buffer_hit_bytes, "bluestore_buffer_hit_bytes", "Read bytes served from cache");
+  b.add_u64_counter(l_bluestore_buffer_miss_bytes, "bluestore_buffer_miss_bytes", "Read bytes not found in cache");
+  b.add_u64_counter(l_bluestore_buffer_evicted_bytes, "bluestore_buffer_evicted_bytes", "Data bytes trimmed from cache");
+  b.add_u64_counter(l_bluestore_wal_batches, "wal_batches", "WAL batches written");
+  b.add_u64_counter(l_bluestore_wal_batch_full, "wal_batch_full", "WAL batches written because they filled up");
+  b.add_u64_counter(l_bluestore_wal_batch_aged, "wal_batch_aged", "WAL batches written because they reached bluestore_wal_batch_max_age");
+  b.add_u64_avg(l_bluestore_wal_batch_txcs, "wal_batch_txcs", "Transactions per WAL batch");
+  b.add_u64_avg(l_bluestore_wal_batch_bytes, "wal_batch_bytes", "Bytes per WAL batch");
+  b.add_u64_avg(l_bluestore_wal_batch_ios, "wal_batch_ios", "Device writes per WAL batch after coalescing");
+  b.add_time_hist(l_bluestore_wal_batch_defer_lat, "wal_batch_defer_lat", "Time a transaction waited in a WAL batch");
   logger = b.create_perf_counters();
   g_ceph_context->get_perfcounters_collection()->add(logger);
 }
@@ -967,26 +1425,63 @@ void BlueStore::_close_bdev()
   bdev = NULL;
 }
 
-int BlueStore::_open_alloc()
+int BlueStore::_open_alloc(bool create)
 {
   assert(fm == NULL);
   assert(alloc == NULL);
-  fm = new FreelistManager();
-  int r = fm->init(db, PREFIX_ALLOC);
+  int r;
+  if (!create) {
+    bufferlist bl;
+    r = db->get(PREFIX_SUPER, "freelist_type", &bl);
+    if (r < 0) {
+      // stores created before the bitmap freelist
+      freelist_type = "extent";
+    } else {
+      freelist_type = string(bl.c_str(), bl.length());
+    }
+  }
+  dout(10) << __func__ << " freelist_type " << freelist_type << dendl;
+  fm = FreelistManager::create(freelist_type, db, PREFIX_ALLOC,
+			       PREFIX_ALLOC_BITMAP);
+  if (!fm)
+    return -EINVAL;
+  if (create) {
+    KeyValueDB::Transaction t = db->get_transaction();
+    r = fm->create(bdev->get_size(), bdev->get_block_size(), t);
+    if (r < 0) {
+      delete fm;
+      fm = NULL;
+      return r;
+    }
+    bufferlist bl;
+    bl.append(freelist_type);
+    t->set(PREFIX_SUPER, "freelist_type", bl);
+    db->submit_transaction_sync(t);
+  }
+  r = fm->init();
   if (r < 0) {
     delete fm;
     fm = NULL;
     return r;
   }
 
-  alloc = Allocator::create("stupid");
+  alloc = Allocator::create(g_conf->bluestore_allocator, bdev->get_size(),
+			    g_conf->bluestore_min_alloc_size);
+  if (!alloc) {
+    fm->shutdown();
+    delete fm;
+    fm = NULL;
+    return -EINVAL;
+  }
   uint64_t num = 0, bytes = 0;
-  const auto& fl = fm->get_freelist();
-  for (auto& p : fl) {
-    alloc->init_add_free(p.first, p.second);
+  uint64_t offset, length;
+  fm->enumerate_reset();
+  while (fm->enumerate_next(&offset, &length)) {
+    alloc->init_add_free(offset, length);
     ++num;
-    bytes += p.second;
+    bytes += length;
   }
+  fm->enumerate_reset();
   dout(10) << __func__ << " loaded " << pretty_si_t(bytes)
 	   << " in " << num << " extents"
 	   << dendl;
@@ -1005,6 +1500,76 @@ void BlueStore::_close_alloc()
   fm = NULL;
 }
 
+void BlueStore::_set_csum()
+{
+  int t = bluestore_csum_t::get_type_by_name(g_conf->bluestore_csum_type);
+  if (t < 0) {
+    derr << __func__ << " unrecognized bluestore_csum_type '"
+	 << g_conf->bluestore_csum_type << "', not checksumming new objects"
+	 << dendl;
+    t = bluestore_csum_t::CSUM_NONE;
+  }
+  csum_type = t;
+
+  // a chunk is a power of two no smaller than a device block, and no
+  // larger than an allocation unit so that it never spans extents.
+  uint64_t chunk_size = MAX((uint64_t)g_conf->bluestore_csum_chunk_size,
+			    bdev->get_block_size());
+  chunk_size = MIN(chunk_size, (uint64_t)g_conf->bluestore_min_alloc_size);
+  csum_chunk_order = 63 - __builtin_clzll(chunk_size);
+  dout(10) << __func__ << " " << bluestore_csum_t::get_type_name(csum_type)
+	   << " chunk_size " << (1ull << csum_chunk_order) << dendl;
+}
+
+void BlueStore::_set_compression()
+{
+  int m = Compressor::get_comp_mode_type(g_conf->bluestore_compression);
+  if (m < 0) {
+    derr << __func__ << " unrecognized bluestore_compression '"
+	 << g_conf->bluestore_compression << "', not compressing" << dendl;
+    m = Compressor::COMP_NONE;
+  }
+  comp_mode = m;
+
+  int a = Compressor::get_comp_alg_type(
+    g_conf->bluestore_compression_algorithm);
+  if (a < 0) {
+    derr << __func__ << " unrecognized bluestore_compression_algorithm '"
+	 << g_conf->bluestore_compression_algorithm << "', not compressing"
+	 << dendl;
+    comp_mode = Compressor::COMP_NONE;
+    a = Compressor::COMP_ALG_NONE;
+  }
+  comp_alg = a;
+  comp_required_ratio = g_conf->bluestore_compression_required_ratio;
+
+  // space is only saved in whole allocation units, so a blob spans at
+  // least two of them.
+  uint64_t min_alloc_size = g_conf->bluestore_min_alloc_size;
+  comp_blob_size = MAX(ROUND_UP_TO(g_conf->bluestore_compression_blob_size,
+				   min_alloc_size),
+		       min_alloc_size * 2);
+  dout(10) << __func__ << " " << Compressor::get_comp_mode_name(comp_mode)
+	   << " " << Compressor::get_comp_alg_name(comp_alg)
+	   << " required_ratio " << comp_required_ratio
+	   << " blob_size " << comp_blob_size << dendl;
+}
+
+CompressorRef BlueStore::_get_compressor(int alg)
+{
+  assert(alg > Compressor::COMP_ALG_NONE && alg < Compressor::COMP_ALG_LAST);
+  std::lock_guard<std::mutex> l(compressor_lock);
+  if (!compressors[alg]) {
+    compressors[alg] = Compressor::create(cct,
+					  Compressor::get_comp_alg_name(alg));
+    if (!compressors[alg]) {
+      derr << __func__ << " unable to load "
+	   << Compressor::get_comp_alg_name(alg) << " compressor" << dendl;
+    }
+  }
+  return compressors[alg];
+}
+
 int BlueStore::_open_fsid(bool create)
 {
   assert(fsid_fd < 0);
@@ -1339,13 +1904,34 @@ int BlueStore::_open_db(bool create)
     return -EIO;
   }
   
-  if (kv_backend == "rocksdb")
+  r = FreelistManager::setup_merge_operators(db, PREFIX_ALLOC_BITMAP);
+  if (create) {
+    freelist_type = g_conf->bluestore_freelist_type;
+    if (r < 0 && freelist_type == "bitmap") {
+      derr << __func__ << " " << kv_backend << " does not support merge"
+	   << " operators; using extent freelist" << dendl;
+      freelist_type = "extent";
+    }
+  }
+
+  r = 0;
+  if (kv_backend == "rocksdb") {
     options = g_conf->bluestore_rocksdb_options;
-  db->init(options);
-  if (create)
-    r = db->create_and_open(err);
-  else
-    r = db->open(err);
+    vector<KeyValueDB::ColumnFamily> cfs;
+    r = KeyValueDB::parse_column_families(g_conf->bluestore_rocksdb_cfs, &cfs);
+    if (r == 0 && !cfs.empty())
+      r = db->set_column_families(cfs);
+    if (r < 0)
+      err << "bad bluestore_rocksdb_cfs '" << g_conf->bluestore_rocksdb_cfs
+	  << "'";
+  }
+  if (r == 0) {
+    db->init(options);
+    if (create)
+      r = db->create_and_open(err);
+    else
+      r = db->open(err);
+  }
   if (r) {
     derr << __func__ << " erroring opening db: " << err.str() << dendl;
     if (bluefs) {
@@ -1559,7 +2145,7 @@ int BlueStore::_open_collections(int *errors)
        it->next()) {
     coll_t cid;
     if (cid.parse(it->key())) {
-      CollectionRef c(new Collection(this, cid));
+      CollectionRef c(new Collection(this, _get_cache_shard(cid), cid));
       bufferlist bl = it->value();
       bufferlist::iterator p = bl.begin();
       try {
@@ -1742,7 +2328,7 @@ int BlueStore::mkfs()
   if (r < 0)
     goto out_close_bdev;
 
-  r = _open_alloc();
+  r = _open_alloc(true);
   if (r < 0)
     goto out_close_db;
 
@@ -1777,6 +2363,7 @@ int BlueStore::mkfs()
 	if (start + l > end)
 	  l = end - start;
 	l = ROUND_UP_TO(l, min_alloc_size);
+	l = MIN(l, bdev->get_size() - start);
 	fm->release(start, l, t);
 	uint64_t u = 1 + (uint64_t)(r * (double)l / (1.0 - r));
 	u = ROUND_UP_TO(u, min_alloc_size);
@@ -1870,11 +2457,14 @@ int BlueStore::mount()
   if (r < 0)
     goto out_fsid;
 
+  _set_csum();
+  _set_compression();
+
   r = _open_db(false);
   if (r < 0)
     goto out_bdev;
 
-  r = _open_alloc();
+  r = _open_alloc(false);
   if (r < 0)
     goto out_db;
 
@@ -1894,18 +2484,22 @@ int BlueStore::mount()
 
   finisher.start();
   wal_tp.start();
+  wal_batch_thread.create("bstore_wal_batch");
   kv_sync_thread.create("bstore_kv_sync");
+  kv_finalize_thread.create("bstore_kv_final");
 
   r = _wal_replay();
   if (r < 0)
     goto out_stop;
 
   mounted = true;
+  _register_admin_socket();
   return 0;
 
  out_stop:
   _kv_stop();
   wal_wq.drain();
+  _wal_batch_stop();
   wal_tp.stop();
   finisher.wait_for_empty();
   finisher.stop();
@@ -1929,14 +2523,19 @@ int BlueStore::umount()
   assert(mounted);
   dout(1) << __func__ << dendl;
 
+  _unregister_admin_socket();
+  _online_fsck_stop();
+
   _sync();
   _reap_collections();
   coll_map.clear();
 
-  dout(20) << __func__ << " stopping kv thread" << dendl;
-  _kv_stop();
   dout(20) << __func__ << " draining wal_wq" << dendl;
   wal_wq.drain();
+  dout(20) << __func__ << " stopping wal batch thread" << dendl;
+  _wal_batch_stop();
+  dout(20) << __func__ << " stopping kv thread" << dendl;
+  _kv_stop();
   dout(20) << __func__ << " stopping wal_tp" << dendl;
   wal_tp.stop();
   dout(20) << __func__ << " draining finisher" << dendl;
@@ -1968,11 +2567,20 @@ int BlueStore::_verify_enode_shared(
   EnodeRef enode,
   vector<bluestore_extent_t>& v,
   interval_set<uint64_t> &used_blocks)
+{
+  return _verify_enode_shared(enode->hash, enode->ref_map, v, used_blocks);
+}
+
+int BlueStore::_verify_enode_shared(
+  uint32_t hash,
+  const bluestore_extent_ref_map_t& enode_ref_map,
+  vector<bluestore_extent_t>& v,
+  interval_set<uint64_t> &used_blocks)
 {
   int errors = 0;
   interval_set<uint64_t> span;
   bluestore_extent_ref_map_t ref_map;
-  dout(10) << __func__ << " hash " << enode->hash << " v " << v << dendl;
+  dout(10) << __func__ << " hash " << hash << " v " << v << dendl;
   for (auto& p : v) {
     interval_set<uint64_t> t, i;
     t.insert(p.offset, p.length);
@@ -1988,15 +2596,15 @@ int BlueStore::_verify_enode_shared(
     }
     span.insert(t);
   }
-  if (enode->ref_map != ref_map) {
-    derr << " hash " << enode->hash << " ref_map " << enode->ref_map
+  if (enode_ref_map != ref_map) {
+    derr << " hash " << hash << " ref_map " << enode_ref_map
 	 << " != expected " << ref_map << dendl;
     ++errors;
   }
   interval_set<uint64_t> i;
   i.intersection_of(span, used_blocks);
   if (!i.empty()) {
-    derr << " hash " << enode->hash << " extent(s) " << i
+    derr << " hash " << hash << " extent(s) " << i
 	 << " already allocated" << dendl;
     ++errors;
   }
@@ -2004,6 +2612,74 @@ int BlueStore::_verify_enode_shared(
   return errors;
 }
 
+int BlueStore::_fsck_check_extents(
+  const ghobject_t& oid,
+  bluestore_onode_t& onode,
+  interval_set<uint64_t>& used_blocks,
+  vector<bluestore_extent_t>& hash_shared)
+{
+  int errors = 0;
+  // blocks
+  for (auto& b : onode.block_map) {
+    if (b.second.has_flag(bluestore_extent_t::FLAG_SHARED)) {
+      hash_shared.push_back(b.second);
+    } else {
+      if (used_blocks.intersects(b.second.offset, b.second.length)) {
+	derr << " " << oid << " extent " << b.first << ": " << b.second
+	     << " already allocated" << dendl;
+	++errors;
+	continue;
+      }
+      used_blocks.insert(b.second.offset, b.second.length);
+      if (b.second.end() > bdev->get_size()) {
+	derr << " " << oid << " extent " << b.first << ": " << b.second
+	     << " past end of block device" << dendl;
+	++errors;
+      }
+    }
+  }
+  // compressed blobs
+  for (auto& b : onode.blob_map) {
+    if (b.first + b.second.length > onode.size) {
+      derr << " " << oid << " blob " << b.first << ": " << b.second
+	   << " extends past end of object" << dendl;
+      ++errors;
+    }
+    auto bp = onode.seek_extent(b.first);
+    if (bp != onode.block_map.end() &&
+	bp->first < b.first + b.second.length) {
+      derr << " " << oid << " blob " << b.first << ": " << b.second
+	   << " overlaps extent " << bp->first << ": " << bp->second
+	   << dendl;
+      ++errors;
+    }
+    if (b.second.compressed_length > b.second.get_allocated()) {
+      derr << " " << oid << " blob " << b.first << ": " << b.second
+	   << " compressed_length exceeds allocation" << dendl;
+      ++errors;
+    }
+    for (auto& e : b.second.extents) {
+      if (e.has_flag(bluestore_extent_t::FLAG_SHARED)) {
+	hash_shared.push_back(e);
+	continue;
+      }
+      if (used_blocks.intersects(e.offset, e.length)) {
+	derr << " " << oid << " blob " << b.first << ": " << b.second
+	     << " extent " << e << " already allocated" << dendl;
+	++errors;
+	continue;
+      }
+      used_blocks.insert(e.offset, e.length);
+      if (e.end() > bdev->get_size()) {
+	derr << " " << oid << " blob " << b.first << ": " << b.second
+	     << " extent " << e << " past end of block device" << dendl;
+	++errors;
+      }
+    }
+  }
+  return errors;
+}
+
 int BlueStore::fsck()
 {
   dout(1) << __func__ << dendl;
@@ -2038,7 +2714,7 @@ int BlueStore::fsck()
   if (r < 0)
     goto out_bdev;
 
-  r = _open_alloc();
+  r = _open_alloc(false);
   if (r < 0)
     goto out_db;
 
@@ -2103,25 +2779,7 @@ int BlueStore::fsck()
 	  }
 	  used_nids.insert(o->onode.nid);
 	}
-	// blocks
-	for (auto& b : o->onode.block_map) {
-	  if (b.second.has_flag(bluestore_extent_t::FLAG_SHARED)) {
-	    hash_shared.push_back(b.second);
-	  } else {
-	    if (used_blocks.intersects(b.second.offset, b.second.length)) {
-	      derr << " " << oid << " extent " << b.first << ": " << b.second
-		   << " already allocated" << dendl;
-	      ++errors;
-	      continue;
-	    }
-	    used_blocks.insert(b.second.offset, b.second.length);
-	    if (b.second.end() > bdev->get_size()) {
-	      derr << " " << oid << " extent " << b.first << ": " << b.second
-		   << " past end of block device" << dendl;
-	      ++errors;
-	    }
-	  }
-	}
+	errors += _fsck_check_extents(oid, o->onode, used_blocks, hash_shared);
 	// overlays
 	set<string> overlay_keys;
 	map<uint64_t,int> refs;
@@ -2204,12 +2862,12 @@ int BlueStore::fsck()
 	  }
 	  used_omap_head.insert(o->onode.omap_head);
 	  // hrm, scan actual key/value pairs?
-	  KeyValueDB::Iterator it = db->get_iterator(PREFIX_OMAP);
-	  if (!it)
-	    break;
 	  string head, tail;
 	  get_omap_header(o->onode.omap_head, &head);
 	  get_omap_tail(o->onode.omap_head, &tail);
+	  KeyValueDB::Iterator it = db->get_iterator(PREFIX_OMAP, tail);
+	  if (!it)
+	    break;
 	  it->lower_bound(head);
 	  while (it->valid()) {
 	    if (it->key() == head) {
@@ -2337,68 +2995,492 @@ int BlueStore::fsck()
     for (it->lower_bound(string()); it->valid(); it->next()) {
       bufferlist bl = it->value();
       bufferlist::iterator p = bl.begin();
-      bluestore_wal_transaction_t wt;
-      try {
-	::decode(wt, p);
-      } catch (buffer::error& e) {
-	derr << __func__ << " failed to decode wal txn "
-	     << pretty_binary_string(it->key()) << dendl;
-	r = -EIO;
-        goto out_scan;
+      bluestore_wal_transaction_t wt;
+      try {
+	::decode(wt, p);
+      } catch (buffer::error& e) {
+	derr << __func__ << " failed to decode wal txn "
+	     << pretty_binary_string(it->key()) << dendl;
+	r = -EIO;
+        goto out_scan;
+      }
+      dout(20) << __func__ << "  wal " << wt.seq
+	       << " ops " << wt.ops.size()
+	       << " released " << wt.released << dendl;
+      used_blocks.insert(wt.released);
+    }
+  }
+
+  dout(1) << __func__ << " checking freelist vs allocated" << dendl;
+  {
+    uint64_t offset, length;
+    fm->enumerate_reset();
+    while (fm->enumerate_next(&offset, &length)) {
+      if (used_blocks.intersects(offset, length)) {
+	derr << __func__ << " free extent " << offset << "~" << length
+	     << " intersects allocated blocks" << dendl;
+	interval_set<uint64_t> free, overlap;
+	free.insert(offset, length);
+	overlap.intersection_of(free, used_blocks);
+	derr << __func__ << " overlap: " << overlap << dendl;
+	++errors;
+	continue;
+      }
+      used_blocks.insert(offset, length);
+    }
+    fm->enumerate_reset();
+    if (!used_blocks.contains(0, bdev->get_size())) {
+      derr << __func__ << " leaked some space; free+used = "
+	   << used_blocks
+	   << " != expected 0~" << bdev->get_size()
+	   << dendl;
+      ++errors;
+    }
+  }
+
+ out_scan:
+  coll_map.clear();
+ out_alloc:
+  _close_alloc();
+ out_db:
+  it.reset();  // before db is closed
+  _close_db();
+ out_bdev:
+  _close_bdev();
+ out_fsid:
+  _close_fsid();
+ out_path:
+  _close_path();
+
+  // fatal errors take precedence
+  if (r < 0)
+    return r;
+
+  dout(1) << __func__ << " finish with " << errors << " errors" << dendl;
+  return errors;
+}
+
+// ---------------
+// online fsck
+
+/*
+ * The online fsck walks one collection at a time, in batches of
+ * bluestore_fsck_online_batch objects.  Each batch is read from its
+ * own kv snapshot and checked against the freelist, enodes and overlay
+ * keys in that same snapshot, so it only ever sees committed,
+ * consistent state and never blocks client io.  The price is that it
+ * can only check what is visible within a batch: an extent used twice
+ * by objects in different batches, or stray keys with no owner, are
+ * left for the offline fsck.
+ */
+
+int BlueStore::start_online_fsck()
+{
+  std::lock_guard<std::mutex> l(online_fsck_lock);
+  if (!mounted)
+    return -EINVAL;
+  if (online_fsck_running)
+    return -EBUSY;
+  if (online_fsck_thread.is_started())
+    online_fsck_thread.join();   // previous run has finished
+  dout(1) << __func__ << dendl;
+  online_fsck_stat = online_fsck_stat_t();
+  online_fsck_stat.started = ceph_clock_now(g_ceph_context);
+  online_fsck_running = true;
+  online_fsck_stop = false;
+  online_fsck_thread.create("bstore_fsck");
+  return 0;
+}
+
+void BlueStore::stop_online_fsck()
+{
+  std::unique_lock<std::mutex> l(online_fsck_lock);
+  if (!online_fsck_running)
+    return;
+  dout(1) << __func__ << dendl;
+  online_fsck_stop = true;
+  online_fsck_cond.notify_all();
+  while (online_fsck_running)
+    online_fsck_cond.wait(l);
+}
+
+void BlueStore::_online_fsck_stop()
+{
+  stop_online_fsck();
+  if (online_fsck_thread.is_started())
+    online_fsck_thread.join();
+}
+
+void BlueStore::dump_online_fsck(Formatter *f)
+{
+  std::lock_guard<std::mutex> l(online_fsck_lock);
+  if (online_fsck_running)
+    f->dump_string("state", online_fsck_stop ? "stopping" : "running");
+  else if (online_fsck_stat.started == utime_t())
+    f->dump_string("state", "idle");
+  else
+    f->dump_string("state", "finished");
+  f->dump_stream("started") << online_fsck_stat.started;
+  f->dump_stream("finished") << online_fsck_stat.finished;
+  f->dump_unsigned("collections", online_fsck_stat.collections);
+  f->dump_unsigned("collections_done", online_fsck_stat.collections_done);
+  if (online_fsck_running)
+    f->dump_stream("collection") << online_fsck_stat.cur_cid;
+  f->dump_unsigned("objects", online_fsck_stat.objects);
+  f->dump_unsigned("errors", online_fsck_stat.errors);
+  f->dump_unsigned("backoffs", online_fsck_stat.backoffs);
+  f->open_array_section("error_log");
+  for (auto& e : online_fsck_stat.error_log)
+    f->dump_string("error", e);
+  f->close_section();
+}
+
+void BlueStore::inject_false_free(const coll_t& cid, const ghobject_t& oid,
+				  bool free)
+{
+  CollectionRef c = _get_collection(cid);
+  assert(c);
+  KeyValueDB::Transaction t = db->get_transaction();
+  {
+    RWLock::RLocker l(c->lock);
+    OnodeRef o = c->get_onode(oid, false);
+    assert(o && o->exists);
+    assert(!o->onode.block_map.empty());
+    const bluestore_extent_t& e = o->onode.block_map.begin()->second;
+    dout(1) << __func__ << " " << oid << " " << e
+	    << (free ? " free" : " allocated") << dendl;
+    if (free)
+      fm->release(e.offset, e.length, t);
+    else
+      fm->allocate(e.offset, e.length, t);
+  }
+  db->submit_transaction_sync(t);
+}
+
+int BlueStore::get_csum_coverage(const coll_t& cid, const ghobject_t& oid,
+				 size_t *valid, size_t *chunks)
+{
+  CollectionRef c = _get_collection(cid);
+  if (!c)
+    return -ENOENT;
+  RWLock::RLocker l(c->lock);
+  OnodeRef o = c->get_onode(oid, false);
+  if (!o || !o->exists)
+    return -ENOENT;
+  const bluestore_csum_t& csum = o->onode.csum;
+  *chunks = csum.get_num_chunks();
+  *valid = 0;
+  for (size_t i = 0; i < *chunks; ++i) {
+    if (csum.is_valid(i))
+      ++*valid;
+  }
+  return 0;
+}
+
+void BlueStore::_online_fsck_error(const string& what, int errors)
+{
+  std::lock_guard<std::mutex> l(online_fsck_lock);
+  online_fsck_stat.errors += errors;
+  online_fsck_stat.error_log.push_back(what + ": " + stringify(errors) +
+				       " errors");
+  if (online_fsck_stat.error_log.size() > 100)
+    online_fsck_stat.error_log.pop_front();
+}
+
+bool BlueStore::_online_fsck_throttle(unsigned objects)
+{
+  std::unique_lock<std::mutex> l(online_fsck_lock);
+  online_fsck_stat.objects += objects;
+  double rate = g_conf->bluestore_fsck_online_objects_per_sec;
+  if (rate > 0 && objects) {
+    online_fsck_cond.wait_for(
+      l, std::chrono::duration<double>(objects / rate),
+      [this]() { return online_fsck_stop; });
+  }
+  // yield to client io
+  int64_t busy = g_conf->bluestore_fsck_online_busy_ops;
+  while (!online_fsck_stop && busy > 0 &&
+	 throttle_ops.get_current() >= busy) {
+    dout(20) << __func__ << " " << throttle_ops.get_current()
+	     << " ops in flight, backing off" << dendl;
+    ++online_fsck_stat.backoffs;
+    online_fsck_cond.wait_for(
+      l, std::chrono::duration<double>(
+	g_conf->bluestore_fsck_online_busy_sleep),
+      [this]() { return online_fsck_stop; });
+  }
+  return !online_fsck_stop;
+}
+
+int BlueStore::_online_fsck_batch(CollectionRef c, const string& end,
+				  string *pos, bool *done)
+{
+  unsigned max = MAX(1, g_conf->bluestore_fsck_online_batch);
+  KeyValueDB::WholeSpaceIterator it = db->get_snapshot_iterator();
+
+  // load a batch of onodes, ending on a hash boundary so that each
+  // enode is checked against all of its objects
+  vector<pair<ghobject_t,bluestore_onode_t>> objs;
+  *done = true;
+  for (it->upper_bound(PREFIX_OBJ, *pos);
+       it->valid() && it->raw_key_is_prefixed(PREFIX_OBJ);
+       it->next()) {
+    string key = it->key();
+    if (key >= end)
+      break;
+    if (is_enode_key(key))
+      continue;
+    ghobject_t oid;
+    int r = get_key_object(key, &oid);
+    if (r < 0) {
+      derr << __func__ << " bad object key " << pretty_binary_string(key)
+	   << dendl;
+      _online_fsck_error(pretty_binary_string(key), 1);
+      *pos = key;
+      continue;
+    }
+    if (objs.size() >= max &&
+	oid.hobj.get_hash() != objs.back().first.hobj.get_hash()) {
+      *done = false;
+      break;
+    }
+    objs.resize(objs.size() + 1);
+    objs.back().first = oid;
+    bufferlist bl = it->value();
+    bufferlist::iterator p = bl.begin();
+    try {
+      ::decode(objs.back().second, p);
+    } catch (buffer::error& e) {
+      derr << __func__ << " " << oid << " failed to decode onode" << dendl;
+      _online_fsck_error(stringify(oid), 1);
+      objs.pop_back();
+    }
+    *pos = key;
+  }
+  dout(20) << __func__ << " " << c->cid << " " << objs.size() << " objects"
+	   << (*done ? ", done" : "") << dendl;
+
+  spg_t pgid;
+  if (!c->cid.is_pg(&pgid))
+    pgid = spg_t();  // meta
+  set<uint64_t> used_nids, used_omap_head;
+  interval_set<uint64_t> used_blocks;
+  vector<bluestore_extent_t> hash_shared;
+  for (unsigned i = 0; i < objs.size(); ++i) {
+    const ghobject_t& oid = objs[i].first;
+    bluestore_onode_t& onode = objs[i].second;
+    dout(30) << __func__ << "  " << oid << dendl;
+    int errors = 0;
+    if (onode.nid && !used_nids.insert(onode.nid).second) {
+      derr << " " << oid << " nid " << onode.nid << " already in use" << dendl;
+      ++errors;
+    }
+    errors += _fsck_check_extents(oid, onode, used_blocks, hash_shared);
+
+    // anything we reference must be allocated
+    for (auto& b : onode.block_map) {
+      if (!b.second.has_flag(bluestore_extent_t::FLAG_SHARED) &&
+	  fm->is_any_free(it, b.second.offset, b.second.length)) {
+	derr << " " << oid << " extent " << b.first << ": " << b.second
+	     << " is free in freelist" << dendl;
+	++errors;
+      }
+    }
+    for (auto& b : onode.blob_map) {
+      for (auto& e : b.second.extents) {
+	if (!e.has_flag(bluestore_extent_t::FLAG_SHARED) &&
+	    fm->is_any_free(it, e.offset, e.length)) {
+	  derr << " " << oid << " blob " << b.first << ": " << b.second
+	       << " extent " << e << " is free in freelist" << dendl;
+	  ++errors;
+	}
+      }
+    }
+
+    for (auto& v : onode.overlay_map) {
+      string key;
+      get_overlay_key(onode.nid, v.second.key, &key);
+      it->lower_bound(PREFIX_OVERLAY, key);
+      if (!it->valid() || !it->raw_key_is_prefixed(PREFIX_OVERLAY) ||
+	  it->key() != key) {
+	derr << " " << oid << " overlay " << v.first << " " << v.second
+	     << " missing" << dendl;
+	++errors;
+      }
+    }
+
+    if (onode.omap_head && !used_omap_head.insert(onode.omap_head).second) {
+      derr << " " << oid << " omap_head " << onode.omap_head
+	   << " already in use" << dendl;
+      ++errors;
+    }
+    if (errors)
+      _online_fsck_error(stringify(oid), errors);
+
+    // shared extents are refcounted by the enode for their hash
+    uint32_t hash = oid.hobj.get_hash();
+    if (hash_shared.empty() ||
+	(i + 1 < objs.size() && objs[i + 1].first.hobj.get_hash() == hash))
+      continue;
+    string ekey;
+    get_enode_key(pgid.shard, pgid.pool(), hash, &ekey);
+    bluestore_extent_ref_map_t ref_map;
+    it->lower_bound(PREFIX_OBJ, ekey);
+    if (it->valid() && it->raw_key_is_prefixed(PREFIX_OBJ) &&
+	it->key() == ekey) {
+      bufferlist bl = it->value();
+      bufferlist::iterator p = bl.begin();
+      ::decode(ref_map, p);
+    }
+    errors = _verify_enode_shared(hash, ref_map, hash_shared, used_blocks);
+    for (auto& e : hash_shared) {
+      if (fm->is_any_free(it, e.offset, e.length)) {
+	derr << " hash " << hash << " shared extent " << e
+	     << " is free in freelist" << dendl;
+	++errors;
       }
-      dout(20) << __func__ << "  wal " << wt.seq
-	       << " ops " << wt.ops.size()
-	       << " released " << wt.released << dendl;
-      used_blocks.insert(wt.released);
     }
+    if (errors) {
+      std::stringstream ss;
+      ss << "hash " << std::hex << hash;
+      _online_fsck_error(ss.str(), errors);
+    }
+    hash_shared.clear();
   }
+  return objs.size();
+}
 
-  dout(1) << __func__ << " checking freelist vs allocated" << dendl;
+int BlueStore::_online_fsck_collection(CollectionRef c)
+{
+  string temp_start, temp_end, start, end;
   {
-    const auto& free = fm->get_freelist();
-    for (auto p = free.begin();
-	 p != free.end(); ++p) {
-      if (used_blocks.intersects(p->first, p->second)) {
-	derr << __func__ << " free extent " << p->first << "~" << p->second
-	     << " intersects allocated blocks" << dendl;
-	interval_set<uint64_t> free, overlap;
-	free.insert(p->first, p->second);
-	overlap.intersection_of(free, used_blocks);
-	derr << __func__ << " overlap: " << overlap << dendl;
-	++errors;
-	continue;
-      }
-      used_blocks.insert(p->first, p->second);
+    RWLock::RLocker l(c->lock);
+    if (!c->exists)
+      return 0;
+    get_coll_key_range(c->cid, c->cnode.bits, &temp_start, &temp_end,
+		       &start, &end);
+  }
+  dout(10) << __func__ << " " << c->cid << dendl;
+
+  // temp objects, then the rest
+  string ranges[2][2] = { { temp_start, temp_end }, { start, end } };
+  for (auto& r : ranges) {
+    string pos = r[0];
+    bool done = false;
+    while (!done) {
+      int n = _online_fsck_batch(c, r[1], &pos, &done);
+      if (!_online_fsck_throttle(n))
+	return -ECANCELED;
     }
-    if (!used_blocks.contains(0, bdev->get_size())) {
-      derr << __func__ << " leaked some space; free+used = "
-	   << used_blocks
-	   << " != expected 0~" << bdev->get_size()
-	   << dendl;
-      ++errors;
+  }
+  return 0;
+}
+
+void BlueStore::_online_fsck_thread()
+{
+  dout(1) << __func__ << " start" << dendl;
+  vector<coll_t> cids;
+  {
+    RWLock::RLocker l(coll_lock);
+    for (auto& p : coll_map)
+      cids.push_back(p.first);
+  }
+  {
+    std::lock_guard<std::mutex> l(online_fsck_lock);
+    online_fsck_stat.collections = cids.size();
+  }
+  for (auto& cid : cids) {
+    {
+      std::lock_guard<std::mutex> l(online_fsck_lock);
+      if (online_fsck_stop)
+	break;
+      online_fsck_stat.cur_cid = cid;
     }
+    CollectionRef c = _get_collection(cid);
+    if (c && _online_fsck_collection(c) < 0)
+      break;
+    std::lock_guard<std::mutex> l(online_fsck_lock);
+    ++online_fsck_stat.collections_done;
+  }
+
+  std::lock_guard<std::mutex> l(online_fsck_lock);
+  online_fsck_stat.finished = ceph_clock_now(g_ceph_context);
+  online_fsck_running = false;
+  online_fsck_cond.notify_all();
+  dout(1) << __func__ << " end, checked "
+	  << online_fsck_stat.collections_done << "/"
+	  << online_fsck_stat.collections << " collections, "
+	  << online_fsck_stat.objects << " objects, "
+	  << online_fsck_stat.errors << " errors" << dendl;
+}
+
+class BlueStore::SocketHook : public AdminSocketHook {
+  BlueStore *store;
+public:
+  explicit SocketHook(BlueStore *s) : store(s) {}
+  bool call(std::string command, cmdmap_t& cmdmap, std::string format,
+	    bufferlist& out) {
+    Formatter *f = Formatter::create(format, "json-pretty", "json-pretty");
+    f->open_object_section("bluestore_fsck");
+    if (command == "bluestore fsck start") {
+      int r = store->start_online_fsck();
+      f->dump_int("result", r);
+      if (r < 0)
+	f->dump_string("error", cpp_strerror(r));
+    } else if (command == "bluestore fsck stop") {
+      store->stop_online_fsck();
+    }
+    store->dump_online_fsck(f);
+    f->close_section();
+    f->flush(out);
+    delete f;
+    return true;
   }
+};
 
- out_scan:
-  coll_map.clear();
- out_alloc:
-  _close_alloc();
- out_db:
-  it.reset();  // before db is closed
-  _close_db();
- out_bdev:
-  _close_bdev();
- out_fsid:
-  _close_fsid();
- out_path:
-  _close_path();
+static const char *online_fsck_commands[][2] = {
+  { "bluestore fsck start", "start an online fsck of all collections" },
+  { "bluestore fsck stop", "stop a running online fsck" },
+  { "bluestore fsck status", "show online fsck progress and errors" },
+};
 
-  // fatal errors take precedence
-  if (r < 0)
-    return r;
+void BlueStore::_register_admin_socket()
+{
+  asok_hook = new SocketHook(this);
+  AdminSocket *admin_socket = g_ceph_context->get_admin_socket();
+  unsigned n = 0;
+  int r = 0;
+  for (; n < sizeof(online_fsck_commands) / sizeof(online_fsck_commands[0]);
+       ++n) {
+    r = admin_socket->register_command(online_fsck_commands[n][0],
+				       online_fsck_commands[n][0],
+				       asok_hook,
+				       online_fsck_commands[n][1]);
+    if (r < 0)
+      break;
+  }
+  if (r == 0)
+    return;
+  // another instance in this process may already own the commands
+  if (r != -EEXIST) {
+    derr << __func__ << " error registering admin socket command: "
+	 << cpp_strerror(r) << dendl;
+  }
+  while (n-- > 0)
+    admin_socket->unregister_command(online_fsck_commands[n][0]);
+  delete asok_hook;
+  asok_hook = NULL;
+}
 
-  dout(1) << __func__ << " finish with " << errors << " errors" << dendl;
-  return errors;
+void BlueStore::_unregister_admin_socket()
+{
+  if (asok_hook) {
+    AdminSocket *admin_socket = g_ceph_context->get_admin_socket();
+    for (auto& c : online_fsck_commands)
+      admin_socket->unregister_command(c[0]);
+    delete asok_hook;
+    asok_hook = NULL;
+  }
 }
 
 void BlueStore::_sync()
@@ -2410,7 +3492,9 @@ void BlueStore::_sync()
 
   std::unique_lock<std::mutex> l(kv_lock);
   while (!kv_committing.empty() ||
-	 !kv_queue.empty()) {
+	 !kv_queue.empty() ||
+	 !kv_committed_queue.empty() ||
+	 kv_finalizing) {
     dout(20) << " waiting for kv to commit" << dendl;
     kv_sync_cond.wait(l);
   }
@@ -2442,6 +3526,21 @@ BlueStore::CollectionRef BlueStore::_get_collection(const coll_t& cid)
   return cp->second;
 }
 
+BlueStore::Cache *BlueStore::_get_cache_shard(const coll_t& cid)
+{
+  return cache_shards[std::hash<coll_t>()(cid) % cache_shards.size()];
+}
+
+void BlueStore::_trim_cache(Cache *cache)
+{
+  // the budget is split evenly over the shards
+  uint64_t shard_size = g_conf->bluestore_cache_size / cache_shards.size();
+  uint64_t meta_size = shard_size * g_conf->bluestore_cache_meta_ratio;
+  uint64_t onode_max = meta_size /
+    MAX(1, g_conf->bluestore_cache_onode_bytes);
+  cache->trim(onode_max, shard_size - meta_size);
+}
+
 void BlueStore::_queue_reap_collection(CollectionRef& c)
 {
   dout(10) << __func__ << " " << c->cid << dendl;
@@ -2462,16 +3561,16 @@ void BlueStore::_reap_collections()
        ++p) {
     CollectionRef c = *p;
     dout(10) << __func__ << " " << c->cid << dendl;
-    {
-      pair<ghobject_t,OnodeRef> next;
-      while (c->onode_map.get_next(next.first, &next)) {
-	assert(!next.second->exists);
-	if (!next.second->flush_txns.empty()) {
-	  dout(10) << __func__ << " " << c->cid << " " << next.second->oid
-		   << " flush_txns " << next.second->flush_txns << dendl;
-	  return;
-	}
-      }
+    if (c->onode_map.map_any([&](OnodeRef o) {
+	  assert(!o->exists);
+	  if (!o->flush_txns.empty()) {
+	    dout(10) << __func__ << " " << c->cid << " " << o->oid
+		     << " flush_txns " << o->flush_txns << dendl;
+	    return true;
+	  }
+	  return false;
+	})) {
+      return;
     }
     c->onode_map.clear();
     dout(10) << __func__ << " " << c->cid << " done" << dendl;
@@ -2509,6 +3608,20 @@ bool BlueStore::exists(CollectionHandle &c_, const ghobject_t& oid)
   return true;
 }
 
+bool BlueStore::has_builtin_csum(CollectionHandle &c_, const ghobject_t& oid)
+{
+  Collection *c = static_cast<Collection*>(c_.get());
+  if (!c->exists)
+    return false;
+  RWLock::RLocker l(c->lock);
+  OnodeRef o = c->get_onode(oid, false);
+  if (!o || !o->exists)
+    return false;
+  bool r = o->onode.is_csum_covered();
+  dout(20) << __func__ << " " << c->cid << " " << oid << " = " << r << dendl;
+  return r;
+}
+
 int BlueStore::stat(
     const coll_t& cid,
     const ghobject_t& oid,
@@ -2589,6 +3702,13 @@ int BlueStore::read(
     length = o->onode.size;
 
   r = _do_read(o, offset, length, bl, op_flags);
+  if (r == -EIO && !allow_eio && g_conf->bluestore_fail_eio) {
+    derr << __func__ << " " << cid << " " << oid << " " << offset << "~"
+	 << length << " got eio" << dendl;
+    assert(0 == "eio on read");
+  }
+  o.reset();
+  _trim_cache(c->cache);
 
  out:
   dout(10) << __func__ << " " << cid << " " << oid
@@ -2597,6 +3717,71 @@ int BlueStore::read(
   return r;
 }
 
+int BlueStore::read_multi(
+  const coll_t& cid,
+  vector<read_multi_op_t>& ops,
+  bool allow_eio)
+{
+  CollectionHandle c = _get_collection(cid);
+  if (!c)
+    return -ENOENT;
+  return read_multi(c, ops, allow_eio);
+}
+
+int BlueStore::read_multi(
+  CollectionHandle &c_,
+  vector<read_multi_op_t>& ops,
+  bool allow_eio)
+{
+  Collection *c = static_cast<Collection*>(c_.get());
+  const coll_t &cid = c->get_cid();
+  dout(15) << __func__ << " " << cid << " " << ops.size() << " objects"
+	   << dendl;
+  if (!c->exists)
+    return -ENOENT;
+  RWLock::RLocker l(c->lock);
+
+  // resolve all the onodes in one pass under a single hold of the
+  // collection lock, before any data io is issued.
+  vector<OnodeRef> onodes(ops.size());
+  for (unsigned i = 0; i < ops.size(); ++i) {
+    onodes[i] = c->get_onode(ops[i].oid, false);
+  }
+
+  for (unsigned i = 0; i < ops.size(); ++i) {
+    read_multi_op_t& op = ops[i];
+    OnodeRef& o = onodes[i];
+    op.r = 0;
+    op.bls.clear();
+    op.bls.resize(op.extents.size());
+    if (!o || !o->exists) {
+      op.r = -ENOENT;
+      continue;
+    }
+    for (unsigned k = 0; k < op.extents.size(); ++k) {
+      uint64_t offset = op.extents[k].offset;
+      uint64_t length = op.extents[k].length;
+      if (offset == length && offset == 0)
+	length = o->onode.size;
+      int r = _do_read(o, offset, length, op.bls[k], op.extents[k].op_flags);
+      if (r < 0) {
+	if (r == -EIO && !allow_eio && g_conf->bluestore_fail_eio) {
+	  derr << __func__ << " " << cid << " " << op.oid << " " << offset
+	       << "~" << length << " got eio" << dendl;
+	  assert(0 == "eio on read");
+	}
+	op.r = r;
+	break;
+      }
+    }
+    dout(20) << __func__ << " " << cid << " " << op.oid << " "
+	     << op.extents.size() << " extents = " << op.r << dendl;
+  }
+  onodes.clear();
+  _trim_cache(c->cache);
+  return 0;
+}
+
 int BlueStore::_do_read(
     OnodeRef o,
     uint64_t offset,
@@ -2606,9 +3791,13 @@ int BlueStore::_do_read(
 {
   map<uint64_t,bluestore_extent_t>::iterator bp, bend;
   map<uint64_t,bluestore_overlay_t>::iterator op, oend;
+  map<uint64_t,bluestore_compressed_blob_t>::iterator cp, cend;
   uint64_t block_size = bdev->get_block_size();
   int r = 0;
   IOContext ioc(NULL);   // FIXME?
+  uint64_t blob_bl_offset = -1ull;  // blob decompressed into blob_bl
+  bufferlist blob_bl;
+  uint64_t orig_offset = offset;
 
   // generally, don't buffer anything, unless the client explicitly requests
   // it.
@@ -2622,6 +3811,9 @@ int BlueStore::_do_read(
     dout(20) << __func__ << " defaulting to buffered read" << dendl;
     buffered = true;
   }
+  // keep what we read in our own cache unless told it won't be reused
+  bool cache = (op_flags & (CEPH_OSD_OP_FLAG_FADVISE_DONTNEED |
+			    CEPH_OSD_OP_FLAG_FADVISE_NOCACHE)) == 0;
 
   dout(20) << __func__ << " " << offset << "~" << length << " size "
 	   << o->onode.size << dendl;
@@ -2636,6 +3828,26 @@ int BlueStore::_do_read(
     length = o->onode.size - offset;
   }
 
+  {
+    // the buffer cache always reflects the latest writes, so a full
+    // hit need not wait for io in flight.
+    map<uint64_t,bufferlist> cached;
+    interval_set<uint64_t> cached_intervals;
+    o->bc.read(offset, length, cached, cached_intervals);
+    uint64_t hit = cached_intervals.size();
+    logger->inc(l_bluestore_buffer_hit_bytes, hit);
+    logger->inc(l_bluestore_buffer_miss_bytes, length - hit);
+    if (hit == length) {
+      dout(20) << __func__ << " " << offset << "~" << length << " cached"
+	       << dendl;
+      for (auto& p : cached) {
+	bl.claim_append(p.second);
+      }
+      r = length;
+      goto out;
+    }
+  }
+
   o->flush();
 
   // loop over overlays and data fragments.  overlays take precedence.
@@ -2649,6 +3861,8 @@ int BlueStore::_do_read(
   if (op != o->onode.overlay_map.begin()) {
     --op;
   }
+  cend = o->onode.blob_map.end();
+  cp = o->onode.seek_blob(offset);
   while (length > 0) {
     if (op != oend && op->first + op->second.length < offset) {
       dout(20) << __func__ << " skip overlay " << op->first << " " << op->second
@@ -2662,6 +3876,12 @@ int BlueStore::_do_read(
       ++bp;
       continue;
     }
+    if (cp != cend && cp->first + cp->second.length <= offset) {
+      dout(30) << __func__ << " skip blob " << cp->first << " " << cp->second
+	       << dendl;
+      ++cp;
+      continue;
+    }
 
     // overlay?
     if (op != oend && op->first <= offset) {
@@ -2694,6 +3914,35 @@ int BlueStore::_do_read(
       x_len = op->first - offset;
     }
 
+    // compressed blob?
+    if (cp != cend && cp->first <= offset) {
+      uint64_t x_off = offset - cp->first;
+      x_len = MIN(x_len, cp->second.length - x_off);
+      dout(30) << __func__ << " blob " << cp->first << ": " << cp->second
+	       << " use " << x_off << "~" << x_len << dendl;
+      if (blob_bl_offset != cp->first) {
+	r = _read_blob(o, cp->first, cp->second, &blob_bl, &ioc, buffered);
+	if (r < 0) {
+	  goto out;
+	}
+	blob_bl_offset = cp->first;
+      }
+      bufferlist u;
+      u.substr_of(blob_bl, x_off, x_len);
+      bl.claim_append(u);
+      offset += x_len;
+      length -= x_len;
+      if (x_off + x_len == cp->second.length) {
+	++cp;
+      }
+      continue;
+    }
+    if (cp != cend &&
+	cp->first > offset &&
+	cp->first - offset < x_len) {
+      x_len = cp->first - offset;
+    }
+
     // extent?
     if (bp != bend && bp->first <= offset) {
       uint64_t x_off = offset - bp->first;
@@ -2703,15 +3952,40 @@ int BlueStore::_do_read(
 		 << " use " << x_off << "~" << x_len
 		 << " final offset " << x_off + bp->second.offset
 		 << dendl;
-	uint64_t front_extra = x_off % block_size;
-	uint64_t r_off = x_off - front_extra;
-	uint64_t r_len = ROUND_UP_TO(x_len + front_extra, block_size);
+	uint64_t r_off = x_off - x_off % block_size;
+	uint64_t r_len = ROUND_UP_TO(x_off + x_len, block_size) - r_off;
+	bool verify = o->onode.csum.has_valid(offset, x_len);
+	if (verify) {
+	  // read whole checksum chunks (within this extent) so we can
+	  // verify them
+	  uint64_t chunk_size = o->onode.csum.get_chunk_size();
+	  uint64_t c_off = bp->first + r_off;
+	  uint64_t c_end = MIN(ROUND_UP_TO(c_off + r_len, chunk_size),
+			       bp->first + bp->second.length);
+	  c_off = MAX(c_off - c_off % chunk_size, bp->first);
+	  r_off = c_off - bp->first;
+	  r_len = c_end - c_off;
+	}
+	uint64_t front_extra = x_off - r_off;
 	dout(30) << __func__ << "  reading " << r_off << "~" << r_len << dendl;
 	bufferlist t;
 	r = bdev->read(r_off + bp->second.offset, r_len, &t, &ioc, buffered);
 	if (r < 0) {
 	  goto out;
 	}
+	if (verify) {
+	  uint64_t bad_offset;
+	  r = o->onode.csum.verify(bp->first + r_off, t, &bad_offset);
+	  if (r < 0) {
+	    derr << __func__ << " " << o->oid << " bad "
+		 << bluestore_csum_t::get_type_name(o->onode.csum.type)
+		 << " checksum for chunk " << bad_offset << "~"
+		 << o->onode.csum.get_chunk_size() << " in extent "
+		 << bp->first << ": " << bp->second << dendl;
+	    logger->inc(l_bluestore_csum_errors);
+	    goto out;
+	  }
+	}
 	r = r_len;
 	bufferlist u;
 	u.substr_of(t, front_extra, x_len);
@@ -2742,11 +4016,67 @@ int BlueStore::_do_read(
     length -= x_len;
   }
   r = bl.length();
+  if (cache) {
+    o->bc.did_read(orig_offset, bl);
+  }
 
  out:
   return r;
 }
 
+int BlueStore::_read_blob(
+  OnodeRef o,
+  uint64_t offset,
+  const bluestore_compressed_blob_t& b,
+  bufferlist *bl,
+  IOContext *ioc,
+  bool buffered)
+{
+  bufferlist raw;
+  for (auto& e : b.extents) {
+    bufferlist t;
+    int r = bdev->read(e.offset, e.length, &t, ioc, buffered);
+    if (r < 0)
+      return r;
+    raw.claim_append(t);
+  }
+  if (b.compressed_length > raw.length() ||
+      b.alg <= Compressor::COMP_ALG_NONE ||
+      b.alg >= Compressor::COMP_ALG_LAST) {
+    derr << __func__ << " " << o->oid << " bad blob " << offset << ": " << b
+	 << dendl;
+    return -EIO;
+  }
+  CompressorRef compressor = _get_compressor(b.alg);
+  if (!compressor)
+    return -EIO;
+  bufferlist compressed;
+  compressed.substr_of(raw, 0, b.compressed_length);
+  bl->clear();
+  int r = compressor->decompress(compressed, *bl);
+  if (r < 0 || bl->length() != b.length) {
+    derr << __func__ << " " << o->oid << " failed to decompress blob "
+	 << offset << ": " << b << ", r = " << r << " length "
+	 << bl->length() << dendl;
+    return -EIO;
+  }
+  if (o->onode.csum.has_valid(offset, b.length)) {
+    uint64_t bad_offset;
+    r = o->onode.csum.verify(offset, *bl, &bad_offset);
+    if (r < 0) {
+      derr << __func__ << " " << o->oid << " bad "
+	   << bluestore_csum_t::get_type_name(o->onode.csum.type)
+	   << " checksum for chunk " << bad_offset << "~"
+	   << o->onode.csum.get_chunk_size() << " in blob "
+	   << offset << ": " << b << dendl;
+      logger->inc(l_bluestore_csum_errors);
+      return r;
+    }
+  }
+  dout(30) << __func__ << " " << offset << ": " << b << dendl;
+  return 0;
+}
+
 int BlueStore::fiemap(
   const coll_t& cid,
   const ghobject_t& oid,
@@ -2792,6 +4122,16 @@ int BlueStore::fiemap(
     len = o->onode.size - offset;
   }
 
+  // compressed blobs never overlap extents or overlays
+  for (auto cp = o->onode.seek_blob(offset);
+       cp != o->onode.blob_map.end() && cp->first < offset + len;
+       ++cp) {
+    uint64_t x_off = MAX(cp->first, offset);
+    uint64_t x_end = MIN(cp->first + cp->second.length, offset + len);
+    dout(30) << __func__ << " blob " << x_off << "~" << x_end - x_off << dendl;
+    m.insert(x_off, x_end - x_off);
+  }
+
   // loop over overlays and data fragments.  overlays take precedence.
   bend = o->onode.block_map.end();
   bp = o->onode.block_map.lower_bound(offset);
@@ -2982,6 +4322,19 @@ int BlueStore::collection_bits(const coll_t& cid)
   return c->cnode.bits;
 }
 
+int BlueStore::set_collection_opts(
+  const coll_t& cid,
+  const pool_opts_t& opts)
+{
+  dout(15) << __func__ << " " << cid << " options " << opts << dendl;
+  CollectionRef c = _get_collection(cid);
+  if (!c)
+    return -ENOENT;
+  RWLock::WLocker l(c->lock);
+  c->pool_opts = opts;
+  return 0;
+}
+
 int BlueStore::collection_list(
   const coll_t& cid, ghobject_t start, ghobject_t end,
   bool sort_bitwise, int max,
@@ -3239,10 +4592,10 @@ int BlueStore::omap_get(
     goto out;
   o->flush();
   {
-    KeyValueDB::Iterator it = db->get_iterator(PREFIX_OMAP);
     string head, tail;
     get_omap_header(o->onode.omap_head, &head);
     get_omap_tail(o->onode.omap_head, &tail);
+    KeyValueDB::Iterator it = db->get_iterator(PREFIX_OMAP, tail);
     it->lower_bound(head);
     while (it->valid()) {
       if (it->key() == head) {
@@ -3350,10 +4703,10 @@ int BlueStore::omap_get_keys(
     goto out;
   o->flush();
   {
-    KeyValueDB::Iterator it = db->get_iterator(PREFIX_OMAP);
     string head, tail;
     get_omap_key(o->onode.omap_head, string(), &head);
     get_omap_tail(o->onode.omap_head, &tail);
+    KeyValueDB::Iterator it = db->get_iterator(PREFIX_OMAP, tail);
     it->lower_bound(head);
     while (it->valid()) {
       if (it->key() >= tail) {
@@ -3509,7 +4862,14 @@ ObjectMap::ObjectMapIterator BlueStore::get_omap_iterator(
   }
   o->flush();
   dout(10) << __func__ << " header = " << o->onode.omap_head <<dendl;
-  KeyValueDB::Iterator it = db->get_iterator(PREFIX_OMAP);
+  KeyValueDB::Iterator it;
+  if (o->onode.omap_head) {
+    string tail;
+    get_omap_tail(o->onode.omap_head, &tail);
+    it = db->get_iterator(PREFIX_OMAP, tail);
+  } else {
+    it = db->get_iterator(PREFIX_OMAP);
+  }
   return ObjectMap::ObjectMapIterator(new OmapIteratorImpl(c, o, it));
 }
 
@@ -3636,8 +4996,8 @@ void BlueStore::_txc_state_proc(TransContext *txc)
 	kv_cond.notify_one();
       }
       return;
-    case TransContext::STATE_KV_QUEUED:
-      txc->log_state_latency(logger, l_bluestore_state_kv_queued_lat);
+    case TransContext::STATE_KV_COMMITTING:
+      txc->log_state_latency(logger, l_bluestore_state_kv_committing_lat);
       txc->state = TransContext::STATE_KV_DONE;
       _txc_finish_kv(txc);
       // ** fall-thru **
@@ -3845,7 +5205,7 @@ void BlueStore::_osr_reap_done(OpSequencer *osr)
     }
 
     if (txc->first_collection) {
-      txc->first_collection->onode_map.trim();
+      _trim_cache(txc->first_collection->cache);
     }
 
     osr->q.pop_front();
@@ -3902,7 +5262,9 @@ void BlueStore::_kv_sync_thread()
     assert(kv_committing.empty());
     assert(wal_cleaning.empty());
     if (kv_queue.empty() && wal_cleanup_queue.empty()) {
-      if (kv_stop)
+      // the finalize thread may still queue wal cleanups
+      if (kv_stop && !kv_finalizing &&
+	  kv_committed_queue.empty() && wal_cleaned_queue.empty())
 	break;
       dout(20) << __func__ << " sleep" << dendl;
       kv_sync_cond.notify_all();
@@ -3919,10 +5281,20 @@ void BlueStore::_kv_sync_thread()
       dout(30) << __func__ << " committing txc " << kv_committing << dendl;
       dout(30) << __func__ << " wal_cleaning txc " << wal_cleaning << dendl;
 
+      for (std::deque<TransContext *>::iterator it = kv_committing.begin();
+	   it != kv_committing.end();
+	   ++it) {
+	(*it)->log_state_latency(logger, l_bluestore_state_kv_queued_lat);
+	(*it)->state = TransContext::STATE_KV_COMMITTING;
+      }
+      logger->inc(l_bluestore_kv_batch_txcs, kv_committing.size());
+
       alloc->commit_start();
 
       // flush/barrier on block device
       bdev->flush();
+      utime_t flushed = ceph_clock_now(NULL);
+      logger->tinc(l_bluestore_kv_flush_lat, flushed - start);
 
       if (!g_conf->bluestore_sync_transaction &&
 	  !g_conf->bluestore_sync_submit_transaction) {
@@ -4003,16 +5375,7 @@ void BlueStore::_kv_sync_thread()
       dout(20) << __func__ << " committed " << kv_committing.size()
 	       << " cleaned " << wal_cleaning.size()
 	       << " in " << dur << dendl;
-      while (!kv_committing.empty()) {
-	TransContext *txc = kv_committing.front();
-	_txc_state_proc(txc);
-	kv_committing.pop_front();
-      }
-      while (!wal_cleaning.empty()) {
-	TransContext *txc = wal_cleaning.front();
-	_txc_state_proc(txc);
-	wal_cleaning.pop_front();
-      }
+      logger->tinc(l_bluestore_kv_commit_lat, finish - flushed);
 
       alloc->commit_finish();
 
@@ -4025,7 +5388,64 @@ void BlueStore::_kv_sync_thread()
 	}
       }
 
+      // hand the completions off so that we can start committing the
+      // next batch right away
+      l.lock();
+      kv_committed_queue.insert(kv_committed_queue.end(),
+				kv_committing.begin(), kv_committing.end());
+      wal_cleaned_queue.insert(wal_cleaned_queue.end(),
+			       wal_cleaning.begin(), wal_cleaning.end());
+      kv_committing.clear();
+      wal_cleaning.clear();
+      kv_finalize_cond.notify_one();
+    }
+  }
+  dout(10) << __func__ << " finish" << dendl;
+}
+
+void BlueStore::_kv_finalize_thread()
+{
+  dout(10) << __func__ << " start" << dendl;
+  std::unique_lock<std::mutex> l(kv_lock);
+  while (true) {
+    if (kv_committed_queue.empty() && wal_cleaned_queue.empty()) {
+      if (kv_finalize_stop)
+	break;
+      dout(20) << __func__ << " sleep" << dendl;
+      kv_finalize_cond.wait(l);
+      dout(20) << __func__ << " wake" << dendl;
+    } else {
+      deque<TransContext*> committed, cleaned;
+      committed.swap(kv_committed_queue);
+      cleaned.swap(wal_cleaned_queue);
+      kv_finalizing = true;
+      l.unlock();
+
+      dout(20) << __func__ << " committed " << committed.size()
+	       << " cleaned " << cleaned.size() << dendl;
+      while (!committed.empty()) {
+	TransContext *txc = committed.front();
+	_txc_state_proc(txc);
+	committed.pop_front();
+      }
+      if (g_conf->bluestore_sync_wal_apply) {
+	// the wal work for this commit group was just batched above;
+	// there is no point in making it wait for more.
+	std::lock_guard<std::mutex> wl(wal_batch_lock);
+	if (wal_batch)
+	  _wal_batch_submit();
+      }
+      while (!cleaned.empty()) {
+	TransContext *txc = cleaned.front();
+	_txc_state_proc(txc);
+	cleaned.pop_front();
+      }
+
       l.lock();
+      kv_finalizing = false;
+      // wake up _sync() waiters, and a kv_sync_thread that is stopping
+      kv_sync_cond.notify_all();
+      kv_cond.notify_one();
     }
   }
   dout(10) << __func__ << " finish" << dendl;
@@ -4059,6 +5479,18 @@ int BlueStore::_wal_apply(TransContext *txc)
   }
 
   assert(txc->ioc.pending_aios.empty());
+  {
+    std::lock_guard<std::mutex> l(wal_batch_lock);
+    if (g_conf->bluestore_wal_batch_ops && _wal_batchable(wt)) {
+      _wal_batch_add(txc);
+      return 0;
+    }
+    // anything already batched may overlap with what we are about
+    // to read or write; get it to the device first.
+    if (wal_batch)
+      _wal_batch_submit();
+  }
+
   vector<OnodeRef>::iterator q = txc->wal_op_onodes.begin();
   for (list<bluestore_wal_op_t>::iterator p = wt.ops.begin();
        p != wt.ops.end();
@@ -4085,7 +5517,8 @@ int BlueStore::_wal_finish(TransContext *txc)
   return 0;
 }
 
-int BlueStore::_do_wal_op(bluestore_wal_op_t& wo, IOContext *ioc)
+int BlueStore::_do_wal_op(bluestore_wal_op_t& wo, IOContext *ioc,
+			  WALBatch *batch)
 {
   const uint64_t block_size = bdev->get_block_size();
   const uint64_t block_mask = ~(block_size - 1);
@@ -4095,7 +5528,8 @@ int BlueStore::_do_wal_op(bluestore_wal_op_t& wo, IOContext *ioc)
   _do_read_all_overlays(wo);
 
   // NOTE: we are doing all reads and writes buffered so that we can
-  // avoid worrying about multiple RMW cycles over the same blocks.
+  // avoid worrying about multiple RMW cycles over the same blocks.  If
+  // we are filling a batch, writes land in the batch and reads see them.
 
   switch (wo.op) {
   case bluestore_wal_op_t::OP_WRITE:
@@ -4116,7 +5550,7 @@ int BlueStore::_do_wal_op(bluestore_wal_op_t& wo, IOContext *ioc)
       offset = offset & block_mask;
       dout(20) << __func__ << "  reading initial partial block "
 	       << src_offset << "~" << block_size << dendl;
-      r = bdev->read(src_offset, block_size, &first, ioc, true);
+      r = _wal_read(batch, src_offset, block_size, &first, ioc);
       assert(r == 0);
       bufferlist t;
       t.substr_of(first, 0, first_len);
@@ -4135,7 +5569,7 @@ int BlueStore::_do_wal_op(bluestore_wal_op_t& wo, IOContext *ioc)
       } else {
 	dout(20) << __func__ << "  reading trailing partial block "
 		 << last_offset << "~" << block_size << dendl;
-	r = bdev->read(last_offset, block_size, &last, ioc, true);
+	r = _wal_read(batch, last_offset, block_size, &last, ioc);
         assert(r == 0);
       }
       bufferlist t;
@@ -4144,7 +5578,7 @@ int BlueStore::_do_wal_op(bluestore_wal_op_t& wo, IOContext *ioc)
       bl.claim_append(t);
     }
     assert((bl.length() & ~block_mask) == 0);
-    r = bdev->aio_write(offset, bl, ioc, true);
+    r = _wal_write(batch, offset, bl, ioc);
     assert(r == 0);
   }
   break;
@@ -4158,11 +5592,11 @@ int BlueStore::_do_wal_op(bluestore_wal_op_t& wo, IOContext *ioc)
     assert(wo.extent.length == wo.src_extent.length);
     assert((wo.src_extent.offset & ~block_mask) == 0);
     bufferlist bl;
-    r = bdev->read(wo.src_extent.offset, wo.src_extent.length, &bl, ioc,
-		       true);
+    r = _wal_read(batch, wo.src_extent.offset, wo.src_extent.length, &bl,
+		  ioc);
     assert(r == 0);
     assert(bl.length() == wo.extent.length);
-    r = bdev->aio_write(wo.extent.offset, bl, ioc, true);
+    r = _wal_write(batch, wo.extent.offset, bl, ioc);
     assert(r == 0);
   }
   break;
@@ -4178,11 +5612,11 @@ int BlueStore::_do_wal_op(bluestore_wal_op_t& wo, IOContext *ioc)
       uint64_t first_offset = offset & block_mask;
       dout(20) << __func__ << "  reading initial partial block "
 	       << first_offset << "~" << block_size << dendl;
-      r = bdev->read(first_offset, block_size, &first, ioc, true);
+      r = _wal_read(batch, first_offset, block_size, &first, ioc);
       assert(r == 0);
       size_t z_len = MIN(block_size - first_len, length);
       memset(first.c_str() + first_len, 0, z_len);
-      r = bdev->aio_write(first_offset, first, ioc, true);
+      r = _wal_write(batch, first_offset, first, ioc);
       assert(r == 0);
       offset += block_size - first_len;
       length -= z_len;
@@ -4191,7 +5625,13 @@ int BlueStore::_do_wal_op(bluestore_wal_op_t& wo, IOContext *ioc)
     if (length >= block_size) {
       uint64_t middle_len = length & block_mask;
       dout(20) << __func__ << "  zero " << offset << "~" << length << dendl;
-      r = bdev->aio_zero(offset, middle_len, ioc);
+      if (batch) {
+	bufferlist zbl;
+	zbl.append_zero(middle_len);
+	r = _wal_write(batch, offset, zbl, ioc);
+      } else {
+	r = bdev->aio_zero(offset, middle_len, ioc);
+      }
       assert(r == 0);
       offset += middle_len;
       length -= middle_len;
@@ -4202,20 +5642,187 @@ int BlueStore::_do_wal_op(bluestore_wal_op_t& wo, IOContext *ioc)
       bufferlist last;
       dout(20) << __func__ << "  reading trailing partial block "
 	       << offset << "~" << block_size << dendl;
-      r = bdev->read(offset, block_size, &last, ioc, true);
+      r = _wal_read(batch, offset, block_size, &last, ioc);
       assert(r == 0);
       memset(last.c_str(), 0, length);
-      r = bdev->aio_write(offset, last, ioc, true);
+      r = _wal_write(batch, offset, last, ioc);
+      assert(r == 0);
+    }
+  }
+  break;
+
+  default:
+    assert(0 == "unrecognized wal op");
+  }
+
+  return 0;
+}
+
+int BlueStore::_wal_read(WALBatch *batch, uint64_t offset, uint64_t length,
+			 bufferlist *bl, IOContext *ioc)
+{
+  int r = bdev->read(offset, length, bl, ioc, true);
+  if (r < 0 || !batch)
+    return r;
+  // batched blocks are newer than what is on the device
+  const uint64_t block_size = bdev->get_block_size();
+  for (map<uint64_t,bufferlist>::iterator p = batch->blocks.lower_bound(offset);
+       p != batch->blocks.end() && p->first < offset + length;
+       ++p) {
+    dout(30) << __func__ << "  batched block " << p->first << dendl;
+    bl->copy_in(p->first - offset, block_size, p->second);
+  }
+  return 0;
+}
+
+int BlueStore::_wal_write(WALBatch *batch, uint64_t offset, bufferlist& bl,
+			  IOContext *ioc)
+{
+  if (!batch)
+    return bdev->aio_write(offset, bl, ioc, true);
+  const uint64_t block_size = bdev->get_block_size();
+  assert(offset % block_size == 0);
+  assert(bl.length() % block_size == 0);
+  for (uint64_t o = 0; o < bl.length(); o += block_size) {
+    bufferlist& t = batch->blocks[offset + o];
+    t.clear();
+    t.substr_of(bl, o, block_size);
+  }
+  return 0;
+}
+
+bool BlueStore::_wal_batchable(bluestore_wal_transaction_t& wt)
+{
+  const uint64_t block_size = bdev->get_block_size();
+  uint64_t bytes = 0;
+  for (list<bluestore_wal_op_t>::iterator p = wt.ops.begin();
+       p != wt.ops.end();
+       ++p) {
+    uint64_t len = ROUND_UP_TO(p->extent.end(), block_size) -
+      (p->extent.offset & ~(block_size - 1));
+    if (len > g_conf->bluestore_min_alloc_size)
+      return false;
+    bytes += len;
+  }
+  return bytes <= g_conf->bluestore_wal_batch_bytes;
+}
+
+void BlueStore::_wal_batch_add(TransContext *txc)
+{
+  // caller holds wal_batch_lock
+  utime_t now = ceph_clock_now(g_ceph_context);
+  if (!wal_batch) {
+    wal_batch = new WALBatch;
+    wal_batch->start = now;
+    wal_batch_cond.notify_all();
+  }
+  dout(20) << __func__ << " txc " << txc << " to batch " << wal_batch << dendl;
+  bluestore_wal_transaction_t& wt = *txc->wal_txn;
+  for (list<bluestore_wal_op_t>::iterator p = wt.ops.begin();
+       p != wt.ops.end();
+       ++p) {
+    int r = _do_wal_op(*p, &wal_batch->ioc, wal_batch);
+    assert(r == 0);
+  }
+  txc->log_state_latency(logger, l_bluestore_state_wal_applying_lat);
+  txc->state = TransContext::STATE_WAL_AIO_WAIT;
+  wal_batch->txcs.push_back(txc);
+  wal_batch->joined.push_back(now);
+
+  if (wal_batch->txcs.size() >= g_conf->bluestore_wal_batch_ops ||
+      wal_batch->blocks.size() * bdev->get_block_size() >=
+      g_conf->bluestore_wal_batch_bytes) {
+    logger->inc(l_bluestore_wal_batch_full);
+    _wal_batch_submit();
+  }
+}
+
+void BlueStore::_wal_batch_submit()
+{
+  // caller holds wal_batch_lock, so nobody can read these blocks back
+  // from the device before we have written them.
+  WALBatch *b = wal_batch;
+  wal_batch = NULL;
+
+  // coalesce adjacent blocks into as few writes as we can
+  unsigned ios = 0;
+  uint64_t offset = 0;
+  bufferlist bl;
+  for (map<uint64_t,bufferlist>::iterator p = b->blocks.begin();
+       p != b->blocks.end();
+       ++p) {
+    if (bl.length() && offset + bl.length() != p->first) {
+      int r = bdev->aio_write(offset, bl, &b->ioc, true);
       assert(r == 0);
+      bl.clear();
+      ++ios;
     }
+    if (!bl.length())
+      offset = p->first;
+    bl.append(p->second);
+  }
+  if (bl.length()) {
+    int r = bdev->aio_write(offset, bl, &b->ioc, true);
+    assert(r == 0);
+    ++ios;
+  }
+
+  utime_t now = ceph_clock_now(g_ceph_context);
+  dout(20) << __func__ << " batch " << b << " txcs " << b->txcs.size()
+	   << " blocks " << b->blocks.size() << " in " << ios << " ios"
+	   << " age " << (now - b->start) << dendl;
+  logger->inc(l_bluestore_wal_batches);
+  logger->inc(l_bluestore_wal_batch_txcs, b->txcs.size());
+  logger->inc(l_bluestore_wal_batch_bytes,
+	      b->blocks.size() * bdev->get_block_size());
+  logger->inc(l_bluestore_wal_batch_ios, ios);
+  for (vector<utime_t>::iterator p = b->joined.begin();
+       p != b->joined.end();
+       ++p) {
+    logger->tinc(l_bluestore_wal_batch_defer_lat, now - *p);
   }
-  break;
 
-  default:
-    assert(0 == "unrecognized wal op");
+  if (b->ioc.has_aios()) {
+    bdev->aio_submit(&b->ioc);
+  } else {
+    _wal_batch_finish(b);
   }
+}
 
-  return 0;
+void BlueStore::_wal_batch_finish(WALBatch *b)
+{
+  dout(20) << __func__ << " batch " << b << dendl;
+  for (vector<TransContext*>::iterator p = b->txcs.begin();
+       p != b->txcs.end();
+       ++p) {
+    _txc_state_proc(*p);
+  }
+  delete b;
+}
+
+void BlueStore::_wal_batch_thread()
+{
+  dout(10) << __func__ << " start" << dendl;
+  std::unique_lock<std::mutex> l(wal_batch_lock);
+  while (true) {
+    if (!wal_batch) {
+      if (wal_batch_stop)
+	break;
+      wal_batch_cond.wait(l);
+      continue;
+    }
+    utime_t age = ceph_clock_now(g_ceph_context) - wal_batch->start;
+    double left = g_conf->bluestore_wal_batch_max_age - (double)age;
+    if (left > 0 && !wal_batch_stop) {
+      wal_batch_cond.wait_for(
+	l, std::chrono::microseconds((uint64_t)(left * 1000000.0) + 1));
+      continue;
+    }
+    dout(20) << __func__ << " batch " << wal_batch << " age " << age << dendl;
+    logger->inc(l_bluestore_wal_batch_aged);
+    _wal_batch_submit();
+  }
+  dout(10) << __func__ << " finish" << dendl;
 }
 
 int BlueStore::_wal_replay()
@@ -4619,9 +6226,11 @@ void BlueStore::_txc_add_transaction(TransContext *txc, Transaction *t)
       {
         uint64_t expected_object_size = op->expected_object_size;
         uint64_t expected_write_size = op->expected_write_size;
+        uint32_t flags = op->hint_type;
 	r = _setallochint(txc, c, o,
 			  expected_object_size,
-			  expected_write_size);
+			  expected_write_size,
+			  flags);
       }
       break;
 
@@ -4777,10 +6386,6 @@ int BlueStore::_do_overlay_write(TransContext *txc,
 {
   _do_overlay_trim(txc, o, offset, length);
 
-  // let's avoid considering how overlay interacts with cached tail
-  // blocks for now.
-  o->clear_tail();
-
   dout(10) << __func__ << " " << o->oid << " "
 	   << offset << "~" << length << dendl;
   bluestore_overlay_t& ov = o->onode.overlay_map[offset] =
@@ -4869,6 +6474,7 @@ int BlueStore::_do_write_overlays(TransContext *txc,
       if (bp->second.has_flag(bluestore_extent_t::FLAG_UNWRITTEN)) {
 	dout(10) << __func__ << " zero new allocation " << bp->second << dendl;
 	bdev->aio_zero(bp->second.offset, bp->second.length, &txc->ioc);
+	o->onode.csum.update_zero(bp->first, bp->second.length);
 	bp->second.clear_flag(bluestore_extent_t::FLAG_UNWRITTEN);
       }
     }
@@ -4879,6 +6485,7 @@ int BlueStore::_do_write_overlays(TransContext *txc,
 	     << offset << "~" << length << dendl;
     op->extent.offset = bp->second.offset + x_off;
     op->extent.length = length;
+    o->onode.csum.invalidate(offset, length);
     op = NULL;
 
     if (p == o->onode.overlay_map.end() || p->first >= orig_offset + orig_length) {
@@ -4915,6 +6522,7 @@ void BlueStore::_dump_onode(OnodeRef o, int log_level)
 	   << " size " << o->onode.size
 	   << " expected_object_size " << o->onode.expected_object_size
 	   << " expected_write_size " << o->onode.expected_write_size
+	   << " alloc_hint_flags " << o->onode.alloc_hint_flags
 	   << dendl;
   for (map<string,bufferptr>::iterator p = o->onode.attrs.begin();
        p != o->onode.attrs.end();
@@ -4932,6 +6540,13 @@ void BlueStore::_dump_onode(OnodeRef o, int log_level)
     pos = p->first + p->second.length;
   }
   pos = 0;
+  for (auto& p : o->onode.blob_map) {
+    dout(log_level) << __func__ << "  blob " << p.first << " " << p.second
+		    << dendl;
+    assert(p.first >= pos);
+    pos = p.first + p.second.length;
+  }
+  pos = 0;
   for (map<uint64_t,bluestore_overlay_t>::iterator p = o->onode.overlay_map.begin();
        p != o->onode.overlay_map.end();
        ++p) {
@@ -4946,7 +6561,6 @@ void BlueStore::_dump_onode(OnodeRef o, int log_level)
 }
 
 void BlueStore::_pad_zeros(
-  TransContext *txc,
   OnodeRef o,
   bufferlist *bl, uint64_t *offset, uint64_t *length,
   uint64_t block_size)
@@ -4991,14 +6605,6 @@ void BlueStore::_pad_zeros(
     bl->substr_of(old, 0, *length - back_copy);
     bl->append(tail);
     *length += back_pad;
-    if (end >= o->onode.size && g_conf->bluestore_cache_tails) {
-      o->tail_bl.clear();
-      o->tail_bl.append(tail, 0, back_copy);
-      o->tail_offset = end - back_copy;
-      o->tail_txc_seq = txc->seq;
-      dout(20) << __func__ << " cached "<< back_copy << " of tail block at "
-	       << o->tail_offset << dendl;
-    }
   }
   dout(20) << __func__ << " pad " << front_pad << " + " << back_pad
 	   << " on front/back, now " << *offset << "~" << *length << dendl;
@@ -5042,7 +6648,6 @@ void BlueStore::_pad_zeros_head(
 }
 
 void BlueStore::_pad_zeros_tail(
-  TransContext *txc,
   OnodeRef o,
   bufferlist *bl, uint64_t offset, uint64_t *length,
   uint64_t block_size)
@@ -5074,15 +6679,6 @@ void BlueStore::_pad_zeros_tail(
   bl->substr_of(old, 0, *length - back_copy);
   bl->append(tail);
   *length += back_pad;
-  if (tail_len == block_size &&
-      end >= o->onode.size && g_conf->bluestore_cache_tails) {
-    o->tail_bl.clear();
-    o->tail_bl.append(tail, 0, back_copy);
-    o->tail_offset = end - back_copy;
-    o->tail_txc_seq = txc->seq;
-    dout(20) << __func__ << " cached "<< back_copy << " of tail block at "
-	     << o->tail_offset << dendl;
-  }
   dout(20) << __func__ << " pad " << back_pad
 	   << " on back, now " << offset << "~" << *length << dendl;
   dout(40) << "after:\n";
@@ -5101,6 +6697,82 @@ void BlueStore::_pad_zeros_tail(
  * nearest block--the overwrite will to read/modify/write on the first or last
  * block as needed using the src_rmw_{head,tail} fields).
  */
+void BlueStore::_do_dealloc_range(
+  TransContext *txc,
+  CollectionRef& c,
+  OnodeRef o,
+  uint64_t offset, uint64_t length,
+  uint64_t *hint)
+{
+  map<uint64_t, bluestore_extent_t>::iterator bp =
+    o->onode.seek_extent(offset);
+  while (bp != o->onode.block_map.end() &&
+	 bp->first < offset + length &&
+	 bp->first + bp->second.length > offset) {
+    dout(30) << "   bp " << bp->first << ": " << bp->second << dendl;
+    if (bp->first < offset) {
+      uint64_t left = offset - bp->first;
+      if (bp->first + bp->second.length <= offset + length) {
+	dout(20) << "  trim tail " << bp->first << ": " << bp->second << dendl;
+	_txc_release(
+	  txc, c, o,
+	  bp->second.offset + left,
+	  bp->second.length - left,
+	  bp->second.has_flag(bluestore_extent_t::FLAG_SHARED));
+	bp->second.length = left;
+	dout(20) << "        now " << bp->first << ": " << bp->second << dendl;
+	*hint = bp->first + bp->second.length;
+	++bp;
+      } else {
+	dout(20) << "      split " << bp->first << ": " << bp->second << dendl;
+	_txc_release(
+	  txc, c, o,
+	  bp->second.offset + left, length,
+	  bp->second.has_flag(bluestore_extent_t::FLAG_SHARED));
+	o->onode.block_map[offset + length] =
+	  bluestore_extent_t(
+	    bp->second.offset + left + length,
+	    bp->second.length - (left + length),
+	    bp->second.flags);
+	bp->second.length = left;
+	dout(20) << "       left " << bp->first << ": " << bp->second << dendl;
+	++bp;
+	dout(20) << "      right " << bp->first << ": " << bp->second << dendl;
+	assert(bp->first == offset + length);
+	*hint = bp->first + bp->second.length;
+      }
+    } else {
+      assert(bp->first >= offset);
+      if (bp->first + bp->second.length > offset + length) {
+	uint64_t overlap = offset + length - bp->first;
+	dout(20) << "  trim head " << bp->first << ": " << bp->second
+		 << " (overlap " << overlap << ")" << dendl;
+	_txc_release(
+	  txc, c, o,
+	  bp->second.offset, overlap,
+	  bp->second.has_flag(bluestore_extent_t::FLAG_SHARED));
+	o->onode.block_map[bp->first + overlap] =
+	  bluestore_extent_t(
+	    bp->second.offset + overlap,
+	    bp->second.length - overlap,
+	    bp->second.flags);
+	o->onode.block_map.erase(bp++);
+	dout(20) << "        now " << bp->first << ": " << bp->second << dendl;
+	assert(bp->first == offset + length);
+	*hint = bp->first;
+      } else {
+	dout(20) << "    dealloc " << bp->first << ": " << bp->second << dendl;
+	_txc_release(
+	  txc, c, o,
+	  bp->second.offset, bp->second.length,
+	  bp->second.has_flag(bluestore_extent_t::FLAG_SHARED));
+	*hint = bp->first + bp->second.length;
+	o->onode.block_map.erase(bp++);
+      }
+    }
+  }
+}
+
 int BlueStore::_do_allocate(
   TransContext *txc,
   CollectionRef& c,
@@ -5211,6 +6883,7 @@ int BlueStore::_do_allocate(
   // COW head and/or tail?
   bluestore_wal_op_t *cow_head_op = nullptr;
   bluestore_wal_op_t *cow_tail_op = nullptr;
+  interval_set<uint64_t> cowed;  // copied as is; keeps its checksums
   if (shared_head) {
     uint64_t cow_offset = offset;
     uint64_t cow_end = MIN(orig_offset & block_mask,
@@ -5227,6 +6900,7 @@ int BlueStore::_do_allocate(
       cow_head_op->src_extent.length = cow_length;
       cow_head_op->extent.offset = 0;   // _do_write will reset this
       cow_head_op->extent.length = cow_length;
+      cowed.insert(cow_offset, cow_length);
     } else {
       dout(20) << "  head shared, but no COW needed" << dendl;
     }
@@ -5254,6 +6928,7 @@ int BlueStore::_do_allocate(
       // _do_write will adjust logical offset -> final bdev offset
       cow_tail_op->extent.offset = cow_offset;
       cow_tail_op->extent.length = cow_length;
+      cowed.insert(cow_offset, cow_length);
     } else {
       dout(20) << "  tail shared, but no COW needed" << dendl;
     }
@@ -5278,72 +6953,27 @@ int BlueStore::_do_allocate(
     }
 
     // deallocate existing extents
-    bp = o->onode.seek_extent(offset);
-    while (bp != o->onode.block_map.end() &&
-	   bp->first < offset + length &&
-	   bp->first + bp->second.length > offset) {
-      dout(30) << "   bp " << bp->first << ": " << bp->second << dendl;
-      if (bp->first < offset) {
-	uint64_t left = offset - bp->first;
-	if (bp->first + bp->second.length <= offset + length) {
-	  dout(20) << "  trim tail " << bp->first << ": " << bp->second << dendl;
-	  _txc_release(
-	    txc, c, o,
-	    bp->second.offset + left,
-	    bp->second.length - left,
-	    bp->second.has_flag(bluestore_extent_t::FLAG_SHARED));
-	  bp->second.length = left;
-	  dout(20) << "        now " << bp->first << ": " << bp->second << dendl;
-	  hint = bp->first + bp->second.length;
-	  ++bp;
-	} else {
-	  dout(20) << "      split " << bp->first << ": " << bp->second << dendl;
-	  _txc_release(
-	    txc, c, o,
-	    bp->second.offset + left, length,
-	    bp->second.has_flag(bluestore_extent_t::FLAG_SHARED));
-	  o->onode.block_map[offset + length] =
-	    bluestore_extent_t(
-	      bp->second.offset + left + length,
-	      bp->second.length - (left + length),
-	      bp->second.flags);
-	  bp->second.length = left;
-	  dout(20) << "       left " << bp->first << ": " << bp->second << dendl;
-	  ++bp;
-	  dout(20) << "      right " << bp->first << ": " << bp->second << dendl;
-	  assert(bp->first == offset + length);
-	  hint = bp->first + bp->second.length;
-	}
-      } else {
-	assert(bp->first >= offset);
-	if (bp->first + bp->second.length > offset + length) {
-	  uint64_t overlap = offset + length - bp->first;
-	  dout(20) << "  trim head " << bp->first << ": " << bp->second
-		   << " (overlap " << overlap << ")" << dendl;
-	  _txc_release(
-	    txc, c, o,
-	    bp->second.offset, overlap,
-	    bp->second.has_flag(bluestore_extent_t::FLAG_SHARED));
-	  o->onode.block_map[bp->first + overlap] =
-	    bluestore_extent_t(
-	      bp->second.offset + overlap,
-	      bp->second.length - overlap,
-	      bp->second.flags);
-	  o->onode.block_map.erase(bp++);
-	  dout(20) << "        now " << bp->first << ": " << bp->second << dendl;
-	  assert(bp->first == offset + length);
-	  hint = bp->first;
-	} else {
-	  dout(20) << "    dealloc " << bp->first << ": " << bp->second << dendl;
-	  _txc_release(
-	    txc, c, o,
-	    bp->second.offset, bp->second.length,
-	    bp->second.has_flag(bluestore_extent_t::FLAG_SHARED));
-	  hint = bp->first + bp->second.length;
-	  o->onode.block_map.erase(bp++);
-	}
-      }
-    }
+    _do_dealloc_range(txc, c, o, offset, length, &hint);
+
+    // new space holds nothing we have checksummed until it is written,
+    // apart from what is copied over from the shared extent
+    uint64_t chunk_mask = o->onode.csum.get_chunk_size() - 1;
+    uint64_t pos = offset;
+    for (interval_set<uint64_t>::iterator p = cowed.begin();
+	 p != cowed.end();
+	 ++p) {
+      // a chunk cut by the copy boundary is partly fresh space
+      uint64_t start = p.get_start() & ~chunk_mask;
+      uint64_t end = ROUND_UP_TO(p.get_start() + p.get_len(),
+				 chunk_mask + 1);
+      o->onode.csum.invalidate(pos, p.get_start() - pos);
+      if (start < p.get_start())
+	o->onode.csum.invalidate(start, p.get_start() - start);
+      if (end > p.get_start() + p.get_len())
+	o->onode.csum.invalidate(end - 1, 1);
+      pos = p.get_start() + p.get_len();
+    }
+    o->onode.csum.invalidate(pos, offset + length - pos);
 
     // allocate our new extent(s)
     uint64_t alloc_start = offset;
@@ -5394,6 +7024,199 @@ bool BlueStore::_can_overlay_write(OnodeRef o, uint64_t length)
     (int)length <= g_conf->bluestore_overlay_max_length;
 }
 
+void BlueStore::_do_release_blob(
+  TransContext *txc,
+  CollectionRef& c,
+  OnodeRef o,
+  const bluestore_compressed_blob_t& b)
+{
+  for (auto& e : b.extents) {
+    _txc_release(txc, c, o, e.offset, e.length,
+		 e.has_flag(bluestore_extent_t::FLAG_SHARED));
+  }
+}
+
+int BlueStore::_do_uncompress(
+  TransContext *txc,
+  CollectionRef& c,
+  OnodeRef o,
+  uint64_t offset,
+  uint64_t length)
+{
+  uint64_t end = offset + length;
+  map<uint64_t,bluestore_compressed_blob_t>::iterator cp =
+    o->onode.seek_blob(offset);
+  while (cp != o->onode.blob_map.end() && cp->first < end) {
+    uint64_t b_off = cp->first;
+    bluestore_compressed_blob_t b = cp->second;
+    o->onode.blob_map.erase(cp);
+    if (b_off >= offset && b_off + b.length <= end) {
+      dout(20) << __func__ << " drop blob " << b_off << ": " << b << dendl;
+      _do_release_blob(txc, c, o, b);
+      cp = o->onode.blob_map.lower_bound(b_off);
+      continue;
+    }
+
+    // partially overwritten; whatever survives goes back to plain extents
+    dout(20) << __func__ << " expand blob " << b_off << ": " << b << dendl;
+    bufferlist bl;
+    map<uint64_t,bufferlist>::iterator p =
+      txc->blobs_written.find(b.extents.front().offset);
+    if (p != txc->blobs_written.end()) {
+      bl = p->second;
+    } else {
+      o->flush();
+      IOContext ioc(NULL);
+      int r = _read_blob(o, b_off, b, &bl, &ioc, false);
+      if (r < 0) {
+	derr << __func__ << " failed to read blob " << b_off << ": " << b
+	     << ": " << cpp_strerror(r) << dendl;
+	return r;
+      }
+    }
+    _do_release_blob(txc, c, o, b);
+    if (b_off < offset) {
+      bufferlist head;
+      head.substr_of(bl, 0, offset - b_off);
+      int r = _do_write_extents(txc, c, o, b_off, head.length(), head, 0);
+      if (r < 0)
+	return r;
+    }
+    if (b_off + b.length > end) {
+      bufferlist tail;
+      tail.substr_of(bl, end - b_off, b_off + b.length - end);
+      int r = _do_write_extents(txc, c, o, end, tail.length(), tail, 0);
+      if (r < 0)
+	return r;
+    }
+    cp = o->onode.blob_map.lower_bound(b_off);
+  }
+  return 0;
+}
+
+bool BlueStore::_want_compress(
+  CollectionRef& c,
+  OnodeRef o,
+  int *alg,
+  double *required_ratio)
+{
+  int mode = comp_mode;
+  *alg = comp_alg;
+  *required_ratio = comp_required_ratio;
+
+  // pool settings win
+  string val;
+  if (c->pool_opts.get(pool_opts_t::COMPRESSION_MODE, &val)) {
+    int m = Compressor::get_comp_mode_type(val);
+    if (m >= 0)
+      mode = m;
+  }
+  if (c->pool_opts.get(pool_opts_t::COMPRESSION_ALGORITHM, &val)) {
+    int a = Compressor::get_comp_alg_type(val);
+    if (a >= 0)
+      *alg = a;
+  }
+  double ratio;
+  if (c->pool_opts.get(pool_opts_t::COMPRESSION_REQUIRED_RATIO, &ratio)) {
+    *required_ratio = ratio;
+  }
+
+  if (*alg == Compressor::COMP_ALG_NONE)
+    return false;
+  uint32_t hint = o->onode.alloc_hint_flags;
+  switch (mode) {
+  case Compressor::COMP_FORCE:
+    return true;
+  case Compressor::COMP_AGGRESSIVE:
+    return (hint & CEPH_OSD_ALLOC_HINT_FLAG_INCOMPRESSIBLE) == 0;
+  case Compressor::COMP_PASSIVE:
+    return (hint & CEPH_OSD_ALLOC_HINT_FLAG_COMPRESSIBLE) != 0;
+  default:
+    return false;
+  }
+}
+
+int BlueStore::_do_write_compressed(
+  TransContext *txc,
+  CollectionRef& c,
+  OnodeRef o,
+  uint64_t offset,
+  bufferlist& bl,
+  bufferlist& compressed,
+  int alg,
+  uint32_t fadvise_flags)
+{
+  uint64_t min_alloc_size = g_conf->bluestore_min_alloc_size;
+  uint64_t length = bl.length();
+  uint64_t want = ROUND_UP_TO(compressed.length(), min_alloc_size);
+  assert(offset % min_alloc_size == 0);
+  assert(length % min_alloc_size == 0);
+  dout(20) << __func__ << " " << o->oid << " " << offset << "~" << length
+	   << " compressed to " << compressed.length()
+	   << " with " << Compressor::get_comp_alg_name(alg) << dendl;
+
+  bool buffered = false;
+  if (fadvise_flags & CEPH_OSD_OP_FLAG_FADVISE_WILLNEED) {
+    buffered = true;
+  }
+
+  int r = alloc->reserve(want);
+  if (r < 0) {
+    derr << __func__ << " failed to reserve " << want << dendl;
+    return r;
+  }
+
+  if (offset > o->onode.size) {
+    _do_zero_tail_extent(txc, c, o, offset);
+  }
+  if (o->onode.block_map.empty() && o->onode.blob_map.empty()) {
+    // nothing on disk yet; checksum with the current settings
+    o->onode.csum.init(csum_type, csum_chunk_order);
+  }
+
+  // ensure any wal IO has completed before we free extents they may
+  // touch.
+  o->flush();
+
+  uint64_t hint = 0;
+  _do_dealloc_range(txc, c, o, offset, length, &hint);
+  _do_overlay_trim(txc, o, offset, length);
+
+  bluestore_compressed_blob_t b;
+  b.length = length;
+  b.compressed_length = compressed.length();
+  b.alg = alg;
+  compressed.append_zero(want - compressed.length());
+  uint64_t pos = 0;
+  while (pos < want) {
+    bluestore_extent_t e;
+    r = alloc->allocate(want - pos, min_alloc_size, hint,
+			&e.offset, &e.length);
+    assert(r == 0);
+    assert(e.length <= want - pos);
+    bufferlist t;
+    t.substr_of(compressed, pos, e.length);
+    bdev->aio_write(e.offset, t, &txc->ioc, buffered);
+    txc->allocated.insert(e.offset, e.length);
+    b.extents.push_back(e);
+    pos += e.length;
+    hint = e.end();
+  }
+  dout(20) << __func__ << " blob " << offset << ": " << b << dendl;
+  o->onode.blob_map[offset] = b;
+  o->onode.csum.update(offset, bl);
+  txc->blobs_written[b.extents.front().offset] = bl;
+
+  if (offset + length > o->onode.size) {
+    dout(20) << __func__ << " extending size to " << offset + length << dendl;
+    o->onode.size = offset + length;
+  }
+  logger->inc(l_bluestore_compress_success_count);
+  logger->inc(l_bluestore_compressed_original_bytes, length);
+  logger->inc(l_bluestore_compressed_allocated_bytes, want);
+  return 0;
+}
+
 int BlueStore::_do_write(
   TransContext *txc,
   CollectionRef& c,
@@ -5402,6 +7225,139 @@ int BlueStore::_do_write(
   uint64_t orig_length,
   bufferlist& orig_bl,
   uint32_t fadvise_flags)
+{
+  if (orig_length == 0) {
+    return 0;
+  }
+
+  // the cache holds logical content, so it can be updated up front
+  if (fadvise_flags & (CEPH_OSD_OP_FLAG_FADVISE_DONTNEED |
+		       CEPH_OSD_OP_FLAG_FADVISE_NOCACHE)) {
+    o->bc.discard(orig_offset, orig_length);
+  } else {
+    bufferlist t;
+    t.substr_of(orig_bl, 0, orig_length);
+    o->bc.write(txc->seq, orig_offset, t);
+  }
+
+  // compressed blobs are never modified in place
+  int r = _do_uncompress(txc, c, o, orig_offset, orig_length);
+  if (r < 0)
+    return r;
+
+  int alg;
+  double required_ratio;
+  CompressorRef compressor;
+  if (_want_compress(c, o, &alg, &required_ratio)) {
+    compressor = _get_compressor(alg);
+  }
+  if (!compressor) {
+    return _do_write_extents(txc, c, o, orig_offset, orig_length, orig_bl,
+			     fadvise_flags);
+  }
+
+  // try to compress each blob-sized, allocation-unit aligned piece;
+  // whatever is left over (or doesn't compress) is written as usual.
+  uint64_t min_alloc_size = g_conf->bluestore_min_alloc_size;
+  uint64_t end = orig_offset + orig_length;
+  uint64_t aligned_end = end - end % min_alloc_size;
+  uint64_t pending = orig_offset;  // not yet written
+  uint64_t offset = ROUND_UP_TO(orig_offset, min_alloc_size);
+  while (offset < aligned_end) {
+    uint64_t blob_end = MIN(ROUND_UP_TO(offset + 1, comp_blob_size),
+			    aligned_end);
+    uint64_t length = blob_end - offset;
+    if (length < min_alloc_size * 2) {
+      // can't save an allocation unit
+      offset = blob_end;
+      continue;
+    }
+    bufferlist bl, compressed;
+    bl.substr_of(orig_bl, offset - orig_offset, length);
+    r = compressor->compress(bl, compressed);
+    if (r < 0 ||
+	compressed.length() > length * required_ratio ||
+	ROUND_UP_TO(compressed.length(), min_alloc_size) >= length) {
+      dout(20) << __func__ << " " << offset << "~" << length
+	       << " compressed to " << compressed.length()
+	       << " (r = " << r << "), storing uncompressed" << dendl;
+      logger->inc(l_bluestore_compress_rejected_count);
+      offset = blob_end;
+      continue;
+    }
+    if (offset > pending) {
+      bufferlist t;
+      t.substr_of(orig_bl, pending - orig_offset, offset - pending);
+      r = _do_write_extents(txc, c, o, pending, t.length(), t, fadvise_flags);
+      if (r < 0)
+	return r;
+    }
+    r = _do_write_compressed(txc, c, o, offset, bl, compressed, alg,
+			     fadvise_flags);
+    if (r < 0)
+      return r;
+    pending = offset = blob_end;
+  }
+  if (end > pending) {
+    bufferlist t;
+    t.substr_of(orig_bl, pending - orig_offset, end - pending);
+    r = _do_write_extents(txc, c, o, pending, t.length(), t, fadvise_flags);
+  }
+  return r;
+}
+
+bool BlueStore::_get_cached_tail(
+  TransContext *txc,
+  OnodeRef o,
+  uint64_t offset,
+  uint64_t length,
+  uint64_t block_size,
+  bufferlist *bl,
+  uint64_t *seq)
+{
+  map<uint64_t,bufferlist> cached;
+  interval_set<uint64_t> cached_intervals;
+  o->bc.read(offset, length, cached, cached_intervals, seq);
+  if (cached_intervals.size() != length) {
+    dout(20) << __func__ << " " << offset << "~" << length
+	     << " not fully cached" << dendl;
+    return false;
+  }
+  if (*seq >= txc->seq) {
+    // our own wal (if any) has not been queued yet
+    dout(20) << __func__ << " written by this txc" << dendl;
+    return false;
+  }
+  // we will rewrite the whole block in place; an overlay would still
+  // take precedence on read.
+  map<uint64_t,bluestore_overlay_t>::iterator op =
+    o->onode.overlay_map.lower_bound(offset);
+  if (op != o->onode.overlay_map.begin()) {
+    map<uint64_t,bluestore_overlay_t>::iterator pp = op;
+    --pp;
+    if (pp->first + pp->second.length > offset)
+      return false;
+  }
+  if (op != o->onode.overlay_map.end() &&
+      op->first < offset + block_size) {
+    dout(20) << __func__ << " overlay " << op->first << " in tail block"
+	     << dendl;
+    return false;
+  }
+  for (auto& p : cached) {
+    bl->claim_append(p.second);
+  }
+  return true;
+}
+
+int BlueStore::_do_write_extents(
+  TransContext *txc,
+  CollectionRef& c,
+  OnodeRef o,
+  uint64_t orig_offset,
+  uint64_t orig_length,
+  bufferlist& orig_bl,
+  uint32_t fadvise_flags)
 {
   int r = 0;
 
@@ -5430,6 +7386,15 @@ int BlueStore::_do_write(
   uint64_t cow_rmw_head = 0;
   uint64_t cow_rmw_tail = 0;
 
+  if (o->onode.block_map.empty() && o->onode.blob_map.empty()) {
+    // nothing on disk yet; checksum with the current settings
+    o->onode.csum.init(csum_type, csum_chunk_order);
+  }
+  // checksums are kept chunk by chunk below: the writes and zeroes set
+  // the chunks they fully cover and drop the ones they partly cover,
+  // and _do_allocate drops whatever it reallocates.  everything else
+  // is untouched on disk and keeps its checksum.
+
   if (orig_offset > o->onode.size) {
     // zero tail of previous existing extent?
     _do_zero_tail_extent(txc, c, o, orig_offset);
@@ -5490,7 +7455,7 @@ int BlueStore::_do_write(
 	offset >= o->onode.size &&                  // past eof +
 	(o->onode.size & ~block_mask) == 0) {       // eof was aligned
       dout(20) << __func__ << " append after aligned eof" << dendl;
-      _pad_zeros(txc, o, &bl, &offset, &length, block_size);
+      _pad_zeros(o, &bl, &offset, &length, block_size);
       assert(offset % block_size == 0);
       assert(length % block_size == 0);
       uint64_t x_off = offset - bp->first;
@@ -5501,6 +7466,7 @@ int BlueStore::_do_write(
 	  dout(20) << __func__ << " zero " << bp->second.offset << "~" << x_off
 		   << dendl;
 	  bdev->aio_zero(bp->second.offset, x_off, &txc->ioc);
+	  o->onode.csum.update_zero(bp->first, x_off);
 	}
       } else {
 	// the trailing block is zeroed from EOF to the end
@@ -5511,12 +7477,14 @@ int BlueStore::_do_write(
 	  dout(20) << __func__ << " zero " << from << "~" << z_len
 		   << " x_off " << zx_off << dendl;
 	  bdev->aio_zero(bp->second.offset + zx_off, z_len, &txc->ioc);
+	  o->onode.csum.update_zero(from, z_len);
 	}
 	bp->second.clear_flag(bluestore_extent_t::FLAG_COW_HEAD);
       }
       dout(20) << __func__ << " write " << offset << "~" << length
 	       << " x_off " << x_off << dendl;
       bdev->aio_write(bp->second.offset + x_off, bl, &txc->ioc, buffered);
+      o->onode.csum.update(offset, bl);
       bp->second.clear_flag(bluestore_extent_t::FLAG_UNWRITTEN);
       ++bp;
       continue;
@@ -5524,58 +7492,46 @@ int BlueStore::_do_write(
 
     // use cached tail block?
     uint64_t tail_start = o->onode.size - o->onode.size % block_size;
+    bufferlist tail_bl;
+    uint64_t tail_seq = 0;
     if (offset >= bp->first &&
 	offset > tail_start &&
 	offset + length >= o->onode.size &&
-	o->tail_offset == tail_start &&
-	o->tail_bl.length() &&
-	(offset / block_size == (o->onode.size - 1) / block_size)) {
+	(offset / block_size == (o->onode.size - 1) / block_size) &&
+	_get_cached_tail(txc, o, tail_start,
+			 MIN(offset, o->onode.size) - tail_start,
+			 block_size, &tail_bl, &tail_seq)) {
       dout(20) << __func__ << " using cached tail" << dendl;
       assert((offset & block_mask) == (o->onode.size & block_mask));
       // wait for any related wal writes to commit
-      txc->osr->wait_for_wal_on_seq(o->tail_txc_seq);
+      if (tail_seq)
+	txc->osr->wait_for_wal_on_seq(tail_seq);
       uint64_t tail_off = offset % block_size;
-      if (tail_off >= o->tail_bl.length()) {
-	bufferlist t;
-	t = o->tail_bl;
-	if (tail_off > t.length()) {
-	  bufferptr z(tail_off - t.length());
-	  z.zero();
-	  t.append(z);
-	}
-	offset -= t.length();
-	length += t.length();
-	t.claim_append(bl);
-	bl.swap(t);
-      } else {
-	bufferlist t;
-	t.substr_of(o->tail_bl, 0, tail_off);
-	offset -= t.length();
-	length += t.length();
-	t.claim_append(bl);
-	bl.swap(t);
+      if (tail_off > tail_bl.length()) {
+	bufferptr z(tail_off - tail_bl.length());
+	z.zero();
+	tail_bl.append(z);
       }
+      offset -= tail_bl.length();
+      length += tail_bl.length();
+      tail_bl.claim_append(bl);
+      bl.swap(tail_bl);
       assert(offset == tail_start);
       assert(!bp->second.has_flag(bluestore_extent_t::FLAG_UNWRITTEN) ||
 	     bp->second.has_flag(bluestore_extent_t::FLAG_COW_HEAD) ||
 	     offset == bp->first);
       bp->second.clear_flag(bluestore_extent_t::FLAG_COW_HEAD);
       bp->second.clear_flag(bluestore_extent_t::FLAG_UNWRITTEN);
-      _pad_zeros(txc, o, &bl, &offset, &length, block_size);
+      _pad_zeros(o, &bl, &offset, &length, block_size);
       uint64_t x_off = offset - bp->first;
       dout(20) << __func__ << " write " << offset << "~" << length
 	       << " x_off " << x_off << dendl;
       bdev->aio_write(bp->second.offset + x_off, bl, &txc->ioc, buffered);
+      o->onode.csum.update(offset, bl);
       ++bp;
       continue;
     }
 
-    if (offset + length > (o->onode.size & block_mask) &&
-	o->tail_bl.length()) {
-      dout(20) << __func__ << " clearing cached tail" << dendl;
-      o->clear_tail();
-    }
-
     if (offset % min_alloc_size == 0 &&
 	length % min_alloc_size == 0) {
       assert(bp->second.has_flag(bluestore_extent_t::FLAG_UNWRITTEN));
@@ -5590,6 +7546,7 @@ int BlueStore::_do_write(
 	uint64_t z_len = z_end - bp->first;
 	dout(20) << __func__ << " zero " << bp->first << "~" << z_len << dendl;
 	bdev->aio_zero(bp->second.offset, z_len, &txc->ioc);
+	o->onode.csum.update_zero(bp->first, z_len);
       }
       uint64_t end = ROUND_UP_TO(offset + length, block_size);
       if (end < bp->first + bp->second.length &&
@@ -5600,12 +7557,13 @@ int BlueStore::_do_write(
 	dout(20) << __func__ << " zero " << end << "~" << z_len
 		 << " x_off " << x_off << dendl;
 	bdev->aio_zero(bp->second.offset + x_off, z_len, &txc->ioc);
+	o->onode.csum.update_zero(end, z_len);
       }
       if ((offset & ~block_mask) != 0 && !cow_rmw_head) {
 	_pad_zeros_head(o, &bl, &offset, &length, block_size);
       }
       if (((offset + length) & ~block_mask) != 0 && !cow_rmw_tail) {
-	_pad_zeros_tail(txc, o, &bl, offset, &length, block_size);
+	_pad_zeros_tail(o, &bl, offset, &length, block_size);
       }
       if ((offset & ~block_mask) == 0 && (length & ~block_mask) == 0) {
 	uint64_t x_off = offset - bp->first;
@@ -5613,6 +7571,7 @@ int BlueStore::_do_write(
 		 << " x_off " << x_off << dendl;
 	_do_overlay_trim(txc, o, offset, length);
 	bdev->aio_write(bp->second.offset + x_off, bl, &txc->ioc, buffered);
+	o->onode.csum.update(offset, bl);
 	bp->second.clear_flag(bluestore_extent_t::FLAG_UNWRITTEN);
 	bp->second.clear_flag(bluestore_extent_t::FLAG_COW_HEAD);
 	bp->second.clear_flag(bluestore_extent_t::FLAG_COW_TAIL);
@@ -5654,7 +7613,7 @@ int BlueStore::_do_write(
     } else if (((offset + length) & ~block_mask) &&
 	       offset + length > o->onode.size) {
       dout(20) << __func__ << " past eof, padding out tail block" << dendl;
-      _pad_zeros_tail(txc, o, &bl, offset, &length, block_size);
+      _pad_zeros_tail(o, &bl, offset, &length, block_size);
     }
     bp->second.clear_flag(bluestore_extent_t::FLAG_COW_HEAD);
     bp->second.clear_flag(bluestore_extent_t::FLAG_COW_TAIL);
@@ -5662,6 +7621,7 @@ int BlueStore::_do_write(
     op->extent.offset = bp->second.offset + offset - bp->first;
     op->extent.length = length;
     op->data = bl;
+    o->onode.csum.update(offset, bl);
     if (offset + length - bp->first > bp->second.length) {
       op->extent.length = offset + length - bp->first;
     }
@@ -5733,7 +7693,11 @@ int BlueStore::_do_write_zero(
   bufferlist zl;
   zl.append_zero(length);
   uint64_t old_size = o->onode.size;
-  int r = _do_write(txc, c, o, offset, length, zl, 0);
+  // this may run past eof, where blobs can't live, so don't compress
+  int r = _do_uncompress(txc, c, o, offset, length);
+  if (r < 0)
+    return r;
+  r = _do_write_extents(txc, c, o, offset, length, zl, 0);
   // we do not modify onode size
   o->onode.size = old_size;
   return r;
@@ -5799,6 +7763,7 @@ void BlueStore::_do_zero_tail_extent(
 	dout(10) << __func__ << " wal zero tail partial block "
 		 << x_off << "~" << x_len << " at " << op->extent
 		 << dendl;
+	o->onode.csum.update_zero(x_off, x_len);
 	assert(!pp->second.has_flag(bluestore_extent_t::FLAG_COW_HEAD));
 	assert(!pp->second.has_flag(bluestore_extent_t::FLAG_COW_TAIL));
       }
@@ -5811,6 +7776,7 @@ void BlueStore::_do_zero_tail_extent(
 		   << " of tail extent " << pp->first << ": " << pp->second
 		   << dendl;
 	  bdev->aio_zero(pp->second.offset + x_off, x_len, &txc->ioc);
+	  o->onode.csum.update_zero(pp->first + x_off, x_len);
 	}
       }
     }
@@ -5827,6 +7793,7 @@ int BlueStore::_do_zero(TransContext *txc,
 	   << dendl;
   int r = 0;
   o->exists = true;
+  o->bc.discard(offset, length);
 
   if (offset > o->onode.size) {
     // we are past eof; just truncate up.
@@ -5836,6 +7803,10 @@ int BlueStore::_do_zero(TransContext *txc,
   _dump_onode(o);
   _assign_nid(txc, o);
 
+  r = _do_uncompress(txc, c, o, offset, length);
+  if (r < 0)
+    return r;
+
   // overlay
   _do_overlay_trim(txc, o, offset, length);
 
@@ -5894,6 +7865,7 @@ int BlueStore::_do_zero(TransContext *txc,
       op->extent.length = x_len;
       dout(20) << __func__ << "  wal zero " << x_off << "~" << x_len
 	       << " " << op->extent << dendl;
+      o->onode.csum.update_zero(bp->first + x_off, x_len);
     }
     ++bp;
   }
@@ -5922,12 +7894,15 @@ int BlueStore::_do_truncate(
   // they may touch.
   o->flush();
 
-  // trim down cached tail
-  if (o->tail_bl.length()) {
-    // we could adjust this if we truncate down within the same
-    // block...
-    dout(20) << __func__ << " clear cached tail" << dendl;
-    o->clear_tail();
+  // drop cached data past the new eof
+  o->bc.truncate(offset);
+
+  // drop compressed blobs past the new eof, and expand one that
+  // straddles it
+  if (offset < o->onode.size) {
+    int r = _do_uncompress(txc, c, o, offset, o->onode.size - offset);
+    if (r < 0)
+      return r;
   }
 
   // trim down fragments
@@ -5971,6 +7946,7 @@ int BlueStore::_do_truncate(
   // adjust size now, in case we need to call _do_write_zero below.
   uint64_t old_size = o->onode.size;
   o->onode.size = offset;
+  o->onode.csum.truncate(offset);
 
   // zero extent if trimming up?
   if (offset > old_size) {
@@ -5996,6 +7972,7 @@ int BlueStore::_do_truncate(
 	op->extent.length = x_len;
 	dout(20) << __func__ << "  wal zero " << x_off << "~" << x_len
 		 << " " << op->extent << dendl;
+	o->onode.csum.update_zero(old_size, x_len);
       }
     }
   }
@@ -6168,21 +8145,12 @@ int BlueStore::_rmattrs(TransContext *txc,
 
 void BlueStore::_do_omap_clear(TransContext *txc, uint64_t id)
 {
-  KeyValueDB::Iterator it = db->get_iterator(PREFIX_OMAP);
   string prefix, tail;
   get_omap_header(id, &prefix);
   get_omap_tail(id, &tail);
-  it->lower_bound(prefix);
-  while (it->valid()) {
-    if (it->key() >= tail) {
-      dout(30) << __func__ << "  stop at " << pretty_binary_string(tail)
-	       << dendl;
-      break;
-    }
-    txc->t->rmkey(PREFIX_OMAP, it->key());
-    dout(30) << __func__ << "  rm " << pretty_binary_string(it->key()) << dendl;
-    it->next();
-  }
+  dout(30) << __func__ << "  rm " << pretty_binary_string(prefix)
+	   << " to " << pretty_binary_string(tail) << dendl;
+  txc->t->rm_range_keys(PREFIX_OMAP, prefix, tail);
 }
 
 int BlueStore::_omap_clear(TransContext *txc,
@@ -6286,25 +8254,17 @@ int BlueStore::_omap_rmkey_range(TransContext *txc,
 				 const string& first, const string& last)
 {
   dout(15) << __func__ << " " << c->cid << " " << o->oid << dendl;
-  KeyValueDB::Iterator it;
   string key_first, key_last;
   int r = 0;
   if (!o->onode.omap_head) {
     goto out;
   }
-  it = db->get_iterator(PREFIX_OMAP);
   get_omap_key(o->onode.omap_head, first, &key_first);
   get_omap_key(o->onode.omap_head, last, &key_last);
-  it->lower_bound(key_first);
-  while (it->valid()) {
-    if (it->key() >= key_last) {
-      dout(30) << __func__ << "  stop at " << pretty_binary_string(key_last)
-	       << dendl;
-      break;
-    }
-    txc->t->rmkey(PREFIX_OMAP, it->key());
-    dout(30) << __func__ << "  rm " << pretty_binary_string(it->key()) << dendl;
-    it->next();
+  if (key_first < key_last) {
+    dout(30) << __func__ << "  rm " << pretty_binary_string(key_first)
+	     << " to " << pretty_binary_string(key_last) << dendl;
+    txc->t->rm_range_keys(PREFIX_OMAP, key_first, key_last);
   }
   r = 0;
 
@@ -6317,19 +8277,23 @@ int BlueStore::_setallochint(TransContext *txc,
 			     CollectionRef& c,
 			     OnodeRef& o,
 			     uint64_t expected_object_size,
-			     uint64_t expected_write_size)
+			     uint64_t expected_write_size,
+			     uint32_t flags)
 {
   dout(15) << __func__ << " " << c->cid << " " << o->oid
 	   << " object_size " << expected_object_size
 	   << " write_size " << expected_write_size
+	   << " flags " << flags
 	   << dendl;
   int r = 0;
   o->onode.expected_object_size = expected_object_size;
   o->onode.expected_write_size = expected_write_size;
+  o->onode.alloc_hint_flags = flags;
   txc->write_onode(o);
   dout(10) << __func__ << " " << c->cid << " " << o->oid
 	   << " object_size " << expected_object_size
 	   << " write_size " << expected_write_size
+	   << " flags " << flags
 	   << " = " << r << dendl;
   return r;
 }
@@ -6360,7 +8324,7 @@ int BlueStore::_clone(TransContext *txc,
     goto out;
 
   if (g_conf->bluestore_clone_cow) {
-    if (!oldo->onode.block_map.empty()) {
+    if (!oldo->onode.block_map.empty() || !oldo->onode.blob_map.empty()) {
       EnodeRef e = c->get_enode(newo->oid.hobj.get_hash());
       bool marked = false;
       for (auto& p : oldo->onode.block_map) {
@@ -6372,9 +8336,22 @@ int BlueStore::_clone(TransContext *txc,
 	  marked = true;
 	}
       }
+      for (auto& p : oldo->onode.blob_map) {
+	for (auto& be : p.second.extents) {
+	  if (be.has_flag(bluestore_extent_t::FLAG_SHARED)) {
+	    e->ref_map.get(be.offset, be.length);
+	  } else {
+	    be.set_flag(bluestore_extent_t::FLAG_SHARED);
+	    e->ref_map.add(be.offset, be.length, 2);
+	    marked = true;
+	  }
+	}
+      }
       dout(20) << __func__ << " hash " << std::hex << e->hash << std::dec << " ref_map now "
 	<< e->ref_map << dendl;
       newo->onode.block_map = oldo->onode.block_map;
+      newo->onode.blob_map = oldo->onode.blob_map;
+      newo->onode.csum = oldo->onode.csum;
       newo->enode = e;
       dout(20) << __func__ << " block_map " << newo->onode.block_map << dendl;
       txc->write_enode(e);
@@ -6426,10 +8403,10 @@ int BlueStore::_clone(TransContext *txc,
     if (!newo->onode.omap_head) {
       newo->onode.omap_head = newo->onode.nid;
     }
-    KeyValueDB::Iterator it = db->get_iterator(PREFIX_OMAP);
     string head, tail;
     get_omap_header(oldo->onode.omap_head, &head);
     get_omap_tail(oldo->onode.omap_head, &tail);
+    KeyValueDB::Iterator it = db->get_iterator(PREFIX_OMAP, tail);
     it->lower_bound(head);
     while (it->valid()) {
       string key;
@@ -6543,7 +8520,7 @@ int BlueStore::_create_collection(
       r = -EEXIST;
       goto out;
     }
-    c->reset(new Collection(this, cid));
+    c->reset(new Collection(this, _get_cache_shard(cid), cid));
     (*c)->cnode.bits = bits;
     coll_map[cid] = *c;
   }
@@ -6569,14 +8546,16 @@ int BlueStore::_remove_collection(TransContext *txc, coll_t cid,
       goto out;
     }
     assert((*c)->exists);
-    pair<ghobject_t,OnodeRef> next;
-    while ((*c)->onode_map.get_next(next.first, &next)) {
-      if (next.second->exists) {
-	dout(10) << __func__ << " " << next.first << " " << next.second
-		 << " exists in onode_map" << dendl;
-	r = -ENOTEMPTY;
-	goto out;
-      }
+    if ((*c)->onode_map.map_any([&](OnodeRef o) {
+	  if (o->exists) {
+	    dout(10) << __func__ << " " << o->oid << " " << o
+		     << " exists in onode_map" << dendl;
+	    return true;
+	  }
+	  return false;
+	})) {
+      r = -ENOTEMPTY;
+      goto out;
     }
     coll_map.erase(cid);
     txc->removed_collections.push_back(*c);
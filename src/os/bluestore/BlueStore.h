@@ -20,6 +20,7 @@
 #include <unistd.h>
 
 #include <atomic>
+#include <functional>
 #include <mutex>
 #include <condition_variable>
 
@@ -28,9 +29,11 @@
 #include <boost/functional/hash.hpp>
 
 #include "include/assert.h"
+#include "include/interval_set.h"
 #include "include/unordered_map.h"
 #include "include/memory.h"
 #include "common/Finisher.h"
+#include "compressor/Compressor.h"
 #include "os/ObjectStore.h"
 
 #include "bluestore_types.h"
@@ -54,6 +57,30 @@ enum {
   l_bluestore_state_wal_done_lat,
   l_bluestore_state_finishing_lat,
   l_bluestore_state_done_lat,
+  l_bluestore_kv_flush_lat,
+  l_bluestore_kv_commit_lat,
+  l_bluestore_kv_batch_txcs,
+  l_bluestore_csum_errors,
+  l_bluestore_compress_success_count,
+  l_bluestore_compress_rejected_count,
+  l_bluestore_compressed_original_bytes,
+  l_bluestore_compressed_allocated_bytes,
+  l_bluestore_onodes,
+  l_bluestore_onode_hits,
+  l_bluestore_onode_misses,
+  l_bluestore_onode_evictions,
+  l_bluestore_buffers,
+  l_bluestore_buffer_bytes,
+  l_bluestore_buffer_hit_bytes,
+  l_bluestore_buffer_miss_bytes,
+  l_bluestore_buffer_evicted_bytes,
+  l_bluestore_wal_batches,
+  l_bluestore_wal_batch_full,
+  l_bluestore_wal_batch_aged,
+  l_bluestore_wal_batch_txcs,
+  l_bluestore_wal_batch_bytes,
+  l_bluestore_wal_batch_ios,
+  l_bluestore_wal_batch_defer_lat,
   l_bluestore_last
 };
 
@@ -119,10 +146,82 @@ public:
     }
   };
 
+  struct BufferSpace;
+  struct Cache;
+
+  /// a cached, clean range of object data
+  struct Buffer {
+    BufferSpace *space;
+    int cache_private = 0; ///< opaque (to us) value used by Cache impl
+    uint64_t seq;          ///< txc that wrote this data (0 if read from disk)
+    uint64_t offset, length;
+    bufferlist data;
+    boost::intrusive::list_member_hook<> lru_item;
+
+    Buffer(BufferSpace *space, uint64_t s, uint64_t o, const bufferlist& b)
+      : space(space), seq(s), offset(o), length(b.length()), data(b) {}
+    Buffer(BufferSpace *space, uint64_t s, uint64_t o, uint64_t l)
+      : space(space), seq(s), offset(o), length(l) {}
+
+    /// a ghost entry: the data is gone but the cache still tracks it
+    bool is_empty() const {
+      return data.length() == 0;
+    }
+    uint64_t end() const {
+      return offset + length;
+    }
+    void truncate(uint64_t newlen) {
+      assert(newlen < length);
+      if (data.length()) {
+	bufferlist t;
+	t.substr_of(data, 0, newlen);
+	data.claim(t);
+      }
+      length = newlen;
+    }
+  };
+
+  /// the cached data of an object, keyed by logical offset
+  struct BufferSpace {
+    Cache *cache;
+    map<uint64_t,std::unique_ptr<Buffer>> buffer_map; ///< protected by cache->lock
+
+    explicit BufferSpace(Cache *c) : cache(c) {}
+    ~BufferSpace() {
+      clear();
+    }
+
+    void _add_buffer(Buffer *b, int level, Buffer *near);
+    void _rm_buffer(map<uint64_t,std::unique_ptr<Buffer>>::iterator p);
+    map<uint64_t,std::unique_ptr<Buffer>>::iterator _data_lower_bound(
+      uint64_t offset);
+    /// drop [offset, offset+length); return the cache_private of the
+    /// strongest entry discarded
+    int _discard(uint64_t offset, uint64_t length);
+
+    void discard(uint64_t offset, uint64_t length);
+    void truncate(uint64_t offset) {
+      discard(offset, (uint64_t)-1 - offset);
+    }
+    /// new data written by txc seq
+    void write(uint64_t seq, uint64_t offset, const bufferlist& bl);
+    /// clean data read from disk
+    void did_read(uint64_t offset, const bufferlist& bl);
+    /// return the cached pieces of [offset, offset+length)
+    void read(uint64_t offset, uint64_t length,
+	      map<uint64_t,bufferlist>& res,
+	      interval_set<uint64_t>& res_intervals,
+	      uint64_t *seq = nullptr);
+    void clear();
+  };
+
+  struct OnodeSpace;
+
   /// an in-memory object
   struct Onode {
     std::atomic_int nref;  ///< reference count
 
+    OnodeSpace *space;    ///< containing OnodeSpace
     ghobject_t oid;
     string key;     ///< key under PREFIX_OBJ where we are stored
     boost::intrusive::list_member_hook<> lru_item;
@@ -136,16 +235,9 @@ public:
     std::condition_variable flush_cond;   ///< wait here for unapplied txns
     set<TransContext*> flush_txns;   ///< committing or wal txns
 
-    uint64_t tail_offset = 0;
-    uint64_t tail_txc_seq = 0;
-    bufferlist tail_bl;
+    BufferSpace bc;  ///< cached data
 
-    Onode(const ghobject_t& o, const string& k)
-      : nref(0),
-	oid(o),
-	key(k),
-	exists(false) {
-    }
+    Onode(OnodeSpace *s, const ghobject_t& o, const string& k);
 
     void flush();
     void get() {
@@ -155,41 +247,168 @@ public:
       if (--nref == 0)
 	delete this;
     }
+  };
+  typedef boost::intrusive_ptr<Onode> OnodeRef;
+
+  /// a cache (shard) of onodes and buffers
+  struct Cache {
+    PerfCounters *logger;
+    std::recursive_mutex lock;  ///< protect lru and the spaces that use us
+
+    static Cache *create(string type, PerfCounters *logger);
 
-    void clear_tail() {
-      tail_offset = 0;
-      tail_bl.clear();
+    explicit Cache(PerfCounters *l) : logger(l) {}
+    virtual ~Cache() {}
+
+    virtual void _add_onode(OnodeRef& o, int level) = 0;
+    virtual void _rm_onode(OnodeRef& o) = 0;
+    virtual void _touch_onode(OnodeRef& o) = 0;
+
+    virtual void _add_buffer(Buffer *b, int level, Buffer *near) = 0;
+    virtual void _rm_buffer(Buffer *b) = 0;
+    virtual void _touch_buffer(Buffer *b) = 0;
+    virtual void _adjust_buffer_size(Buffer *b, int64_t delta) = 0;
+
+    virtual uint64_t _get_num_onodes() = 0;
+    virtual uint64_t _get_buffer_bytes() = 0;
+
+    void trim(uint64_t onode_max, uint64_t buffer_max) {
+      std::lock_guard<std::recursive_mutex> l(lock);
+      _trim(onode_max, buffer_max);
     }
+    virtual void _trim(uint64_t onode_max, uint64_t buffer_max) = 0;
+
+  protected:
+    /// evict onodes from the tail of lru; shared by the implementations
+    template<class L>
+    void _trim_onodes(L& lru, uint64_t onode_max);
   };
-  typedef boost::intrusive_ptr<Onode> OnodeRef;
 
-  struct OnodeHashLRU {
+  /// simple LRU cache for onodes and buffers
+  struct LRUCache : public Cache {
+  private:
     typedef boost::intrusive::list<
       Onode,
       boost::intrusive::member_hook<
-        Onode,
+	Onode,
 	boost::intrusive::list_member_hook<>,
-	&Onode::lru_item> > lru_list_t;
+	&Onode::lru_item> > onode_lru_list_t;
+    typedef boost::intrusive::list<
+      Buffer,
+      boost::intrusive::member_hook<
+	Buffer,
+	boost::intrusive::list_member_hook<>,
+	&Buffer::lru_item> > buffer_lru_list_t;
+
+    onode_lru_list_t onode_lru;
+    buffer_lru_list_t buffer_lru;
+    uint64_t buffer_size = 0;
+
+  public:
+    explicit LRUCache(PerfCounters *l) : Cache(l) {}
+
+    void _add_onode(OnodeRef& o, int level) override;
+    void _rm_onode(OnodeRef& o) override;
+    void _touch_onode(OnodeRef& o) override;
+
+    void _add_buffer(Buffer *b, int level, Buffer *near) override;
+    void _rm_buffer(Buffer *b) override;
+    void _touch_buffer(Buffer *b) override;
+    void _adjust_buffer_size(Buffer *b, int64_t delta) override;
+
+    uint64_t _get_num_onodes() override {
+      return onode_lru.size();
+    }
+    uint64_t _get_buffer_bytes() override {
+      return buffer_size;
+    }
+
+    void _trim(uint64_t onode_max, uint64_t buffer_max) override;
+  };
+
+  /**
+   * 2Q cache (Johnson and Shasha) for buffers; onodes use a plain LRU.
+   *
+   * New buffers enter warm_in, which is a FIFO.  Buffers that age out
+   * of warm_in leave a ghost entry (no data) in warm_out.  A buffer is
+   * only promoted to the hot LRU if it is used again while its ghost is
+   * still remembered, so one-off scans do not push out the working set.
+   */
+  struct TwoQCache : public Cache {
+  private:
+    typedef boost::intrusive::list<
+      Onode,
+      boost::intrusive::member_hook<
+	Onode,
+	boost::intrusive::list_member_hook<>,
+	&Onode::lru_item> > onode_lru_list_t;
+    typedef boost::intrusive::list<
+      Buffer,
+      boost::intrusive::member_hook<
+	Buffer,
+	boost::intrusive::list_member_hook<>,
+	&Buffer::lru_item> > buffer_list_t;
+
+    enum {
+      BUFFER_NEW = 0,
+      BUFFER_WARM_IN,   ///< in buffer_warm_in
+      BUFFER_WARM_OUT,  ///< in buffer_warm_out (ghost)
+      BUFFER_HOT,       ///< in buffer_hot
+    };
+
+    onode_lru_list_t onode_lru;
+    buffer_list_t buffer_hot;       ///< "Am" hot buffers
+    buffer_list_t buffer_warm_in;   ///< "A1in" newly warm buffers
+    buffer_list_t buffer_warm_out;  ///< "A1out" empty buffers we've evicted
+    uint64_t buffer_bytes = 0;          ///< bytes with data
+    uint64_t buffer_warm_in_bytes = 0;
+    uint64_t buffer_warm_out_bytes = 0; ///< logical bytes of ghosts
+
+  public:
+    explicit TwoQCache(PerfCounters *l) : Cache(l) {}
+
+    void _add_onode(OnodeRef& o, int level) override;
+    void _rm_onode(OnodeRef& o) override;
+    void _touch_onode(OnodeRef& o) override;
 
-    std::mutex lock;
-    ceph::unordered_map<ghobject_t,OnodeRef> onode_map;  ///< forward lookups
-    lru_list_t lru;                                      ///< lru
-    size_t max_size;
+    void _add_buffer(Buffer *b, int level, Buffer *near) override;
+    void _rm_buffer(Buffer *b) override;
+    void _touch_buffer(Buffer *b) override;
+    void _adjust_buffer_size(Buffer *b, int64_t delta) override;
 
-    OnodeHashLRU(size_t s) : max_size(s) {}
+    uint64_t _get_num_onodes() override {
+      return onode_lru.size();
+    }
+    uint64_t _get_buffer_bytes() override {
+      return buffer_bytes;
+    }
+
+    void _trim(uint64_t onode_max, uint64_t buffer_max) override;
+  };
 
-    void add(const ghobject_t& oid, OnodeRef o);
-    void _touch(OnodeRef o);
+  /// the cached onodes of a collection
+  struct OnodeSpace {
+    Cache *cache;
+    /// forward lookups (protected by cache->lock)
+    ceph::unordered_map<ghobject_t,OnodeRef> onode_map;
+
+    explicit OnodeSpace(Cache *c) : cache(c) {}
+    ~OnodeSpace() {
+      clear();
+    }
+
+    OnodeRef add(const ghobject_t& oid, OnodeRef o);
     OnodeRef lookup(const ghobject_t& o);
-    void rename(OnodeRef& o, const ghobject_t& old_oid, const ghobject_t& new_oid);
+    void rename(OnodeRef& o, const ghobject_t& old_oid,
+		const ghobject_t& new_oid);
     void clear();
-    bool get_next(const ghobject_t& after, pair<ghobject_t,OnodeRef> *next);
-    int trim(int max=-1);
-    int _trim(int max);
+    /// return true if f true for any item
+    bool map_any(std::function<bool(OnodeRef)> f);
   };
 
   struct Collection : public CollectionImpl {
     BlueStore *store;
+    Cache *cache;       ///< our cache shard
     coll_t cid;
     bluestore_cnode_t cnode;
     RWLock lock;
@@ -198,9 +417,11 @@ public:
 
     EnodeSet enode_set;      ///< open Enodes
 
-    // cache onodes on a per-collection basis to avoid lock
-    // contention.
-    OnodeHashLRU onode_map;
+    pool_opts_t pool_opts;   ///< pool options (protected by lock)
+
+    // onodes are cached here, but memory is accounted (and trimmed)
+    // in the shared cache shard.
+    OnodeSpace onode_map;
 
     OnodeRef get_onode(const ghobject_t& oid, bool create);
     EnodeRef get_enode(uint32_t hash);
@@ -220,7 +441,7 @@ public:
       return false;
     }
 
-    Collection(BlueStore *ns, coll_t c);
+    Collection(BlueStore *ns, Cache *ca, coll_t c);
   };
   typedef boost::intrusive_ptr<Collection> CollectionRef;
 
@@ -246,7 +467,13 @@ public:
   class OpSequencer;
   typedef boost::intrusive_ptr<OpSequencer> OpSequencerRef;
 
-  struct TransContext {
+  /// owner of an IOContext; told when all of its aios have completed
+  struct AioContext {
+    virtual void aio_finish(BlueStore *store) = 0;
+    virtual ~AioContext() {}
+  };
+
+  struct TransContext : public AioContext {
     typedef enum {
       STATE_PREPARE,
       STATE_AIO_WAIT,
@@ -311,6 +538,10 @@ public:
 
     interval_set<uint64_t> allocated, released;
 
+    /// decompressed data of blobs we wrote, by first device offset; the
+    /// aio has not been submitted yet, so we can't read them back
+    map<uint64_t,bufferlist> blobs_written;
+
     IOContext ioc;
 
     CollectionRef first_collection;  ///< first referenced collection
@@ -327,7 +558,7 @@ public:
 	onreadable(NULL),
 	onreadable_sync(NULL),
 	wal_txn(NULL),
-	ioc(this),
+	ioc(static_cast<AioContext*>(this)),
 	start(ceph_clock_now(g_ceph_context)) {
       //cout << "txc new " << this << std::endl;
     }
@@ -336,6 +567,10 @@ public:
       //cout << "txc del " << this << std::endl;
     }
 
+    void aio_finish(BlueStore *store) override {
+      store->_txc_state_proc(this);
+    }
+
     void write_onode(OnodeRef &o) {
       onodes.insert(o);
     }
@@ -503,6 +738,31 @@ public:
     }
   };
 
+  /// small wal writes from many txcs, applied in memory and written
+  /// to the device together
+  struct WALBatch : public AioContext {
+    IOContext ioc;
+    vector<TransContext*> txcs;      ///< in apply order
+    vector<utime_t> joined;          ///< when each of txcs joined
+    map<uint64_t,bufferlist> blocks; ///< device offset -> one block of data
+    utime_t start;                   ///< when the first txc joined
+
+    WALBatch() : ioc(static_cast<AioContext*>(this)) {}
+
+    void aio_finish(BlueStore *store) override {
+      store->_wal_batch_finish(this);
+    }
+  };
+
+  struct WALBatchThread : public Thread {
+    BlueStore *store;
+    explicit WALBatchThread(BlueStore *s) : store(s) {}
+    void *entry() {
+      store->_wal_batch_thread();
+      return NULL;
+    }
+  };
+
   struct KVSyncThread : public Thread {
     BlueStore *store;
     explicit KVSyncThread(BlueStore *s) : store(s) {}
@@ -512,6 +772,38 @@ public:
     }
   };
 
+  struct KVFinalizeThread : public Thread {
+    BlueStore *store;
+    explicit KVFinalizeThread(BlueStore *s) : store(s) {}
+    void *entry() {
+      store->_kv_finalize_thread();
+      return NULL;
+    }
+  };
+
+  struct OnlineFsckThread : public Thread {
+    BlueStore *store;
+    explicit OnlineFsckThread(BlueStore *s) : store(s) {}
+    void *entry() {
+      store->_online_fsck_thread();
+      return NULL;
+    }
+  };
+
+  /// progress of the online (background) fsck
+  struct online_fsck_stat_t {
+    utime_t started, finished;
+    unsigned collections = 0, collections_done = 0;
+    coll_t cur_cid;
+    uint64_t objects = 0;
+    uint64_t errors = 0;
+    uint64_t backoffs = 0;      ///< times we yielded to client io
+    list<string> error_log;     ///< most recent errors, oldest first
+  };
+
+  class SocketHook;
+  friend class SocketHook;
+
   // --------------------------------------------------------
   // members
 private:
@@ -521,6 +813,7 @@ private:
   KeyValueDB *db;
   BlockDevice *bdev;
   FreelistManager *fm;
+  string freelist_type;  ///< extent | bitmap
   Allocator *alloc;
   uuid_d fsid;
   int path_fd;  ///< open handle to $path
@@ -544,6 +837,12 @@ private:
   ThreadPool wal_tp;
   WALWQ wal_wq;
 
+  WALBatchThread wal_batch_thread;
+  std::mutex wal_batch_lock;
+  std::condition_variable wal_batch_cond;
+  bool wal_batch_stop;
+  WALBatch *wal_batch;  ///< batch being filled (if any)
+
   Finisher finisher;
 
   KVSyncThread kv_sync_thread;
@@ -553,11 +852,39 @@ private:
   deque<TransContext*> kv_queue, kv_committing;
   deque<TransContext*> wal_cleanup_queue, wal_cleaning;
 
+  /// committed txcs whose completions run while the next batch commits
+  KVFinalizeThread kv_finalize_thread;
+  std::condition_variable kv_finalize_cond;
+  bool kv_finalize_stop;
+  bool kv_finalizing;  ///< finalize thread is working outside kv_lock
+  deque<TransContext*> kv_committed_queue, wal_cleaned_queue;
+
   PerfCounters *logger;
 
+  int csum_type;               ///< bluestore_csum_t::CSUM_* for new objects
+  unsigned csum_chunk_order;   ///< log2 of checksum chunk size
+
+  int comp_mode;               ///< Compressor::COMP_* unless the pool says
+  int comp_alg;                ///< Compressor::COMP_ALG_* unless the pool says
+  double comp_required_ratio;  ///< unless the pool says
+  uint64_t comp_blob_size;     ///< logical bytes per compressed blob
+  std::mutex compressor_lock;  ///< protects compressors
+  CompressorRef compressors[Compressor::COMP_ALG_LAST];
+
+  vector<Cache*> cache_shards;  ///< onode and buffer caches
+
   std::mutex reap_lock;
   list<CollectionRef> removed_collections;
 
+  OnlineFsckThread online_fsck_thread;
+  std::mutex online_fsck_lock;
+  std::condition_variable online_fsck_cond;
+  bool online_fsck_running;
+  bool online_fsck_stop;
+  online_fsck_stat_t online_fsck_stat;
+
+  SocketHook *asok_hook;
+
 
   // --------------------------------------------------------
   // private methods
@@ -576,10 +903,13 @@ private:
   void _close_bdev();
   int _open_db(bool create);
   void _close_db();
-  int _open_alloc();
+  int _open_alloc(bool create);
   void _close_alloc();
   int _open_collections(int *errors=0);
   void _close_collections();
+  void _set_csum();
+  void _set_compression();
+  CompressorRef _get_compressor(int alg);
 
   int _setup_block_symlink_or_file(string name, string path, uint64_t size,
 				   bool create);
@@ -597,6 +927,8 @@ private:
   void _commit_bluefs_freespace(const vector<bluestore_extent_t>& extents);
 
   CollectionRef _get_collection(const coll_t& cid);
+  Cache *_get_cache_shard(const coll_t& cid);
+  void _trim_cache(Cache *cache);
   void _queue_reap_collection(CollectionRef& c);
   void _reap_collections();
 
@@ -615,7 +947,7 @@ private:
   void _txc_update_fm(TransContext *txc);
 public:
   void _txc_aio_finish(void *p) {
-    _txc_state_proc(static_cast<TransContext*>(p));
+    static_cast<AioContext*>(p)->aio_finish(this);
   }
 private:
   void _txc_finish_io(TransContext *txc);
@@ -625,6 +957,7 @@ private:
   void _osr_reap_done(OpSequencer *osr);
 
   void _kv_sync_thread();
+  void _kv_finalize_thread();
   void _kv_stop() {
     {
       std::lock_guard<std::mutex> l(kv_lock);
@@ -632,18 +965,63 @@ private:
       kv_cond.notify_all();
     }
     kv_sync_thread.join();
+    {
+      std::lock_guard<std::mutex> l(kv_lock);
+      kv_finalize_stop = true;
+      kv_finalize_cond.notify_all();
+    }
+    kv_finalize_thread.join();
     kv_stop = false;
+    kv_finalize_stop = false;
   }
 
   bluestore_wal_op_t *_get_wal_op(TransContext *txc, OnodeRef o);
   int _wal_apply(TransContext *txc);
   int _wal_finish(TransContext *txc);
-  int _do_wal_op(bluestore_wal_op_t& wo, IOContext *ioc);
+  int _do_wal_op(bluestore_wal_op_t& wo, IOContext *ioc,
+		 WALBatch *batch = nullptr);
+  int _wal_read(WALBatch *batch, uint64_t offset, uint64_t length,
+		bufferlist *bl, IOContext *ioc);
+  int _wal_write(WALBatch *batch, uint64_t offset, bufferlist& bl,
+		 IOContext *ioc);
   int _wal_replay();
 
+  bool _wal_batchable(bluestore_wal_transaction_t& wt);
+  void _wal_batch_add(TransContext *txc);
+  void _wal_batch_submit();
+  void _wal_batch_finish(WALBatch *b);
+  void _wal_batch_thread();
+  void _wal_batch_stop() {
+    {
+      std::lock_guard<std::mutex> l(wal_batch_lock);
+      wal_batch_stop = true;
+      wal_batch_cond.notify_all();
+    }
+    wal_batch_thread.join();
+    wal_batch_stop = false;
+  }
+
   // for fsck
   int _verify_enode_shared(EnodeRef enode, vector<bluestore_extent_t>& v,
 			   interval_set<uint64_t> &used_blocks);
+  int _verify_enode_shared(uint32_t hash,
+			   const bluestore_extent_ref_map_t& enode_ref_map,
+			   vector<bluestore_extent_t>& v,
+			   interval_set<uint64_t> &used_blocks);
+  int _fsck_check_extents(const ghobject_t& oid, bluestore_onode_t& onode,
+			  interval_set<uint64_t>& used_blocks,
+			  vector<bluestore_extent_t>& hash_shared);
+
+  void _online_fsck_thread();
+  int _online_fsck_collection(CollectionRef c);
+  int _online_fsck_batch(CollectionRef c, const string& end,
+			 string *pos, bool *done);
+  void _online_fsck_error(const string& what, int errors);
+  bool _online_fsck_throttle(unsigned objects);
+  void _online_fsck_stop();
+
+  void _register_admin_socket();
+  void _unregister_admin_socket();
 
 public:
   BlueStore(CephContext *cct, const string& path);
@@ -657,6 +1035,8 @@ public:
   bool wants_journal() override { return false; };
   bool allows_journal() override { return false; };
 
+  bool has_builtin_csum(CollectionHandle &c, const ghobject_t& oid) override;
+
   static int get_block_device_fsid(const string& path, uuid_d *fsid);
 
   bool test_mount_in_use() override;
@@ -667,6 +1047,20 @@ public:
 
   int fsck() override;
 
+  /// start checking collections in the background while mounted
+  int start_online_fsck();
+  /// ask a running online fsck to stop; returns once it has
+  void stop_online_fsck();
+  void dump_online_fsck(Formatter *f);
+
+  /// debug: mark the first extent of an object free in the freelist
+  /// (or, with free false, allocated again), leaving the object alone
+  void inject_false_free(const coll_t& cid, const ghobject_t& oid,
+			 bool free = true);
+  /// debug: how many of an object's checksum chunks are valid
+  int get_csum_coverage(const coll_t& cid, const ghobject_t& oid,
+			size_t *valid, size_t *chunks);
+
   int validate_hobject_key(const hobject_t &obj) const override {
     return 0;
   }
@@ -710,6 +1104,14 @@ public:
     bufferlist& bl,
     uint32_t op_flags = 0,
     bool allow_eio = false) override;
+  int read_multi(
+    const coll_t& cid,
+    vector<read_multi_op_t>& ops,
+    bool allow_eio = false) override;
+  int read_multi(
+    CollectionHandle &c,
+    vector<read_multi_op_t>& ops,
+    bool allow_eio = false) override;
   int _do_read(
     OnodeRef o,
     uint64_t offset,
@@ -739,6 +1141,9 @@ public:
   bool collection_exists(const coll_t& c) override;
   bool collection_empty(const coll_t& c) override;
   int collection_bits(const coll_t& c) override;
+  int set_collection_opts(
+    const coll_t& cid,
+    const pool_opts_t& opts) override;
 
   int collection_list(const coll_t& cid, ghobject_t start, ghobject_t end,
 		      bool sort_bitwise, int max,
@@ -830,6 +1235,11 @@ public:
     return fsid;
   }
 
+  void bind_op_thread(unsigned index) override {
+    if (bdev)
+      bdev->bind_op_thread(index);
+  }
+
   objectstore_perf_stat_t get_cur_stats() override {
     return objectstore_perf_stat_t();
   }
@@ -867,16 +1277,21 @@ private:
   int _do_write_overlays(TransContext *txc, CollectionRef& c, OnodeRef o,
 			 uint64_t offset, uint64_t length);
   void _do_read_all_overlays(bluestore_wal_op_t& wo);
-  void _pad_zeros(TransContext *txc,
-		  OnodeRef o, bufferlist *bl, uint64_t *offset, uint64_t *length,
+  void _pad_zeros(OnodeRef o, bufferlist *bl,
+		  uint64_t *offset, uint64_t *length,
 		  uint64_t block_size);
   void _pad_zeros_head(OnodeRef o, bufferlist *bl,
 		       uint64_t *offset, uint64_t *length,
 		       uint64_t block_size);
-  void _pad_zeros_tail(TransContext *txc,
-		       OnodeRef o, bufferlist *bl,
+  void _pad_zeros_tail(OnodeRef o, bufferlist *bl,
 		       uint64_t offset, uint64_t *length,
 		       uint64_t block_size);
+  /// cached data for the start of the tail block, if we may use it
+  /// to rewrite that block in place
+  bool _get_cached_tail(TransContext *txc, OnodeRef o,
+			uint64_t offset, uint64_t length,
+			uint64_t block_size,
+			bufferlist *bl, uint64_t *seq);
   int _do_allocate(TransContext *txc,
 		   CollectionRef& c,
 		   OnodeRef o,
@@ -885,6 +1300,43 @@ private:
 		   bool allow_overlay,
 		   uint64_t *rmw_cow_head,
 		   uint64_t *rmw_cow_tail);
+  void _do_dealloc_range(TransContext *txc,
+			 CollectionRef& c,
+			 OnodeRef o,
+			 uint64_t offset, uint64_t length,
+			 uint64_t *hint);
+  int _read_blob(OnodeRef o,
+		 uint64_t offset,
+		 const bluestore_compressed_blob_t& b,
+		 bufferlist *bl,
+		 IOContext *ioc,
+		 bool buffered);
+  void _do_release_blob(TransContext *txc,
+			CollectionRef& c,
+			OnodeRef o,
+			const bluestore_compressed_blob_t& b);
+  int _do_uncompress(TransContext *txc,
+		     CollectionRef& c,
+		     OnodeRef o,
+		     uint64_t offset, uint64_t length);
+  bool _want_compress(CollectionRef& c,
+		      OnodeRef o,
+		      int *alg,
+		      double *required_ratio);
+  int _do_write_compressed(TransContext *txc,
+			   CollectionRef& c,
+			   OnodeRef o,
+			   uint64_t offset,
+			   bufferlist& bl,
+			   bufferlist& compressed,
+			   int alg,
+			   uint32_t fadvise_flags);
+  int _do_write_extents(TransContext *txc,
+			CollectionRef &c,
+			OnodeRef o,
+			uint64_t offset, uint64_t length,
+			bufferlist& bl,
+			uint32_t fadvise_flags);
   int _do_write(TransContext *txc,
 		CollectionRef &c,
 		OnodeRef o,
@@ -965,7 +1417,8 @@ private:
 		    CollectionRef& c,
 		    OnodeRef& o,
 		    uint64_t expected_object_size,
-		    uint64_t expected_write_size);
+		    uint64_t expected_write_size,
+		    uint32_t flags);
   int _clone(TransContext *txc,
 	     CollectionRef& c,
 	     OnodeRef& oldo,
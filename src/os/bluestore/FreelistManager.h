@@ -5,51 +5,58 @@
 #define CEPH_OS_BLUESTORE_FREELISTMANAGER_H
 
 #include <string>
-#include <map>
-#include <mutex>
 #include <ostream>
 #include "kv/KeyValueDB.h"
 
-#include "include/cpp-btree/btree_map.h"
-
+/**
+ * FreelistManager
+ *
+ * Persists the set of free extents on the device in the kv store.
+ * Allocations and releases are recorded in the same kv transaction
+ * that references (or stops referencing) the space, and the allocator
+ * is populated from the freelist at mount.
+ */
 class FreelistManager {
-  std::string prefix;
-  std::mutex lock;
-  uint64_t total_free;
+public:
+  FreelistManager() {}
+  virtual ~FreelistManager() {}
 
-  typedef btree::btree_map<uint64_t,uint64_t> map_t;
-  static const bool map_t_has_stable_iterators = false;
+  static FreelistManager *create(
+    std::string type,
+    KeyValueDB *db,
+    std::string meta_prefix,
+    std::string bitmap_prefix);
 
-  map_t kv_free;    ///< mirrors our kv values in the db
+  /// register any kv merge operators we need; call before the db is opened
+  static int setup_merge_operators(KeyValueDB *db,
+				   std::string bitmap_prefix);
 
-  void _audit();
-  void _dump();
+  /// set up the persistent state for a new store (mkfs)
+  virtual int create(uint64_t size, uint64_t block_size,
+		     KeyValueDB::Transaction txn) = 0;
 
-public:
-  FreelistManager() :
-    total_free(0) {
-  }
+  virtual int init() = 0;
+  virtual void shutdown() = 0;
 
-  int init(KeyValueDB *kvdb, std::string prefix);
-  void shutdown();
+  virtual void dump() = 0;
 
-  void dump();
+  virtual uint64_t get_total_free() = 0;
 
-  uint64_t get_total_free() {
-    std::lock_guard<std::mutex> l(lock);
-    return total_free;
-  }
+  /// iterate over free extents, in offset order
+  virtual void enumerate_reset() = 0;
+  virtual bool enumerate_next(uint64_t *offset, uint64_t *length) = 0;
 
-  const map_t& get_freelist() {
-    return kv_free;
-  }
+  /// true if any part of offset~length is free in the db state seen by it
+  /// (which may be a snapshot iterator); it is repositioned.
+  virtual bool is_any_free(KeyValueDB::WholeSpaceIterator it,
+			   uint64_t offset, uint64_t length) = 0;
 
-  int allocate(
+  virtual int allocate(
     uint64_t offset, uint64_t length,
-    KeyValueDB::Transaction txn);
-  int release(
+    KeyValueDB::Transaction txn) = 0;
+  virtual int release(
     uint64_t offset, uint64_t length,
-    KeyValueDB::Transaction txn);
+    KeyValueDB::Transaction txn) = 0;
 };
 
 
@@ -53,6 +53,7 @@ extern "C" {
 #include "common/perf_counters.h"
 
 #include "NVMEDevice.h"
+#include "PolledQueue.h"
 
 #define dout_subsys ceph_subsys_bdev
 #undef dout_prefix
@@ -73,6 +74,8 @@ enum {
   l_bluestore_nvmedevice_flush_queue_lat,
   l_bluestore_nvmedevice_queue_ops,
   l_bluestore_nvmedevice_polling_lat,
+  l_bluestore_nvmedevice_polled_ops,
+  l_bluestore_nvmedevice_polled_queues,
   l_bluestore_nvmedevice_last
 };
 
@@ -84,6 +87,27 @@ int dpdk_thread_adaptor(void *f)
   return 0;
 }
 
+/**
+ * NVMEQueue
+ *
+ * The io queue pair SPDK allocates for a thread when it registers
+ * itself.  Commands issued from that thread go to its own queue pair,
+ * and spdk_nvme_ctrlr_process_io_completions() reaps only that queue
+ * pair, so the thread submits and completes its io without touching
+ * the driver thread.
+ *
+ * SPDK only lets a thread unregister itself, so the queue pair stays
+ * with the thread until it exits or the controller is detached.
+ */
+class NVMEQueue : public PolledQueue {
+  spdk_nvme_ctrlr *ctrlr;
+ public:
+  explicit NVMEQueue(spdk_nvme_ctrlr *c) : ctrlr(c) {}
+  int poll(unsigned max) override {
+    return spdk_nvme_ctrlr_process_io_completions(ctrlr, max);
+  }
+};
+
 class SharedDriverData {
   unsigned id;
   std::string sn;
@@ -122,6 +146,10 @@ class SharedDriverData {
   Cond flush_cond;
   std::atomic_int flush_waiters;
 
+  PolledQueueSet queues;
+
+  void _issue(Task *t);
+
  public:
   bool zero_command_support;
   std::atomic_int inflight_ops;
@@ -139,6 +167,15 @@ class SharedDriverData {
         queue_lock("NVMEDevice::queue_lock"),
         flush_lock("NVMEDevice::flush_lock"),
         flush_waiters(0),
+        queues(g_conf->bdev_nvme_polled_queues,
+               [this]() -> PolledQueue* {
+                 if (spdk_nvme_register_io_thread() != 0) {
+                   derr << "NVMEDevice failed to register io thread" << dendl;
+                   return nullptr;
+                 }
+                 logger->inc(l_bluestore_nvmedevice_polled_queues);
+                 return new NVMEQueue(ctrlr);
+               }),
         inflight_ops(0) {
     block_size = spdk_nvme_ns_get_sector_size(ns);
     size = block_size * spdk_nvme_ns_get_num_sectors(ns);
@@ -152,6 +189,8 @@ class SharedDriverData {
     b.add_time_avg(l_bluestore_nvmedevice_flush_lat, "flush_lat", "Average flush completing latency");
     b.add_u64(l_bluestore_nvmedevice_queue_ops, "queue_ops", "Operations in nvme queue");
     b.add_time_avg(l_bluestore_nvmedevice_polling_lat, "polling_lat", "Average polling latency");
+    b.add_u64_counter(l_bluestore_nvmedevice_polled_ops, "polled_ops", "Operations submitted and reaped on the caller's own queue pair");
+    b.add_u64(l_bluestore_nvmedevice_polled_queues, "polled_queues", "Per-thread queue pairs");
     b.add_time_avg(l_bluestore_nvmedevice_aio_write_queue_lat, "aio_write_queue_lat", "Average queue write request latency");
     b.add_time_avg(l_bluestore_nvmedevice_aio_zero_queue_lat, "aio_zero_queue_lat", "Average queue zero request latency");
     b.add_time_avg(l_bluestore_nvmedevice_read_queue_lat, "read_queue_lat", "Average queue read request latency");
@@ -200,6 +239,25 @@ class SharedDriverData {
     }
   }
 
+  /// give the calling op thread its own queue pair, if there is one left
+  void bind_op_thread(unsigned index) {
+    queues.bind(index);
+  }
+
+  /// the calling thread's own queue pair, or nullptr for the shared thread
+  NVMEQueue *get_queue() {
+    return static_cast<NVMEQueue*>(queues.get());
+  }
+
+  /// issue a task chain on the caller's queue pair; reap with its poll()
+  void submit_polled(Task *t, uint64_t ops = 1) {
+    logger->inc(l_bluestore_nvmedevice_polled_ops, ops);
+    for (Task *p = t; p; p = p->next)
+      p->polled = true;
+    for (; t; t = t->next)
+      _issue(t);
+  }
+
   void flush_wait() {
     if (inflight_ops.load()) {
       // TODO: this may contains read op
@@ -214,6 +272,81 @@ class SharedDriverData {
   }
 };
 
+void SharedDriverData::_issue(Task *t)
+{
+  int r = 0;
+  uint64_t lba_off = t->offset / block_size;
+  uint64_t lba_count = t->len / block_size;
+  utime_t lat;
+  switch (t->command) {
+    case IOCommand::WRITE_COMMAND:
+    {
+      dout(20) << __func__ << " write command issued " << lba_off << "~" << lba_count << dendl;
+      r = spdk_nvme_ns_cmd_write(ns, t->buf, lba_off, lba_count, io_complete, t, 0);
+      if (r < 0) {
+        t->ctx->nvme_task_first = t->ctx->nvme_task_last = nullptr;
+        rte_free(t->buf);
+        rte_mempool_put(task_pool, t);
+        derr << __func__ << " failed to do write command" << dendl;
+        assert(0);
+      }
+      lat = ceph_clock_now(g_ceph_context);
+      lat -= t->start;
+      logger->tinc(l_bluestore_nvmedevice_aio_write_queue_lat, lat);
+      break;
+    }
+    case IOCommand::ZERO_COMMAND:
+    {
+      dout(20) << __func__ << " zero command issued " << lba_off << "~" << lba_count << dendl;
+      assert(zero_command_support);
+      r = spdk_nvme_ns_cmd_write_zeroes(ns, lba_off, lba_count, io_complete, t, 0);
+      if (r < 0) {
+        t->ctx->nvme_task_first = t->ctx->nvme_task_last = nullptr;
+        rte_mempool_put(task_pool, t);
+        derr << __func__ << " failed to do zero command" << dendl;
+        assert(0);
+      }
+      lat = ceph_clock_now(g_ceph_context);
+      lat -= t->start;
+      logger->tinc(l_bluestore_nvmedevice_aio_zero_queue_lat, lat);
+      break;
+    }
+    case IOCommand::READ_COMMAND:
+    {
+      dout(20) << __func__ << " read command issueed " << lba_off << "~" << lba_count << dendl;
+      r = spdk_nvme_ns_cmd_read(ns, t->buf, lba_off, lba_count, io_complete, t, 0);
+      if (r < 0) {
+        derr << __func__ << " failed to read" << dendl;
+        --t->ctx->num_reading;
+        t->return_code = r;
+        std::unique_lock<std::mutex> l(t->ctx->lock);
+        t->ctx->cond.notify_all();
+      } else {
+        lat = ceph_clock_now(g_ceph_context);
+        lat -= t->start;
+        logger->tinc(l_bluestore_nvmedevice_read_queue_lat, lat);
+      }
+      break;
+    }
+    case IOCommand::FLUSH_COMMAND:
+    {
+      dout(20) << __func__ << " flush command issueed " << dendl;
+      r = spdk_nvme_ns_cmd_flush(ns, io_complete, t);
+      if (r < 0) {
+        derr << __func__ << " failed to flush" << dendl;
+        t->return_code = r;
+        std::unique_lock<std::mutex> l(t->ctx->lock);
+        t->ctx->cond.notify_all();
+      } else {
+        lat = ceph_clock_now(g_ceph_context);
+        lat -= t->start;
+        logger->tinc(l_bluestore_nvmedevice_flush_queue_lat, lat);
+      }
+      break;
+    }
+  }
+}
+
 void SharedDriverData::_aio_thread()
 {
   dout(1) << __func__ << " start" << dendl;
@@ -222,9 +355,7 @@ void SharedDriverData::_aio_thread()
   }
 
   Task *t;
-  int r = 0;
   const int max = 4;
-  uint64_t lba_off, lba_count;
   utime_t lat, start = ceph_clock_now(g_ceph_context);
   while (true) {
     dout(40) << __func__ << " polling" << dendl;
@@ -261,77 +392,8 @@ void SharedDriverData::_aio_thread()
       }
     }
 
-    for (; t; t = t->next) {
-      lba_off = t->offset / block_size;
-      lba_count = t->len / block_size;
-      switch (t->command) {
-        case IOCommand::WRITE_COMMAND:
-        {
-          dout(20) << __func__ << " write command issued " << lba_off << "~" << lba_count << dendl;
-          r = spdk_nvme_ns_cmd_write(ns, t->buf, lba_off, lba_count, io_complete, t, 0);
-          if (r < 0) {
-            t->ctx->nvme_task_first = t->ctx->nvme_task_last = nullptr;
-            rte_free(t->buf);
-            rte_mempool_put(task_pool, t);
-            derr << __func__ << " failed to do write command" << dendl;
-            assert(0);
-          }
-          lat = ceph_clock_now(g_ceph_context);
-          lat -= t->start;
-          logger->tinc(l_bluestore_nvmedevice_aio_write_queue_lat, lat);
-          break;
-        }
-        case IOCommand::ZERO_COMMAND:
-        {
-          dout(20) << __func__ << " zero command issued " << lba_off << "~" << lba_count << dendl;
-          assert(zero_command_support);
-          r = spdk_nvme_ns_cmd_write_zeroes(ns, lba_off, lba_count, io_complete, t, 0);
-          if (r < 0) {
-            t->ctx->nvme_task_first = t->ctx->nvme_task_last = nullptr;
-            rte_mempool_put(task_pool, t);
-            derr << __func__ << " failed to do zero command" << dendl;
-            assert(0);
-          }
-          lat = ceph_clock_now(g_ceph_context);
-          lat -= t->start;
-          logger->tinc(l_bluestore_nvmedevice_aio_zero_queue_lat, lat);
-          break;
-        }
-        case IOCommand::READ_COMMAND:
-        {
-          dout(20) << __func__ << " read command issueed " << lba_off << "~" << lba_count << dendl;
-          r = spdk_nvme_ns_cmd_read(ns, t->buf, lba_off, lba_count, io_complete, t, 0);
-          if (r < 0) {
-            derr << __func__ << " failed to read" << dendl;
-            --t->ctx->num_reading;
-            t->return_code = r;
-            std::unique_lock<std::mutex> l(t->ctx->lock);
-            t->ctx->cond.notify_all();
-          } else {
-            lat = ceph_clock_now(g_ceph_context);
-            lat -= t->start;
-            logger->tinc(l_bluestore_nvmedevice_read_queue_lat, lat);
-          }
-          break;
-        }
-        case IOCommand::FLUSH_COMMAND:
-        {
-          dout(20) << __func__ << " flush command issueed " << dendl;
-          r = spdk_nvme_ns_cmd_flush(ns, io_complete, t);
-          if (r < 0) {
-            derr << __func__ << " failed to flush" << dendl;
-            t->return_code = r;
-            std::unique_lock<std::mutex> l(t->ctx->lock);
-            t->ctx->cond.notify_all();
-          } else {
-            lat = ceph_clock_now(g_ceph_context);
-            lat -= t->start;
-            logger->tinc(l_bluestore_nvmedevice_flush_queue_lat, lat);
-          }
-          break;
-        }
-      }
-    }
+    for (; t; t = t->next)
+      _issue(t);
     if (inflight_ops.load()) {
       spdk_nvme_ctrlr_process_io_completions(ctrlr, max);
       dout(30) << __func__ << " idle, have a pause" << dendl;
@@ -553,7 +615,9 @@ void io_complete(void *t, const struct spdk_nvme_cpl *completion)
   Task *task = static_cast<Task*>(t);
   IOContext *ctx = task->ctx;
   SharedDriverData *driver = task->device->get_driver();
-  int left = --driver->inflight_ops;
+  // polled tasks are reaped by their submitter and never counted as
+  // inflight on the shared thread
+  int left = task->polled ? 0 : --driver->inflight_ops;
   utime_t lat = ceph_clock_now(g_ceph_context);
   lat -= task->start;
   if (task->command == IOCommand::WRITE_COMMAND ||
@@ -565,7 +629,13 @@ void io_complete(void *t, const struct spdk_nvme_cpl *completion)
     assert(!spdk_nvme_cpl_is_error(completion));
     dout(20) << __func__ << " write/zero op successfully, left " << left << dendl;
     // buffer write/zero won't have ctx, and we will free request later, see `flush`
-    if (ctx) {
+    if (ctx && task->polled) {
+      // the submitter is polling for num_running to drop to zero and
+      // does the wakeup and callback itself; see aio_submit.
+      --ctx->num_running;
+      rte_free(task->buf);
+      rte_mempool_put(task_pool, task);
+    } else if (ctx) {
       // check waiting count before doing callback (which may
       // destroy this ioc).
       if (!--ctx->num_running) {
@@ -676,6 +746,12 @@ void NVMEDevice::close()
   dout(1) << __func__ << " end" << dendl;
 }
 
+void NVMEDevice::bind_op_thread(unsigned index)
+{
+  dout(10) << __func__ << " " << index << dendl;
+  driver->bind_op_thread(index);
+}
+
 int NVMEDevice::flush()
 {
   dout(10) << __func__ << " start" << dendl;
@@ -741,9 +817,23 @@ void NVMEDevice::aio_submit(IOContext *ioc)
     ioc->num_running += pending;
     ioc->num_pending -= pending;
     assert(ioc->num_pending.load() == 0);  // we should be only thread doing this
-    // Only need to push the first entry
-    driver->queue_task(t, pending);
     ioc->nvme_task_first = ioc->nvme_task_last = nullptr;
+    NVMEQueue *q = driver->get_queue();
+    if (!q) {
+      // Only need to push the first entry
+      driver->queue_task(t, pending);
+      return;
+    }
+
+    // issue and reap on our own queue pair.  io_complete leaves the
+    // wakeup and callback to us so that we never touch the ioc after
+    // the callback (which may destroy it).
+    driver->submit_polled(t, pending);
+    q->poll_until([ioc]() { return ioc->num_running.load() == 0; });
+    ioc->aio_wake();
+    if (aio_callback && ioc->priv) {
+      aio_callback(aio_callback_priv, ioc->priv);
+    }
   }
 }
 
@@ -785,9 +875,12 @@ int NVMEDevice::aio_write(
   t->device = this;
   t->return_code = 0;
   t->next = nullptr;
+  t->polled = false;
 
   if (buffered) {
     t->ctx = nullptr;
+    // buffered writes always go to the shared thread, whose inflight
+    // count flush() waits on.
     // Only need to push the first entry
     driver->queue_task(t);
     Mutex::Locker l(buffer_lock);
@@ -837,6 +930,7 @@ int NVMEDevice::aio_zero(
     t->buf = nullptr;
     t->return_code = 0;
     t->next = nullptr;
+    t->polled = false;
     t->ctx = ioc;
     Task *first = static_cast<Task*>(ioc->nvme_task_first);
     Task *last = static_cast<Task*>(ioc->nvme_task_last);
@@ -863,6 +957,20 @@ int NVMEDevice::aio_zero(
   return 0;
 }
 
+void NVMEDevice::_submit_and_wait(Task *t, IOContext *ioc)
+{
+  NVMEQueue *q = driver->get_queue();
+  if (q) {
+    driver->submit_polled(t);
+    q->poll_until([t]() { return t->return_code <= 0; });
+    return;
+  }
+  driver->queue_task(t);
+  std::unique_lock<std::mutex> l(ioc->lock);
+  while (t->return_code > 0)
+    ioc->cond.wait(l);
+}
+
 int NVMEDevice::read(uint64_t off, uint64_t len, bufferlist *pbl,
                      IOContext *ioc,
                      bool buffered)
@@ -896,14 +1004,9 @@ int NVMEDevice::read(uint64_t off, uint64_t len, bufferlist *pbl,
   t->device = this;
   t->return_code = 1;
   t->next = nullptr;
+  t->polled = false;
   ++ioc->num_reading;
-  driver->queue_task(t);
-
-  {
-    std::unique_lock<std::mutex> l(ioc->lock);
-    while (t->return_code > 0)
-      ioc->cond.wait(l);
-  }
+  _submit_and_wait(t, ioc);
   memcpy(p.c_str(), t->buf, len);
   {
     Mutex::Locker l(buffer_lock);
@@ -957,14 +1060,9 @@ int NVMEDevice::read_buffered(uint64_t off, uint64_t len, char *buf)
   t->device = this;
   t->return_code = 1;
   t->next = nullptr;
+  t->polled = false;
   ++ioc.num_reading;
-  driver->queue_task(t);
-
-  {
-    std::unique_lock<std::mutex> l(ioc.lock);
-    while (t->return_code > 0)
-      ioc.cond.wait(l);
-  }
+  _submit_and_wait(t, &ioc);
   memcpy(buf, (char*)t->buf+off-aligned_off, len);
   {
     Mutex::Locker l(buffer_lock);
@@ -50,6 +50,7 @@ struct Task {
   Task *next;
   int64_t return_code;
   utime_t start;
+  bool polled;   ///< issued on the submitter's own queue pair
 };
 
 class PerfCounters;
@@ -213,6 +214,10 @@ class NVMEDevice : public BlockDevice {
   Task *buffered_task_head = nullptr;
 
   static void init();
+
+  /// issue a read/flush task and wait for it to complete
+  void _submit_and_wait(Task *t, IOContext *ioc);
+
  public:
   void queue_buffer_task(Task *t) {
     Mutex::Locker l(buffer_lock);
@@ -251,6 +256,7 @@ class NVMEDevice : public BlockDevice {
                IOContext *ioc) override;
   int flush() override;
   int read_buffered(uint64_t off, uint64_t len, char *buf) override;
+  void bind_op_thread(unsigned index) override;
 
   // for managing buffered readers/writers
   int invalidate_cache(uint64_t off, uint64_t len) override;
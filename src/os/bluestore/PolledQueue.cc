@@ -0,0 +1,107 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <utility>
+
+#include "PolledQueue.h"
+
+#include "common/debug.h"
+
+#define dout_subsys ceph_subsys_bdev
+#undef dout_prefix
+#define dout_prefix *_dout << "bdev polled_queues(" << id << ") "
+
+std::atomic<uint64_t> PolledQueueSet::last_id = {0};
+
+// (set id, queue) for every set this thread has bound or asked;
+// nullptr means the thread uses the shared path.  ids are never reused,
+// so entries for sets that have since been destroyed are never matched.
+static thread_local std::vector<std::pair<uint64_t, PolledQueue*>> tls_queues;
+
+static PolledQueue **tls_find(uint64_t id)
+{
+  for (auto& p : tls_queues) {
+    if (p.first == id)
+      return &p.second;
+  }
+  return nullptr;
+}
+
+PolledQueueSet::PolledQueueSet(unsigned max, factory_t f)
+  : id(++last_id),
+    max_queues(max),
+    factory(f),
+    queues(max, nullptr)
+{
+}
+
+PolledQueueSet::~PolledQueueSet()
+{
+  for (auto q : queues)
+    delete q;
+}
+
+PolledQueue *PolledQueueSet::_claim(unsigned slot)
+{
+  std::lock_guard<std::mutex> l(lock);
+  if (slot >= max_queues) {
+    dout(10) << __func__ << " slot " << slot << " >= " << max_queues
+	     << ", using shared path" << dendl;
+    return nullptr;
+  }
+  if (queues[slot]) {
+    // a thread that held it exited and another took its index; the
+    // queue stays with the thread that built it
+    dout(1) << __func__ << " slot " << slot << " already bound"
+	    << ", using shared path" << dendl;
+    return nullptr;
+  }
+  PolledQueue *q = factory();
+  if (!q) {
+    dout(1) << __func__ << " slot " << slot << " failed to create queue"
+	    << ", using shared path" << dendl;
+    return nullptr;
+  }
+  queues[slot] = q;
+  ++num_queues;
+  dout(10) << __func__ << " slot " << slot << " queue " << q << dendl;
+  return q;
+}
+
+PolledQueue *PolledQueueSet::bind(unsigned slot)
+{
+  PolledQueue **cached = tls_find(id);
+  if (cached && *cached)
+    return *cached;  // already bound
+  PolledQueue *q = _claim(slot);
+  if (cached) {
+    // already counted as shared by get() or an earlier bind()
+    *cached = q;
+    if (q)
+      --num_shared;
+  } else {
+    tls_queues.push_back(std::make_pair(id, q));
+    if (!q)
+      ++num_shared;
+  }
+  return q;
+}
+
+PolledQueue *PolledQueueSet::get()
+{
+  PolledQueue **cached = tls_find(id);
+  if (cached)
+    return *cached;
+  ++num_shared;
+  tls_queues.push_back(std::make_pair(id, static_cast<PolledQueue*>(nullptr)));
+  return nullptr;
+}
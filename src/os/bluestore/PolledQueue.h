@@ -0,0 +1,98 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_OS_BLUESTORE_POLLEDQUEUE_H
+#define CEPH_OS_BLUESTORE_POLLEDQUEUE_H
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+/**
+ * PolledQueue
+ *
+ * A device submission/completion queue that belongs to one thread.
+ * The owner issues io on it directly and reaps completions by calling
+ * poll(), so completion callbacks run in the submitting thread and
+ * the hot path has no handoff to a driver thread and no interrupt.
+ */
+class PolledQueue {
+public:
+  virtual ~PolledQueue() {}
+
+  /// reap up to max completions; return the number reaped
+  virtual int poll(unsigned max) = 0;
+
+  /// poll until done() is true
+  template <typename Pred>
+  void poll_until(Pred done, unsigned max = 4) {
+    while (!done())
+      poll(max);
+  }
+};
+
+/**
+ * PolledQueueSet
+ *
+ * Up to max_queues PolledQueues, one per slot.  A long-lived io thread
+ * (an OSD op shard worker) claims a slot with bind(); its queue is
+ * built there by factory(), in that thread, and get() returns it from
+ * then on.  Every other thread, and a bound thread whose slot is out of
+ * range, taken, or whose factory() failed, gets nullptr from get() and
+ * must use the device's shared submission path.
+ *
+ * get() is a lookup in a thread-local cache; the lock is only taken by
+ * bind() and the first get() of an unbound thread.
+ */
+class PolledQueueSet {
+public:
+  typedef std::function<PolledQueue*()> factory_t;
+
+private:
+  const uint64_t id;       ///< unique per set, never reused
+  const unsigned max_queues;
+  factory_t factory;
+
+  std::mutex lock;
+  std::vector<PolledQueue*> queues;        ///< by slot, nullptr if unclaimed
+  unsigned num_queues = 0;
+  std::atomic<unsigned> num_shared = {0};  ///< threads sent to shared path
+
+  static std::atomic<uint64_t> last_id;
+
+  PolledQueue *_claim(unsigned slot);
+
+public:
+  PolledQueueSet(unsigned max_queues, factory_t f);
+  ~PolledQueueSet();
+
+  // no copying
+  PolledQueueSet(const PolledQueueSet&) = delete;
+  PolledQueueSet &operator=(const PolledQueueSet&) = delete;
+
+  /// give the calling thread the queue in slot; nullptr if it can't have it
+  PolledQueue *bind(unsigned slot);
+
+  /// queue bound to the calling thread, or nullptr to use the shared path
+  PolledQueue *get();
+
+  unsigned get_num_queues() {
+    std::lock_guard<std::mutex> l(lock);
+    return num_queues;
+  }
+  unsigned get_num_shared() const {
+    return num_shared.load();
+  }
+};
+
+#endif
@@ -26,6 +26,13 @@ struct bluefs_extent_t {
 };
 WRITE_CLASS_ENCODER(bluefs_extent_t)
 
+inline bool operator==(const bluefs_extent_t& l, const bluefs_extent_t& r) {
+  return l.offset == r.offset && l.length == r.length && l.bdev == r.bdev;
+}
+inline bool operator!=(const bluefs_extent_t& l, const bluefs_extent_t& r) {
+  return !(l == r);
+}
+
 ostream& operator<<(ostream& out, bluefs_extent_t e);
 
 
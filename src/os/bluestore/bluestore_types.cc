@@ -15,6 +15,8 @@
 #include "bluestore_types.h"
 #include "common/Formatter.h"
 #include "include/stringify.h"
+#include "compressor/Compressor.h"
+#include "xxHash/xxhash.h"
 
 // bluestore_bdev_label_t
 
@@ -394,11 +396,324 @@ ostream& operator<<(ostream& out, const bluestore_overlay_t& o)
   return out;
 }
 
+// bluestore_compressed_blob_t
+
+void bluestore_compressed_blob_t::encode(bufferlist& bl) const
+{
+  ENCODE_START(1, 1, bl);
+  ::encode(length, bl);
+  ::encode(compressed_length, bl);
+  ::encode(alg, bl);
+  ::encode(extents, bl);
+  ENCODE_FINISH(bl);
+}
+
+void bluestore_compressed_blob_t::decode(bufferlist::iterator& p)
+{
+  DECODE_START(1, p);
+  ::decode(length, p);
+  ::decode(compressed_length, p);
+  ::decode(alg, p);
+  ::decode(extents, p);
+  DECODE_FINISH(p);
+}
+
+void bluestore_compressed_blob_t::dump(Formatter *f) const
+{
+  f->dump_unsigned("length", length);
+  f->dump_unsigned("compressed_length", compressed_length);
+  f->dump_string("alg", Compressor::get_comp_alg_name(alg));
+  f->open_array_section("extents");
+  for (auto& e : extents) {
+    f->open_object_section("extent");
+    e.dump(f);
+    f->close_section();
+  }
+  f->close_section();
+}
+
+void bluestore_compressed_blob_t::generate_test_instances(
+  list<bluestore_compressed_blob_t*>& o)
+{
+  o.push_back(new bluestore_compressed_blob_t());
+  o.push_back(new bluestore_compressed_blob_t());
+  o.back()->length = 262144;
+  o.back()->compressed_length = 70000;
+  o.back()->alg = Compressor::COMP_ALG_SNAPPY;
+  o.back()->extents.push_back(bluestore_extent_t(65536, 65536));
+  o.back()->extents.push_back(bluestore_extent_t(
+				1048576, 65536,
+				bluestore_extent_t::FLAG_SHARED));
+}
+
+ostream& operator<<(ostream& out, const bluestore_compressed_blob_t& b)
+{
+  out << "blob(" << b.length << " "
+      << Compressor::get_comp_alg_name(b.alg) << " "
+      << b.compressed_length << " in " << b.extents << ")";
+  return out;
+}
+
+// bluestore_csum_t
+
+uint64_t bluestore_csum_t::calc(unsigned t, const bufferlist& bl,
+				uint64_t off, uint64_t len)
+{
+  bufferlist sub;
+  sub.substr_of(bl, off, len);
+  switch (t) {
+  case CSUM_CRC32C:
+    return sub.crc32c(-1);
+  case CSUM_XXHASH32:
+    {
+      XXH32_state_t s;
+      XXH32_reset(&s, -1);
+      for (auto& p : sub.buffers())
+	XXH32_update(&s, p.c_str(), p.length());
+      return XXH32_digest(&s);
+    }
+  case CSUM_XXHASH64:
+    {
+      XXH64_state_t s;
+      XXH64_reset(&s, -1);
+      for (auto& p : sub.buffers())
+	XXH64_update(&s, p.c_str(), p.length());
+      return XXH64_digest(&s);
+    }
+  default:
+    assert(0 == "unknown csum type");
+  }
+  return 0;
+}
+
+void bluestore_csum_t::update(uint64_t offset, const bufferlist& bl)
+{
+  if (!enabled() || bl.length() == 0)
+    return;
+  uint64_t chunk_size = get_chunk_size();
+  uint64_t end = offset + bl.length();
+  size_t first = offset >> chunk_order;
+  size_t last = (end + chunk_size - 1) >> chunk_order;
+  _grow(last);
+  for (size_t i = first; i < last; ++i) {
+    uint64_t start = (uint64_t)i << chunk_order;
+    if (start >= offset && start + chunk_size <= end)
+      _set(i, calc(type, bl, start - offset, chunk_size));
+    else
+      valid[i] = false;
+  }
+}
+
+void bluestore_csum_t::update_zero(uint64_t offset, uint64_t length)
+{
+  if (!enabled() || length == 0)
+    return;
+  uint64_t chunk_size = get_chunk_size();
+  uint64_t end = offset + length;
+  size_t first = offset >> chunk_order;
+  size_t last = (end + chunk_size - 1) >> chunk_order;
+  _grow(last);
+  bool have_zero = false;
+  uint64_t zero = 0;
+  for (size_t i = first; i < last; ++i) {
+    uint64_t start = (uint64_t)i << chunk_order;
+    if (start >= offset && start + chunk_size <= end) {
+      if (!have_zero) {
+	bufferlist z;
+	z.append_zero(chunk_size);
+	zero = calc(type, z, 0, chunk_size);
+	have_zero = true;
+      }
+      _set(i, zero);
+    } else {
+      valid[i] = false;
+    }
+  }
+}
+
+void bluestore_csum_t::invalidate(uint64_t offset, uint64_t length)
+{
+  if (!enabled() || length == 0)
+    return;
+  size_t first = offset >> chunk_order;
+  size_t last = MIN((offset + length + get_chunk_size() - 1) >> chunk_order,
+		    valid.size());
+  for (size_t i = first; i < last; ++i)
+    valid[i] = false;
+}
+
+void bluestore_csum_t::truncate(uint64_t size)
+{
+  size_t n = ROUND_UP_TO(size, get_chunk_size()) >> chunk_order;
+  if (n < values.size()) {
+    values.resize(n);
+    valid.resize(n);
+  }
+}
+
+bool bluestore_csum_t::has_valid(uint64_t offset, uint64_t length) const
+{
+  if (!enabled() || length == 0)
+    return false;
+  size_t first = offset >> chunk_order;
+  size_t last = MIN((offset + length + get_chunk_size() - 1) >> chunk_order,
+		    valid.size());
+  for (size_t i = first; i < last; ++i) {
+    if (valid[i])
+      return true;
+  }
+  return false;
+}
+
+int bluestore_csum_t::verify(uint64_t offset, const bufferlist& bl,
+			     uint64_t *bad_offset) const
+{
+  if (!enabled())
+    return 0;
+  uint64_t chunk_size = get_chunk_size();
+  uint64_t pos = ROUND_UP_TO(offset, chunk_size) - offset;
+  for (; pos + chunk_size <= bl.length(); pos += chunk_size) {
+    size_t i = (offset + pos) >> chunk_order;
+    if (!is_valid(i))
+      continue;
+    if (calc(type, bl, pos, chunk_size) != values[i]) {
+      *bad_offset = offset + pos;
+      return -EIO;
+    }
+  }
+  return 0;
+}
+
+void bluestore_csum_t::encode(bufferlist& bl) const
+{
+  ENCODE_START(1, 1, bl);
+  ::encode(type, bl);
+  ::encode(chunk_order, bl);
+  unsigned value_size = get_value_size(type);
+  uint32_t n = value_size ? values.size() : 0;
+  ::encode(n, bl);
+  if (n) {
+    // validity bitmap, then one value_size value per chunk
+    bufferptr bits((n + 7) / 8);
+    bits.zero();
+    for (uint32_t i = 0; i < n; ++i) {
+      if (valid[i])
+	bits.c_str()[i / 8] |= 1 << (i % 8);
+    }
+    bl.append(bits);
+    for (uint32_t i = 0; i < n; ++i) {
+      if (value_size == 4)
+	::encode((uint32_t)values[i], bl);
+      else
+	::encode(values[i], bl);
+    }
+  }
+  ENCODE_FINISH(bl);
+}
+
+void bluestore_csum_t::decode(bufferlist::iterator& p)
+{
+  DECODE_START(1, p);
+  ::decode(type, p);
+  ::decode(chunk_order, p);
+  uint32_t n;
+  ::decode(n, p);
+  values.resize(n);
+  valid.resize(n);
+  if (n) {
+    unsigned value_size = get_value_size(type);
+    string bits;
+    p.copy((n + 7) / 8, bits);
+    for (uint32_t i = 0; i < n; ++i) {
+      valid[i] = bits[i / 8] & (1 << (i % 8));
+      if (value_size == 4) {
+	uint32_t v;
+	::decode(v, p);
+	values[i] = v;
+      } else {
+	::decode(values[i], p);
+      }
+    }
+  }
+  DECODE_FINISH(p);
+}
+
+void bluestore_csum_t::dump(Formatter *f) const
+{
+  f->dump_string("type", get_type_name(type));
+  f->dump_unsigned("chunk_size", get_chunk_size());
+  f->open_array_section("values");
+  for (size_t i = 0; i < values.size(); ++i) {
+    if (valid[i])
+      f->dump_unsigned("value", values[i]);
+    else
+      f->dump_string("value", "invalid");
+  }
+  f->close_section();
+}
+
+void bluestore_csum_t::generate_test_instances(list<bluestore_csum_t*>& o)
+{
+  o.push_back(new bluestore_csum_t());
+  o.push_back(new bluestore_csum_t());
+  o.back()->init(CSUM_CRC32C, 12);
+  o.back()->update_zero(0, 3 * 4096);
+  o.back()->invalidate(4096, 1);
+  o.push_back(new bluestore_csum_t());
+  o.back()->init(CSUM_XXHASH64, 16);
+  o.back()->update_zero(65536, 65536);
+}
+
+ostream& operator<<(ostream& out, const bluestore_csum_t& c)
+{
+  out << "csum(" << bluestore_csum_t::get_type_name(c.type);
+  if (c.enabled()) {
+    size_t num_valid = 0;
+    for (size_t i = 0; i < c.valid.size(); ++i) {
+      if (c.valid[i])
+	++num_valid;
+    }
+    out << " chunk " << c.get_chunk_size()
+	<< " valid " << num_valid << "/" << c.get_num_chunks();
+  }
+  out << ")";
+  return out;
+}
+
 // bluestore_onode_t
 
+bool bluestore_onode_t::is_csum_covered() const
+{
+  if (!csum.enabled() || !overlay_map.empty())
+    return false;
+  uint64_t chunk_mask = csum.get_chunk_size() - 1;
+  if (size & chunk_mask)
+    return false;  // the tail chunk is never read whole
+  for (size_t i = 0; i < (size >> csum.chunk_order); ++i) {
+    if (!csum.is_valid(i))
+      return false;
+  }
+  for (map<uint64_t,bluestore_extent_t>::const_iterator p = block_map.begin();
+       p != block_map.end();
+       ++p) {
+    if (p->second.has_flag(bluestore_extent_t::FLAG_UNWRITTEN))
+      continue;  // read as zeros, not from disk
+    if ((p->first & chunk_mask) || (p->second.length & chunk_mask))
+      return false;
+  }
+  for (map<uint64_t,bluestore_compressed_blob_t>::const_iterator p =
+	 blob_map.begin();
+       p != blob_map.end();
+       ++p) {
+    if ((p->first & chunk_mask) || (p->second.length & chunk_mask))
+      return false;
+  }
+  return true;
+}
+
 void bluestore_onode_t::encode(bufferlist& bl) const
 {
-  ENCODE_START(1, 1, bl);
+  ENCODE_START(3, 1, bl);
   ::encode(nid, bl);
   ::encode(size, bl);
   ::encode(attrs, bl);
@@ -409,12 +724,15 @@ void bluestore_onode_t::encode(bufferlist& bl) const
   ::encode(omap_head, bl);
   ::encode(expected_object_size, bl);
   ::encode(expected_write_size, bl);
+  ::encode(csum, bl);
+  ::encode(blob_map, bl);
+  ::encode(alloc_hint_flags, bl);
   ENCODE_FINISH(bl);
 }
 
 void bluestore_onode_t::decode(bufferlist::iterator& p)
 {
-  DECODE_START(1, p);
+  DECODE_START(3, p);
   ::decode(nid, p);
   ::decode(size, p);
   ::decode(attrs, p);
@@ -425,6 +743,12 @@ void bluestore_onode_t::decode(bufferlist::iterator& p)
   ::decode(omap_head, p);
   ::decode(expected_object_size, p);
   ::decode(expected_write_size, p);
+  if (struct_v >= 2)
+    ::decode(csum, p);
+  if (struct_v >= 3) {
+    ::decode(blob_map, p);
+    ::decode(alloc_hint_flags, p);
+  }
   DECODE_FINISH(p);
 }
 
@@ -472,6 +796,18 @@ void bluestore_onode_t::dump(Formatter *f) const
   f->dump_unsigned("omap_head", omap_head);
   f->dump_unsigned("expected_object_size", expected_object_size);
   f->dump_unsigned("expected_write_size", expected_write_size);
+  f->dump_unsigned("alloc_hint_flags", alloc_hint_flags);
+  f->open_array_section("blob_map");
+  for (auto& p : blob_map) {
+    f->open_object_section("blob");
+    f->dump_unsigned("offset", p.first);
+    p.second.dump(f);
+    f->close_section();
+  }
+  f->close_section();
+  f->open_object_section("csum");
+  csum.dump(f);
+  f->close_section();
 }
 
 void bluestore_onode_t::generate_test_instances(list<bluestore_onode_t*>& o)
@@ -179,6 +179,163 @@ WRITE_CLASS_ENCODER(bluestore_overlay_t)
 
 ostream& operator<<(ostream& out, const bluestore_overlay_t& o);
 
+/**
+ * compressed blob: a logical range of an object stored compressed
+ *
+ * The compressed bytes are padded out to min_alloc_size and may be
+ * spread over several device extents.  A blob is always rewritten as a
+ * whole; partial overwrites first expand it back into plain extents.
+ */
+struct bluestore_compressed_blob_t {
+  uint32_t length;             ///< logical (decompressed) length
+  uint32_t compressed_length;  ///< bytes of compressed data
+  uint8_t alg;                 ///< Compressor::COMP_ALG_*
+  vector<bluestore_extent_t> extents;  ///< where the compressed data lives
+
+  bluestore_compressed_blob_t()
+    : length(0), compressed_length(0), alg(0) {}
+
+  /// allocated bytes on the device
+  uint64_t get_allocated() const {
+    uint64_t r = 0;
+    for (auto& e : extents)
+      r += e.length;
+    return r;
+  }
+
+  void encode(bufferlist& bl) const;
+  void decode(bufferlist::iterator& p);
+  void dump(Formatter *f) const;
+  static void generate_test_instances(list<bluestore_compressed_blob_t*>& o);
+};
+WRITE_CLASS_ENCODER(bluestore_compressed_blob_t)
+
+ostream& operator<<(ostream& out, const bluestore_compressed_blob_t& b);
+
+/**
+ * checksums over an object's logical data
+ *
+ * The object is carved into chunks of 2^chunk_order bytes, and each
+ * chunk has one checksum value.  A value covers the bytes of the chunk
+ * as they sit on disk (including anything past eof), so a chunk is only
+ * valid if we know exactly what was last written to all of it; partial
+ * overwrites invalidate it until the whole chunk is written again.
+ * For compressed blobs the value covers the decompressed data.
+ */
+struct bluestore_csum_t {
+  enum {
+    CSUM_NONE = 0,
+    CSUM_CRC32C = 1,
+    CSUM_XXHASH32 = 2,
+    CSUM_XXHASH64 = 3,
+    CSUM_MAX,
+  };
+  static const char *get_type_name(unsigned t) {
+    switch (t) {
+    case CSUM_NONE: return "none";
+    case CSUM_CRC32C: return "crc32c";
+    case CSUM_XXHASH32: return "xxhash32";
+    case CSUM_XXHASH64: return "xxhash64";
+    default: return "???";
+    }
+  }
+  static int get_type_by_name(const string& s) {
+    for (unsigned t = CSUM_NONE; t < CSUM_MAX; ++t) {
+      if (s == get_type_name(t))
+	return t;
+    }
+    return -EINVAL;
+  }
+  /// encoded bytes per value
+  static unsigned get_value_size(unsigned t) {
+    switch (t) {
+    case CSUM_CRC32C:
+    case CSUM_XXHASH32:
+      return 4;
+    case CSUM_XXHASH64:
+      return 8;
+    default:
+      return 0;
+    }
+  }
+  /// checksum len bytes of bl, starting at off
+  static uint64_t calc(unsigned t, const bufferlist& bl,
+		       uint64_t off, uint64_t len);
+
+  uint8_t type;            ///< CSUM_*
+  uint8_t chunk_order;     ///< log2(chunk size)
+  vector<uint64_t> values; ///< one per chunk
+  vector<bool> valid;      ///< whether values[i] describes the chunk
+
+  bluestore_csum_t() : type(CSUM_NONE), chunk_order(0) {}
+
+  bool enabled() const {
+    return type != CSUM_NONE;
+  }
+  uint64_t get_chunk_size() const {
+    return 1ull << chunk_order;
+  }
+  size_t get_num_chunks() const {
+    return values.size();
+  }
+  bool is_valid(size_t i) const {
+    return i < valid.size() && valid[i];
+  }
+
+  /// start over with a new type/chunk size; all chunks become invalid
+  void init(unsigned t, unsigned order) {
+    type = t;
+    chunk_order = t == CSUM_NONE ? 0 : order;
+    values.clear();
+    valid.clear();
+  }
+
+  /// bl was written at offset; checksum the chunks it fully covers
+  void update(uint64_t offset, const bufferlist& bl);
+  /// length bytes of zeros were written at offset
+  void update_zero(uint64_t offset, uint64_t length);
+  /// offset~length changed in a way we can't describe
+  void invalidate(uint64_t offset, uint64_t length);
+  /// drop chunks that start at or past size
+  void truncate(uint64_t size);
+
+  /// true if any chunk overlapping offset~length has a valid checksum
+  bool has_valid(uint64_t offset, uint64_t length) const;
+
+  /**
+   * check bl, read from offset, against stored checksums
+   *
+   * Only whole chunks in bl with a valid checksum are checked.
+   *
+   * @param offset logical offset of bl
+   * @param bl data
+   * @param bad_offset [out] logical offset of the first bad chunk
+   * @return 0 on success, -EIO on mismatch
+   */
+  int verify(uint64_t offset, const bufferlist& bl,
+	     uint64_t *bad_offset) const;
+
+  void encode(bufferlist& bl) const;
+  void decode(bufferlist::iterator& p);
+  void dump(Formatter *f) const;
+  static void generate_test_instances(list<bluestore_csum_t*>& o);
+
+private:
+  void _set(size_t i, uint64_t v) {
+    values[i] = v;
+    valid[i] = true;
+  }
+  void _grow(size_t n) {
+    if (values.size() < n) {
+      values.resize(n, 0);
+      valid.resize(n, false);
+    }
+  }
+};
+WRITE_CLASS_ENCODER(bluestore_csum_t)
+
+ostream& operator<<(ostream& out, const bluestore_csum_t& c);
+
 /// onode: per-object metadata
 struct bluestore_onode_t {
   uint64_t nid;                        ///< numeric id (locally unique)
@@ -187,11 +344,15 @@ struct bluestore_onode_t {
   map<uint64_t, bluestore_extent_t> block_map;   ///< block data
   map<uint64_t,bluestore_overlay_t> overlay_map; ///< overlay data (stored in db)
   map<uint64_t,uint16_t> overlay_refs; ///< overlay keys ref counts (if >1)
+  map<uint64_t,bluestore_compressed_blob_t> blob_map; ///< compressed data
   uint32_t last_overlay_key;           ///< key for next overlay
   uint64_t omap_head;                  ///< id for omap root node
 
   uint32_t expected_object_size;
   uint32_t expected_write_size;
+  uint32_t alloc_hint_flags;           ///< CEPH_OSD_ALLOC_HINT_FLAG_*
+
+  bluestore_csum_t csum;               ///< data checksums
 
   bluestore_onode_t()
     : nid(0),
@@ -199,7 +360,8 @@ struct bluestore_onode_t {
       last_overlay_key(0),
       omap_head(0),
       expected_object_size(0),
-      expected_write_size(0) {}
+      expected_write_size(0),
+      alloc_hint_flags(0) {}
 
   map<uint64_t,bluestore_extent_t>::iterator find_extent(uint64_t offset) {
     map<uint64_t,bluestore_extent_t>::iterator fp = block_map.lower_bound(offset);
@@ -214,6 +376,20 @@ struct bluestore_onode_t {
     return fp;
   }
 
+  /// first blob that ends after offset
+  map<uint64_t,bluestore_compressed_blob_t>::iterator seek_blob(
+    uint64_t offset) {
+    map<uint64_t,bluestore_compressed_blob_t>::iterator p =
+      blob_map.lower_bound(offset);
+    if (p != blob_map.begin()) {
+      --p;
+      if (p->first + p->second.length <= offset) {
+	++p;
+      }
+    }
+    return p;
+  }
+
   map<uint64_t,bluestore_extent_t>::iterator seek_extent(uint64_t offset) {
     map<uint64_t,bluestore_extent_t>::iterator fp = block_map.lower_bound(offset);
     if (fp != block_map.begin()) {
@@ -243,6 +419,17 @@ struct bluestore_onode_t {
       ++q->second;
   }
 
+  /**
+   * true if a read of the whole object verifies every byte it gets
+   * from disk against csum
+   *
+   * That needs every chunk up to size to be whole and valid, and each
+   * extent and compressed blob to start and end on a chunk boundary,
+   * since reads only verify chunks they see in full.  Overlay data is
+   * not checksummed, so any overlay makes this false.
+   */
+  bool is_csum_covered() const;
+
   void encode(bufferlist& bl) const;
   void decode(bufferlist::iterator& p);
   void dump(Formatter *f) const;
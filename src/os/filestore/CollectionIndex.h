@@ -190,6 +190,33 @@ protected:
       uint64_t expected_num_objs  ///< [in] expected number of objects this collection has
       ) { assert(0); return 0; }
 
+  /**
+   * Background splitting.  created() and presplit() queue directories
+   * to split instead of (or ahead of) splitting them on the write path;
+   * the caller then drains the queue with split_next().  All three
+   * require access_lock held for write.
+   */
+  virtual bool split_pending() { return false; }
+
+  /**
+   * Take the next step of the queued splits: move the objects of one
+   * child of the directory at the head of the queue, if it still needs
+   * splitting.  Queued splits survive a restart; cleanup() requeues
+   * them.
+   *
+   * @param moved [out] objects moved, for rate limiting
+   * @Return 0 on success, an error code otherwise.
+   */
+  virtual int split_next(uint64_t *moved) { *moved = 0; return 0; }
+
+  /*
+   * Queue splits so that no directory goes over the split threshold
+   * once the (non-empty) collection holds expected_num_objs objects.
+   *
+   * @Return 0 on success, an error code otherwise.
+   */
+  virtual int presplit(uint64_t expected_num_objs) { return -EOPNOTSUPP; }
+
   /// Virtual destructor
   virtual ~CollectionIndex() {}
 };
@@ -36,6 +36,70 @@ const string DBObjectMap::HOBJECT_TO_SEQ = "_HOBJTOSEQ_";
 const string DBObjectMap::LEAF_PREFIX = "_LEAF_";
 const string DBObjectMap::REVERSE_LEAF_PREFIX = "_REVLEAF_";
 
+DBObjectMap::DBObjectMap(KeyValueDB *db)
+  : db(db), header_lock("DBOBjectMap")
+{
+  int shards = MAX(1, g_conf->filestore_omap_header_cache_shards);
+  int cache_size = MAX(1, g_conf->filestore_omap_header_cache_size / shards);
+  for (int i = 0; i < shards; ++i)
+    map_header_shards.push_back(new MapHeaderShard(cache_size));
+}
+
+DBObjectMap::~DBObjectMap()
+{
+  for (vector<MapHeaderShard*>::iterator i = map_header_shards.begin();
+       i != map_header_shards.end();
+       ++i)
+    delete *i;
+}
+
+DBObjectMap::MapHeaderLock::MapHeaderLock(
+  DBObjectMap *db, const ghobject_t &oid, bool shared)
+  : db(db), locked(oid), shared(shared)
+{
+  MapHeaderShard *shard = db->get_map_header_shard(oid);
+  Mutex::Locker l(shard->lock);
+  if (shared) {
+    // queued writers go first, so a stream of readers can't starve them
+    while (true) {
+      map<ghobject_t,int,ghobject_t::BitwiseComparator>::iterator i =
+	shard->in_use.find(oid);
+      if ((i == shard->in_use.end() || i->second >= 0) &&
+	  !shard->writers_waiting.count(oid))
+	break;
+      shard->cond.Wait(shard->lock);
+    }
+    ++shard->in_use[oid];
+  } else {
+    ++shard->writers_waiting[oid];
+    while (shard->in_use.count(oid))
+      shard->cond.Wait(shard->lock);
+    if (--shard->writers_waiting[oid] == 0)
+      shard->writers_waiting.erase(oid);
+    shard->in_use[oid] = -1;
+  }
+}
+
+DBObjectMap::MapHeaderLock::~MapHeaderLock()
+{
+  if (!locked)
+    return;
+  MapHeaderShard *shard = db->get_map_header_shard(*locked);
+  Mutex::Locker l(shard->lock);
+  map<ghobject_t,int,ghobject_t::BitwiseComparator>::iterator i =
+    shard->in_use.find(*locked);
+  assert(i != shard->in_use.end());
+  if (shared) {
+    assert(i->second > 0);
+    if (--i->second > 0)
+      return;
+  } else {
+    assert(i->second == -1);
+  }
+  shard->in_use.erase(i);
+  shard->cond.SignalAll();
+}
+
 static void append_escaped(const string &in, string *out)
 {
   for (string::const_iterator i = in.begin(); i != in.end(); ++i) {
@@ -232,12 +296,13 @@ int DBObjectMap::DBObjectMapIteratorImpl::init()
   }
   assert(!parent_iter);
   if (header->parent) {
-    Header parent = map->lookup_parent(header);
+    Header parent = map->lookup_parent(header, shared);
     if (!parent) {
       assert(0);
       return -EINVAL;
     }
-    parent_iter = std::make_shared<DBObjectMapIteratorImpl>(map, parent);
+    parent_iter = std::make_shared<DBObjectMapIteratorImpl>(map, parent,
+							    shared);
   }
   key_iter = map->db->get_iterator(map->user_prefix(header));
   assert(key_iter);
@@ -252,11 +317,11 @@ int DBObjectMap::DBObjectMapIteratorImpl::init()
 ObjectMap::ObjectMapIterator DBObjectMap::get_iterator(
   const ghobject_t &oid)
 {
-  MapHeaderLock hl(this, oid);
+  MapHeaderLock hl(this, oid, true);
   Header header = lookup_map_header(hl, oid);
   if (!header)
     return ObjectMapIterator(new EmptyIteratorImpl());
-  DBObjectMapIterator iter = _get_iterator(header);
+  DBObjectMapIterator iter = _get_iterator(header, true);
   iter->hlock.swap(hl);
   return iter;
 }
@@ -481,16 +546,17 @@ void DBObjectMap::_set_header(Header header, const bufferlist &bl,
 int DBObjectMap::get_header(const ghobject_t &oid,
 			    bufferlist *bl)
 {
-  MapHeaderLock hl(this, oid);
+  MapHeaderLock hl(this, oid, true);
   Header header = lookup_map_header(hl, oid);
   if (!header) {
     return 0;
   }
-  return _get_header(header, bl);
+  return _get_header(header, bl, true);
 }
 
 int DBObjectMap::_get_header(Header header,
-			     bufferlist *bl)
+			     bufferlist *bl,
+			     bool shared)
 {
   map<string, bufferlist> out;
   while (true) {
@@ -505,7 +571,7 @@ int DBObjectMap::_get_header(Header header,
     Header current(header);
     if (!current->parent)
       break;
-    header = lookup_parent(current);
+    header = lookup_parent(current, shared);
   }
 
   if (!out.empty())
@@ -709,6 +775,40 @@ int DBObjectMap::rm_keys(const ghobject_t &oid,
   return db->submit_transaction(t);
 }
 
+int DBObjectMap::rm_key_range(const ghobject_t &oid,
+			      const string &first,
+			      const string &last,
+			      const SequencerPosition *spos)
+{
+  {
+    MapHeaderLock hl(this, oid);
+    Header header = lookup_map_header(hl, oid);
+    if (!header)
+      return -ENOENT;
+    if (!header->parent) {
+      // nothing to copy up from a parent, so drop the whole range
+      // instead of enumerating it
+      KeyValueDB::Transaction t = db->get_transaction();
+      if (check_spos(oid, header, spos))
+	return 0;
+      if (first < last)
+	t->rm_range_keys(user_prefix(header), first, last);
+      return db->submit_transaction(t);
+    }
+  }
+
+  // keys may come from the parent; rm_keys copies up around them
+  set<string> keys;
+  {
+    ObjectMapIterator iter = get_iterator(oid);
+    for (iter->lower_bound(first); iter->valid() && iter->key() < last;
+	 iter->next()) {
+      keys.insert(iter->key());
+    }
+  }
+  return rm_keys(oid, keys, spos);
+}
+
 int DBObjectMap::clear_keys_header(const ghobject_t &oid,
 				   const SequencerPosition *spos)
 {
@@ -750,12 +850,12 @@ int DBObjectMap::get(const ghobject_t &oid,
 		     bufferlist *_header,
 		     map<string, bufferlist> *out)
 {
-  MapHeaderLock hl(this, oid);
+  MapHeaderLock hl(this, oid, true);
   Header header = lookup_map_header(hl, oid);
   if (!header)
     return -ENOENT;
-  _get_header(header, _header);
-  ObjectMapIterator iter = _get_iterator(header);
+  _get_header(header, _header, true);
+  ObjectMapIterator iter = _get_iterator(header, true);
   for (iter->seek_to_first(); iter->valid(); iter->next()) {
     if (iter->status())
       return iter->status();
@@ -767,11 +867,11 @@ int DBObjectMap::get(const ghobject_t &oid,
 int DBObjectMap::get_keys(const ghobject_t &oid,
 			  set<string> *keys)
 {
-  MapHeaderLock hl(this, oid);
+  MapHeaderLock hl(this, oid, true);
   Header header = lookup_map_header(hl, oid);
   if (!header)
     return -ENOENT;
-  ObjectMapIterator iter = _get_iterator(header);
+  ObjectMapIterator iter = _get_iterator(header, true);
   for (iter->seek_to_first(); iter->valid(); iter->next()) {
     if (iter->status())
       return iter->status();
@@ -783,9 +883,10 @@ int DBObjectMap::get_keys(const ghobject_t &oid,
 int DBObjectMap::scan(Header header,
 		      const set<string> &in_keys,
 		      set<string> *out_keys,
-		      map<string, bufferlist> *out_values)
+		      map<string, bufferlist> *out_values,
+		      bool shared)
 {
-  ObjectMapIterator db_iter = _get_iterator(header);
+  ObjectMapIterator db_iter = _get_iterator(header, shared);
   for (set<string>::const_iterator key_iter = in_keys.begin();
        key_iter != in_keys.end();
        ++key_iter) {
@@ -806,29 +907,29 @@ int DBObjectMap::get_values(const ghobject_t &oid,
 			    const set<string> &keys,
 			    map<string, bufferlist> *out)
 {
-  MapHeaderLock hl(this, oid);
+  MapHeaderLock hl(this, oid, true);
   Header header = lookup_map_header(hl, oid);
   if (!header)
     return -ENOENT;
-  return scan(header, keys, 0, out);
+  return scan(header, keys, 0, out, true);
 }
 
 int DBObjectMap::check_keys(const ghobject_t &oid,
 			    const set<string> &keys,
 			    set<string> *out)
 {
-  MapHeaderLock hl(this, oid);
+  MapHeaderLock hl(this, oid, true);
   Header header = lookup_map_header(hl, oid);
   if (!header)
     return -ENOENT;
-  return scan(header, keys, out, 0);
+  return scan(header, keys, out, 0, true);
 }
 
 int DBObjectMap::get_xattrs(const ghobject_t &oid,
 			    const set<string> &to_get,
 			    map<string, bufferlist> *out)
 {
-  MapHeaderLock hl(this, oid);
+  MapHeaderLock hl(this, oid, true);
   Header header = lookup_map_header(hl, oid);
   if (!header)
     return -ENOENT;
@@ -838,7 +939,7 @@ int DBObjectMap::get_xattrs(const ghobject_t &oid,
 int DBObjectMap::get_all_xattrs(const ghobject_t &oid,
 				set<string> *out)
 {
-  MapHeaderLock hl(this, oid);
+  MapHeaderLock hl(this, oid, true);
   Header header = lookup_map_header(hl, oid);
   if (!header)
     return -ENOENT;
@@ -1078,36 +1179,30 @@ DBObjectMap::Header DBObjectMap::_lookup_map_header(
   const ghobject_t &oid)
 {
   assert(l.get_locked() == oid);
+  assert(l.is_shared() || header_lock.is_locked_by_me());
 
   _Header *header = new _Header();
-  {
-    Mutex::Locker l(cache_lock);
-    if (caches.lookup(oid, header)) {
-      assert(!in_use.count(header->seq));
-      in_use.insert(header->seq);
-      return Header(header, RemoveOnDelete(this));
+  MapHeaderShard *shard = get_map_header_shard(oid);
+  if (!shard->cache.lookup(oid, header)) {
+    bufferlist out;
+    int r = db->get(HOBJECT_TO_SEQ, map_header_key(oid), &out);
+    if (r < 0 || out.length()==0) {
+      delete header;
+      return Header();
     }
+    bufferlist::iterator iter = out.begin();
+    header->decode(iter);
+    shard->cache.add(oid, *header);
   }
 
-  bufferlist out;
-  int r = db->get(HOBJECT_TO_SEQ, map_header_key(oid), &out);
-  if (r < 0 || out.length()==0) {
-    delete header;
-    return Header();
-  }
-
-  Header ret(header, RemoveOnDelete(this));
-  bufferlist::iterator iter = out.begin();
-
-  ret->decode(iter);
-  {
-    Mutex::Locker l(cache_lock);
-    caches.add(oid, *ret);
-  }
+  // A leaf is never another header's parent, so nobody but writers
+  // of oid, which the shared lock keeps out, would contend for it
+  if (l.is_shared())
+    return Header(header);
 
   assert(!in_use.count(header->seq));
   in_use.insert(header->seq);
-  return ret;
+  return Header(header, RemoveOnDelete(this));
 }
 
 DBObjectMap::Header DBObjectMap::_generate_new_header(const ghobject_t &oid,
@@ -1128,11 +1223,8 @@ DBObjectMap::Header DBObjectMap::_generate_new_header(const ghobject_t &oid,
   return header;
 }
 
-DBObjectMap::Header DBObjectMap::lookup_parent(Header input)
+int DBObjectMap::_read_parent(Header input, _Header *parent)
 {
-  Mutex::Locker l(header_lock);
-  while (in_use.count(input->parent))
-    header_cond.Wait(header_lock);
   map<string, bufferlist> out;
   set<string> keys;
   keys.insert(HEADER_KEY);
@@ -1140,21 +1232,44 @@ DBObjectMap::Header DBObjectMap::lookup_parent(Header input)
   dout(20) << "lookup_parent: parent " << input->parent
        << " for seq " << input->seq << dendl;
   int r = db->get(sys_parent_prefix(input), keys, &out);
-  if (r < 0) {
-    assert(0);
-    return Header();
+  if (r < 0)
+    return r;
+  if (out.empty())
+    return -ENOENT;
+
+  parent->seq = input->parent;
+  bufferlist::iterator iter = out.begin()->second.begin();
+  parent->decode(iter);
+  dout(20) << "lookup_parent: parent seq is " << parent->seq << " with parent "
+       << parent->parent << dendl;
+  return 0;
+}
+
+DBObjectMap::Header DBObjectMap::lookup_parent(Header input, bool shared)
+{
+  if (shared) {
+    // Under a shared lock on a descendant: the parent cannot be cleared
+    // while that descendant is around, and writers only ever change
+    // its num_children, which readers do not look at.
+    Header header(new _Header());
+    int r = _read_parent(input, header.get());
+    if (r < 0) {
+      assert(0);
+      return Header();
+    }
+    return header;
   }
-  if (out.empty()) {
+
+  Mutex::Locker l(header_lock);
+  while (in_use.count(input->parent))
+    header_cond.Wait(header_lock);
+
+  Header header = Header(new _Header(), RemoveOnDelete(this));
+  int r = _read_parent(input, header.get());
+  if (r < 0) {
     assert(0);
     return Header();
   }
-
-  Header header = Header(new _Header(), RemoveOnDelete(this));
-  header->seq = input->parent;
-  bufferlist::iterator iter = out.begin()->second.begin();
-  header->decode(iter);
-  dout(20) << "lookup_parent: parent seq is " << header->seq << " with parent "
-       << header->parent << dendl;
   in_use.insert(header->seq);
   return header;
 }
@@ -1205,10 +1320,7 @@ void DBObjectMap::remove_map_header(
   set<string> to_remove;
   to_remove.insert(map_header_key(oid));
   t->rmkeys(HOBJECT_TO_SEQ, to_remove);
-  {
-    Mutex::Locker l(cache_lock);
-    caches.clear(oid);
-  }
+  get_map_header_shard(oid)->cache.clear(oid);
 }
 
 void DBObjectMap::set_map_header(
@@ -1223,10 +1335,7 @@ void DBObjectMap::set_map_header(
   map<string, bufferlist> to_set;
   header.encode(to_set[map_header_key(oid)]);
   t->set(HOBJECT_TO_SEQ, to_set);
-  {
-    Mutex::Locker l(cache_lock);
-    caches.add(oid, header);
-  }
+  get_map_header_shard(oid)->cache.add(oid, header);
 }
 
 bool DBObjectMap::check_spos(const ghobject_t &oid,
@@ -64,38 +64,40 @@ public:
    */
   Mutex header_lock;
   Cond header_cond;
-  Cond map_header_cond;
 
   /**
    * Set of headers currently in use
    */
   set<uint64_t> in_use;
-  set<ghobject_t, ghobject_t::BitwiseComparator> map_header_in_use;
 
   /**
-   * Takes the map_header_in_use entry in constructor, releases in
-   * destructor
+   * Takes the oid's map header in constructor, releases in destructor.
+   *
+   * A shared lock is for readers: they may hold the same oid at once,
+   * and they look up headers without header_lock or in_use, @see
+   * _lookup_map_header.  A writer waits for readers to drain and
+   * keeps new ones out meanwhile.
    */
   class MapHeaderLock {
     DBObjectMap *db;
     boost::optional<ghobject_t> locked;
+    bool shared;
 
     MapHeaderLock(const MapHeaderLock &);
     MapHeaderLock &operator=(const MapHeaderLock &);
   public:
-    explicit MapHeaderLock(DBObjectMap *db) : db(db) {}
-    MapHeaderLock(DBObjectMap *db, const ghobject_t &oid) : db(db), locked(oid) {
-      Mutex::Locker l(db->header_lock);
-      while (db->map_header_in_use.count(*locked))
-	db->map_header_cond.Wait(db->header_lock);
-      db->map_header_in_use.insert(*locked);
-    }
+    explicit MapHeaderLock(DBObjectMap *db) : db(db), shared(false) {}
+    MapHeaderLock(DBObjectMap *db, const ghobject_t &oid, bool shared=false);
 
     const ghobject_t &get_locked() const {
       assert(locked);
       return *locked;
     }
 
+    bool is_shared() const {
+      return shared;
+    }
+
     void swap(MapHeaderLock &o) {
       assert(db == o.db);
 
@@ -103,22 +105,14 @@ public:
       boost::optional<ghobject_t> _locked = o.locked;
       o.locked = locked;
       locked = _locked;
+      std::swap(shared, o.shared);
     }
 
-    ~MapHeaderLock() {
-      if (locked) {
-	Mutex::Locker l(db->header_lock);
-	assert(db->map_header_in_use.count(*locked));
-	db->map_header_cond.Signal();
-	db->map_header_in_use.erase(*locked);
-      }
-    }
+    ~MapHeaderLock();
   };
 
-  explicit DBObjectMap(KeyValueDB *db) : db(db), header_lock("DBOBjectMap"),
-           	                         cache_lock("DBObjectMap::CacheLock"),
-      	                                 caches(g_conf->filestore_omap_header_cache_size)
-    {}
+  explicit DBObjectMap(KeyValueDB *db);
+  ~DBObjectMap();
 
   int set_keys(
     const ghobject_t &oid,
@@ -153,6 +147,13 @@ public:
     const SequencerPosition *spos=0
     );
 
+  int rm_key_range(
+    const ghobject_t &oid,
+    const string &first,
+    const string &last,
+    const SequencerPosition *spos=0
+    );
+
   int get(
     const ghobject_t &oid,
     bufferlist *header,
@@ -326,10 +327,32 @@ public:
   static string ghobject_key_v0(coll_t c, const ghobject_t &oid);
   static int is_buggy_ghobject_key_v1(const string &in);
 private:
-  /// Implicit lock on Header->seq
+  /// Implicit lock on Header->seq, unless looked up under a shared lock
   typedef ceph::shared_ptr<_Header> Header;
-  Mutex cache_lock;
-  SimpleLRU<ghobject_t, _Header, ghobject_t::BitwiseComparator> caches;
+
+  /**
+   * MapHeaderLock state and decoded leaf headers, sharded by oid hash
+   * so that objects in different shards never contend.  A cached
+   * header only changes under its oid's exclusive MapHeaderLock.
+   */
+  struct MapHeaderShard {
+    Mutex lock;
+    Cond cond;
+    /// oid -> number of readers, or -1 while a writer holds it
+    map<ghobject_t, int, ghobject_t::BitwiseComparator> in_use;
+    /// writers waiting for an oid; new readers wait behind them
+    map<ghobject_t, int, ghobject_t::BitwiseComparator> writers_waiting;
+    SimpleLRU<ghobject_t, _Header, ghobject_t::BitwiseComparator> cache;
+
+    explicit MapHeaderShard(size_t cache_size)
+      : lock("DBObjectMap::MapHeaderShard::lock"),
+	cache(cache_size) {}
+  };
+  vector<MapHeaderShard*> map_header_shards;
+
+  MapHeaderShard *get_map_header_shard(const ghobject_t &oid) {
+    return map_header_shards[oid.hobj.get_hash() % map_header_shards.size()];
+  }
 
   string map_header_key(const ghobject_t &oid);
   string header_key(uint64_t seq);
@@ -379,9 +402,13 @@ private:
     bool ready;
     /// past end
     bool invalid;
+    /// header was looked up under a shared MapHeaderLock
+    bool shared;
 
-    DBObjectMapIteratorImpl(DBObjectMap *map, Header header) :
-      map(map), hlock(map), header(header), r(0), ready(false), invalid(true) {}
+    DBObjectMapIteratorImpl(DBObjectMap *map, Header header,
+			    bool shared=false) :
+      map(map), hlock(map), header(header), r(0), ready(false), invalid(true),
+      shared(shared) {}
     int seek_to_first();
     int seek_to_last();
     int upper_bound(const string &after);
@@ -412,8 +439,8 @@ private:
   };
 
   typedef ceph::shared_ptr<DBObjectMapIteratorImpl> DBObjectMapIterator;
-  DBObjectMapIterator _get_iterator(Header header) {
-    return std::make_shared<DBObjectMapIteratorImpl>(this, header);
+  DBObjectMapIterator _get_iterator(Header header, bool shared=false) {
+    return std::make_shared<DBObjectMapIteratorImpl>(this, header, shared);
   }
 
   /// sys
@@ -466,22 +493,27 @@ private:
   Header lookup_map_header(
     const MapHeaderLock &l2,
     const ghobject_t &oid) {
+    if (l2.is_shared())
+      return _lookup_map_header(l2, oid);
     Mutex::Locker l(header_lock);
     return _lookup_map_header(l2, oid);
   }
 
   /// Lookup header node for input
-  Header lookup_parent(Header input);
+  Header lookup_parent(Header input, bool shared=false);
+  /// Read header node for input from the db
+  int _read_parent(Header input, _Header *parent);
 
 
   /// Helpers
-  int _get_header(Header header, bufferlist *bl);
+  int _get_header(Header header, bufferlist *bl, bool shared=false);
 
   /// Scan keys in header into out_keys and out_values (if nonnull)
   int scan(Header header,
 	   const set<string> &in_keys,
 	   set<string> *out_keys,
-	   map<string, bufferlist> *out_values);
+	   map<string, bufferlist> *out_values,
+	   bool shared=false);
 
   /// Remove header and all related prefixes
   int _clear(Header header,
@@ -20,6 +20,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/file.h>
+#include <sys/uio.h>
 #include <errno.h>
 #include <dirent.h>
 #include <sys/ioctl.h>
@@ -306,6 +307,8 @@ int FileStore::lfn_open(const coll_t& cid,
           << ") in index: " << cpp_strerror(-r) << dendl;
       goto fail;
     }
+    if ((*index)->split_pending())
+      queue_split(cid);
     r = chain_fsetxattr<true, true>(
       fd, XATTR_SPILL_OUT_NAME,
       XATTR_NO_SPILL_OUT, sizeof(XATTR_NO_SPILL_OUT));
@@ -530,6 +533,8 @@ FileStore::FileStore(const std::string &base, const std::string &jdev, osflagbit
   sync_entry_timeo_lock("sync_entry_timeo_lock"),
   timer(g_ceph_context, sync_entry_timeo_lock),
   stop(false), sync_thread(this),
+  split_lock("FileStore::split_lock"),
+  split_stop(false), split_thread(this),
   fdcache(g_ceph_context),
   wbthrottle(g_ceph_context),
   next_osr_id(0),
@@ -1612,6 +1617,9 @@ int FileStore::mount()
       RWLock::WLocker l((index.index)->access_lock);
 
       index->cleanup();
+      // cleanup() requeues the background splits we were stopped in
+      if (index->split_pending())
+	queue_split(*i);
     }
   }
   if (!m_disable_wbthrottle) {
@@ -1660,6 +1668,9 @@ int FileStore::mount()
 
   timer.init();
 
+  split_stop = false;
+  split_thread.create("filestore_split");
+
   // upgrade?
   if (g_conf->filestore_update_to >= (int)get_target_version()) {
     int err = upgrade();
@@ -1754,6 +1765,12 @@ int FileStore::umount()
   }
   op_tp.stop();
 
+  split_lock.Lock();
+  split_stop = true;
+  split_cond.Signal();
+  split_lock.Unlock();
+  split_thread.join();
+
   journal_stop();
   if (!(generic_flags & SKIP_JOURNAL_REPLAY))
     journal_write_close();
@@ -3043,6 +3060,150 @@ int FileStore::read(
   }
 }
 
+int FileStore::read_multi(
+  const coll_t& cid,
+  vector<read_multi_op_t>& ops,
+  bool allow_eio)
+{
+  for (auto& op : ops) {
+    op.r = _read_multi_object(cid, op, allow_eio);
+  }
+  return 0;
+}
+
+int FileStore::_read_multi_object(
+  const coll_t& _cid,
+  read_multi_op_t& op,
+  bool allow_eio)
+{
+  const coll_t& cid = !_need_temp_object_collection(_cid, op.oid) ? _cid : _cid.get_temp();
+  dout(15) << __func__ << " " << cid << "/" << op.oid << " "
+	   << op.extents.size() << " extents" << dendl;
+
+  op.bls.clear();
+  op.bls.resize(op.extents.size());
+
+  FDRef fd;
+  int r = lfn_open(cid, op.oid, false, &fd);
+  if (r < 0) {
+    dout(10) << __func__ << " " << cid << "/" << op.oid << " open error: "
+	     << cpp_strerror(r) << dendl;
+    return r;
+  }
+
+  // 0~0 means the whole object, as it does for read()
+  vector<read_extent_t> extents(op.extents);
+  for (auto& e : extents) {
+    if (e.offset == 0 && e.length == 0) {
+      struct stat st;
+      memset(&st, 0, sizeof(struct stat));
+      int r = ::fstat(**fd, &st);
+      assert(r == 0);
+      e.length = st.st_size;
+    }
+  }
+
+  unsigned i = 0;
+  while (i < extents.size()) {
+    // back-to-back extents go down in a single preadv
+    unsigned n = 1;
+    uint64_t start = extents[i].offset;
+    uint64_t end = start + extents[i].length;
+    while (i + n < extents.size() &&
+	   n < IOV_MAX &&
+	   extents[i + n].offset == end) {
+      end += extents[i + n].length;
+      ++n;
+    }
+
+    vector<bufferptr> bptrs(n);
+    vector<struct iovec> iov(n);
+    for (unsigned k = 0; k < n; ++k) {
+      const read_extent_t& e = extents[i + k];
+#ifdef HAVE_POSIX_FADVISE
+      if (e.op_flags & CEPH_OSD_OP_FLAG_FADVISE_RANDOM)
+	posix_fadvise(**fd, e.offset, e.length, POSIX_FADV_RANDOM);
+      if (e.op_flags & CEPH_OSD_OP_FLAG_FADVISE_SEQUENTIAL)
+	posix_fadvise(**fd, e.offset, e.length, POSIX_FADV_SEQUENTIAL);
+#endif
+      bptrs[k] = buffer::create(e.length);
+      iov[k].iov_base = bptrs[k].c_str();
+      iov[k].iov_len = e.length;
+    }
+
+    uint64_t got = 0;
+    unsigned cur = 0;
+    while (cur < n) {
+      ssize_t rr = ::preadv(**fd, &iov[cur], n - cur, start + got);
+      if (rr < 0) {
+	if (errno == EINTR)
+	  continue;
+	r = -errno;
+	break;
+      }
+      if (rr == 0)
+	break;  // eof
+      got += rr;
+      while (cur < n && (size_t)rr >= iov[cur].iov_len) {
+	rr -= iov[cur].iov_len;
+	++cur;
+      }
+      if (cur < n) {
+	iov[cur].iov_base = (char *)iov[cur].iov_base + rr;
+	iov[cur].iov_len -= rr;
+      }
+    }
+    if (r < 0) {
+      dout(10) << __func__ << " " << cid << "/" << op.oid << " preadv error: "
+	       << cpp_strerror(r) << dendl;
+      lfn_close(fd);
+      if (!(allow_eio || !m_filestore_fail_eio || r != -EIO)) {
+	derr << __func__ << " " << cid << "/" << op.oid << " preadv error: "
+	     << cpp_strerror(r) << dendl;
+	assert(0 == "eio on pread");
+      }
+      return r;
+    }
+
+    for (unsigned k = 0; k < n; ++k) {
+      const read_extent_t& e = extents[i + k];
+      uint64_t len = MIN(got, e.length);
+      got -= len;
+      bptrs[k].set_length(len);
+      bufferlist& bl = op.bls[i + k];
+      bl.push_back(std::move(bptrs[k]));
+
+#ifdef HAVE_POSIX_FADVISE
+      if (e.op_flags & CEPH_OSD_OP_FLAG_FADVISE_DONTNEED)
+	posix_fadvise(**fd, e.offset, e.length, POSIX_FADV_DONTNEED);
+      if (e.op_flags & (CEPH_OSD_OP_FLAG_FADVISE_RANDOM | CEPH_OSD_OP_FLAG_FADVISE_SEQUENTIAL))
+	posix_fadvise(**fd, e.offset, e.length, POSIX_FADV_NORMAL);
+#endif
+
+      if (m_filestore_sloppy_crc && (!replaying || backend->can_checkpoint())) {
+	ostringstream ss;
+	int errors = backend->_crc_verify_read(**fd, e.offset, len, bl, &ss);
+	if (errors != 0) {
+	  dout(0) << __func__ << " " << cid << "/" << op.oid << " " << e.offset
+		  << "~" << len << " ... BAD CRC:\n" << ss.str() << dendl;
+	  assert(0 == "bad crc on read");
+	}
+      }
+      dout(20) << __func__ << " " << cid << "/" << op.oid << " " << e.offset
+	       << "~" << len << "/" << e.length << dendl;
+    }
+    i += n;
+  }
+
+  lfn_close(fd);
+
+  if (g_conf->filestore_debug_inject_read_err &&
+      debug_data_eio(op.oid)) {
+    return -EIO;
+  }
+  return 0;
+}
+
 int FileStore::_do_fiemap(int fd, uint64_t offset, size_t len,
                           map<uint64_t, uint64_t> *m)
 {
@@ -5020,8 +5181,10 @@ int FileStore::_collection_hint_expected_num_objs(const coll_t& c, uint32_t pg_n
      << pg_num << " expected number of objects: " << expected_num_objs << dendl;
 
   if (!collection_empty(c) && !replaying) {
-    dout(0) << "Failed to give an expected number of objects hint to collection : "
-      << c << ", only empty collection can take such type of hint. " << dendl;
+    // Too late to pre-hash; split what is there ahead of the ingest
+    dout(10) << __func__ << " " << c << " is not empty, queueing presplit"
+	     << dendl;
+    queue_split(c, expected_num_objs);
     return 0;
   }
 
@@ -5040,6 +5203,94 @@ int FileStore::_collection_hint_expected_num_objs(const coll_t& c, uint32_t pg_n
   return 0;
 }
 
+void FileStore::queue_split(const coll_t& c, uint64_t expected_num_objs)
+{
+  Mutex::Locker l(split_lock);
+  map<coll_t, uint64_t>::iterator p = split_queued.find(c);
+  if (p == split_queued.end()) {
+    split_queue.push_back(c);
+    split_queued[c] = expected_num_objs;
+    split_cond.Signal();
+  } else if (expected_num_objs > p->second) {
+    p->second = expected_num_objs;
+  }
+}
+
+void FileStore::split_entry()
+{
+  split_lock.Lock();
+  while (!split_stop) {
+    if (split_queue.empty()) {
+      split_cond.Wait(split_lock);
+      continue;
+    }
+    coll_t c = split_queue.front();
+    split_queue.pop_front();
+    uint64_t expected_num_objs = split_queued[c];
+    split_queued.erase(c);
+    split_lock.Unlock();
+
+    int r = _split_in_background(c, expected_num_objs);
+    if (r < 0) {
+      derr << __func__ << " " << c << " got " << cpp_strerror(r) << dendl;
+      assert(!m_filestore_fail_eio || r != -EIO);
+    }
+
+    split_lock.Lock();
+  }
+  split_lock.Unlock();
+}
+
+/*
+ * Splits are done one child directory at a time, taking the index lock
+ * for write around each, so writes to the collection only ever wait
+ * for one child's worth of links.  Each step is tagged with the
+ * InProgressOp like an inline split, and cleanup() finishes the split
+ * if we crash part way.  Queued splits are kept in an attr on the index
+ * and requeued at mount.
+ */
+int FileStore::_split_in_background(const coll_t& c, uint64_t expected_num_objs)
+{
+  Index index;
+  int r = get_index(c, &index);
+  if (r < 0)
+    return r;
+  assert(NULL != index.index);
+
+  if (expected_num_objs) {
+    RWLock::WLocker l((index.index)->access_lock);
+    if (!collection_exists(c))
+      return 0;
+    r = index->presplit(expected_num_objs);
+    if (r < 0)
+      return r;
+  }
+
+  while (true) {
+    uint64_t moved = 0;
+    {
+      RWLock::WLocker l((index.index)->access_lock);
+      if (!index->split_pending())
+	break;
+      r = index->split_next(&moved);
+    }
+    if (r < 0)
+      return r;
+
+    Mutex::Locker l(split_lock);
+    if (split_stop)
+      break;
+    if (moved && g_conf->filestore_split_rate > 0) {
+      utime_t wait;
+      wait.set_from_double((double)moved / g_conf->filestore_split_rate);
+      dout(20) << __func__ << " " << c << " moved " << moved
+	       << ", waiting " << wait << dendl;
+      split_cond.WaitInterval(g_ceph_context, split_lock, wait);
+    }
+  }
+  return 0;
+}
+
 int FileStore::_create_collection(
   const coll_t& c,
   const SequencerPosition &spos)
@@ -5353,17 +5604,27 @@ int FileStore::_omap_rmkeyrange(const coll_t& cid, const ghobject_t &hoid,
 				const string& first, const string& last,
 				const SequencerPosition &spos) {
   dout(15) << __func__ << " " << cid << "/" << hoid << " [" << first << "," << last << "]" << dendl;
-  set<string> keys;
+  Index index;
+  int r;
+  //treat pgmeta as a logical object, skip to check exist
+  if (hoid.is_pgmeta())
+    goto skip;
+
+  r = get_index(cid, &index);
+  if (r < 0)
+    return r;
   {
-    ObjectMap::ObjectMapIterator iter = get_omap_iterator(cid, hoid);
-    if (!iter)
-      return -ENOENT;
-    for (iter->lower_bound(first); iter->valid() && iter->key() < last;
-	 iter->next()) {
-      keys.insert(iter->key());
-    }
+    assert(NULL != index.index);
+    RWLock::RLocker l((index.index)->access_lock);
+    r = lfn_find(hoid, index);
+    if (r < 0)
+      return r;
   }
-  return _omap_rmkeys(cid, hoid, keys, spos);
+skip:
+  r = object_map->rm_key_range(hoid, first, last, &spos);
+  if (r < 0 && r != -ENOENT)
+    return r;
+  return 0;
 }
 
 int FileStore::_omap_setheader(const coll_t& cid, const ghobject_t &hoid,
@@ -187,6 +187,24 @@ private:
     }
   } sync_thread;
 
+  // background index splitting
+  Mutex split_lock;
+  Cond split_cond;
+  bool split_stop;
+  list<coll_t> split_queue;
+  map<coll_t, uint64_t> split_queued; ///< coll -> presplit target, or 0
+  void split_entry();
+  void queue_split(const coll_t& c, uint64_t expected_num_objs = 0);
+  int _split_in_background(const coll_t& c, uint64_t expected_num_objs);
+  struct SplitThread : public Thread {
+    FileStore *fs;
+    explicit SplitThread(FileStore *f) : fs(f) {}
+    void *entry() {
+      fs->split_entry();
+      return 0;
+    }
+  } split_thread;
+
   // -- op workqueue --
   struct Op {
     utime_t start;
@@ -545,6 +563,13 @@ public:
     bufferlist& bl,
     uint32_t op_flags = 0,
     bool allow_eio = false);
+  using ObjectStore::read_multi;
+  int read_multi(
+    const coll_t& cid,
+    vector<read_multi_op_t>& ops,
+    bool allow_eio = false);
+  int _read_multi_object(const coll_t& cid, read_multi_op_t& op,
+			 bool allow_eio);
   int _do_fiemap(int fd, uint64_t offset, size_t len,
                  map<uint64_t, uint64_t> *m);
   int _do_seek_hole_data(int fd, uint64_t offset, size_t len,
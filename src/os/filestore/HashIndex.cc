@@ -24,6 +24,7 @@
 
 const string HashIndex::SUBDIR_ATTR = "contents";
 const string HashIndex::IN_PROGRESS_OP_TAG = "in_progress_op";
+const string HashIndex::SPLIT_QUEUE_TAG = "split_queue";
 
 /// hex digit to integer value
 int hex_to_int(char c)
@@ -89,8 +90,11 @@ bool cmp_hexdigit_string_bitwise(const string& l, const string& r)
 }
 
 int HashIndex::cleanup() {
+  int r = load_split_queue();
+  if (r < 0)
+    return r;
   bufferlist bl;
-  int r = get_attr_path(vector<string>(), IN_PROGRESS_OP_TAG, bl);
+  r = get_attr_path(vector<string>(), IN_PROGRESS_OP_TAG, bl);
   if (r < 0) {
     // No in progress operations!
     return 0;
@@ -329,6 +333,8 @@ int HashIndex::_created(const vector<string> &path,
       return r;
     return complete_split(path, info);
   } else {
+    if (want_split_ahead(info))
+      return queue_split_root(path, split_ahead_point(), false);
     return 0;
   }
 }
@@ -399,9 +405,276 @@ int HashIndex::_collection_list_partial(const ghobject_t &start,
 }
 
 int HashIndex::prep_delete() {
+  split_queue.clear();
+  split_queued.clear();
+  split_roots.clear();
   return recursive_remove(vector<string>());
 }
 
+int HashIndex::split_next(uint64_t *moved) {
+  *moved = 0;
+  if (split_queue.empty())
+    return 0;
+  split_job_t job = split_queue.front();
+  split_queue.pop_front();
+  split_queued.erase(job.path);
+
+  // The subdir may have been merged away or split inline since
+  int exists = 0;
+  int r = path_exists(job.path, &exists);
+  if (r < 0)
+    return r;
+  subdir_info_s info;
+  if (exists) {
+    r = get_info(job.path, &info);
+    if (r < 0)
+      return r;
+    if (!job.started &&
+	info.hash_level < (unsigned)MAX_HASH_LEVEL &&
+	info.objs > job.min_objs) {
+      dout(10) << __func__ << " " << coll() << " " << job.path
+	       << " objs " << info.objs << " > " << job.min_objs << dendl;
+      job.started = true;
+    }
+  }
+
+  if (exists && job.started) {
+    // One child per call, so the caller can drop access_lock in between
+    r = split_one_child(job.path, info, moved);
+    if (r < 0)
+      return r;
+    if (*moved) {
+      split_queue.push_front(job);
+      split_queued.insert(job.path);
+      return 0;
+    }
+  }
+
+  if (exists && job.recurse) {
+    vector<string> subdirs;
+    r = list_subdirs(job.path, &subdirs);
+    if (r < 0)
+      return r;
+    vector<string> sub_path(job.path);
+    for (vector<string>::iterator i = subdirs.begin();
+	 i != subdirs.end();
+	 ++i) {
+      sub_path.push_back(*i);
+      queue_split(sub_path, job.min_objs, true);
+      sub_path.pop_back();
+    }
+  }
+
+  if (split_queue.empty() && !split_roots.empty()) {
+    split_roots.clear();
+    r = remove_attr_path(vector<string>(), SPLIT_QUEUE_TAG);
+    if (r < 0 && r != -ENODATA)
+      return r;
+  }
+  return 0;
+}
+
+/*
+ * Each child is moved like a whole split is inline: tagged with the
+ * InProgressOp, so that cleanup() completes the split of path if we
+ * crash part way, and with the child's info written only once all of
+ * its objects are linked.  In between calls path is simply a subdir
+ * with some of its children split out.
+ */
+int HashIndex::split_one_child(const vector<string> &path,
+			       const subdir_info_s &info,
+			       uint64_t *moved) {
+  *moved = 0;
+  int level = info.hash_level;
+  map<string, ghobject_t> objects;
+  int r = list_objects(path, 0, 0, &objects);
+  if (r < 0)
+    return r;
+  vector<string> subdirs_vec;
+  r = list_subdirs(path, &subdirs_vec);
+  if (r < 0)
+    return r;
+  set<string> subdirs;
+  subdirs.insert(subdirs_vec.begin(), subdirs_vec.end());
+  map<string, map<string, ghobject_t> > mapped;
+  for (map<string, ghobject_t>::iterator i = objects.begin();
+       i != objects.end();
+       ++i) {
+    vector<string> new_path;
+    get_path_components(i->second, &new_path);
+    mapped[new_path[level]][i->first] = i->second;
+  }
+
+  for (map<string, map<string, ghobject_t> >::iterator i = mapped.begin();
+       i != mapped.end();
+       ++i) {
+    // Lookups already go to an existing subdir
+    if (subdirs.count(i->first))
+      continue;
+    subdir_info_s info_new;
+    info_new.objs = i->second.size();
+    info_new.subdirs = 0;
+    info_new.hash_level = level + 1;
+    if (must_merge(info_new))
+      continue;
+
+    vector<string> dst = path;
+    dst.push_back(i->first);
+    r = start_split(path);
+    if (r < 0)
+      return r;
+    r = create_path(dst);
+    if (r < 0)
+      return r;
+    for (map<string, ghobject_t>::iterator j = i->second.begin();
+	 j != i->second.end();
+	 ++j) {
+      objects.erase(j->first);
+      r = link_object(path, dst, j->second, j->first);
+      if (r < 0)
+	return r;
+    }
+    r = fsync_dir(dst);
+    if (r < 0)
+      return r;
+    // Presence of info must imply that all objects have been copied
+    r = set_info(dst, info_new);
+    if (r < 0)
+      return r;
+    r = fsync_dir(dst);
+    if (r < 0)
+      return r;
+    r = remove_objects(path, i->second, &objects);
+    if (r < 0)
+      return r;
+    r = reset_attr(path);
+    if (r < 0)
+      return r;
+    r = fsync_dir(path);
+    if (r < 0)
+      return r;
+    *moved = info_new.objs;
+    return end_split_or_merge(path);
+  }
+  return 0;
+}
+
+int HashIndex::presplit(uint64_t expected_num_objs) {
+  uint64_t objs = 0;
+  int r = count_objects(vector<string>(), &objs);
+  if (r < 0)
+    return r;
+  // Empty collections take the pg_num based pre-hash instead
+  if (objs == 0 || expected_num_objs <= objs)
+    return 0;
+
+  // A subdir holding n objects now will hold about
+  // n * expected_num_objs / objs of them, so split it if that is over
+  // the threshold.  Fewer than 16 objects say little about how its
+  // children will fill, so those are left to split_ahead_ratio.
+  uint64_t min_objs = split_threshold() * objs / expected_num_objs;
+  if (min_objs < 16)
+    min_objs = 16;
+  dout(10) << __func__ << " " << coll() << " objs " << objs
+	   << " expected " << expected_num_objs
+	   << " split above " << min_objs << dendl;
+  return queue_split_root(vector<string>(), min_objs, true);
+}
+
+bool HashIndex::queue_split(const vector<string> &path,
+			    uint64_t min_objs,
+			    bool recurse) {
+  if (path.size() >= (unsigned)MAX_HASH_LEVEL)
+    return false;
+  if (split_queued.count(path)) {
+    for (list<split_job_t>::iterator i = split_queue.begin();
+	 i != split_queue.end();
+	 ++i) {
+      if (i->path == path) {
+	if (i->min_objs <= min_objs && (i->recurse || !recurse))
+	  return false;
+	i->min_objs = std::min(i->min_objs, min_objs);
+	i->recurse = i->recurse || recurse;
+	return true;
+      }
+    }
+    return false;
+  }
+  dout(20) << __func__ << " " << coll() << " " << path << dendl;
+  split_queue.push_back(split_job_t(path, min_objs, recurse));
+  split_queued.insert(path);
+  return true;
+}
+
+int HashIndex::queue_split_root(const vector<string> &path,
+				uint64_t min_objs,
+				bool recurse) {
+  if (!queue_split(path, min_objs, recurse))
+    return 0;
+  split_roots.push_back(split_job_t(path, min_objs, recurse));
+  bufferlist bl;
+  __u32 n = split_roots.size();
+  ::encode(n, bl);
+  for (list<split_job_t>::iterator i = split_roots.begin();
+       i != split_roots.end();
+       ++i)
+    i->encode(bl);
+  int r = add_attr_path(vector<string>(), SPLIT_QUEUE_TAG, bl);
+  if (r < 0)
+    return r;
+  return 0;
+}
+
+int HashIndex::load_split_queue() {
+  if (!split_roots.empty()) {
+    // Already loaded, and kept in step with the attr since
+    return 0;
+  }
+  bufferlist bl;
+  int r = get_attr_path(vector<string>(), SPLIT_QUEUE_TAG, bl);
+  if (r < 0) {
+    // Nothing queued
+    return 0;
+  }
+  bufferlist::iterator p = bl.begin();
+  __u32 n;
+  ::decode(n, p);
+  while (n--) {
+    split_job_t job;
+    job.decode(p);
+    queue_split(job.path, job.min_objs, job.recurse);
+    split_roots.push_back(job);
+  }
+  dout(10) << __func__ << " " << coll() << " requeued " << split_roots.size()
+	   << " splits" << dendl;
+  return 0;
+}
+
+int HashIndex::count_objects(const vector<string> &path, uint64_t *objs) {
+  subdir_info_s info;
+  int r = get_info(path, &info);
+  if (r < 0)
+    return r;
+  *objs += info.objs;
+  if (info.subdirs == 0)
+    return 0;
+  vector<string> subdirs;
+  r = list_subdirs(path, &subdirs);
+  if (r < 0)
+    return r;
+  vector<string> sub_path(path);
+  for (vector<string>::iterator i = subdirs.begin();
+       i != subdirs.end();
+       ++i) {
+    sub_path.push_back(*i);
+    r = count_objects(sub_path, objs);
+    if (r < 0)
+      return r;
+    sub_path.pop_back();
+  }
+  return 0;
+}
+
 int HashIndex::_pre_hash_collection(uint32_t pg_num, uint64_t expected_num_objs) {
   int ret;
   vector<string> path;
@@ -638,6 +911,16 @@ bool HashIndex::must_split(const subdir_info_s &info) {
 
 }
 
+bool HashIndex::want_split_ahead(const subdir_info_s &info) {
+  // On every create past the point, not just on the crossing: a subdir
+  // can get past it without a create crossing it (a collection split, a
+  // job dropped after removes took it back under min_objs) and would
+  // then only ever be split inline.  queue_split makes repeats cheap.
+  return (split_ahead_ratio > 0 &&
+	  info.hash_level < (unsigned)MAX_HASH_LEVEL &&
+	  info.objs > split_ahead_point());
+}
+
 int HashIndex::initiate_merge(const vector<string> &path, subdir_info_s info) {
   return start_merge(path);
 }
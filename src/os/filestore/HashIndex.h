@@ -53,6 +53,8 @@ private:
   static const string SUBDIR_ATTR;
   /// Attribute name for storing in progress op tag
   static const string IN_PROGRESS_OP_TAG;
+  /// Attribute name for storing queued background splits
+  static const string SPLIT_QUEUE_TAG;
   /// Size (bits) in object hash
   static const int PATH_HASH_LEN = 32;
   /// Max length of hashed path
@@ -66,6 +68,44 @@ private:
    */
   int merge_threshold;
   int split_multiplier;
+  /// queue a background split once a subdir passes this fraction of
+  /// the split threshold; 0 leaves all splitting to the write path
+  double split_ahead_ratio;
+
+  /// A subdir to split in the background, @see split_next
+  struct split_job_t {
+    vector<string> path;
+    uint64_t min_objs;  ///< split only if the subdir holds more than this
+    bool recurse;       ///< then queue its subdirs with the same min_objs
+    bool started;       ///< some children already moved, not encoded
+    split_job_t() : min_objs(0), recurse(false), started(false) {}
+    split_job_t(const vector<string> &p, uint64_t m, bool r)
+      : path(p), min_objs(m), recurse(r), started(false) {}
+
+    void encode(bufferlist &bl) const {
+      __u8 v = 1;
+      ::encode(v, bl);
+      ::encode(path, bl);
+      ::encode(min_objs, bl);
+      ::encode(recurse, bl);
+    }
+
+    void decode(bufferlist::iterator &bl) {
+      __u8 v;
+      ::decode(v, bl);
+      assert(v == 1);
+      ::decode(path, bl);
+      ::decode(min_objs, bl);
+      ::decode(recurse, bl);
+    }
+  };
+  /// protected by access_lock, like the directories themselves
+  list<split_job_t> split_queue;
+  set<vector<string> > split_queued;
+  /// jobs queued since the queue was last empty, kept in SPLIT_QUEUE_TAG
+  /// so that a restart picks them up again; jobs they recurse into are
+  /// found again by rerunning them
+  list<split_job_t> split_roots;
 
   /// Encodes current subdir state for determining when to split/merge.
   struct subdir_info_s {
@@ -139,10 +179,12 @@ public:
     int merge_at,          ///< [in] Merge threshhold.
     int split_multiple,	   ///< [in] Split threshhold.
     uint32_t index_version,///< [in] Index version
-    double retry_probability=0) ///< [in] retry probability
+    double retry_probability=0, ///< [in] retry probability
+    double split_ahead=0)  ///< [in] background split ratio
     : LFNIndex(collection, base_path, index_version, retry_probability),
       merge_threshold(merge_at),
-      split_multiplier(split_multiple) {}
+      split_multiplier(split_multiple),
+      split_ahead_ratio(split_ahead) {}
 
   /// @see CollectionIndex
   uint32_t collection_version() { return index_version; }
@@ -160,6 +202,17 @@ public:
     CollectionIndex* dest
     );
 
+  /// @see CollectionIndex
+  bool split_pending() {
+    return !split_queue.empty();
+  }
+
+  /// @see CollectionIndex
+  int split_next(uint64_t *moved);
+
+  /// @see CollectionIndex
+  int presplit(uint64_t expected_num_objs);
+
 protected:
   int _init();
 
@@ -240,6 +293,58 @@ private:
     const subdir_info_s &info ///< [in] Info to check
     ); /// @return True if info must be split, False otherwise
 
+  /// Objects a subdir may hold before it must be split
+  uint64_t split_threshold() const {
+    return (uint64_t)abs(merge_threshold) * 16 * split_multiplier;
+  }
+
+  /**
+   * Objects a subdir may hold before it is queued for a background
+   * split.  Never below 16 * merge_threshold: a split leaves behind the
+   * children that would be merged straight back, up to
+   * 16 * (merge_threshold - 1) objects, and must not be asked for again
+   * because of them.
+   */
+  uint64_t split_ahead_point() const {
+    return std::max((uint64_t)(split_threshold() * split_ahead_ratio),
+		    (uint64_t)abs(merge_threshold) * 16);
+  }
+
+  /// Encapsulates logic for when to split in the background.
+  bool want_split_ahead(
+    const subdir_info_s &info ///< [in] Info to check
+    ); /// @return True if info is past the split ahead point
+
+  /// Queue path for a background split, once
+  bool queue_split(
+    const vector<string> &path, ///< [in] Subdir to split
+    uint64_t min_objs,          ///< [in] Split only above this
+    bool recurse                ///< [in] Then look at its subdirs
+    ); /// @return True if the queue changed
+
+  /// Queue path for a background split and remember it across restarts
+  int queue_split_root(
+    const vector<string> &path, ///< [in] Subdir to split
+    uint64_t min_objs,          ///< [in] Split only above this
+    bool recurse                ///< [in] Then look at its subdirs
+    ); /// @return Error Code, 0 on success
+
+  /// Requeue the splits saved by queue_split_root
+  int load_split_queue();
+
+  /// Move the objects of one child of path into their own subdir
+  int split_one_child(
+    const vector<string> &path, ///< [in] Subdir to split
+    const subdir_info_s &info,  ///< [in] Info attached to path
+    uint64_t *moved             ///< [out] Objects moved, 0 if none left
+    ); /// @return Error Code, 0 on success
+
+  /// Count objects in path and its subdirs
+  int count_objects(
+    const vector<string> &path, ///< [in] Subdir to count
+    uint64_t *objs              ///< [out] Objects
+    ); /// @return Error Code, 0 on success
+
   /// Initiates merge
   int initiate_merge(
     const vector<string> &path, ///< [in] Subdir to merge
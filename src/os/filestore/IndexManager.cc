@@ -101,7 +101,8 @@ int IndexManager::build_index(coll_t c, const char *path, CollectionIndex **inde
     case CollectionIndex::HOBJECT_WITH_POOL: {
       // Must be a HashIndex
       *index = new HashIndex(c, path, g_conf->filestore_merge_threshold,
-				   g_conf->filestore_split_multiple, version);
+				   g_conf->filestore_split_multiple, version,
+				   0, g_conf->filestore_split_ahead_ratio);
       return 0;
     }
     default: assert(0);
@@ -112,7 +113,8 @@ int IndexManager::build_index(coll_t c, const char *path, CollectionIndex **inde
     *index = new HashIndex(c, path, g_conf->filestore_merge_threshold,
 				 g_conf->filestore_split_multiple,
 				 CollectionIndex::HOBJECT_WITH_POOL,
-				 g_conf->filestore_index_retry_probability);
+				 g_conf->filestore_index_retry_probability,
+				 g_conf->filestore_split_ahead_ratio);
     return 0;
   }
 }
@@ -42,7 +42,7 @@
 const string PREFIX_SUPER = "S"; // field -> value
 const string PREFIX_COLL = "C"; // collection name -> (nothing)
 const string PREFIX_OBJ = "O";  // object name -> onode
-const string PREFIX_DATA = "D"; // nid + offset -> data
+const string PREFIX_DATA = "D"; // nid + offset (or blob id) -> data
 const string PREFIX_OMAP = "M"; // u64 + keyname -> value
 
 /*
@@ -1524,6 +1524,11 @@ int KStore::_do_read(
     length = o->onode.size - offset;
   }
   if (stripe_size == 0) {
+    if (!o->onode.extent_map.empty()) {
+      o->flush();
+      r = _do_read_extents(o, offset, length, bl);
+      goto out;
+    }
     bl.append_zero(length);
     r = length;
     goto out;
@@ -1601,6 +1606,26 @@ int KStore::fiemap(
   dout(20) << __func__ << " " << offset << "~" << len << " size "
 	   << o->onode.size << dendl;
 
+  if (!o->onode.stripe_size && !o->onode.extent_map.empty()) {
+    // report the mapped extents, merging the ones that touch
+    uint64_t end = offset + len;
+    map<uint64_t,kstore_extent_t>::iterator p =
+      o->onode.extent_map.upper_bound(offset);
+    if (p != o->onode.extent_map.begin())
+      --p;
+    for (; p != o->onode.extent_map.end() && p->first < end; ++p) {
+      uint64_t s = MAX(p->first, offset);
+      uint64_t e = MIN(p->first + p->second.length, end);
+      if (s >= e)
+	continue;
+      if (!m.empty() && m.rbegin()->first + m.rbegin()->second == s)
+	m.rbegin()->second += e - s;
+      else
+	m[s] = e - s;
+    }
+    goto out;
+  }
+
   // FIXME: do something smarter here
   m[0] = o->onode.size;
 
@@ -2860,6 +2885,190 @@ void KStore::_do_remove_stripe(TransContext *txc, OnodeRef o, uint64_t offset)
   txc->t->rmkey(PREFIX_DATA, key);
 }
 
+bool KStore::_use_extents(OnodeRef o)
+{
+  if (o->onode.stripe_size)
+    return false;
+  return !o->onode.extent_map.empty() || g_conf->kstore_extent_layout;
+}
+
+int KStore::_do_read_extents(
+  OnodeRef o,
+  uint64_t offset,
+  size_t length,
+  bufferlist& bl)
+{
+  map<uint64_t,kstore_extent_t>& em = o->onode.extent_map;
+  uint64_t end = offset + length;
+  map<uint64_t,kstore_extent_t>::iterator start = em.upper_bound(offset);
+  if (start != em.begin()) {
+    --start;
+    if (start->first + start->second.length <= offset)
+      ++start;
+  }
+
+  // fetch every blob we need that isn't pending in a single batch
+  map<uint64_t,bufferlist> blobs;
+  map<string,uint64_t> keys;
+  for (map<uint64_t,kstore_extent_t>::iterator p = start;
+       p != em.end() && p->first < end;
+       ++p) {
+    uint64_t blob = p->second.blob;
+    map<uint64_t,bufferlist>::iterator q = o->pending_stripes.find(blob);
+    if (q != o->pending_stripes.end()) {
+      blobs[blob] = q->second;
+    } else {
+      string key;
+      get_data_key(o->onode.nid, blob, &key);
+      keys[key] = blob;
+    }
+  }
+  if (!keys.empty()) {
+    set<string> want;
+    for (map<string,uint64_t>::iterator p = keys.begin(); p != keys.end(); ++p)
+      want.insert(want.end(), p->first);
+    map<string,bufferlist> got;
+    db->get(PREFIX_DATA, want, &got);
+    dout(30) << __func__ << " fetched " << got.size() << "/" << want.size()
+	     << " blobs" << dendl;
+    for (map<string,bufferlist>::iterator p = got.begin(); p != got.end(); ++p)
+      blobs[keys[p->first]].claim(p->second);
+  }
+
+  uint64_t pos = offset;
+  for (map<uint64_t,kstore_extent_t>::iterator p = start;
+       p != em.end() && p->first < end;
+       ++p) {
+    if (p->first > pos) {
+      dout(30) << __func__ << " hole " << pos << "~" << p->first - pos << dendl;
+      bl.append_zero(p->first - pos);
+      pos = p->first;
+    }
+    uint64_t l = MIN(p->first + p->second.length, end) - pos;
+    uint64_t blob_off = p->second.blob_off + (pos - p->first);
+    bufferlist& blob = blobs[p->second.blob];
+    if (blob_off + l > blob.length()) {
+      derr << __func__ << " " << o->oid << " extent " << p->first << " "
+	   << p->second << " has only " << blob.length() << " bytes" << dendl;
+      return -EIO;
+    }
+    dout(30) << __func__ << " taking " << pos << "~" << l << " from "
+	     << p->second << dendl;
+    bufferlist t;
+    t.substr_of(blob, blob_off, l);
+    bl.claim_append(t);
+    pos += l;
+  }
+  if (pos < end)
+    bl.append_zero(end - pos);
+  return bl.length();
+}
+
+void KStore::_do_punch_extents(
+  TransContext *txc,
+  OnodeRef o,
+  uint64_t offset,
+  uint64_t end)
+{
+  map<uint64_t,kstore_extent_t>& em = o->onode.extent_map;
+  map<uint64_t,kstore_extent_t>::iterator p = em.upper_bound(offset);
+  if (p != em.begin()) {
+    --p;
+    if (p->first + p->second.length <= offset)
+      ++p;
+  }
+
+  set<uint64_t> released;
+  while (p != em.end() && p->first < end) {
+    uint64_t e_off = p->first;
+    kstore_extent_t e = p->second;
+    uint64_t e_end = e_off + e.length;
+    released.insert(e.blob);
+    em.erase(p++);
+    // keep whatever sticks out on either side, pointing at the old blob
+    if (e_off < offset) {
+      em[e_off] = kstore_extent_t(e.blob, e.blob_off, offset - e_off);
+      dout(20) << __func__ << " keep head " << e_off << " " << em[e_off]
+	       << dendl;
+    }
+    if (e_end > end) {
+      em[end] = kstore_extent_t(e.blob, e.blob_off + (end - e_off),
+				e_end - end);
+      dout(20) << __func__ << " keep tail " << end << " " << em[end] << dendl;
+    }
+  }
+
+  // drop the blobs nothing points at anymore
+  if (released.empty())
+    return;
+  for (p = em.begin(); p != em.end(); ++p)
+    released.erase(p->second.blob);
+  for (set<uint64_t>::iterator b = released.begin(); b != released.end(); ++b) {
+    dout(20) << __func__ << " rm blob " << *b << dendl;
+    _do_remove_stripe(txc, o, *b);
+  }
+}
+
+void KStore::_do_write_extents(
+  TransContext *txc,
+  OnodeRef o,
+  uint64_t offset,
+  uint64_t length,
+  bufferlist& orig_bl)
+{
+  _do_punch_extents(txc, o, offset, offset + length);
+
+  // blobs never cross a kstore_max_blob_size boundary, so a small read
+  // only has to fetch a bounded amount
+  uint64_t max_blob = MAX(1, g_conf->kstore_max_blob_size);
+  unsigned bl_off = 0;
+  while (length > 0) {
+    uint64_t l = MIN(length, max_blob - offset % max_blob);
+    bufferlist bl;
+    bl.substr_of(orig_bl, bl_off, l);
+    uint64_t blob = ++o->onode.last_blob;
+    _do_write_stripe(txc, o, blob, bl);
+    o->onode.extent_map[offset] = kstore_extent_t(blob, 0, l);
+    dout(20) << __func__ << " " << offset << " "
+	     << o->onode.extent_map[offset] << dendl;
+    offset += l;
+    length -= l;
+    bl_off += l;
+  }
+
+  map<uint64_t,kstore_extent_t>& em = o->onode.extent_map;
+  uint64_t end = em.rbegin()->first + em.rbegin()->second.length;
+  if (em.size() > end / max_blob + 1 + g_conf->kstore_max_extents)
+    _do_compact_extents(txc, o);
+}
+
+void KStore::_do_compact_extents(TransContext *txc, OnodeRef o)
+{
+  map<uint64_t,kstore_extent_t>& em = o->onode.extent_map;
+  uint64_t end = em.rbegin()->first + em.rbegin()->second.length;
+  dout(20) << __func__ << " " << o->oid << " " << em.size() << " extents over "
+	   << end << " bytes" << dendl;
+
+  bufferlist bl;
+  int r = _do_read_extents(o, 0, end, bl);
+  if (r < 0)
+    return;
+  _do_punch_extents(txc, o, 0, end);
+
+  uint64_t max_blob = MAX(1, g_conf->kstore_max_blob_size);
+  for (uint64_t pos = 0; pos < end; pos += max_blob) {
+    uint64_t l = MIN(max_blob, end - pos);
+    bufferlist t;
+    t.substr_of(bl, pos, l);
+    if (t.is_zero())
+      continue;  // leave holes as holes
+    uint64_t blob = ++o->onode.last_blob;
+    _do_write_stripe(txc, o, blob, t);
+    em[pos] = kstore_extent_t(blob, 0, l);
+  }
+  dout(20) << __func__ << " now " << em.size() << " extents" << dendl;
+}
+
 int KStore::_do_write(TransContext *txc,
 		      OnodeRef o,
 		      uint64_t offset, uint64_t length,
@@ -2879,6 +3088,16 @@ int KStore::_do_write(TransContext *txc,
     return 0;
   }
 
+  if (_use_extents(o)) {
+    _do_write_extents(txc, o, offset, length, orig_bl);
+    if (offset + length > o->onode.size) {
+      dout(20) << __func__ << " extending size to " << offset + length
+	       << dendl;
+      o->onode.size = offset + length;
+    }
+    return 0;
+  }
+
   uint64_t stripe_size = o->onode.stripe_size;
   if (!stripe_size) {
     o->onode.stripe_size = g_conf->kstore_default_stripe_size;
@@ -3022,6 +3241,9 @@ int KStore::_zero(TransContext *txc,
 	pos += stripe_size;
       }
     }
+  } else if (!o->onode.extent_map.empty()) {
+    // zeros are just holes
+    _do_punch_extents(txc, o, offset, offset + length);
   }
   if (offset + length > o->onode.size) {
     o->onode.size = offset + length;
@@ -3073,6 +3295,8 @@ int KStore::_do_truncate(TransContext *txc, OnodeRef o, uint64_t offset)
 	o->clear_tail();
       }
     }
+  } else if (!o->onode.extent_map.empty()) {
+    _do_punch_extents(txc, o, offset, (uint64_t)-1);
   }
 
   o->onode.size = offset;
@@ -74,7 +74,8 @@ public:
     uint64_t tail_offset;
     bufferlist tail_bl;
 
-    map<uint64_t,bufferlist> pending_stripes;  ///< unwritten stripes
+    /// unwritten stripes, or blobs (by id) for extent-mapped objects
+    map<uint64_t,bufferlist> pending_stripes;
 
     Onode(const ghobject_t& o, const string& k)
       : nref(0),
@@ -389,6 +390,20 @@ private:
 			uint64_t offset, bufferlist& bl);
   void _do_remove_stripe(TransContext *txc, OnodeRef o, uint64_t offset);
 
+  // Objects written with kstore_extent_layout keep a map of variable
+  // size extents, each pointing into a blob stored under the same keys
+  // stripes use (nid + blob id).  Overwrites go to new blobs, so only
+  // the bytes written are rewritten; blobs no longer referenced are
+  // removed.
+  bool _use_extents(OnodeRef o);
+  int _do_read_extents(OnodeRef o, uint64_t offset, size_t length,
+		       bufferlist& bl);
+  void _do_write_extents(TransContext *txc, OnodeRef o,
+			 uint64_t offset, uint64_t length, bufferlist& bl);
+  void _do_punch_extents(TransContext *txc, OnodeRef o,
+			 uint64_t offset, uint64_t end);
+  void _do_compact_extents(TransContext *txc, OnodeRef o);
+
 public:
   KStore(CephContext *cct, const string& path);
   ~KStore();
@@ -45,11 +45,52 @@ void kstore_cnode_t::generate_test_instances(list<kstore_cnode_t*>& o)
 }
 
 
+// kstore_extent_t
+
+void kstore_extent_t::encode(bufferlist& bl) const
+{
+  ENCODE_START(1, 1, bl);
+  ::encode(blob, bl);
+  ::encode(blob_off, bl);
+  ::encode(length, bl);
+  ENCODE_FINISH(bl);
+}
+
+void kstore_extent_t::decode(bufferlist::iterator& p)
+{
+  DECODE_START(1, p);
+  ::decode(blob, p);
+  ::decode(blob_off, p);
+  ::decode(length, p);
+  DECODE_FINISH(p);
+}
+
+void kstore_extent_t::dump(Formatter *f) const
+{
+  f->dump_unsigned("blob", blob);
+  f->dump_unsigned("blob_off", blob_off);
+  f->dump_unsigned("length", length);
+}
+
+void kstore_extent_t::generate_test_instances(list<kstore_extent_t*>& o)
+{
+  o.push_back(new kstore_extent_t());
+  o.push_back(new kstore_extent_t(1, 0, 4096));
+  o.push_back(new kstore_extent_t(7, 512, 1024));
+}
+
+ostream& operator<<(ostream& out, const kstore_extent_t& e)
+{
+  return out << "blob " << e.blob << " " << e.blob_off << "~" << e.length;
+}
+
+
 // kstore_onode_t
 
 void kstore_onode_t::encode(bufferlist& bl) const
 {
-  ENCODE_START(1, 1, bl);
+  // an older decoder would read an extent-mapped object as all zeros
+  ENCODE_START(2, extent_map.empty() ? 1 : 2, bl);
   ::encode(nid, bl);
   ::encode(size, bl);
   ::encode(attrs, bl);
@@ -57,12 +98,14 @@ void kstore_onode_t::encode(bufferlist& bl) const
   ::encode(stripe_size, bl);
   ::encode(expected_object_size, bl);
   ::encode(expected_write_size, bl);
+  ::encode(extent_map, bl);
+  ::encode(last_blob, bl);
   ENCODE_FINISH(bl);
 }
 
 void kstore_onode_t::decode(bufferlist::iterator& p)
 {
-  DECODE_START(1, p);
+  DECODE_START(2, p);
   ::decode(nid, p);
   ::decode(size, p);
   ::decode(attrs, p);
@@ -70,6 +113,10 @@ void kstore_onode_t::decode(bufferlist::iterator& p)
   ::decode(stripe_size, p);
   ::decode(expected_object_size, p);
   ::decode(expected_write_size, p);
+  if (struct_v >= 2) {
+    ::decode(extent_map, p);
+    ::decode(last_blob, p);
+  }
   DECODE_FINISH(p);
 }
 
@@ -90,10 +137,26 @@ void kstore_onode_t::dump(Formatter *f) const
   f->dump_unsigned("stripe_size", stripe_size);
   f->dump_unsigned("expected_object_size", expected_object_size);
   f->dump_unsigned("expected_write_size", expected_write_size);
+  f->open_array_section("extent_map");
+  for (map<uint64_t,kstore_extent_t>::const_iterator p = extent_map.begin();
+       p != extent_map.end(); ++p) {
+    f->open_object_section("extent");
+    f->dump_unsigned("offset", p->first);
+    p->second.dump(f);
+    f->close_section();
+  }
+  f->close_section();
+  f->dump_unsigned("last_blob", last_blob);
 }
 
 void kstore_onode_t::generate_test_instances(list<kstore_onode_t*>& o)
 {
   o.push_back(new kstore_onode_t());
+  o.push_back(new kstore_onode_t());
+  o.back()->nid = 3;
+  o.back()->size = 8192;
+  o.back()->extent_map[0] = kstore_extent_t(1, 0, 4096);
+  o.back()->extent_map[6144] = kstore_extent_t(2, 2048, 2048);
+  o.back()->last_blob = 2;
   // FIXME
 }
@@ -37,24 +37,47 @@ struct kstore_cnode_t {
 };
 WRITE_CLASS_ENCODER(kstore_cnode_t)
 
+/// extent: a logical range of object data, backed by part of a blob
+struct kstore_extent_t {
+  uint64_t blob;       ///< blob id, unique within the onode
+  uint32_t blob_off;   ///< where our data starts within the blob
+  uint32_t length;     ///< length of the extent
+
+  explicit kstore_extent_t(uint64_t b=0, uint32_t bo=0, uint32_t l=0)
+    : blob(b), blob_off(bo), length(l) {}
+
+  void encode(bufferlist& bl) const;
+  void decode(bufferlist::iterator& p);
+  void dump(Formatter *f) const;
+  static void generate_test_instances(list<kstore_extent_t*>& o);
+};
+WRITE_CLASS_ENCODER(kstore_extent_t)
+
+ostream& operator<<(ostream& out, const kstore_extent_t& e);
+
 /// onode: per-object metadata
 struct kstore_onode_t {
   uint64_t nid;                        ///< numeric id (locally unique)
   uint64_t size;                       ///< object size
   map<string, bufferptr> attrs;        ///< attrs
   uint64_t omap_head;                  ///< id for omap root node
-  uint32_t stripe_size;                ///< stripe size
+  uint32_t stripe_size;                ///< stripe size, 0 if not striped
 
   uint32_t expected_object_size;
   uint32_t expected_write_size;
 
+  /// logical offset -> extent; used instead of stripes when stripe_size is 0
+  map<uint64_t, kstore_extent_t> extent_map;
+  uint64_t last_blob;                  ///< last blob id handed out
+
   kstore_onode_t()
     : nid(0),
       size(0),
       omap_head(0),
       stripe_size(0),
       expected_object_size(0),
-      expected_write_size(0) {}
+      expected_write_size(0),
+      last_blob(0) {}
 
   void encode(bufferlist& bl) const;
   void decode(bufferlist::iterator& p);
@@ -43,6 +43,7 @@ bool operator>(const MemStore::CollectionRef& l,
 
 int MemStore::mount()
 {
+  Page::pool_bytes() = cct->_conf->memstore_page_pool_bytes;
   int r = _load();
   if (r < 0)
     return r;
@@ -1036,7 +1037,7 @@ int MemStore::_write(const coll_t& cid, const ghobject_t& oid,
   ObjectRef o = c->get_or_create_object(oid);
   const ssize_t old_size = o->get_size();
   o->write(offset, bl);
-  used_bytes += (o->get_size() - old_size);
+  _update_used_bytes(o->get_size() - old_size);
 
   return 0;
 }
@@ -1063,7 +1064,7 @@ int MemStore::_truncate(const coll_t& cid, const ghobject_t& oid, uint64_t size)
     return -ENOENT;
   const ssize_t old_size = o->get_size();
   int r = o->truncate(size);
-  used_bytes += (o->get_size() - old_size);
+  _update_used_bytes(o->get_size() - old_size);
   return r;
 }
 
@@ -1075,12 +1076,10 @@ int MemStore::_remove(const coll_t& cid, const ghobject_t& oid)
     return -ENOENT;
   RWLock::WLocker l(c->lock);
 
-  auto i = c->object_hash.find(oid);
-  if (i == c->object_hash.end())
+  ObjectRef o = c->_remove_object(oid);
+  if (!o)
     return -ENOENT;
-  used_bytes -= i->second->get_size();
-  c->object_hash.erase(i);
-  c->object_map.erase(oid);
+  _update_used_bytes(-(ssize_t)o->get_size());
 
   return 0;
 }
@@ -1148,7 +1147,7 @@ int MemStore::_clone(const coll_t& cid, const ghobject_t& oldoid,
   if (!oo)
     return -ENOENT;
   ObjectRef no = c->get_or_create_object(newoid);
-  used_bytes += oo->get_size() - no->get_size();
+  _update_used_bytes(oo->get_size() - no->get_size());
   no->clone(oo.get(), 0, oo->get_size(), 0);
 
   // take xattr and omap locks with std::lock()
@@ -1188,7 +1187,7 @@ int MemStore::_clone_range(const coll_t& cid, const ghobject_t& oldoid,
 
   const ssize_t old_size = no->get_size();
   no->clone(oo.get(), srcoff, len, dstoff);
-  used_bytes += (no->get_size() - old_size);
+  _update_used_bytes(no->get_size() - old_size);
 
   return len;
 }
@@ -1331,13 +1330,12 @@ int MemStore::_collection_add(const coll_t& cid, const coll_t& ocid, const ghobj
   RWLock::WLocker l1(MIN(&(*c), &(*oc))->lock);
   RWLock::WLocker l2(MAX(&(*c), &(*oc))->lock);
 
-  if (c->object_hash.count(oid))
+  if (c->_has_object(oid))
     return -EEXIST;
-  if (oc->object_hash.count(oid) == 0)
+  ObjectRef o = oc->get_object(oid);
+  if (!o)
     return -ENOENT;
-  ObjectRef o = oc->object_hash[oid];
-  c->object_map[oid] = o;
-  c->object_hash[oid] = o;
+  c->_add_object(oid, o);
   return 0;
 }
 
@@ -1358,17 +1356,14 @@ int MemStore::_collection_move_rename(const coll_t& oldcid, const ghobject_t& ol
   c->lock.get_write();
 
   int r = -EEXIST;
-  if (c->object_hash.count(oid))
+  if (c->_has_object(oid))
     goto out;
   r = -ENOENT;
-  if (oc->object_hash.count(oldoid) == 0)
-    goto out;
   {
-    ObjectRef o = oc->object_hash[oldoid];
-    c->object_map[oid] = o;
-    c->object_hash[oid] = o;
-    oc->object_map.erase(oldoid);
-    oc->object_hash.erase(oldoid);
+    ObjectRef o = oc->_remove_object(oldoid);
+    if (!o)
+      goto out;
+    c->_add_object(oid, o);
   }
   r = 0;
  out:
@@ -1394,10 +1389,8 @@ int MemStore::_split_collection(const coll_t& cid, uint32_t bits, uint32_t match
   while (p != sc->object_map.end()) {
     if (p->first.match(bits, match)) {
       dout(20) << " moving " << p->first << dendl;
-      dc->object_map.insert(make_pair(p->first, p->second));
-      dc->object_hash.insert(make_pair(p->first, p->second));
-      sc->object_hash.erase(p->first);
-      sc->object_map.erase(p++);
+      ghobject_t oid = (p++)->first;
+      dc->_add_object(oid, sc->_remove_object(oid));
     } else {
       ++p;
     }
@@ -1479,14 +1472,9 @@ int MemStore::BufferlistObject::truncate(uint64_t size)
 
 // PageSetObject
 
-#if defined(__GLIBCXX__)
 // use a thread-local vector for the pages returned by PageSet, so we
 // can avoid allocations in read/write()
 thread_local PageSet::page_vector MemStore::PageSetObject::tls_pages;
-#define DEFINE_PAGE_VECTOR(name)
-#else
-#define DEFINE_PAGE_VECTOR(name) PageSet::page_vector name;
-#endif
 
 int MemStore::PageSetObject::read(uint64_t offset, uint64_t len, bufferlist& bl)
 {
@@ -1494,7 +1482,6 @@ int MemStore::PageSetObject::read(uint64_t offset, uint64_t len, bufferlist& bl)
   const auto end = offset + len;
   auto remaining = len;
 
-  DEFINE_PAGE_VECTOR(tls_pages);
   data.get_range(offset, len, tls_pages);
 
   // allocate a buffer for the data
@@ -1541,7 +1528,6 @@ int MemStore::PageSetObject::write(uint64_t offset, const bufferlist &src)
 {
   unsigned len = src.length();
 
-  DEFINE_PAGE_VECTOR(tls_pages);
   // make sure the page range is allocated
   data.alloc_range(offset, src.length(), tls_pages);
 
@@ -1576,7 +1562,6 @@ int MemStore::PageSetObject::clone(Object *src, uint64_t srcoff,
   auto &dst_data = data;
   const auto dst_page_size = dst_data.get_page_size();
 
-  DEFINE_PAGE_VECTOR(tls_pages);
   PageSet::page_vector dst_pages;
 
   while (len) {
@@ -1621,7 +1606,6 @@ int MemStore::PageSetObject::truncate(uint64_t size)
   if (page_offset == size)
     return 0;
 
-  DEFINE_PAGE_VECTOR(tls_pages);
   // write zeroes to the rest of the last page
   data.get_range(page_offset, page_size, tls_pages);
   if (tls_pages.empty())
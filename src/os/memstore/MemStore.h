@@ -16,6 +16,7 @@
 #ifndef CEPH_MEMSTORE_H
 #define CEPH_MEMSTORE_H
 
+#include <atomic>
 #include <mutex>
 #include <boost/intrusive_ptr.hpp>
 
@@ -124,11 +125,9 @@ public:
   struct PageSetObject : public Object {
     PageSet data;
     uint64_t data_len;
-#if defined(__GLIBCXX__)
     // use a thread-local vector for the pages returned by PageSet, so we
     // can avoid allocations in read/write()
     static thread_local PageSet::page_vector tls_pages;
-#endif
 
     explicit PageSetObject(size_t page_size) : data(page_size), data_len(0) {}
 
@@ -160,10 +159,16 @@ public:
     coll_t cid;
     CephContext *cct;
     bool use_page_set;
-    ceph::unordered_map<ghobject_t, ObjectRef> object_hash;  ///< for lookup
+
+    /// a slice of the lookup hash, with its own lock
+    struct ObjectShard {
+      Spinlock lock;
+      ceph::unordered_map<ghobject_t, ObjectRef> objects;
+    };
+    vector<ObjectShard> object_hash;  ///< for lookup, sharded by oid
     map<ghobject_t, ObjectRef,ghobject_t::BitwiseComparator> object_map;        ///< for iteration
     map<string,bufferptr> xattr;
-    RWLock lock;   ///< for object_{map,hash}
+    RWLock lock;   ///< for object_map, and for adding or removing objects
     bool exists;
 
     typedef boost::intrusive_ptr<Collection> Ref;
@@ -184,23 +189,64 @@ public:
     // contents of individual objects.  The osd is already sequencing
     // reads and writes, so we will never see them concurrently at this
     // level.
+    //
+    // Lookups of existing objects only take the object's hash shard, so
+    // the op threads of one collection don't all serialize on lock.
+    // Adding or removing an object takes lock for write and then the
+    // shard.
+
+    ObjectShard &get_shard(const ghobject_t &oid) {
+      // objects in a collection share the low bits of their hash; use
+      // the reversed key so they still spread over the shards
+      return object_hash[oid.hobj.get_bitwise_key_u32() % object_hash.size()];
+    }
 
     ObjectRef get_object(ghobject_t oid) {
-      RWLock::RLocker l(lock);
-      auto o = object_hash.find(oid);
-      if (o == object_hash.end())
+      ObjectShard &shard = get_shard(oid);
+      std::lock_guard<Spinlock> l(shard.lock);
+      auto o = shard.objects.find(oid);
+      if (o == shard.objects.end())
 	return ObjectRef();
       return o->second;
     }
 
     ObjectRef get_or_create_object(ghobject_t oid) {
+      ObjectRef o = get_object(oid);
+      if (o)
+	return o;
       RWLock::WLocker l(lock);
-      auto result = object_hash.emplace(oid, ObjectRef());
+      ObjectShard &shard = get_shard(oid);
+      std::lock_guard<Spinlock> sl(shard.lock);
+      auto result = shard.objects.emplace(oid, ObjectRef());
       if (result.second)
         object_map[oid] = result.first->second = create_object();
       return result.first->second;
     }
 
+    /// lock must be held for write
+    bool _has_object(const ghobject_t &oid) {
+      ObjectShard &shard = get_shard(oid);
+      std::lock_guard<Spinlock> l(shard.lock);
+      return shard.objects.count(oid);
+    }
+    void _add_object(const ghobject_t &oid, ObjectRef o) {
+      ObjectShard &shard = get_shard(oid);
+      std::lock_guard<Spinlock> l(shard.lock);
+      shard.objects[oid] = o;
+      object_map[oid] = o;
+    }
+    ObjectRef _remove_object(const ghobject_t &oid) {
+      ObjectShard &shard = get_shard(oid);
+      std::lock_guard<Spinlock> l(shard.lock);
+      auto i = shard.objects.find(oid);
+      if (i == shard.objects.end())
+	return ObjectRef();
+      ObjectRef o = i->second;
+      shard.objects.erase(i);
+      object_map.erase(oid);
+      return o;
+    }
+
     void encode(bufferlist& bl) const {
       ENCODE_START(1, 1, bl);
       ::encode(xattr, bl);
@@ -226,8 +272,7 @@ public:
 	::decode(k, p);
 	auto o = create_object();
 	o->decode(p);
-	object_map.insert(make_pair(k, o));
-	object_hash.insert(make_pair(k, o));
+	_add_object(k, o);
       }
       DECODE_FINISH(p);
     }
@@ -247,6 +292,7 @@ public:
       : cid(c),
 	cct(cct),
 	use_page_set(cct->_conf->memstore_page_set),
+	object_hash(MAX(1, cct->_conf->memstore_object_shards)),
         lock("MemStore::Collection::lock", true, false),
 	exists(true) {}
   };
@@ -306,7 +352,13 @@ private:
 
   Finisher finisher;
 
-  uint64_t used_bytes;
+  std::atomic<uint64_t> used_bytes;
+
+  /// skip the shared counter for overwrites that don't change the size
+  void _update_used_bytes(ssize_t delta) {
+    if (delta)
+      used_bytes += delta;
+  }
 
   void _do_transaction(Transaction& t);
 
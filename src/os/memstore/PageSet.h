@@ -67,11 +67,17 @@ struct Page {
     const auto align = alignof(Page);
     page_size = (page_size + align - 1) & ~(align - 1);
     // allocate the Page and its data in a single buffer
-    auto buffer = new char[page_size + sizeof(Page)];
+    auto buffer = alloc_buffer(page_size + sizeof(Page));
     // place the Page structure at the end of the buffer
     return new (buffer + page_size) Page(buffer, offset);
   }
 
+  /// bytes of freed pages each thread may keep around for reuse
+  static std::atomic<size_t>& pool_bytes() {
+    static std::atomic<size_t> bytes(0);
+    return bytes;
+  }
+
   // copy disabled
   Page(const Page&) = delete;
   const Page& operator=(const Page&) = delete;
@@ -80,7 +86,50 @@ struct Page {
   Page(char *data, uint64_t offset) : data(data), offset(offset), nrefs(1) {}
 
   static void operator delete(void *p) {
-    delete[] reinterpret_cast<Page*>(p)->data;
+    char *data = reinterpret_cast<Page*>(p)->data;
+    free_buffer(data, reinterpret_cast<char*>(p) + sizeof(Page) - data);
+  }
+
+  // Freed page buffers are cached per thread, so the op threads that
+  // keep writing and freeing pages recycle them without going through
+  // the allocator's locks.  With first-touch placement the memory also
+  // stays on the node of the thread that last used it.
+  struct Pool {
+    size_t buffer_size = 0;
+    std::vector<char*> buffers;
+    ~Pool() {
+      for (auto b : buffers)
+	delete[] b;
+    }
+  };
+  static Pool& get_pool() {
+    static thread_local Pool pool;
+    return pool;
+  }
+
+  static char *alloc_buffer(size_t size) {
+    Pool &pool = get_pool();
+    if (pool.buffer_size == size && !pool.buffers.empty()) {
+      char *b = pool.buffers.back();
+      pool.buffers.pop_back();
+      return b;
+    }
+    return new char[size];
+  }
+  static void free_buffer(char *b, size_t size) {
+    Pool &pool = get_pool();
+    if (pool.buffer_size != size) {
+      // page size changed, drop what we cached for the old one
+      for (auto p : pool.buffers)
+	delete[] p;
+      pool.buffers.clear();
+      pool.buffer_size = size;
+    }
+    if ((pool.buffers.size() + 1) * size <= pool_bytes()) {
+      pool.buffers.push_back(b);
+      return;
+    }
+    delete[] b;
   }
 };
 
@@ -892,70 +892,78 @@ void ECBackend::handle_sub_read(
   ECSubReadReply *reply)
 {
   shard_id_t shard = get_parent()->whoami_shard().shard;
+  vector<ObjectStore::read_multi_op_t> reads;
+  vector<ECUtil::HashInfoRef> hinfos;
+  reads.reserve(op.to_read.size());
+  hinfos.reserve(op.to_read.size());
   for(map<hobject_t, list<boost::tuple<uint64_t, uint64_t, uint32_t> >, hobject_t::BitwiseComparator>::iterator i =
         op.to_read.begin();
       i != op.to_read.end();
       ++i) {
-    int r = 0;
     ECUtil::HashInfoRef hinfo = get_hash_info(i->first);
     if (!hinfo) {
-      r = -EIO;
       get_parent()->clog_error() << __func__ << ": No hinfo for " << i->first << "\n";
       dout(5) << __func__ << ": No hinfo for " << i->first << dendl;
-      goto error;
+      reply->errors[i->first] = -EIO;
+      continue;
     }
+    reads.push_back(
+      ObjectStore::read_multi_op_t(
+	ghobject_t(i->first, ghobject_t::NO_GEN, shard)));
     for (list<boost::tuple<uint64_t, uint64_t, uint32_t> >::iterator j =
 	   i->second.begin(); j != i->second.end(); ++j) {
-      bufferlist bl;
-      r = store->read(
-	ch,
-	ghobject_t(i->first, ghobject_t::NO_GEN, shard),
-	j->get<0>(),
-	j->get<1>(),
-	bl, j->get<2>(),
-	true); // Allow EIO return
-      if (r < 0) {
-	get_parent()->clog_error() << __func__
-				   << ": Error " << r
-				   << " reading "
-				   << i->first;
-	dout(5) << __func__ << ": Error " << r
-		<< " reading " << i->first << dendl;
-	goto error;
-      } else {
-        dout(20) << __func__ << " read request=" << j->get<1>() << " r=" << r << " len=" << bl.length() << dendl;
-	reply->buffers_read[i->first].push_back(
-	  make_pair(
-	    j->get<0>(),
-	    bl)
-	  );
-      }
+      reads.back().extents.push_back(
+	ObjectStore::read_extent_t(j->get<0>(), j->get<1>(), j->get<2>()));
+    }
+    hinfos.push_back(hinfo);
+  }
+
+  // fetch every chunk in one call so the store can batch the lookups and io
+  int rr = store->read_multi(ch, reads, true); // Allow EIO return
+  for (unsigned i = 0; i < reads.size(); ++i) {
+    const hobject_t& hoid = reads[i].oid.hobj;
+    ECUtil::HashInfoRef& hinfo = hinfos[i];
+    int r = rr < 0 ? rr : reads[i].r;
+    if (r < 0) {
+      get_parent()->clog_error() << __func__
+				 << ": Error " << r
+				 << " reading "
+				 << hoid;
+      dout(5) << __func__ << ": Error " << r
+	      << " reading " << hoid << dendl;
+      goto error;
+    }
+    for (unsigned j = 0; j < reads[i].extents.size(); ++j) {
+      const ObjectStore::read_extent_t& e = reads[i].extents[j];
+      bufferlist& bl = reads[i].bls[j];
+      dout(20) << __func__ << " read request=" << e.length << " len=" << bl.length() << dendl;
 
       // This shows that we still need deep scrub because large enough files
       // are read in sections, so the digest check here won't be done here.
       // Do NOT check osd_read_eio_on_bad_digest here.  We need to report
       // the state of our chunk in case other chunks could substitute.
       if ((bl.length() == hinfo->get_total_chunk_size()) &&
-	  (j->get<0>() == 0)) {
-	dout(20) << __func__ << ": Checking hash of " << i->first << dendl;
+	  (e.offset == 0)) {
+	dout(20) << __func__ << ": Checking hash of " << hoid << dendl;
 	bufferhash h(-1);
 	h << bl;
 	if (h.digest() != hinfo->get_chunk_hash(shard)) {
-	  get_parent()->clog_error() << __func__ << ": Bad hash for " << i->first << " digest 0x"
+	  get_parent()->clog_error() << __func__ << ": Bad hash for " << hoid << " digest 0x"
 	          << hex << h.digest() << " expected 0x" << hinfo->get_chunk_hash(shard) << dec << "\n";
-	  dout(5) << __func__ << ": Bad hash for " << i->first << " digest 0x"
+	  dout(5) << __func__ << ": Bad hash for " << hoid << " digest 0x"
 	          << hex << h.digest() << " expected 0x" << hinfo->get_chunk_hash(shard) << dec << dendl;
 	  r = -EIO;
 	  goto error;
 	}
       }
+      reply->buffers_read[hoid].push_back(make_pair(e.offset, bl));
     }
     continue;
 error:
     // Do NOT check osd_read_eio_on_bad_digest here.  We need to report
     // the state of our chunk in case other chunks could substitute.
-    reply->buffers_read.erase(i->first);
-    reply->errors[i->first] = r;
+    reply->buffers_read.erase(hoid);
+    reply->errors[hoid] = r;
   }
   for (set<hobject_t, hobject_t::BitwiseComparator>::iterator i = op.attrs_to_read.begin();
        i != op.attrs_to_read.end();
@@ -2063,6 +2071,12 @@ void ECBackend::be_deep_scrub(
 
   uint32_t fadvise_flags = CEPH_OSD_OP_FLAG_FADVISE_SEQUENTIAL | CEPH_OSD_OP_FLAG_FADVISE_DONTNEED;
 
+  // if the store verifies every byte of this shard on read, a clean read
+  // is as good as matching the chunk hash, so don't bother computing it.
+  bool builtin_csum = store->has_builtin_csum(
+    ch,
+    ghobject_t(poid, ghobject_t::NO_GEN, get_parent()->whoami_shard().shard));
+
   while (true) {
     bufferlist bl;
     handle.reset_tp_timeout();
@@ -2080,7 +2094,8 @@ void ECBackend::be_deep_scrub(
       break;
     }
     pos += r;
-    h << bl;
+    if (!builtin_csum)
+      h << bl;
     if ((unsigned)r < stride)
       break;
   }
@@ -2099,7 +2114,8 @@ void ECBackend::be_deep_scrub(
     o.digest_present = false;
     return;
   } else {
-    if (hinfo->get_chunk_hash(get_parent()->whoami_shard().shard) != h.digest()) {
+    if (!builtin_csum &&
+	hinfo->get_chunk_hash(get_parent()->whoami_shard().shard) != h.digest()) {
       dout(0) << "_scan_list  " << poid << " got incorrect hash on read" << dendl;
       o.read_error = true;
       return;
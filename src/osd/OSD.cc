@@ -171,6 +171,27 @@ void PGQueueable::RunVis::operator()(PGScrub &op) {
   return pg->scrub(op.epoch_queued, handle);
 }
 
+unsigned PGQueueable::ClassVis::operator()(const OpRequestRef &op) const {
+  switch (op->get_req()->get_type()) {
+  case MSG_OSD_PG_PUSH:
+  case MSG_OSD_PG_PULL:
+  case MSG_OSD_PG_PUSH_REPLY:
+  case MSG_OSD_PG_SCAN:
+  case MSG_OSD_PG_BACKFILL:
+    return OP_CLASS_RECOVERY;
+  default:
+    return OP_CLASS_CLIENT;
+  }
+}
+
+unsigned PGQueueable::ClassVis::operator()(const PGSnapTrim &op) const {
+  return OP_CLASS_SNAPTRIM;
+}
+
+unsigned PGQueueable::ClassVis::operator()(const PGScrub &op) const {
+  return OP_CLASS_SCRUB;
+}
+
 //Initial features in new superblock.
 //Features here are also automatically upgraded
 CompatSet OSD::get_osd_initial_compat_set() {
@@ -255,9 +276,10 @@ OSDService::OSDService(OSD *osd) :
 		  cct->_conf->osd_min_recovery_priority),
   pg_temp_lock("OSDService::pg_temp_lock"),
   map_cache_lock("OSDService::map_lock"),
-  map_cache(cct, cct->_conf->osd_map_cache_size),
+  map_cache(cct, 0),
   map_bl_cache(cct->_conf->osd_map_cache_size),
   map_bl_inc_cache(cct->_conf->osd_map_cache_size),
+  map_cache_bytes(0),
   in_progress_split_lock("OSDService::in_progress_split_lock"),
   stat_lock("OSD::stat_lock"),
   full_status_lock("OSDService::full_status_lock"),
@@ -1300,11 +1322,11 @@ void OSDService::clear_map_bl_cache_pins(epoch_t e)
   map_bl_cache.clear_pinned(e);
 }
 
-OSDMapRef OSDService::_add_map(OSDMap *o)
+OSDMapRef OSDService::_add_map(OSDMap *o, bool dedup)
 {
   epoch_t e = o->get_epoch();
 
-  if (cct->_conf->osd_map_dedup) {
+  if (dedup && cct->_conf->osd_map_dedup) {
     // Dedup against an existing map at a nearby epoch
     OSDMapRef for_dedup = map_cache.lower_bound(e);
     if (for_dedup) {
@@ -1316,9 +1338,157 @@ OSDMapRef OSDService::_add_map(OSDMap *o)
   if (existed) {
     delete o;
   }
+
+  int interval = cct->_conf->osd_map_cache_checkpoint_interval;
+  if (e > 0 && (interval <= 1 || e % interval == 0) &&
+      !map_checkpoints.count(e)) {
+    uint64_t bytes = l->get_approx_size();
+    dout(20) << __func__ << " checkpoint " << e << " ~" << bytes << " bytes"
+	     << dendl;
+    map_checkpoints[e] = make_pair(l, bytes);
+    map_cache_bytes += bytes;
+    _trim_map_cache();
+  }
   return l;
 }
 
+void OSDService::_add_map_inc(epoch_t e, OSDMapIncRef inc, uint64_t bytes)
+{
+  if (map_incs.count(e))
+    return;
+  map_incs[e] = make_pair(inc, bytes);
+  map_cache_bytes += bytes;
+  _trim_map_cache();
+}
+
+OSDService::OSDMapIncRef OSDService::_get_map_inc(epoch_t e, uint64_t *bytes)
+{
+  map<epoch_t, pair<OSDMapIncRef, uint64_t> >::iterator p = map_incs.find(e);
+  if (p != map_incs.end()) {
+    *bytes = 0;
+    return p->second.first;
+  }
+
+  bufferlist bl;
+  bool found = map_bl_inc_cache.lookup(e, &bl);
+  if (!found) {
+    found = store->read(coll_t::meta(),
+			OSD::get_inc_osdmap_pobject_name(e), 0, 0, bl) >= 0;
+    if (!found)
+      return OSDMapIncRef();
+    _add_map_inc_bl(e, bl);
+  }
+  OSDMap::Incremental *inc = new OSDMap::Incremental;
+  bufferlist::iterator i = bl.begin();
+  inc->decode(i);
+  *bytes = bl.length();
+  return OSDMapIncRef(inc);
+}
+
+void OSDService::_trim_map_cache()
+{
+  // map_cache's oldest epoch bounds how far the meta collection is
+  // trimmed, so don't hold anything further back than
+  // osd_map_cache_size epochs even if it would fit
+  epoch_t newest = 0;
+  if (!map_checkpoints.empty())
+    newest = map_checkpoints.rbegin()->first;
+  if (!map_incs.empty())
+    newest = MAX(newest, map_incs.rbegin()->first);
+  epoch_t horizon = 0;
+  if (newest > (epoch_t)cct->_conf->osd_map_cache_size)
+    horizon = newest - cct->_conf->osd_map_cache_size;
+
+  // the oldest maps are the least likely to be wanted again
+  uint64_t max = cct->_conf->osd_map_cache_max_bytes;
+  while ((!map_checkpoints.empty() &&
+	  map_checkpoints.begin()->first < horizon) ||
+	 (!map_incs.empty() && map_incs.begin()->first < horizon) ||
+	 (map_cache_bytes > max &&
+	  (!map_checkpoints.empty() || !map_incs.empty()))) {
+    if (map_incs.empty() ||
+	(!map_checkpoints.empty() &&
+	 map_checkpoints.begin()->first <= map_incs.begin()->first)) {
+      map_cache_bytes -= map_checkpoints.begin()->second.second;
+      map_checkpoints.erase(map_checkpoints.begin());
+    } else {
+      map_cache_bytes -= map_incs.begin()->second.second;
+      map_incs.erase(map_incs.begin());
+    }
+  }
+  if (logger)
+    logger->set(l_osd_map_cache_bytes, map_cache_bytes);
+}
+
+OSDMapRef OSDService::_build_map(epoch_t epoch)
+{
+  // walk back to something we have, at most to the last checkpoint
+  int interval = MAX(cct->_conf->osd_map_cache_checkpoint_interval, 1);
+  epoch_t stop = epoch > (epoch_t)interval ? epoch - interval : 1;
+  OSDMapRef base;
+  for (epoch_t e = epoch - 1; e >= stop && e > 0; --e) {
+    base = map_cache.lookup(e);
+    if (base)
+      break;
+    map<epoch_t, pair<OSDMapRef, uint64_t> >::iterator p =
+      map_checkpoints.find(e);
+    if (p != map_checkpoints.end()) {
+      base = p->second.first;
+      break;
+    }
+  }
+  if (!base)
+    return OSDMapRef();
+
+  // make sure we have every incremental before committing to this.
+  // bytes is 0 for those already in map_incs, which handle_osd_map or
+  // an earlier rebuild checked against full_crc.
+  vector<pair<OSDMapIncRef, uint64_t> > incs;
+  for (epoch_t e = base->get_epoch() + 1; e <= epoch; ++e) {
+    uint64_t bytes;
+    OSDMapIncRef inc = _get_map_inc(e, &bytes);
+    if (!inc)
+      return OSDMapRef();
+    incs.push_back(make_pair(inc, bytes));
+  }
+
+  dout(20) << "get_map " << epoch << " - building from "
+	   << base->get_epoch() << dendl;
+  for (vector<pair<OSDMapIncRef, uint64_t> >::iterator i = incs.begin();
+       i != incs.end();
+       ++i) {
+    const OSDMap::Incremental& inc = *i->first;
+    OSDMap *m = new OSDMap;
+    m->copy_for_incremental(*base, inc);
+    if (m->apply_incremental(inc) < 0) {
+      derr << "get_map " << epoch << " - incremental " << inc.epoch
+	   << " does not apply to " << base->get_epoch() << dendl;
+      delete m;
+      return OSDMapRef();
+    }
+    if (i->second) {
+      // read back from disk: only trust it if the result matches the
+      // full map the monitor built.  otherwise use the stored full map.
+      bufferlist fbl;
+      m->encode(fbl, inc.encode_features | CEPH_FEATURE_RESERVED);
+      if (inc.have_crc && m->get_crc() != inc.full_crc) {
+	derr << "get_map " << epoch << " - incremental " << inc.epoch
+	     << " does not give the expected crc, using the full map"
+	     << dendl;
+	delete m;
+	return OSDMapRef();
+      }
+      _add_map_bl(inc.epoch, fbl);
+      _add_map_inc(inc.epoch, i->first, i->second);
+    }
+    // already shares everything unchanged with base
+    base = _add_map(m, false);
+    if (logger)
+      logger->inc(l_osd_map_cache_rebuild);
+  }
+  return base;
+}
+
 OSDMapRef OSDService::try_get_map(epoch_t epoch)
 {
   Mutex::Locker l(map_cache_lock);
@@ -1327,6 +1497,11 @@ OSDMapRef OSDService::try_get_map(epoch_t epoch)
     dout(30) << "get_map " << epoch << " -cached" << dendl;
     return retval;
   }
+  if (epoch > 0) {
+    retval = _build_map(epoch);
+    if (retval)
+      return retval;
+  }
 
   OSDMap *map = new OSDMap;
   if (epoch > 0) {
@@ -1874,6 +2049,57 @@ bool OSD::asok_command(string command, cmdmap_t& cmdmap, string format,
     f->close_section();
   } else if (command == "get_latest_osdmap") {
     get_latest_osdmap();
+  } else if (command == "presplit_pool") {
+    string poolstr;
+    int64_t expected_num_objects = 0;
+    cmd_getval(cct, cmdmap, "pool", poolstr);
+    cmd_getval(cct, cmdmap, "expected_num_objects", expected_num_objects);
+    OSDMapRef curmap = service.get_osdmap();
+    int64_t pool = curmap->lookup_pg_pool_name(poolstr);
+    if (pool < 0 && isdigit(poolstr[0]))
+      pool = atoll(poolstr.c_str());
+    const pg_pool_t *pi = pool < 0 ? NULL : curmap->get_pg_pool(pool);
+    if (!pi) {
+      ss << "unrecognized pool '" << poolstr << "'";
+    } else if (expected_num_objects <= 0) {
+      ss << "expected_num_objects must be positive";
+    } else {
+      // The same hint PG::_init gives a new PG.  The store pre-hashes
+      // collections that are still empty and splits the others in the
+      // background.
+      uint32_t pg_num = pi->get_pg_num();
+      uint64_t expected_num_objects_pg = expected_num_objects / pg_num;
+      unsigned hinted = 0;
+      {
+	RWLock::RLocker l(pg_map_lock);
+	for (ceph::unordered_map<spg_t,PG*>::iterator it = pg_map.begin();
+	     it != pg_map.end();
+	     ++it) {
+	  if (it->first.pool() != pool)
+	    continue;
+	  PG *pg = it->second;
+	  pg->lock();
+	  if (!pg->deleting) {
+	    bufferlist hint;
+	    ::encode(pg_num, hint);
+	    ::encode(expected_num_objects_pg, hint);
+	    ObjectStore::Transaction t;
+	    t.collection_hint(
+	      pg->coll,
+	      ObjectStore::Transaction::COLL_HINT_EXPECTED_NUM_OBJECTS,
+	      hint);
+	    store->queue_transaction(pg->osr.get(), std::move(t), NULL);
+	    ++hinted;
+	  }
+	  pg->unlock();
+	}
+      }
+      f->open_object_section("presplit");
+      f->dump_int("pool", pool);
+      f->dump_unsigned("expected_num_objects_per_pg", expected_num_objects_pg);
+      f->dump_unsigned("num_pgs", hinted);
+      f->close_section();
+    }
   } else if (command == "set_heap_property") {
     string property;
     int64_t value = 0;
@@ -2270,6 +2496,16 @@ void OSD::final_init()
 				     "the mon");
   assert(r == 0);
 
+  r = admin_socket->register_command("presplit_pool",
+				     "presplit_pool " \
+				     "name=pool,type=CephString " \
+				     "name=expected_num_objects,type=CephInt,range=1",
+				     asok_hook,
+				     "split the directories of this osd's pgs in "
+				     "<pool> ahead of <expected_num_objects> "
+				     "objects (filestore)");
+  assert(r == 0);
+
   r = admin_socket->register_command("set_heap_property",
 				     "set_heap_property " \
 				     "name=property,type=CephString " \
@@ -2495,6 +2731,14 @@ void OSD::create_logger()
   osd_plb.add_time_avg(l_osd_tier_promote_lat, "osd_tier_promote_lat", "Object promote latency");
   osd_plb.add_time_avg(l_osd_tier_r_lat, "osd_tier_r_lat", "Object proxy read latency");
 
+  osd_plb.add_u64(l_osd_op_wq_depth, "op_wq_depth", "Ops queued across all op queue shards");
+  osd_plb.add_u64_counter(l_osd_op_wq_steal, "op_wq_steal", "Ops run by a thread of another op queue shard");
+  osd_plb.add_u64_counter(l_osd_op_wq_steal_miss, "op_wq_steal_miss", "Steal attempts that found only busy pgs");
+
+  osd_plb.add_u64(l_osd_map_cache_bytes, "map_cache_bytes", "OSD map checkpoints and incrementals held by the map cache");
+  osd_plb.add_u64_counter(l_osd_map_cache_rebuild, "map_cache_rebuild", "OSD maps rebuilt from incrementals");
+  osd_plb.add_u64(l_osd_map_disk_epochs, "map_disk_epochs", "OSD map epochs stored on disk");
+
   logger = osd_plb.create_perf_counters();
   cct->get_perfcounters_collection()->add(logger);
 }
@@ -2597,6 +2841,7 @@ int OSD::shutdown()
   cct->get_admin_socket()->unregister_command("dump_watchers");
   cct->get_admin_socket()->unregister_command("dump_reservations");
   cct->get_admin_socket()->unregister_command("get_latest_osdmap");
+  cct->get_admin_socket()->unregister_command("presplit_pool");
   cct->get_admin_socket()->unregister_command("set_heap_property");
   cct->get_admin_socket()->unregister_command("get_heap_property");
   delete asok_hook;
@@ -4067,6 +4312,8 @@ void OSD::heartbeat()
     dout(30) << "heartbeat: daily_loadavg " << daily_loadavg << dendl;
   }
 
+  logger->set(l_osd_op_wq_depth, op_shardedwq.get_depth());
+
   dout(30) << "heartbeat checking stats" << dendl;
 
   // refresh stats?
@@ -6621,27 +6868,33 @@ void OSD::handle_osd_map(MOSDMap *m)
     if (p != m->incremental_maps.end()) {
       dout(10) << "handle_osd_map  got inc map for epoch " << e << dendl;
       bufferlist& bl = p->second;
-      ghobject_t oid = get_inc_osdmap_pobject_name(e);
-      t.write(coll_t::meta(), oid, 0, bl.length(), bl);
-      pin_map_inc_bl(e, bl);
+
+      OSDMap::Incremental *inc = new OSDMap::Incremental;
+      OSDService::OSDMapIncRef incref(inc);
+      bufferlist::iterator p = bl.begin();
+      inc->decode(p);
 
       OSDMap *o = new OSDMap;
       if (e > 1) {
-	bufferlist obl;
-	get_map_bl(e - 1, obl);
-	o->decode(obl);
+	// start from the previous map, sharing whatever this epoch
+	// leaves alone
+	OSDMapRef prev = service.try_get_map(e - 1);
+	if (prev) {
+	  o->copy_for_incremental(*prev, *inc);
+	} else {
+	  bufferlist obl;
+	  get_map_bl(e - 1, obl);
+	  o->decode(obl);
+	}
       }
 
-      OSDMap::Incremental inc;
-      bufferlist::iterator p = bl.begin();
-      inc.decode(p);
-      if (o->apply_incremental(inc) < 0) {
-	derr << "ERROR: bad fsid?  i have " << osdmap->get_fsid() << " and inc has " << inc.fsid << dendl;
+      if (o->apply_incremental(*inc) < 0) {
+	derr << "ERROR: bad fsid?  i have " << osdmap->get_fsid() << " and inc has " << inc->fsid << dendl;
 	assert(0 == "bad fsid");
       }
 
       bufferlist fbl;
-      o->encode(fbl, inc.encode_features | CEPH_FEATURE_RESERVED);
+      o->encode(fbl, inc->encode_features | CEPH_FEATURE_RESERVED);
 
       bool injected_failure = false;
       if (g_conf->osd_inject_bad_map_crc_probability > 0 &&
@@ -6650,7 +6903,7 @@ void OSD::handle_osd_map(MOSDMap *m)
 	injected_failure = true;
       }
 
-      if ((inc.have_crc && o->get_crc() != inc.full_crc) || injected_failure) {
+      if ((inc->have_crc && o->get_crc() != inc->full_crc) || injected_failure) {
 	dout(2) << "got incremental " << e
 		<< " but failed to encode full with correct crc; requesting"
 		<< dendl;
@@ -6659,15 +6912,25 @@ void OSD::handle_osd_map(MOSDMap *m)
 	fbl.hexdump(*_dout);
 	*_dout << dendl;
 	delete o;
+	// the incremental is not stored; when the full map arrives it is
+	// the only copy of this epoch, so rebuilds can't disagree with it
+	ghobject_t oid = get_inc_osdmap_pobject_name(e);
+	t.remove(coll_t::meta(), oid);
 	request_full_map(e, last);
 	last = e - 1;
 	break;
       }
       got_full_map(e);
 
+      // store the incremental only once it is known to give the right map
+      ghobject_t oid = get_inc_osdmap_pobject_name(e);
+      t.write(coll_t::meta(), oid, 0, bl.length(), bl);
+      pin_map_inc_bl(e, bl);
+
       ghobject_t fulloid = get_osdmap_pobject_name(e);
       t.write(coll_t::meta(), fulloid, 0, fbl.length(), fbl);
       pin_map_bl(e, fbl);
+      service.add_map_inc(e, incref, bl.length());
       pinned_maps.push_back(add_map(o));
       continue;
     }
@@ -6712,6 +6975,8 @@ void OSD::handle_osd_map(MOSDMap *m)
     superblock.oldest_map = first;
   superblock.newest_map = last;
   superblock.current_epoch = last;
+  logger->set(l_osd_map_disk_epochs,
+	      superblock.newest_map - superblock.oldest_map + 1);
 
   // note in the superblock that we were clean thru the prior epoch
   epoch_t boot_epoch = service.get_boot_epoch();
@@ -8582,6 +8847,11 @@ void OSD::enqueue_op(PG *pg, OpRequestRef& op)
   pg->queue_op(op);
 }
 
+void OSD::ShardedOpWQ::_thread_start(uint32_t thread_index)
+{
+  osd->store->bind_op_thread(thread_index);
+}
+
 void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb ) {
 
   uint32_t shard_index = thread_index % num_shards;
@@ -8591,6 +8861,8 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb )
   sdata->sdata_op_ordering_lock.Lock();
   if (sdata->pqueue->empty()) {
     sdata->sdata_op_ordering_lock.Unlock();
+    if (_steal(shard_index, hb))
+      return;
     osd->cct->get_heartbeat_map()->reset_timeout(hb, 4, 0);
     sdata->sdata_lock.Lock();
     sdata->sdata_cond.WaitInterval(osd->cct, sdata->sdata_lock, utime_t(2, 0));
@@ -8602,25 +8874,31 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb )
     }
   }
   pair<PGRef, PGQueueable> item = sdata->pqueue->dequeue();
+  sdata->depth.dec();
   sdata->pg_for_processing[&*(item.first)].push_back(item.second);
   sdata->sdata_op_ordering_lock.Unlock();
   ThreadPool::TPHandle tp_handle(osd->cct, hb, timeout_interval,
     suicide_interval);
 
   (item.first)->lock_suspend_timeout(tp_handle);
+  _process_pg(sdata, item.first, tp_handle);
+}
 
+void OSD::ShardedOpWQ::_process_pg(ShardData *sdata, PGRef pg,
+				   ThreadPool::TPHandle &tp_handle)
+{
   boost::optional<PGQueueable> op;
   {
     Mutex::Locker l(sdata->sdata_op_ordering_lock);
-    if (!sdata->pg_for_processing.count(&*(item.first))) {
-      (item.first)->unlock();
+    if (!sdata->pg_for_processing.count(&*pg)) {
+      pg->unlock();
       return;
     }
-    assert(sdata->pg_for_processing[&*(item.first)].size());
-    op = sdata->pg_for_processing[&*(item.first)].front();
-    sdata->pg_for_processing[&*(item.first)].pop_front();
-    if (!(sdata->pg_for_processing[&*(item.first)].size()))
-      sdata->pg_for_processing.erase(&*(item.first));
+    assert(sdata->pg_for_processing[&*pg].size());
+    op = sdata->pg_for_processing[&*pg].front();
+    sdata->pg_for_processing[&*pg].pop_front();
+    if (!(sdata->pg_for_processing[&*pg].size()))
+      sdata->pg_for_processing.erase(&*pg);
   }
 
   // osd:opwq_process marks the point at which an operation has been dequeued
@@ -8645,7 +8923,7 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb )
   delete f;
   *_dout << dendl;
 
-  op->run(osd, item.first, tp_handle);
+  op->run(osd, pg, tp_handle);
 
   {
 #ifdef WITH_LTTNG
@@ -8658,7 +8936,87 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb )
         reqid.name._num, reqid.tid, reqid.inc);
   }
 
-  (item.first)->unlock();
+  pg->unlock();
+}
+
+bool OSD::ShardedOpWQ::_steal(uint32_t shard_index, heartbeat_handle_d *hb)
+{
+  int min_depth = osd->cct->_conf->osd_op_queue_steal_min_depth;
+  int max_scan = osd->cct->_conf->osd_op_queue_steal_max_scan;
+  if (min_depth <= 0 || max_scan <= 0)
+    return false;
+
+  for (uint32_t i = 1; i < num_shards; i++) {
+    ShardData* victim = shard_list[(shard_index + i) % num_shards];
+    assert(NULL != victim);
+    if (victim->depth.read() < (unsigned)min_depth)
+      continue;
+    // never wait on a busy shard; its own threads are making progress
+    if (!victim->sdata_op_ordering_lock.TryLock())
+      continue;
+
+    // ops whose pg is locked are passed over, and so is everything
+    // after them for the same pg; ordering them back in reverse puts
+    // each one back where it was in its class
+    list<pair<PGRef, PGQueueable> > passed;
+    boost::optional<pair<PGRef, PGQueueable> > item =
+      opqueue_dequeue_unlocked(
+	*victim->pqueue, max_scan,
+	[](const pair<PGRef, PGQueueable>& i) { return &*i.first; },
+	[](const pair<PGRef, PGQueueable>& i) { return i.first->try_lock(); },
+	&passed);
+    for (list<pair<PGRef, PGQueueable> >::iterator p = passed.begin();
+	 p != passed.end();
+	 ++p) {
+      _requeue_front(victim, *p);
+    }
+    if (!item) {
+      victim->sdata_op_ordering_lock.Unlock();
+      osd->logger->inc(l_osd_op_wq_steal_miss);
+      continue;
+    }
+    victim->depth.dec();
+    victim->stolen.inc();
+    victim->pg_for_processing[&*(item->first)].push_back(item->second);
+    victim->sdata_op_ordering_lock.Unlock();
+    osd->logger->inc(l_osd_op_wq_steal);
+
+    ThreadPool::TPHandle tp_handle(osd->cct, hb, timeout_interval,
+      suicide_interval);
+    _process_pg(victim, item->first, tp_handle);
+    return true;
+  }
+  return false;
+}
+
+void OSD::ShardedOpWQ::_wake_thief(uint32_t shard_index)
+{
+  int min_depth = osd->cct->_conf->osd_op_queue_steal_min_depth;
+  if (min_depth <= 0 || num_shards < 2 ||
+      shard_list[shard_index]->depth.read() < (unsigned)min_depth)
+    return;
+  ShardData* sdata = shard_list[(shard_index + 1) % num_shards];
+  if (sdata->depth.read())
+    return;
+  sdata->sdata_lock.Lock();
+  sdata->sdata_cond.SignalOne();
+  sdata->sdata_lock.Unlock();
+}
+
+void OSD::ShardedOpWQ::_requeue_front(ShardData *sdata,
+				      pair<PGRef, PGQueueable>& item)
+{
+  assert(sdata->sdata_op_ordering_lock.is_locked());
+  unsigned priority = item.second.get_priority();
+  unsigned cost = item.second.get_cost();
+  if (priority >= osd->op_prio_cutoff)
+    sdata->pqueue->enqueue_strict_front(
+      item.second.get_owner(),
+      priority, item);
+  else
+    sdata->pqueue->enqueue_front(
+      item.second.get_owner(),
+      priority, cost, item);
 }
 
 void OSD::ShardedOpWQ::_enqueue(pair<PGRef, PGQueueable> item) {
@@ -8678,12 +9036,14 @@ void OSD::ShardedOpWQ::_enqueue(pair<PGRef, PGQueueable> item) {
     sdata->pqueue->enqueue(
       item.second.get_owner(),
       priority, cost, item);
+  sdata->depth.inc();
   sdata->sdata_op_ordering_lock.Unlock();
 
   sdata->sdata_lock.Lock();
   sdata->sdata_cond.SignalOne();
   sdata->sdata_lock.Unlock();
 
+  _wake_thief(shard_index);
 }
 
 void OSD::ShardedOpWQ::_enqueue_front(pair<PGRef, PGQueueable> item) {
@@ -8698,16 +9058,8 @@ void OSD::ShardedOpWQ::_enqueue_front(pair<PGRef, PGQueueable> item) {
     item.second = sdata->pg_for_processing[&*(item.first)].back();
     sdata->pg_for_processing[&*(item.first)].pop_back();
   }
-  unsigned priority = item.second.get_priority();
-  unsigned cost = item.second.get_cost();
-  if (priority >= osd->op_prio_cutoff)
-    sdata->pqueue->enqueue_strict_front(
-      item.second.get_owner(),
-      priority, item);
-  else
-    sdata->pqueue->enqueue_front(
-      item.second.get_owner(),
-      priority, cost, item);
+  _requeue_front(sdata, item);
+  sdata->depth.inc();
 
   sdata->sdata_op_ordering_lock.Unlock();
   sdata->sdata_lock.Lock();
@@ -8865,6 +9217,7 @@ const char** OSD::get_tracked_conf_keys() const
     "osd_op_history_size", "osd_op_history_duration",
     "osd_enable_op_tracker",
     "osd_map_cache_size",
+    "osd_map_cache_max_bytes",
     "osd_map_max_advance",
     "osd_pg_epoch_persisted_max_stale",
     "osd_disk_thread_ioprio_class",
@@ -8914,10 +9267,12 @@ void OSD::handle_conf_change(const struct md_config_t *conf,
     set_disk_tp_priority();
   }
   if (changed.count("osd_map_cache_size")) {
-    service.map_cache.set_size(cct->_conf->osd_map_cache_size);
     service.map_bl_cache.set_size(cct->_conf->osd_map_cache_size);
     service.map_bl_inc_cache.set_size(cct->_conf->osd_map_cache_size);
   }
+  if (changed.count("osd_map_cache_max_bytes")) {
+    service.set_map_cache_max_bytes();
+  }
   if (changed.count("clog_to_monitors") ||
       changed.count("clog_to_syslog") ||
       changed.count("clog_to_syslog_level") ||
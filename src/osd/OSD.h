@@ -55,6 +55,7 @@ using namespace std;
 #include "common/sharedptr_registry.hpp"
 #include "common/WeightedPriorityQueue.h"
 #include "common/PrioritizedQueue.h"
+#include "common/mClockQueue.h"
 #include "common/OpQueue.h"
 #include "messages/MOSDOp.h"
 #include "include/Spinlock.h"
@@ -161,6 +162,14 @@ enum {
   l_osd_tier_promote_lat,
   l_osd_tier_r_lat,
 
+  l_osd_op_wq_depth,
+  l_osd_op_wq_steal,
+  l_osd_op_wq_steal_miss,
+
+  l_osd_map_cache_bytes,
+  l_osd_map_cache_rebuild,
+  l_osd_map_disk_epochs,
+
   l_osd_last,
 };
 
@@ -365,7 +374,21 @@ class PGQueueable {
     void operator()(PGSnapTrim &op);
     void operator()(PGScrub &op);
   };
+  struct ClassVis : public boost::static_visitor<unsigned> {
+    unsigned operator()(const OpRequestRef &op) const;
+    unsigned operator()(const PGSnapTrim &op) const;
+    unsigned operator()(const PGScrub &op) const;
+  };
 public:
+  /// scheduling classes for the mclock op queue
+  enum op_class_t {
+    OP_CLASS_CLIENT = 0,
+    OP_CLASS_RECOVERY,
+    OP_CLASS_SCRUB,
+    OP_CLASS_SNAPTRIM,
+    OP_CLASS_MAX,
+  };
+
   // cppcheck-suppress noExplicitConstructor
   PGQueueable(OpRequestRef op)
     : qvariant(op), cost(op->get_req()->get_cost()),
@@ -391,6 +414,9 @@ public:
     RunVis v(osd, pg, handle);
     boost::apply_visitor(v, qvariant);
   }
+  unsigned get_op_class() const {
+    return boost::apply_visitor(ClassVis(), qvariant);
+  }
   unsigned get_priority() const { return priority; }
   int get_cost() const { return cost; }
   utime_t get_start_time() const { return start_time; }
@@ -874,10 +900,38 @@ public:
   }
 
   // osd map cache (past osd maps)
+  //
+  // map_cache indexes every map still referenced anywhere, but only
+  // holds on to full maps at checkpoint epochs (multiples of
+  // osd_map_cache_checkpoint_interval) and the decoded incrementals
+  // after them, together bounded by osd_map_cache_max_bytes and by
+  // the last osd_map_cache_size epochs.  Other epochs are rebuilt on
+  // demand from the nearest map below them.  Since map_cache's oldest
+  // epoch bounds on-disk map trimming, nothing older is held.
   Mutex map_cache_lock;
   SharedLRU<epoch_t, const OSDMap> map_cache;
   SimpleLRU<epoch_t, bufferlist> map_bl_cache;
   SimpleLRU<epoch_t, bufferlist> map_bl_inc_cache;
+  typedef ceph::shared_ptr<const OSDMap::Incremental> OSDMapIncRef;
+  map<epoch_t, pair<OSDMapRef, uint64_t> > map_checkpoints;
+  map<epoch_t, pair<OSDMapIncRef, uint64_t> > map_incs;
+  uint64_t map_cache_bytes;
+
+  /// rebuild a map from a cached one and incrementals, if we can
+  OSDMapRef _build_map(epoch_t e);
+  /// *bytes is 0 if e was already in map_incs, else its encoded size
+  OSDMapIncRef _get_map_inc(epoch_t e, uint64_t *bytes);
+  void _add_map_inc(epoch_t e, OSDMapIncRef inc, uint64_t bytes);
+  void _trim_map_cache();
+
+  void add_map_inc(epoch_t e, OSDMapIncRef inc, uint64_t bytes) {
+    Mutex::Locker l(map_cache_lock);
+    _add_map_inc(e, inc, bytes);
+  }
+  void set_map_cache_max_bytes() {
+    Mutex::Locker l(map_cache_lock);
+    _trim_map_cache();
+  }
 
   OSDMapRef try_get_map(epoch_t e);
   OSDMapRef get_map(epoch_t e) {
@@ -889,7 +943,7 @@ public:
     Mutex::Locker l(map_cache_lock);
     return _add_map(o);
   }
-  OSDMapRef _add_map(OSDMap *o);
+  OSDMapRef _add_map(OSDMap *o, bool dedup = true);
 
   void add_map_bl(epoch_t e, bufferlist& bl) {
     Mutex::Locker l(map_cache_lock);
@@ -1642,7 +1696,8 @@ private:
   // -- op queue --
   enum io_queue {
     prioritized,
-    weightedpriority};
+    weightedpriority,
+    mclock};
   const io_queue op_queue;
   const unsigned int op_prio_cutoff;
 
@@ -1655,6 +1710,8 @@ private:
       Mutex sdata_op_ordering_lock;
       map<PG*, list<PGQueueable> > pg_for_processing;
       std::unique_ptr<OpQueue< pair<PGRef, PGQueueable>, entity_inst_t>> pqueue;
+      atomic_t depth;   ///< items in pqueue; read without the ordering lock
+      atomic_t stolen;  ///< items run by threads of other shards
       ShardData(
 	string lock_name, string ordering_lock,
 	uint64_t max_tok_per_prio, uint64_t min_cost, CephContext *cct,
@@ -1671,8 +1728,38 @@ private:
 		<PrioritizedQueue< pair<PGRef, PGQueueable>, entity_inst_t>>(
 		  new PrioritizedQueue< pair<PGRef, PGQueueable>, entity_inst_t>(
 		    max_tok_per_prio, min_cost));
+	    } else if (opqueue == mclock) {
+	      pqueue = std::unique_ptr
+		<mClockQueue< pair<PGRef, PGQueueable>, entity_inst_t>>(
+		  new mClockQueue< pair<PGRef, PGQueueable>, entity_inst_t>(
+		    [](const pair<PGRef, PGQueueable>& i) {
+		      return i.second.get_op_class();
+		    },
+		    get_mclock_classes(cct)));
 	    }
 	  }
+
+      static vector<mClockClassInfo> get_mclock_classes(CephContext *cct) {
+	const md_config_t *conf = cct->_conf;
+	vector<mClockClassInfo> info(PGQueueable::OP_CLASS_MAX);
+	info[PGQueueable::OP_CLASS_CLIENT] = mClockClassInfo(
+	  conf->osd_op_queue_mclock_client_op_res,
+	  conf->osd_op_queue_mclock_client_op_wgt,
+	  conf->osd_op_queue_mclock_client_op_lim);
+	info[PGQueueable::OP_CLASS_RECOVERY] = mClockClassInfo(
+	  conf->osd_op_queue_mclock_recov_res,
+	  conf->osd_op_queue_mclock_recov_wgt,
+	  conf->osd_op_queue_mclock_recov_lim);
+	info[PGQueueable::OP_CLASS_SCRUB] = mClockClassInfo(
+	  conf->osd_op_queue_mclock_scrub_res,
+	  conf->osd_op_queue_mclock_scrub_wgt,
+	  conf->osd_op_queue_mclock_scrub_lim);
+	info[PGQueueable::OP_CLASS_SNAPTRIM] = mClockClassInfo(
+	  conf->osd_op_queue_mclock_snap_res,
+	  conf->osd_op_queue_mclock_snap_wgt,
+	  conf->osd_op_queue_mclock_snap_lim);
+	return info;
+      }
     };
     
     vector<ShardData*> shard_list;
@@ -1706,8 +1793,44 @@ private:
     }
 
     void _process(uint32_t thread_index, heartbeat_handle_d *hb);
+    void _thread_start(uint32_t thread_index);
     void _enqueue(pair <PGRef, PGQueueable> item);
     void _enqueue_front(pair <PGRef, PGQueueable> item);
+
+  private:
+    /// requeue at the front of its class; sdata_op_ordering_lock held
+    void _requeue_front(ShardData *sdata, pair<PGRef, PGQueueable>& item);
+
+    /// run the next op queued for pg in sdata, then unlock pg
+    void _process_pg(ShardData *sdata, PGRef pg,
+		     ThreadPool::TPHandle &tp_handle);
+
+    /**
+     * run an op from another shard's backlog
+     *
+     * Only shards with at least osd_op_queue_steal_min_depth queued ops
+     * are considered, and only ops whose pg can be locked without
+     * waiting are taken.  Once an op is passed over, later ops for its
+     * pg are passed over too, so they can't overtake it.  Anything
+     * passed over goes back to the front of its queue.  The op is
+     * handed over through the owning shard's pg_for_processing exactly
+     * as for the shard's own threads, so per-pg ordering is unchanged.
+     *
+     * @returns true if an op was run
+     */
+    bool _steal(uint32_t shard_index, heartbeat_handle_d *hb);
+
+    /// wake an idle neighbour of a shard that is falling behind
+    void _wake_thief(uint32_t shard_index);
+
+  public:
+    /// ops queued across all shards
+    unsigned get_depth() {
+      unsigned depth = 0;
+      for (uint32_t i = 0; i < num_shards; i++)
+	depth += shard_list[i]->depth.read();
+      return depth;
+    }
       
     void return_waiting_threads() {
       for(uint32_t i = 0; i < num_shards; i++) {
@@ -1727,6 +1850,8 @@ private:
 	assert (NULL != sdata);
 	sdata->sdata_op_ordering_lock.Lock();
 	f->open_object_section(lock_name);
+	f->dump_unsigned("depth", sdata->depth.read());
+	f->dump_unsigned("stolen", sdata->stolen.read());
 	sdata->pqueue->dump(f);
 	f->close_section();
 	sdata->sdata_op_ordering_lock.Unlock();
@@ -1749,6 +1874,7 @@ private:
       assert(sdata != NULL);
       sdata->sdata_op_ordering_lock.Lock();
       sdata->pqueue->remove_by_filter(Pred(pg), 0);
+      sdata->depth.set(sdata->pqueue->length());
       sdata->pg_for_processing.erase(pg);
       sdata->sdata_op_ordering_lock.Unlock();
     }
@@ -1763,6 +1889,7 @@ private:
       list<pair<PGRef, PGQueueable> > _dequeued;
       sdata->sdata_op_ordering_lock.Lock();
       sdata->pqueue->remove_by_filter(Pred(pg), &_dequeued);
+      sdata->depth.sub(_dequeued.size());
       for (list<pair<PGRef, PGQueueable> >::iterator i = _dequeued.begin();
 	   i != _dequeued.end(); ++i) {
 	boost::optional<OpRequestRef> mop = i->second.maybe_get_op();
@@ -2356,9 +2483,18 @@ protected:
   io_queue get_io_queue() const {
     if (cct->_conf->osd_op_queue == "debug_random") {
       srand(time(NULL));
-      return (rand() % 2 < 1) ? prioritized : weightedpriority;
+      switch (rand() % 3) {
+      case 0:
+	return prioritized;
+      case 1:
+	return weightedpriority;
+      default:
+	return mclock;
+      }
     } else if (cct->_conf->osd_op_queue == "wpq") {
       return weightedpriority;
+    } else if (cct->_conf->osd_op_queue == "mclock") {
+      return mclock;
     } else {
       return prioritized;
     }
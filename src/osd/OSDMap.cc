@@ -16,6 +16,7 @@
  */
 
 #include "OSDMap.h"
+#include "OSDMapMapping.h"
 
 #include "common/config.h"
 #include "common/Formatter.h"
@@ -415,7 +416,10 @@ void OSDMap::Incremental::encode(bufferlist& bl, uint64_t features) const
   ENCODE_START(8, 7, bl);
 
   {
-    ENCODE_START(3, 1, bl); // client-usable data
+    uint8_t v = 3;
+    if (features & CEPH_FEATURE_OSDMAP_PG_UPMAP)
+      v = 4;
+    ENCODE_START(v, 1, bl); // client-usable data
     ::encode(fsid, bl);
     ::encode(epoch, bl);
     ::encode(modified, bl);
@@ -436,6 +440,10 @@ void OSDMap::Incremental::encode(bufferlist& bl, uint64_t features) const
     ::encode(new_primary_affinity, bl);
     ::encode(new_erasure_code_profiles, bl);
     ::encode(old_erasure_code_profiles, bl);
+    if (v >= 4) {
+      ::encode(new_pg_upmap_items, bl);
+      ::encode(old_pg_upmap_items, bl);
+    }
     ENCODE_FINISH(bl); // client-usable data
   }
 
@@ -597,7 +605,7 @@ void OSDMap::Incremental::decode(bufferlist::iterator& bl)
     return;
   }
   {
-    DECODE_START(3, bl); // client-usable data
+    DECODE_START(4, bl); // client-usable data
     ::decode(fsid, bl);
     ::decode(epoch, bl);
     ::decode(modified, bl);
@@ -626,6 +634,13 @@ void OSDMap::Incremental::decode(bufferlist::iterator& bl)
       new_erasure_code_profiles.clear();
       old_erasure_code_profiles.clear();
     }
+    if (struct_v >= 4) {
+      ::decode(new_pg_upmap_items, bl);
+      ::decode(old_pg_upmap_items, bl);
+    } else {
+      new_pg_upmap_items.clear();
+      old_pg_upmap_items.clear();
+    }
     DECODE_FINISH(bl); // client-usable data
   }
 
@@ -789,6 +804,34 @@ void OSDMap::Incremental::dump(Formatter *f) const
   }
   f->close_section(); // primary_temp
 
+  f->open_array_section("new_pg_upmap_items");
+  for (map<pg_t,vector<pair<int32_t,int32_t> > >::const_iterator p =
+	 new_pg_upmap_items.begin();
+       p != new_pg_upmap_items.end();
+       ++p) {
+    f->open_object_section("pg");
+    f->dump_stream("pgid") << p->first;
+    f->open_array_section("mappings");
+    for (vector<pair<int32_t,int32_t> >::const_iterator q = p->second.begin();
+	 q != p->second.end();
+	 ++q) {
+      f->open_object_section("mapping");
+      f->dump_int("from", q->first);
+      f->dump_int("to", q->second);
+      f->close_section();
+    }
+    f->close_section();
+    f->close_section();
+  }
+  f->close_section();
+
+  f->open_array_section("old_pg_upmap_items");
+  for (set<pg_t>::const_iterator p = old_pg_upmap_items.begin();
+       p != old_pg_upmap_items.end();
+       ++p)
+    f->dump_stream("pgid") << *p;
+  f->close_section();
+
   f->open_array_section("new_up_thru");
   for (map<int32_t,uint32_t>::const_iterator p = new_up_thru.begin(); p != new_up_thru.end(); ++p) {
     f->open_object_section("osd");
@@ -875,6 +918,7 @@ void OSDMap::Incremental::generate_test_instances(list<Incremental*>& o)
 void OSDMap::set_epoch(epoch_t e)
 {
   epoch = e;
+  mapping.reset();
   for (map<int64_t,pg_pool_t>::iterator p = pools.begin();
        p != pools.end();
        ++p)
@@ -911,8 +955,15 @@ void OSDMap::get_blacklist(list<pair<entity_addr_t,utime_t> > *bl) const
   }
 }
 
+void OSDMap::set_mapping(ceph::shared_ptr<const OSDMapMapping> m)
+{
+  assert(!m || m->get_epoch() == epoch);
+  mapping = m;
+}
+
 void OSDMap::set_max_osd(int m)
 {
+  mapping.reset();
   int o = max_osd;
   max_osd = m;
   osd_state.resize(m);
@@ -1088,6 +1139,10 @@ uint64_t OSDMap::get_features(int entity_type, uint64_t *pmask) const
   }
   mask |= CEPH_FEATURE_OSD_PRIMARY_AFFINITY;
 
+  if (!pg_upmap_items.empty())
+    features |= CEPH_FEATURE_OSDMAP_PG_UPMAP;
+  mask |= CEPH_FEATURE_OSDMAP_PG_UPMAP;
+
   if (pmask)
     *pmask = mask;
   return features;
@@ -1115,6 +1170,64 @@ uint64_t OSDMap::get_up_osd_features() const
   return cached_up_osd_features;
 }
 
+void OSDMap::copy_for_incremental(const OSDMap& o, const Incremental& inc)
+{
+  if (inc.fullmap.length()) {
+    // decode() fills in everything in place; start from scratch
+    *this = OSDMap();
+    epoch = o.epoch;
+    fsid = o.fsid;
+    return;
+  }
+
+  *this = o;
+  mapping.reset();
+
+  // osd state changes can destroy an osd, which resets its addrs,
+  // uuid and primary affinity; resizing touches all of them
+  bool resize = inc.new_max_osd >= 0;
+  bool state = resize || !inc.new_state.empty();
+  if (!inc.new_pg_temp.empty())
+    pg_temp.reset(new map<pg_t,vector<int32_t> >(*o.pg_temp));
+  if (!inc.new_primary_temp.empty())
+    primary_temp.reset(new map<pg_t,int32_t>(*o.primary_temp));
+  if (state || !inc.new_uuid.empty())
+    osd_uuid.reset(new vector<uuid_d>(*o.osd_uuid));
+  if (o.osd_primary_affinity &&
+      (state || !inc.new_primary_affinity.empty()))
+    osd_primary_affinity.reset(new vector<__u32>(*o.osd_primary_affinity));
+  if (state || !inc.new_up_client.empty() || !inc.new_up_cluster.empty())
+    osd_addrs.reset(new addrs_s(*o.osd_addrs));
+}
+
+uint64_t OSDMap::get_approx_size() const
+{
+  uint64_t size = sizeof(*this);
+  size += max_osd * (sizeof(int32_t) + sizeof(uint32_t) +
+		     sizeof(osd_info_t) + sizeof(osd_xinfo_t) +
+		     sizeof(uuid_d));
+  // four addrs per osd, plus the pointers to them
+  size += max_osd * 4 * (sizeof(entity_addr_t) +
+			 sizeof(ceph::shared_ptr<entity_addr_t>));
+  if (osd_primary_affinity)
+    size += max_osd * sizeof(__u32);
+  // map nodes cost roughly 4 pointers on top of their payload
+  size += pg_temp->size() *
+    (sizeof(pg_t) + sizeof(vector<int32_t>) + 3 * sizeof(int32_t) +
+     4 * sizeof(void*));
+  size += primary_temp->size() *
+    (sizeof(pg_t) + sizeof(int32_t) + 4 * sizeof(void*));
+  size += pg_upmap_items.size() *
+    (sizeof(pg_t) + sizeof(vector<pair<int32_t,int32_t> >) +
+     sizeof(pair<int32_t,int32_t>) + 4 * sizeof(void*));
+  size += pools.size() * (sizeof(int64_t) + sizeof(pg_pool_t) +
+			  4 * sizeof(void*));
+  size += blacklist.size() * (sizeof(entity_addr_t) + sizeof(utime_t) +
+			      4 * sizeof(void*));
+  size += crush->get_max_devices() * 64;
+  return size;
+}
+
 void OSDMap::dedup(const OSDMap *o, OSDMap *n)
 {
   if (o->epoch == n->epoch)
@@ -1122,6 +1235,14 @@ void OSDMap::dedup(const OSDMap *o, OSDMap *n)
 
   int diff = 0;
 
+  // already shared, e.g. by copy_for_incremental()
+  if (o->osd_addrs == n->osd_addrs &&
+      o->crush == n->crush &&
+      o->pg_temp == n->pg_temp &&
+      o->primary_temp == n->primary_temp &&
+      o->osd_uuid == n->osd_uuid)
+    return;
+
   // do addrs match?
   if (o->max_osd != n->max_osd)
     diff++;
@@ -1153,11 +1274,13 @@ void OSDMap::dedup(const OSDMap *o, OSDMap *n)
   }
 
   // does crush match?
-  bufferlist oc, nc;
-  ::encode(*o->crush, oc);
-  ::encode(*n->crush, nc);
-  if (oc.contents_equal(nc)) {
-    n->crush = o->crush;
+  if (o->crush != n->crush) {
+    bufferlist oc, nc;
+    ::encode(*o->crush, oc);
+    ::encode(*n->crush, nc);
+    if (oc.contents_equal(nc)) {
+      n->crush = o->crush;
+    }
   }
 
   // does pg_temp match?
@@ -1265,6 +1388,7 @@ int OSDMap::apply_incremental(const Incremental &inc)
     return -EINVAL;
   
   assert(inc.epoch == epoch+1);
+  mapping.reset();
 
   epoch++;
   modified = inc.modified;
@@ -1306,6 +1430,10 @@ int OSDMap::apply_incremental(const Incremental &inc)
     pools.erase(*p);
     name_pool.erase(pool_name[*p]);
     pool_name.erase(*p);
+    map<pg_t,vector<pair<int32_t,int32_t> > >::iterator q =
+      pg_upmap_items.lower_bound(pg_t(0, *p));
+    while (q != pg_upmap_items.end() && q->first.pool() == (uint64_t)*p)
+      pg_upmap_items.erase(q++);
   }
 
   for (map<int32_t,uint32_t>::const_iterator i = inc.new_weight.begin();
@@ -1429,6 +1557,16 @@ int OSDMap::apply_incremental(const Incremental &inc)
       (*primary_temp)[p->first] = p->second;
   }
 
+  for (map<pg_t,vector<pair<int32_t,int32_t> > >::const_iterator p =
+	 inc.new_pg_upmap_items.begin();
+       p != inc.new_pg_upmap_items.end();
+       ++p)
+    pg_upmap_items[p->first] = p->second;
+  for (set<pg_t>::const_iterator p = inc.old_pg_upmap_items.begin();
+       p != inc.old_pg_upmap_items.end();
+       ++p)
+    pg_upmap_items.erase(*p);
+
   // blacklist
   for (map<entity_addr_t,utime_t>::const_iterator p = inc.new_blacklist.begin();
        p != inc.new_blacklist.end();
@@ -1522,6 +1660,32 @@ void OSDMap::_remove_nonexistent_osds(const pg_pool_t& pool,
   }
 }
 
+void OSDMap::_apply_upmap(const pg_pool_t& pool, pg_t raw_pg,
+			  vector<int> *raw) const
+{
+  if (pg_upmap_items.empty())
+    return;
+  map<pg_t,vector<pair<int32_t,int32_t> > >::const_iterator p =
+    pg_upmap_items.find(pool.raw_pg_to_pg(raw_pg));
+  if (p == pg_upmap_items.end())
+    return;
+  for (vector<pair<int32_t,int32_t> >::const_iterator q = p->second.begin();
+       q != p->second.end();
+       ++q) {
+    // ignore targets that are gone, out, or already in the set
+    int to = q->second;
+    if (to == CRUSH_ITEM_NONE || !exists(to) || is_out(to) ||
+	std::find(raw->begin(), raw->end(), to) != raw->end())
+      continue;
+    for (vector<int>::iterator r = raw->begin(); r != raw->end(); ++r) {
+      if (*r == q->first) {
+	*r = to;
+	break;
+      }
+    }
+  }
+}
+
 int OSDMap::_pg_to_osds(const pg_pool_t& pool, pg_t pg,
                         vector<int> *osds, int *primary,
 			ps_t *ppps) const
@@ -1536,6 +1700,7 @@ int OSDMap::_pg_to_osds(const pg_pool_t& pool, pg_t pg,
     crush->do_rule(ruleno, pps, *osds, size, osd_weight);
 
   _remove_nonexistent_osds(pool, *osds);
+  _apply_upmap(pool, pg, osds);
 
   *primary = -1;
   for (unsigned i = 0; i < osds->size(); ++i) {
@@ -1694,8 +1859,12 @@ void OSDMap::pg_to_raw_up(pg_t pg, vector<int> *up, int *primary) const
 }
   
 void OSDMap::_pg_to_up_acting_osds(const pg_t& pg, vector<int> *up, int *up_primary,
-                                   vector<int> *acting, int *acting_primary) const
+                                   vector<int> *acting, int *acting_primary,
+				   bool use_mapping) const
 {
+  if (use_mapping && mapping &&
+      mapping->get(pg, up, up_primary, acting, acting_primary))
+    return;
   const pg_pool_t *pool = get_pg_pool(pg.pool());
   if (!pool) {
     if (up)
@@ -1900,7 +2069,10 @@ void OSDMap::encode(bufferlist& bl, uint64_t features) const
   ENCODE_START(8, 7, bl);
 
   {
-    ENCODE_START(3, 1, bl); // client-usable data
+    uint8_t v = 3;
+    if (features & CEPH_FEATURE_OSDMAP_PG_UPMAP)
+      v = 4;
+    ENCODE_START(v, 1, bl); // client-usable data
     // base
     ::encode(fsid, bl);
     ::encode(epoch, bl);
@@ -1932,6 +2104,9 @@ void OSDMap::encode(bufferlist& bl, uint64_t features) const
     crush->encode(cbl);
     ::encode(cbl, bl);
     ::encode(erasure_code_profiles, bl);
+    if (v >= 4) {
+      ::encode(pg_upmap_items, bl);
+    }
     ENCODE_FINISH(bl); // client-usable data
   }
 
@@ -2098,6 +2273,7 @@ void OSDMap::decode_classic(bufferlist::iterator& p)
 
 void OSDMap::decode(bufferlist::iterator& bl)
 {
+  mapping.reset();
   /**
    * Older encodings of the OSDMap had a single struct_v which
    * covered the whole encoding, and was prior to our modern
@@ -2120,7 +2296,7 @@ void OSDMap::decode(bufferlist::iterator& bl)
    * Since we made it past that hurdle, we can use our normal paths.
    */
   {
-    DECODE_START(3, bl); // client-usable data
+    DECODE_START(4, bl); // client-usable data
     // base
     ::decode(fsid, bl);
     ::decode(epoch, bl);
@@ -2159,6 +2335,11 @@ void OSDMap::decode(bufferlist::iterator& bl)
     } else {
       erasure_code_profiles.clear();
     }
+    if (struct_v >= 4) {
+      ::decode(pg_upmap_items, bl);
+    } else {
+      pg_upmap_items.clear();
+    }
     DECODE_FINISH(bl); // client-usable data
   }
 
@@ -2324,6 +2505,27 @@ void OSDMap::dump(Formatter *f) const
   }
   f->close_section(); // primary_temp
 
+  f->open_array_section("pg_upmap_items");
+  for (map<pg_t,vector<pair<int32_t,int32_t> > >::const_iterator p =
+	 pg_upmap_items.begin();
+       p != pg_upmap_items.end();
+       ++p) {
+    f->open_object_section("pg_upmap_item");
+    f->dump_stream("pgid") << p->first;
+    f->open_array_section("mappings");
+    for (vector<pair<int32_t,int32_t> >::const_iterator q = p->second.begin();
+	 q != p->second.end();
+	 ++q) {
+      f->open_object_section("mapping");
+      f->dump_int("from", q->first);
+      f->dump_int("to", q->second);
+      f->close_section();
+    }
+    f->close_section();
+    f->close_section();
+  }
+  f->close_section(); // pg_upmap_items
+
   f->open_object_section("blacklist");
   for (ceph::unordered_map<entity_addr_t,utime_t>::const_iterator p = blacklist.begin();
        p != blacklist.end();
@@ -2470,6 +2672,12 @@ void OSDMap::print(ostream& out) const
       ++p)
     out << "primary_temp " << p->first << " " << p->second << "\n";
 
+  for (map<pg_t,vector<pair<int32_t,int32_t> > >::const_iterator p =
+	 pg_upmap_items.begin();
+       p != pg_upmap_items.end();
+       ++p)
+    out << "pg_upmap_items " << p->first << " " << p->second << "\n";
+
   for (ceph::unordered_map<entity_addr_t,utime_t>::const_iterator p = blacklist.begin();
        p != blacklist.end();
        ++p)
@@ -2627,6 +2835,187 @@ bool OSDMap::crush_ruleset_in_use(int ruleset) const
   return false;
 }
 
+/// the widest bucket type a rule spreads replicas across
+static int get_rule_failure_domain(const CrushWrapper& crush, int ruleno)
+{
+  int type = 0;
+  for (int i = 0; i < crush.get_rule_len(ruleno); ++i) {
+    switch (crush.get_rule_op(ruleno, i)) {
+    case CRUSH_RULE_CHOOSE_FIRSTN:
+    case CRUSH_RULE_CHOOSE_INDEP:
+    case CRUSH_RULE_CHOOSELEAF_FIRSTN:
+    case CRUSH_RULE_CHOOSELEAF_INDEP:
+      type = MAX(type, crush.get_rule_arg2(ruleno, i));
+      break;
+    }
+  }
+  return type;
+}
+
+/// the ancestor of an osd of the given bucket type (the osd for type 0)
+static int get_ancestor_of_type(CrushWrapper& crush, int item, int type)
+{
+  while (type > 0) {
+    int parent;
+    if (crush.get_immediate_parent_id(item, &parent) < 0)
+      return CRUSH_ITEM_NONE;
+    item = parent;
+    if (crush.get_bucket_type(item) >= type)
+      break;
+  }
+  return item;
+}
+
+int OSDMap::calc_pg_upmaps(
+  CephContext *cct,
+  float max_deviation,
+  int max,
+  const set<int64_t>& only_pools,
+  Incremental *pending_inc) const
+{
+  OSDMap tmp;
+  tmp.deepish_copy_from(*this);
+  int num_changed = 0;
+  while (num_changed < max) {
+    // pgs on each osd, and each osd's share by crush weight * reweight
+    map<int,set<pg_t> > pgs_by_osd;
+    map<int,float> osd_weight;
+    map<int64_t,int> failure_domain;
+    float weight_total = 0;
+    unsigned pg_total = 0;
+    for (map<int64_t,pg_pool_t>::const_iterator p = tmp.pools.begin();
+	 p != tmp.pools.end();
+	 ++p) {
+      if (!only_pools.empty() && !only_pools.count(p->first))
+	continue;
+      int ruleno = tmp.crush->find_rule(p->second.get_crush_ruleset(),
+					p->second.get_type(),
+					p->second.get_size());
+      if (ruleno < 0)
+	continue;
+      failure_domain[p->first] = get_rule_failure_domain(*tmp.crush, ruleno);
+      for (unsigned ps = 0; ps < p->second.get_pg_num(); ++ps) {
+	pg_t pg(ps, p->first);
+	vector<int> raw;
+	int primary;
+	tmp.pg_to_osds(pg, &raw, &primary);
+	for (vector<int>::iterator q = raw.begin(); q != raw.end(); ++q) {
+	  if (*q != CRUSH_ITEM_NONE)
+	    pgs_by_osd[*q].insert(pg);
+	}
+      }
+      pg_total += p->second.get_size() * p->second.get_pg_num();
+      map<int,float> pmap;
+      tmp.crush->get_rule_weight_osd_map(ruleno, &pmap);
+      for (map<int,float>::iterator q = pmap.begin(); q != pmap.end(); ++q) {
+	float w = q->second * tmp.get_weightf(q->first);
+	osd_weight[q->first] += w;
+	weight_total += w;
+      }
+    }
+    if (weight_total == 0)
+      break;
+
+    // relative deviation from the target, most underfull first
+    float pgs_per_weight = pg_total / weight_total;
+    multimap<float,int> by_deviation;
+    for (map<int,float>::iterator p = osd_weight.begin();
+	 p != osd_weight.end();
+	 ++p) {
+      if (p->second <= 0)
+	continue;
+      float target = p->second * pgs_per_weight;
+      float deviation = (float)pgs_by_osd[p->first].size() - target;
+      by_deviation.insert(make_pair(deviation / target, p->first));
+    }
+    ldout(cct, 20) << __func__ << " " << pg_total << " pgs over "
+		   << by_deviation.size() << " osds, most overfull "
+		   << (by_deviation.empty() ? 0 : by_deviation.rbegin()->first)
+		   << dendl;
+
+    // move one pg off the most overfull osd that has a legal move
+    bool moved = false;
+    for (multimap<float,int>::reverse_iterator over = by_deviation.rbegin();
+	 over != by_deviation.rend() && over->first > max_deviation && !moved;
+	 ++over) {
+      int from = over->second;
+      for (set<pg_t>::iterator pp = pgs_by_osd[from].begin();
+	   pp != pgs_by_osd[from].end() && !moved;
+	   ++pp) {
+	pg_t pg = *pp;
+	int type = failure_domain[pg.pool()];
+	vector<int> raw;
+	int primary;
+	tmp.pg_to_osds(pg, &raw, &primary);
+	int from_domain = get_ancestor_of_type(*tmp.crush, from, type);
+	for (multimap<float,int>::iterator under = by_deviation.begin();
+	     under != by_deviation.end() && under->first < 0;
+	     ++under) {
+	  int to = under->second;
+	  if (std::find(raw.begin(), raw.end(), to) != raw.end() ||
+	      tmp.is_out(to))
+	    continue;
+	  // keep the pg spread across failure domains
+	  int to_domain = get_ancestor_of_type(*tmp.crush, to, type);
+	  bool conflict = false;
+	  if (to_domain != from_domain) {
+	    for (vector<int>::iterator q = raw.begin(); q != raw.end(); ++q) {
+	      if (*q != CRUSH_ITEM_NONE && *q != from &&
+		  get_ancestor_of_type(*tmp.crush, *q, type) == to_domain) {
+		conflict = true;
+		break;
+	      }
+	    }
+	  }
+	  if (conflict)
+	    continue;
+
+	  // fold into an existing exception that already targets 'from'
+	  vector<pair<int32_t,int32_t> > items;
+	  map<pg_t,vector<pair<int32_t,int32_t> > >::iterator e =
+	    tmp.pg_upmap_items.find(pg);
+	  if (e != tmp.pg_upmap_items.end())
+	    items = e->second;
+	  bool folded = false;
+	  for (vector<pair<int32_t,int32_t> >::iterator q = items.begin();
+	       q != items.end();
+	       ++q) {
+	    if (q->second == from) {
+	      if (q->first == to)
+		items.erase(q);
+	      else
+		q->second = to;
+	      folded = true;
+	      break;
+	    }
+	  }
+	  if (!folded)
+	    items.push_back(make_pair(from, to));
+
+	  ldout(cct, 10) << __func__ << " " << pg << " osd." << from
+			 << " -> osd." << to << " items " << items << dendl;
+	  if (items.empty()) {
+	    tmp.pg_upmap_items.erase(pg);
+	    pending_inc->new_pg_upmap_items.erase(pg);
+	    if (pg_upmap_items.count(pg))
+	      pending_inc->old_pg_upmap_items.insert(pg);
+	  } else {
+	    tmp.pg_upmap_items[pg] = items;
+	    pending_inc->new_pg_upmap_items[pg] = items;
+	    pending_inc->old_pg_upmap_items.erase(pg);
+	  }
+	  ++num_changed;
+	  moved = true;
+	  break;
+	}
+      }
+    }
+    if (!moved)
+      break;
+  }
+  return num_changed;
+}
+
 int OSDMap::build_simple(CephContext *cct, epoch_t e, uuid_d &fsid,
 			  int nosd, int pg_bits, int pgp_bits)
 {
@@ -2634,6 +3023,7 @@ int OSDMap::build_simple(CephContext *cct, epoch_t e, uuid_d &fsid,
 		 << " osds with " << pg_bits << " pg bits per osd, "
 		 << dendl;
   epoch = e;
+  mapping.reset();
   set_fsid(fsid);
   created = modified = ceph_clock_now(cct);
 
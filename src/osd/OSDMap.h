@@ -110,6 +110,8 @@ ostream& operator<<(ostream& out, const osd_xinfo_t& xi);
 
 /** OSDMap
  */
+class OSDMapMapping;
+
 class OSDMap {
 
 public:
@@ -142,6 +144,8 @@ public:
     map<pg_t,vector<int32_t> > new_pg_temp;     // [] to remove
     map<pg_t, int32_t> new_primary_temp;            // [-1] to remove
     map<int32_t,uint32_t> new_primary_affinity;
+    map<pg_t,vector<pair<int32_t,int32_t> > > new_pg_upmap_items;
+    set<pg_t> old_pg_upmap_items;
     map<int32_t,epoch_t> new_up_thru;
     map<int32_t,pair<epoch_t,epoch_t> > new_last_clean_interval;
     map<int32_t,epoch_t> new_lost;
@@ -234,6 +238,9 @@ private:
   ceph::shared_ptr< map<pg_t,int32_t > > primary_temp;  // temp primary mapping (e.g. while we rebuild)
   ceph::shared_ptr< vector<__u32> > osd_primary_affinity; ///< 16.16 fixed point, 0x10000 = baseline
 
+  /// per-pg (from, to) osd substitutions applied to the crush output
+  map<pg_t,vector<pair<int32_t,int32_t> > > pg_upmap_items;
+
   map<int64_t,pg_pool_t> pools;
   map<int64_t,string> pool_name;
   map<string,map<string,string> > erasure_code_profiles;
@@ -253,6 +260,9 @@ private:
   mutable bool crc_defined;
   mutable uint32_t crc;
 
+  /// precomputed pg mappings for this epoch, if any; see set_mapping()
+  ceph::shared_ptr<const OSDMapMapping> mapping;
+
   void _calc_up_osd_features();
 
  public:
@@ -263,6 +273,7 @@ private:
 
   friend class OSDMonitor;
   friend class PGMonitor;
+  friend class OSDMapMapping;
 
  public:
   OSDMap() : epoch(0), 
@@ -304,8 +315,24 @@ public:
 
     // NOTE: we do not copy crush.  note that apply_incremental will
     // allocate a new CrushWrapper, though.
+
+    // the copy is about to be modified
+    mapping.reset();
   }
 
+  /**
+   * copy o in preparation for apply_incremental(inc)
+   *
+   * Unlike deepish_copy_from(), only the substructures inc will modify
+   * are cloned; pg_temp, primary_temp, osd_addrs, osd_uuid and
+   * osd_primary_affinity are otherwise shared with o, as is crush
+   * (which apply_incremental replaces rather than modifies).
+   */
+  void copy_for_incremental(const OSDMap& o, const Incremental& inc);
+
+  /// rough heap footprint, counting shared substructures in full
+  uint64_t get_approx_size() const;
+
   // map info
   const uuid_d& get_fsid() const { return fsid; }
   void set_fsid(uuid_d& f) { fsid = f; }
@@ -315,6 +342,17 @@ public:
 
   void set_epoch(epoch_t e);
 
+  /**
+   * attach a mapping table built from this map.  pg lookups are served
+   * from it until the map is next modified through one of its
+   * setters or an incremental.  crush is edited in place by a few
+   * tools; do that before attaching a table.
+   */
+  void set_mapping(ceph::shared_ptr<const OSDMapMapping> m);
+  ceph::shared_ptr<const OSDMapMapping> get_mapping() const {
+    return mapping;
+  }
+
   /* stamps etc */
   const utime_t& get_created() const { return created; }
   const utime_t& get_modified() const { return modified; }
@@ -350,6 +388,9 @@ public:
   unsigned get_num_pg_temp() const {
     return pg_temp->size();
   }
+  const map<pg_t,vector<pair<int32_t,int32_t> > >& get_pg_upmap_items() const {
+    return pg_upmap_items;
+  }
 
   int get_flags() const { return flags; }
   bool test_flag(int f) const { return flags & f; }
@@ -371,12 +412,14 @@ public:
   void set_state(int o, unsigned s) {
     assert(o < max_osd);
     osd_state[o] = s;
+    mapping.reset();
   }
   void set_weight(int o, unsigned w) {
     assert(o < max_osd);
     osd_weight[o] = w;
     if (w)
       osd_state[o] |= CEPH_OSD_EXISTS;
+    mapping.reset();
   }
   unsigned get_weight(int o) const {
     assert(o < max_osd);
@@ -393,6 +436,7 @@ public:
       osd_primary_affinity.reset(new vector<__u32>(max_osd,
 						   CEPH_OSD_DEFAULT_PRIMARY_AFFINITY));
     (*osd_primary_affinity)[o] = w;
+    mapping.reset();
   }
   unsigned get_primary_affinity(int o) const {
     assert(o < max_osd);
@@ -633,6 +677,9 @@ private:
 		  ps_t *ppps) const;
   void _remove_nonexistent_osds(const pg_pool_t& pool, vector<int>& osds) const;
 
+  /// substitute osds in the crush output per pg_upmap_items
+  void _apply_upmap(const pg_pool_t& pool, pg_t pg, vector<int> *raw) const;
+
   void _apply_primary_affinity(ps_t seed, const pg_pool_t& pool,
 			       vector<int> *osds, int *primary) const;
 
@@ -651,9 +698,12 @@ private:
 
   /**
    *  map to up and acting. Fills in whatever fields are non-NULL.
+   *  Answers from the attached mapping table, if any, unless
+   *  use_mapping is false.
    */
   void _pg_to_up_acting_osds(const pg_t& pg, vector<int> *up, int *up_primary,
-                             vector<int> *acting, int *acting_primary) const;
+                             vector<int> *acting, int *acting_primary,
+			     bool use_mapping = true) const;
 
 public:
   /***
@@ -853,9 +903,27 @@ public:
 
   bool crush_ruleset_in_use(int ruleset) const;
 
+  /**
+   * compute pg_upmap_items that even out the pgs per osd
+   *
+   * Repeatedly moves a pg off the most overfull osd onto the most
+   * underfull one it can legally use, until every osd is within
+   * max_deviation (a fraction of its weighted target) or max moves
+   * have been made.  Existing exceptions are reused or undone where
+   * possible so the result stays small.
+   *
+   * @param only_pools pools to balance; empty means all
+   * @param pending_inc [out] new/old_pg_upmap_items are filled in
+   * @returns number of pg moves made
+   */
+  int calc_pg_upmaps(CephContext *cct, float max_deviation, int max,
+		     const set<int64_t>& only_pools,
+		     Incremental *pending_inc) const;
+
   void clear_temp() {
     pg_temp->clear();
     primary_temp->clear();
+    mapping.reset();
   }
 
 private:
@@ -0,0 +1,100 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "OSDMapMapping.h"
+#include "OSDMap.h"
+
+// ----------------------
+// OSDMapMapping
+
+void OSDMapMapping::init(const OSDMap& osdmap)
+{
+  pools.clear();
+  epoch = osdmap.get_epoch();
+  num_pgs = 0;
+
+  // pg_temp may hold more osds than the pool size
+  std::map<int64_t,unsigned> width;
+  for (auto& p : osdmap.get_pools()) {
+    width[p.first] = p.second.get_size();
+  }
+  for (auto& p : *osdmap.pg_temp) {
+    std::map<int64_t,unsigned>::iterator q = width.find(p.first.pool());
+    if (q != width.end() && p.second.size() > q->second)
+      q->second = p.second.size();
+  }
+
+  for (auto& p : osdmap.get_pools()) {
+    unsigned pg_num = p.second.get_pg_num();
+    pools.insert(std::make_pair(p.first, PoolMapping(width[p.first], pg_num)));
+    num_pgs += pg_num;
+  }
+}
+
+void OSDMapMapping::update(const OSDMap& osdmap, int64_t pool,
+			   unsigned begin, unsigned end)
+{
+  std::map<int64_t,PoolMapping>::iterator p = pools.find(pool);
+  assert(p != pools.end());
+  assert(end <= p->second.pg_num);
+  std::vector<int> up, acting;
+  int up_primary, acting_primary;
+  for (unsigned ps = begin; ps < end; ++ps) {
+    osdmap._pg_to_up_acting_osds(pg_t(ps, pool), &up, &up_primary,
+				 &acting, &acting_primary, false);
+    p->second.set(ps, up, up_primary, acting, acting_primary);
+  }
+}
+
+void OSDMapMapping::update(const OSDMap& osdmap)
+{
+  init(osdmap);
+  for (auto& p : pools) {
+    update(osdmap, p.first, 0, p.second.pg_num);
+  }
+}
+
+// ----------------------
+// ParallelPGMapper
+
+void ParallelPGMapper::WQ::_process(Item *i, ThreadPool::TPHandle &h)
+{
+  i->job->mapping->update(*i->job->osdmap, i->pool, i->begin, i->end);
+  Job *job = i->job;
+  delete i;
+  Mutex::Locker l(job->lock);
+  assert(job->pending > 0);
+  if (--job->pending == 0)
+    job->cond.Signal();
+}
+
+void ParallelPGMapper::map(const OSDMap& osdmap, OSDMapMapping *mapping,
+			   unsigned pgs_per_chunk)
+{
+  assert(pgs_per_chunk > 0);
+  mapping->init(osdmap);
+
+  Job job(&osdmap, mapping);
+  std::vector<Item*> items;
+  for (auto& p : osdmap.get_pools()) {
+    unsigned pg_num = p.second.get_pg_num();
+    for (unsigned ps = 0; ps < pg_num; ps += pgs_per_chunk) {
+      items.push_back(new Item(&job, p.first, ps,
+			       MIN(pg_num, ps + pgs_per_chunk)));
+    }
+  }
+  if (items.empty())
+    return;
+
+  job.lock.Lock();
+  job.pending = items.size();
+  job.lock.Unlock();
+  for (auto i : items) {
+    wq.queue(i);
+  }
+
+  job.lock.Lock();
+  while (job.pending > 0)
+    job.cond.Wait(job.lock);
+  job.lock.Unlock();
+}
@@ -0,0 +1,180 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_OSDMAPMAPPING_H
+#define CEPH_OSDMAPMAPPING_H
+
+#include <map>
+#include <vector>
+
+#include "osd/osd_types.h"
+#include "common/Cond.h"
+#include "common/Mutex.h"
+#include "common/WorkQueue.h"
+
+class OSDMap;
+
+/**
+ * OSDMapMapping -- the up and acting sets of every pg in an OSDMap
+ *
+ * Running CRUSH and applying pg_temp/primary_temp for a pg is far more
+ * expensive than looking the answer up, and every consumer of a map
+ * wants the answer for many pgs.  This table is built once per epoch
+ * (see ParallelPGMapper) and then serves lookups by array index.
+ *
+ * Once built the table is read-only, so a single instance can be shared
+ * by any number of readers; OSDMap::set_mapping() attaches one to the
+ * map it was built from.
+ */
+class OSDMapMapping {
+  struct PoolMapping {
+    unsigned size;     ///< max osds in an up or acting set
+    unsigned pg_num;
+
+    /// per pg: acting_primary, up_primary, num_acting, num_up,
+    ///         acting[size], up[size]
+    std::vector<int32_t> table;
+
+    PoolMapping(unsigned s, unsigned p)
+      : size(s), pg_num(p), table(p * row_size()) {}
+
+    size_t row_size() const {
+      return 4 + 2 * size;
+    }
+
+    void get(size_t ps,
+	     std::vector<int> *up, int *up_primary,
+	     std::vector<int> *acting, int *acting_primary) const {
+      const int32_t *row = &table[ps * row_size()];
+      if (acting_primary)
+	*acting_primary = row[0];
+      if (up_primary)
+	*up_primary = row[1];
+      if (acting)
+	acting->assign(row + 4, row + 4 + row[2]);
+      if (up)
+	up->assign(row + 4 + size, row + 4 + size + row[3]);
+    }
+
+    void set(size_t ps,
+	     const std::vector<int>& up, int up_primary,
+	     const std::vector<int>& acting, int acting_primary) {
+      assert(up.size() <= size && acting.size() <= size);
+      int32_t *row = &table[ps * row_size()];
+      row[0] = acting_primary;
+      row[1] = up_primary;
+      row[2] = acting.size();
+      row[3] = up.size();
+      std::copy(acting.begin(), acting.end(), row + 4);
+      std::copy(up.begin(), up.end(), row + 4 + size);
+    }
+  };
+
+  std::map<int64_t,PoolMapping> pools;
+  epoch_t epoch;
+  uint64_t num_pgs;
+
+public:
+  OSDMapMapping() : epoch(0), num_pgs(0) {}
+
+  epoch_t get_epoch() const {
+    return epoch;
+  }
+  uint64_t get_num_pgs() const {
+    return num_pgs;
+  }
+
+  /// size the tables for @p osdmap; must precede update()
+  void init(const OSDMap& osdmap);
+
+  /// fill in pgs [begin, end) of @p pool.  disjoint ranges may be
+  /// updated concurrently.
+  void update(const OSDMap& osdmap, int64_t pool, unsigned begin,
+	      unsigned end);
+
+  /// build the whole table in the calling thread
+  void update(const OSDMap& osdmap);
+
+  /**
+   * look up a pg
+   *
+   * @returns false if the pg is not covered by the table (the pool is
+   * unknown, or the pg is past pg_num), in which case the caller must
+   * compute the mapping itself.
+   */
+  bool get(const pg_t& pgid,
+	   std::vector<int> *up, int *up_primary,
+	   std::vector<int> *acting, int *acting_primary) const {
+    std::map<int64_t,PoolMapping>::const_iterator p = pools.find(pgid.pool());
+    if (p == pools.end() || pgid.ps() >= p->second.pg_num)
+      return false;
+    p->second.get(pgid.ps(), up, up_primary, acting, acting_primary);
+    return true;
+  }
+};
+
+/**
+ * ParallelPGMapper -- build an OSDMapMapping across a thread pool
+ *
+ * Each pool is cut into chunks of pgs_per_chunk pgs which are mapped
+ * by the pool's threads; map() blocks until the table is complete.
+ */
+class ParallelPGMapper {
+  struct Job {
+    const OSDMap *osdmap;
+    OSDMapMapping *mapping;
+    Mutex lock;
+    Cond cond;
+    unsigned pending;
+
+    Job(const OSDMap *m, OSDMapMapping *mm)
+      : osdmap(m), mapping(mm), lock("ParallelPGMapper::Job::lock"),
+	pending(0) {}
+  };
+
+  struct Item {
+    Job *job;
+    int64_t pool;
+    unsigned begin, end;
+    Item(Job *j, int64_t p, unsigned b, unsigned e)
+      : job(j), pool(p), begin(b), end(e) {}
+  };
+
+  struct WQ : public ThreadPool::WorkQueue<Item> {
+    std::deque<Item*> q;
+
+    WQ(ThreadPool *tp)
+      : ThreadPool::WorkQueue<Item>("ParallelPGMapper::WQ", 0, 0, tp) {}
+
+    bool _empty() override {
+      return q.empty();
+    }
+    bool _enqueue(Item *i) override {
+      q.push_back(i);
+      return true;
+    }
+    void _dequeue(Item *i) override {
+      assert(0);
+    }
+    Item *_dequeue() override {
+      if (q.empty())
+	return NULL;
+      Item *i = q.front();
+      q.pop_front();
+      return i;
+    }
+    void _process(Item *i, ThreadPool::TPHandle &h) override;
+    void _clear() override {
+      assert(q.empty());
+    }
+  } wq;
+
+public:
+  explicit ParallelPGMapper(ThreadPool *tp) : wq(tp) {}
+
+  /// build @p mapping for @p osdmap, returning once it is complete
+  void map(const OSDMap& osdmap, OSDMapMapping *mapping,
+	   unsigned pgs_per_chunk);
+};
+
+#endif
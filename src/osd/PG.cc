@@ -1558,6 +1558,9 @@ void PG::activate(ObjectStore::Transaction& t,
   assert(scrubber.callbacks.empty());
   assert(callbacks_for_degraded_object.empty());
 
+  // a new pg's collection exists in the store by now
+  update_store_with_options();
+
   // -- crash recovery?
   if (acting.size() >= pool.info.min_size &&
       is_primary() &&
@@ -3158,6 +3161,17 @@ void PG::read_state(ObjectStore *store, bufferlist &bl)
 
   // log any weirdness
   log_weirdness();
+
+  update_store_with_options();
+}
+
+void PG::update_store_with_options()
+{
+  int r = osd->store->set_collection_opts(coll, pool.info.opts);
+  if (r < 0 && r != -EOPNOTSUPP) {
+    dout(1) << __func__ << " set_collection_opts returned "
+	    << cpp_strerror(r) << dendl;
+  }
 }
 
 void PG::log_weirdness()
@@ -5562,8 +5576,10 @@ void PG::handle_advance_map(
     osdmap, lastmap, newup, up_primary,
     newacting, acting_primary);
   recovery_state.handle_event(evt, rctx);
-  if (pool.info.last_change == osdmap_ref->get_epoch())
+  if (pool.info.last_change == osdmap_ref->get_epoch()) {
     on_pool_change();
+    update_store_with_options();
+  }
 }
 
 void PG::handle_activate_map(RecoveryCtx *rctx)
@@ -260,6 +260,13 @@ public:
 
   void lock_suspend_timeout(ThreadPool::TPHandle &handle);
   void lock(bool no_lockdep = false) const;
+  bool try_lock() const {
+    if (!_lock.TryLock())
+      return false;
+    assert(!dirty_info);
+    assert(!dirty_big_info);
+    return true;
+  }
   void unlock() const {
     //generic_dout(0) << this << " " << info.pgid << " unlock" << dendl;
     assert(!dirty_info);
@@ -2248,6 +2255,8 @@ public:
     bufferlist &bl, pg_info_t &info, map<epoch_t,pg_interval_t> &past_intervals,
     __u8 &);
   void read_state(ObjectStore *store, bufferlist &bl);
+  /// pass pool options (e.g. compression) down to our collection
+  void update_store_with_options();
   static bool _has_removal_flag(ObjectStore *store, spg_t pgid);
   static int peek_map_epoch(ObjectStore *store, spg_t pgid,
 			    epoch_t *pepoch, bufferlist *bl);
@@ -968,7 +968,13 @@ static opt_mapping_t opt_mapping = boost::assign::map_list_of
            ("recovery_op_priority", pool_opts_t::opt_desc_t(
              pool_opts_t::RECOVERY_OP_PRIORITY, pool_opts_t::INT))
            ("scrub_priority", pool_opts_t::opt_desc_t(
-             pool_opts_t::SCRUB_PRIORITY, pool_opts_t::INT));
+             pool_opts_t::SCRUB_PRIORITY, pool_opts_t::INT))
+	   ("compression_mode", pool_opts_t::opt_desc_t(
+	     pool_opts_t::COMPRESSION_MODE, pool_opts_t::STR))
+	   ("compression_algorithm", pool_opts_t::opt_desc_t(
+	     pool_opts_t::COMPRESSION_ALGORITHM, pool_opts_t::STR))
+	   ("compression_required_ratio", pool_opts_t::opt_desc_t(
+	     pool_opts_t::COMPRESSION_REQUIRED_RATIO, pool_opts_t::DOUBLE));
 
 bool pool_opts_t::is_opt_name(const std::string& name) {
     return opt_mapping.find(name) != opt_mapping.end();
@@ -5464,7 +5470,8 @@ ostream& operator<<(ostream& out, const OSDOp& op)
       break;
     case CEPH_OSD_OP_SETALLOCHINT:
       out << " object_size " << op.op.alloc_hint.expected_object_size
-          << " write_size " << op.op.alloc_hint.expected_write_size;
+          << " write_size " << op.op.alloc_hint.expected_write_size
+          << " flags " << op.op.alloc_hint.flags;
       break;
     default:
       out << " " << op.op.extent.offset << "~" << op.op.extent.length;
@@ -200,6 +200,29 @@ int KeyValueDBMemory::rmkey(const string &prefix,
   return 0;
 }
 
+int KeyValueDBMemory::merge(const string &prefix,
+			    const string &key,
+			    const bufferlist &bl) {
+  std::shared_ptr<MergeOperator> mop = merge_ops[prefix];
+  assert(mop);
+  string r;
+  bl.copy(0, bl.length(), r);
+  string v;
+  map<std::pair<string,string>,bufferlist>::iterator i =
+    db.find(make_pair(prefix, key));
+  if (i == db.end()) {
+    mop->merge_nonexistent(r.data(), r.size(), &v);
+  } else {
+    string l;
+    i->second.copy(0, i->second.length(), l);
+    mop->merge(l.data(), l.size(), r.data(), r.size(), &v);
+  }
+  bufferlist out;
+  out.append(v);
+  db[make_pair(prefix, key)] = out;
+  return 0;
+}
+
 int KeyValueDBMemory::rmkeys_by_prefix(const string &prefix) {
   map<std::pair<string,string>,bufferlist>::iterator i;
   i = db.lower_bound(make_pair(prefix, ""));
@@ -217,6 +240,18 @@ int KeyValueDBMemory::rmkeys_by_prefix(const string &prefix) {
   return 0;
 }
 
+int KeyValueDBMemory::rm_range_keys(const string &prefix, const string &start,
+				    const string &end) {
+  map<std::pair<string,string>,bufferlist>::iterator i;
+  i = db.lower_bound(make_pair(prefix, start));
+  while (i != db.end() && i->first < make_pair(prefix, end)) {
+    std::pair<string,string> key = (*i).first;
+    ++i;
+    rmkey(key.first, key.second);
+  }
+  return 0;
+}
+
 KeyValueDB::WholeSpaceIterator KeyValueDBMemory::_get_iterator() {
   return ceph::shared_ptr<KeyValueDB::WholeSpaceIteratorImpl>(
     new WholeSpaceMemIterator(this)
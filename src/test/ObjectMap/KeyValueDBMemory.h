@@ -14,6 +14,7 @@ using std::string;
 class KeyValueDBMemory : public KeyValueDB {
 public:
   std::map<std::pair<string,string>,bufferlist> db;
+  std::map<string,std::shared_ptr<MergeOperator> > merge_ops;
 
   KeyValueDBMemory() { }
   explicit KeyValueDBMemory(KeyValueDBMemory *db) : db(db->db) { }
@@ -57,6 +58,24 @@ public:
     const string &prefix
     );
 
+  int rm_range_keys(
+    const string &prefix,
+    const string &start,
+    const string &end
+    );
+
+  int merge(
+    const string &prefix,
+    const string &key,
+    const bufferlist &bl
+    );
+
+  int set_merge_operator(const string& prefix,
+			 std::shared_ptr<MergeOperator> mop) {
+    merge_ops[prefix] = mop;
+    return 0;
+  }
+
   class TransactionImpl_ : public TransactionImpl {
   public:
     list<Context *> on_commit;
@@ -111,6 +130,39 @@ public:
       on_commit.push_back(new RmKeysByPrefixOp(db, prefix));
     }
 
+    struct RmRangeKeysOp : public Context {
+      KeyValueDBMemory *db;
+      string prefix, start, end;
+      RmRangeKeysOp(KeyValueDBMemory *db, const string &prefix,
+		    const string &start, const string &end)
+	: db(db), prefix(prefix), start(start), end(end) {}
+      void finish(int r) {
+	db->rm_range_keys(prefix, start, end);
+      }
+    };
+    void rm_range_keys(const string &prefix, const string &start,
+		       const string &end) {
+      on_commit.push_back(new RmRangeKeysOp(db, prefix, start, end));
+    }
+
+    struct MergeOp : public Context {
+      KeyValueDBMemory *db;
+      std::pair<string,string> key;
+      bufferlist value;
+      MergeOp(KeyValueDBMemory *db,
+	      const std::pair<string,string> &key,
+	      const bufferlist &value)
+	: db(db), key(key), value(value) {}
+      void finish(int r) {
+	db->merge(key.first, key.second, value);
+      }
+    };
+
+    void merge(const string &prefix, const string &k, const bufferlist &bl) {
+      assert(db->merge_ops.count(prefix));
+      on_commit.push_back(new MergeOp(db, std::make_pair(prefix, k), bl));
+    }
+
     int complete() {
       for (list<Context *>::iterator i = on_commit.begin();
 	   i != on_commit.end();
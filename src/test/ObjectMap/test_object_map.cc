@@ -12,6 +12,7 @@
 #include <sys/types.h>
 #include "global/global_init.h"
 #include "common/ceph_argparse.h"
+#include "common/Thread.h"
 #include <dirent.h>
 
 #include "gtest/gtest.h"
@@ -673,6 +674,39 @@ TEST_F(ObjectMapTest, CloneOneObject) {
   db->clear(hoid2);
 }
 
+TEST_F(ObjectMapTest, RmKeyRange) {
+  ghobject_t hoid(hobject_t(sobject_t("foo", CEPH_NOSNAP)));
+  ghobject_t hoid2(hobject_t(sobject_t("foo2", CEPH_NOSNAP)));
+  ghobject_t hoid3(hobject_t(sobject_t("foo3", CEPH_NOSNAP)));
+
+  for (char c = 'a'; c <= 'f'; ++c) {
+    tester.set_key(hoid, string(1, c), "bar");
+    tester.set_key(hoid3, string(1, c), "bar");
+  }
+  // hoid and hoid2 now share a parent; hoid3 has none
+  db->clone(hoid, hoid2);
+  tester.set_key(hoid2, "g", "bar");
+
+  ASSERT_EQ(0, db->rm_key_range(hoid, "b", "e"));
+  ASSERT_EQ(0, db->rm_key_range(hoid2, "c", "f"));
+  ASSERT_EQ(0, db->rm_key_range(hoid3, "b", "e"));
+
+  string result;
+  string expect1 = "aef", expect2 = "abfg";
+  for (char c = 'a'; c <= 'g'; ++c) {
+    string k(1, c);
+    ASSERT_EQ(expect1.find(c) != string::npos ? 1 : 0,
+	      tester.get_key(hoid, k, &result));
+    ASSERT_EQ(expect2.find(c) != string::npos ? 1 : 0,
+	      tester.get_key(hoid2, k, &result));
+    ASSERT_EQ(expect1.find(c) != string::npos ? 1 : 0,
+	      tester.get_key(hoid3, k, &result));
+  }
+  db->clear(hoid);
+  db->clear(hoid2);
+  db->clear(hoid3);
+}
+
 TEST_F(ObjectMapTest, OddEvenClone) {
   ghobject_t hoid(hobject_t(sobject_t("foo", CEPH_NOSNAP)));
   ghobject_t hoid2(hobject_t(sobject_t("foo2", CEPH_NOSNAP)));
@@ -744,6 +778,74 @@ TEST_F(ObjectMapTest, OddEvenClone) {
   db->clear(hoid2);
 }
 
+TEST_F(ObjectMapTest, ConcurrentReaders) {
+  ghobject_t hoid(hobject_t(sobject_t("foo", CEPH_NOSNAP)));
+  ghobject_t hoid2(hobject_t(sobject_t("foo2", CEPH_NOSNAP)));
+  ghobject_t hoid3(hobject_t(sobject_t("foo3", CEPH_NOSNAP)));
+
+  for (unsigned i = 0; i < 100; ++i) {
+    tester.set_key(hoid, "foo" + num_str(i), "bar" + num_str(i));
+    tester.set_key(hoid3, "foo" + num_str(i), "bar" + num_str(i));
+  }
+  tester.set_header(hoid, "header");
+  // hoid and hoid2 read through a shared parent, hoid3 has its own keys
+  db->clone(hoid, hoid2);
+
+  struct Reader : public Thread {
+    ObjectMapTester *tester;
+    vector<ghobject_t> oids;
+    unsigned errors;
+    Reader(ObjectMapTester *tester, const vector<ghobject_t> &oids)
+      : tester(tester), oids(oids), errors(0) {}
+    void *entry() {
+      for (unsigned round = 0; round < 20; ++round) {
+	for (vector<ghobject_t>::iterator o = oids.begin();
+	     o != oids.end();
+	     ++o) {
+	  for (unsigned i = 0; i < 100; i += 7) {
+	    string result;
+	    if (tester->get_key(*o, "foo" + num_str(i), &result) != 1 ||
+		result != "bar" + num_str(i))
+	      ++errors;
+	  }
+	  unsigned count = 0;
+	  ObjectMap::ObjectMapIterator iter = tester->db->get_iterator(*o);
+	  for (iter->seek_to_first(); iter->valid(); iter->next())
+	    ++count;
+	  if (count != 100)
+	    ++errors;
+	}
+      }
+      return 0;
+    }
+  };
+
+  vector<ghobject_t> all;
+  all.push_back(hoid);
+  all.push_back(hoid2);
+  all.push_back(hoid3);
+  vector<Reader*> readers;
+  for (unsigned i = 0; i < 8; ++i) {
+    // half of the readers pile onto the same object
+    vector<ghobject_t> oids = i % 2 ? all : vector<ghobject_t>(1, hoid2);
+    readers.push_back(new Reader(&tester, oids));
+    readers.back()->create("omap_reader");
+  }
+  for (vector<Reader*>::iterator i = readers.begin(); i != readers.end(); ++i) {
+    (*i)->join();
+    ASSERT_EQ(0u, (*i)->errors);
+    delete *i;
+  }
+
+  string header;
+  ASSERT_EQ(0, tester.get_header(hoid2, &header));
+  ASSERT_EQ("header", header);
+
+  db->clear(hoid);
+  db->clear(hoid2);
+  db->clear(hoid3);
+}
+
 TEST_F(ObjectMapTest, RandomTest) {
   tester.def_init();
   for (unsigned i = 0; i < 5000; ++i) {
@@ -10,4 +10,11 @@
      --test-random           do random placements
      --test-map-pg <pgid>    map a pgid to osds
      --test-map-object <objectname> [--pool <poolid>] map an object to osds
+     --upmap <file>          calculate pg upmap entries to balance pg layout
+                             writing commands to <file> [default: - for stdout]
+     --upmap-max <max-count> set max upmap entries to calculate [default: 100]
+     --upmap-deviation <max-deviation>
+                             max deviation from target [default: .01]
+     --upmap-pool <poolname> restrict upmap balancing to 1 or more pools
+     --upmap-save            write modified OSDMap with upmap changes
   [1]
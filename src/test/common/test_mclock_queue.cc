@@ -0,0 +1,197 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "gtest/gtest.h"
+#include "common/Formatter.h"
+#include "common/mClockQueue.h"
+
+#include <vector>
+#include <map>
+#include <list>
+#include <tuple>
+
+class mClockQueueTest : public testing::Test
+{
+protected:
+  typedef unsigned Klass;
+  // tuple<op class, Klass, OpID>
+  typedef std::tuple<unsigned, unsigned, unsigned> Item;
+  typedef mClockQueue<Item, Klass> MQ;
+
+  double now;
+
+  mClockQueueTest() : now(100) {}
+
+  MQ *create(const std::vector<mClockClassInfo>& info) {
+    return new MQ(
+      [](const Item& i) { return std::get<0>(i); },
+      info,
+      [this]() { return now; });
+  }
+
+  /// dequeue n ops, advancing the clock by step after each, and count
+  /// what each class got
+  std::map<unsigned, unsigned> run(MQ& q, unsigned n, double step) {
+    std::map<unsigned, unsigned> served;
+    for (unsigned i = 0; i < n && !q.empty(); ++i) {
+      ++served[std::get<0>(q.dequeue())];
+      now += step;
+    }
+    return served;
+  }
+
+  void fill(MQ& q, unsigned op_class, unsigned n) {
+    for (unsigned i = 0; i < n; ++i)
+      q.enqueue(i % 7, 0, 0, std::make_tuple(op_class, i % 7, i));
+  }
+};
+
+TEST_F(mClockQueueTest, StrictFirstAndFifo) {
+  std::vector<mClockClassInfo> info(2);
+  std::unique_ptr<MQ> q(create(info));
+  fill(*q, 0, 10);
+  fill(*q, 1, 10);
+  q->enqueue_strict(0, 10, std::make_tuple(0, 0, 100));
+  q->enqueue_strict(0, 20, std::make_tuple(0, 0, 200));
+  q->enqueue_strict_front(0, 20, std::make_tuple(0, 0, 201));
+  q->enqueue_front(0, 0, 0, std::make_tuple(1, 0, 1000));
+  ASSERT_EQ(24u, q->length());
+
+  // strict, highest priority first, front enqueues respected
+  ASSERT_EQ(201u, std::get<2>(q->dequeue()));
+  ASSERT_EQ(200u, std::get<2>(q->dequeue()));
+  ASSERT_EQ(100u, std::get<2>(q->dequeue()));
+
+  // each class is served in order
+  std::map<unsigned, std::vector<unsigned> > seen;
+  while (!q->empty()) {
+    Item i = q->dequeue();
+    seen[std::get<0>(i)].push_back(std::get<2>(i));
+  }
+  ASSERT_EQ(10u, seen[0].size());
+  ASSERT_EQ(11u, seen[1].size());
+  ASSERT_EQ(1000u, seen[1][0]);
+  for (unsigned i = 0; i < 10; ++i) {
+    ASSERT_EQ(i, seen[0][i]);
+    ASSERT_EQ(i, seen[1][i + 1]);
+  }
+}
+
+TEST_F(mClockQueueTest, Weight) {
+  std::vector<mClockClassInfo> info;
+  info.push_back(mClockClassInfo(0, 1, 0));
+  info.push_back(mClockClassInfo(0, 3, 0));
+  std::unique_ptr<MQ> q(create(info));
+  fill(*q, 0, 400);
+  fill(*q, 1, 400);
+  std::map<unsigned, unsigned> served = run(*q, 400, .001);
+  ASSERT_NEAR(100, served[0], 2);
+  ASSERT_NEAR(300, served[1], 2);
+}
+
+TEST_F(mClockQueueTest, IdleClassDoesNotBankCredit) {
+  std::vector<mClockClassInfo> info(2);
+  std::unique_ptr<MQ> q(create(info));
+  fill(*q, 0, 1000);
+  run(*q, 500, .001);
+  // a class arriving late shares from here on rather than getting
+  // everything until it has caught up
+  fill(*q, 1, 500);
+  std::map<unsigned, unsigned> served = run(*q, 200, .001);
+  ASSERT_NEAR(100, served[0], 2);
+  ASSERT_NEAR(100, served[1], 2);
+}
+
+TEST_F(mClockQueueTest, DrainedQueueDoesNotBankCredit) {
+  std::vector<mClockClassInfo> info;
+  info.push_back(mClockClassInfo(0, 500, 0));
+  info.push_back(mClockClassInfo(0, 1, 0));
+  std::unique_ptr<MQ> q(create(info));
+  // class 0 alone at 10k ops/s for a minute, draining after every op
+  for (unsigned i = 0; i < 600000; ++i) {
+    q->enqueue(0, 0, 0, std::make_tuple(0u, 0u, i));
+    ASSERT_EQ(0u, std::get<0>(q->dequeue()));
+    now += .0001;
+  }
+  // a burst of class 1 gets its share by weight, not everything until
+  // it has caught up with the time class 0 has used
+  fill(*q, 1, 5000);
+  fill(*q, 0, 5000);
+  std::map<unsigned, unsigned> served = run(*q, 5000, .0001);
+  ASSERT_LE(served[1], 20u);
+  ASSERT_GE(served[0], 4980u);
+
+  // and the same once the queue has drained again
+  while (!q->empty())
+    q->dequeue();
+  now += 10;
+  fill(*q, 0, 5000);
+  fill(*q, 1, 5000);
+  served = run(*q, 5000, .0001);
+  ASSERT_LE(served[1], 20u);
+  ASSERT_GE(served[0], 4980u);
+}
+
+TEST_F(mClockQueueTest, Reservation) {
+  // class 0 would get 1% by weight, but is guaranteed 20 ops/s
+  std::vector<mClockClassInfo> info;
+  info.push_back(mClockClassInfo(20, 1, 0));
+  info.push_back(mClockClassInfo(0, 99, 0));
+  std::unique_ptr<MQ> q(create(info));
+  fill(*q, 0, 1000);
+  fill(*q, 1, 1000);
+  // 100 ops/s for 5 seconds
+  std::map<unsigned, unsigned> served = run(*q, 500, .01);
+  ASSERT_GE(served[0], 99u);
+  ASSERT_LE(served[0], 110u);
+}
+
+TEST_F(mClockQueueTest, Limit) {
+  // class 0 would get 99% by weight, but is capped at 10 ops/s
+  std::vector<mClockClassInfo> info;
+  info.push_back(mClockClassInfo(0, 99, 10));
+  info.push_back(mClockClassInfo(0, 1, 0));
+  std::unique_ptr<MQ> q(create(info));
+  fill(*q, 0, 1000);
+  fill(*q, 1, 1000);
+  std::map<unsigned, unsigned> served = run(*q, 500, .01);
+  ASSERT_LE(served[0], 51u);
+
+  // but with nothing else to do it is still served
+  q.reset(create(info));
+  fill(*q, 0, 100);
+  served = run(*q, 100, 0);
+  ASSERT_EQ(100u, served[0]);
+  ASSERT_TRUE(q->empty());
+}
+
+TEST_F(mClockQueueTest, Remove) {
+  std::vector<mClockClassInfo> info(3);
+  std::unique_ptr<MQ> q(create(info));
+  for (unsigned c = 0; c < 3; ++c)
+    fill(*q, c, 70);
+  for (unsigned i = 0; i < 14; ++i)
+    q->enqueue_strict(i % 7, 1, std::make_tuple(0, i % 7, i));
+  ASSERT_EQ(224u, q->length());
+
+  std::list<Item> removed;
+  q->remove_by_class(3, &removed);
+  ASSERT_EQ(32u, removed.size());
+  for (std::list<Item>::iterator p = removed.begin(); p != removed.end(); ++p)
+    ASSERT_EQ(3u, std::get<1>(*p));
+
+  removed.clear();
+  q->remove_by_filter(
+    [](Item i) { return std::get<0>(i) == 2; }, &removed);
+  ASSERT_EQ(60u, removed.size());
+  ASSERT_EQ(132u, q->length());
+
+  unsigned n = 0;
+  while (!q->empty()) {
+    Item i = q->dequeue();
+    ASSERT_NE(3u, std::get<1>(i));
+    ASSERT_NE(2u, std::get<0>(i));
+    ++n;
+  }
+  ASSERT_EQ(132u, n);
+}
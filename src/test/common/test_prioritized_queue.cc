@@ -246,3 +246,56 @@ TEST_F(PrioritizedQueueTest, remove_by_class) {
   }
   EXPECT_TRUE(items.empty());
 }
+
+TEST_F(PrioritizedQueueTest, dequeue_unlocked) {
+  PQ pq(50, 1);
+  // items for keys 1, 1, 2, 3; key = item / 10
+  const Item in[] = { 10, 11, 20, 30 };
+  for (unsigned i = 0; i < 4; i++)
+    pq.enqueue(Klass(1), 0, 1, in[i]);
+
+  // key 1 is busy the first time it is tried and free after that, as
+  // if its lock were dropped partway through the scan
+  std::set<unsigned> tried;
+  auto try_lock = [&tried](const Item& i) {
+    return !tried.insert(i / 10).second || i / 10 != 1;
+  };
+  std::list<Item> passed;
+  boost::optional<Item> got = opqueue_dequeue_unlocked(
+    pq, 10, [](const Item& i) { return i / 10; }, try_lock, &passed);
+  ASSERT_TRUE(got);
+  EXPECT_EQ(20u, *got);
+  ASSERT_EQ(2u, passed.size());
+  EXPECT_EQ(11u, passed.front());
+  EXPECT_EQ(10u, passed.back());
+
+  // 11 was not taken although key 1 was free by then, since 10 had
+  // been passed over; requeueing puts both back in order
+  for (std::list<Item>::iterator p = passed.begin(); p != passed.end(); ++p)
+    pq.enqueue_front(Klass(1), 0, 1, *p);
+  got = opqueue_dequeue_unlocked(
+    pq, 10, [](const Item& i) { return i / 10; }, try_lock, &passed);
+  ASSERT_TRUE(got);
+  EXPECT_EQ(10u, *got);
+
+  // the next scan starts afresh; a passed-over key is only skipped
+  // within one scan
+  passed.clear();
+  tried.clear();
+  got = opqueue_dequeue_unlocked(
+    pq, 10, [](const Item& i) { return i / 10; }, try_lock, &passed);
+  ASSERT_TRUE(got);
+  EXPECT_EQ(30u, *got);
+  ASSERT_EQ(1u, passed.size());
+  EXPECT_EQ(11u, passed.front());
+
+  // nothing lockable within max_scan
+  pq.enqueue_front(Klass(1), 0, 1, passed.front());
+  passed.clear();
+  tried.clear();
+  got = opqueue_dequeue_unlocked(
+    pq, 1, [](const Item& i) { return i / 10; },
+    [](const Item& i) { return false; }, &passed);
+  EXPECT_FALSE(got);
+  EXPECT_EQ(1u, passed.size());
+}
@@ -119,6 +119,8 @@ TYPE(bluestore_cnode_t)
 TYPE(bluestore_extent_t)
 TYPE(bluestore_extent_ref_map_t)
 TYPE(bluestore_overlay_t)
+TYPE(bluestore_compressed_blob_t)
+TYPE(bluestore_csum_t)
 TYPE(bluestore_onode_t)
 TYPE(bluestore_wal_op_t)
 TYPE(bluestore_wal_transaction_t)
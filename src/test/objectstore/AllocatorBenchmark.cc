@@ -0,0 +1,244 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * Compare alloc/free throughput and resident memory of the BlueStore
+ * allocators on a pre-fragmented device.  Free space is laid out the
+ * same way mkfs does it with bluestore_debug_prefill, using extents of
+ * at most bluestore_debug_prefragment_max bytes.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <thread>
+#include <mutex>
+
+using namespace std;
+
+#include "common/ceph_argparse.h"
+#include "common/debug.h"
+#include "common/Cycles.h"
+#include "common/strtol.h"
+#include "global/global_init.h"
+#include "os/bluestore/Allocator.h"
+
+static uint64_t get_rss()
+{
+  ifstream f("/proc/self/statm");
+  uint64_t size = 0, resident = 0;
+  f >> size >> resident;
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+static void prefragment(Allocator *alloc, uint64_t size, uint64_t min_alloc_size,
+			float ratio, uint64_t *extents, uint64_t *bytes)
+{
+  uint64_t max_b = MAX(1, g_conf->bluestore_debug_prefragment_max /
+		       min_alloc_size);
+  uint64_t start = 0;
+  while (start < size) {
+    uint64_t l = (rand() % max_b + 1) * min_alloc_size;
+    if (start + l > size)
+      l = size - start;
+    l -= l % min_alloc_size;
+    if (!l)
+      break;
+    alloc->init_add_free(start, l);
+    ++*extents;
+    *bytes += l;
+    uint64_t u = 1 + (uint64_t)(ratio * (double)l / (1.0 - ratio));
+    u = ROUND_UP_TO(u, min_alloc_size);
+    start += l + u;
+  }
+}
+
+struct Result {
+  uint64_t init_us = 0;
+  uint64_t rss = 0;
+  uint64_t ops = 0;
+  uint64_t bytes = 0;
+  uint64_t ticks = 0;
+};
+
+static int run(const string& type, uint64_t size, uint64_t min_alloc_size,
+	       float ratio, uint64_t io_size, int threads, uint64_t ops,
+	       Result *res)
+{
+  uint64_t rss_before = get_rss();
+  uint64_t start_time = Cycles::rdtsc();
+  Allocator *alloc = Allocator::create(type, size, min_alloc_size);
+  if (!alloc)
+    return -EINVAL;
+  uint64_t extents = 0, free_bytes = 0;
+  srand(0);
+  prefragment(alloc, size, min_alloc_size, ratio, &extents, &free_bytes);
+  res->init_us = Cycles::to_microseconds(Cycles::rdtsc() - start_time);
+  uint64_t rss_after = get_rss();
+  res->rss = rss_after > rss_before ? rss_after - rss_before : 0;
+  cerr << type << ": " << extents << " free extents, " << free_bytes
+       << " bytes free" << std::endl;
+
+  std::mutex commit_lock;
+  std::mutex res_lock;
+  vector<std::thread> workers;
+  start_time = Cycles::rdtsc();
+  for (int t = 0; t < threads; ++t) {
+    workers.push_back(std::thread([&]() {
+	  uint64_t done = 0, bytes = 0;
+	  vector<pair<uint64_t,uint32_t> > extents;
+	  for (uint64_t i = 0; i < ops / threads; ++i) {
+	    if (alloc->reserve(io_size) < 0) {
+	      // wait for releases to commit
+	      std::lock_guard<std::mutex> l(commit_lock);
+	      alloc->commit_start();
+	      alloc->commit_finish();
+	      continue;
+	    }
+	    uint64_t want = io_size;
+	    while (want) {
+	      uint64_t offset;
+	      uint32_t length;
+	      int r = alloc->allocate(want, min_alloc_size, 0, &offset, &length);
+	      assert(r == 0);
+	      extents.push_back(make_pair(offset, length));
+	      want -= length;
+	    }
+	    // age the allocations a bit before giving them back
+	    if (extents.size() > 64) {
+	      for (auto& e : extents) {
+		alloc->release(e.first, e.second);
+	      }
+	      extents.clear();
+	    }
+	    if (i % 128 == 0) {
+	      std::lock_guard<std::mutex> l(commit_lock);
+	      alloc->commit_start();
+	      alloc->commit_finish();
+	    }
+	    ++done;
+	    bytes += io_size;
+	  }
+	  for (auto& e : extents) {
+	    alloc->release(e.first, e.second);
+	  }
+	  std::lock_guard<std::mutex> l(res_lock);
+	  res->ops += done;
+	  res->bytes += bytes;
+	}));
+  }
+  for (auto& w : workers) {
+    w.join();
+  }
+  res->ticks = Cycles::rdtsc() - start_time;
+  alloc->shutdown();
+  delete alloc;
+  return 0;
+}
+
+void usage(const string &name) {
+  cerr << "Usage: " << name << " [options]\n"
+       << "  --type <stupid|bitmap|all>   allocator(s) to test (default all)\n"
+       << "  --device-size <bytes>        device size (default 1T)\n"
+       << "  --io-size <bytes>            allocation size (default 64K)\n"
+       << "  --prefill <ratio>            fraction of the device in use"
+       << " (default bluestore_debug_prefill, or 0.5)\n"
+       << "  --threads <n>                concurrent allocating threads"
+       << " (default 1)\n"
+       << "  --ops <n>                    allocations to perform"
+       << " (default 1000000)\n"
+       << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+  env_to_vec(args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+  g_ceph_context->_conf->apply_changes(NULL);
+  Cycles::init();
+
+  string type = "all";
+  uint64_t size = 1ull << 40;
+  uint64_t io_size = 65536;
+  float ratio = g_conf->bluestore_debug_prefill > 0 ?
+    g_conf->bluestore_debug_prefill : 0.5;
+  int threads = 1;
+  uint64_t ops = 1000000;
+
+  string val, e;
+  std::ostringstream err;
+  for (auto i = args.begin(); i != args.end(); ) {
+    if (ceph_argparse_double_dash(args, i)) {
+      break;
+    } else if (ceph_argparse_flag(args, i, "-h", "--help", (char*)NULL)) {
+      usage(argv[0]);
+      return 0;
+    } else if (ceph_argparse_witharg(args, i, &val, "--type", (char*)NULL)) {
+      type = val;
+    } else if (ceph_argparse_witharg(args, i, &val, "--device-size",
+				     (char*)NULL)) {
+      size = strict_sistrtoll(val.c_str(), &e);
+    } else if (ceph_argparse_witharg(args, i, &val, "--io-size",
+				     (char*)NULL)) {
+      io_size = strict_sistrtoll(val.c_str(), &e);
+    } else if (ceph_argparse_witharg(args, i, &val, "--prefill",
+				     (char*)NULL)) {
+      ratio = atof(val.c_str());
+    } else if (ceph_argparse_witharg(args, i, &threads, err, "--threads",
+				     (char*)NULL)) {
+    } else if (ceph_argparse_witharg(args, i, &val, "--ops", (char*)NULL)) {
+      ops = strtoull(val.c_str(), NULL, 10);
+    } else {
+      cerr << "unrecognized argument " << *i << std::endl;
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (!e.empty() || ratio < 0 || ratio >= 1.0 || threads < 1 || !io_size) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  uint64_t min_alloc_size = g_conf->bluestore_min_alloc_size;
+  io_size = ROUND_UP_TO(io_size, min_alloc_size);
+  vector<string> types;
+  if (type == "all") {
+    types.push_back("stupid");
+    types.push_back("bitmap");
+  } else {
+    types.push_back(type);
+  }
+
+  for (auto& t : types) {
+    Result res;
+    int r = run(t, size, min_alloc_size, ratio, io_size, threads, ops, &res);
+    if (r < 0) {
+      cerr << "unknown allocator type " << t << std::endl;
+      return 1;
+    }
+    double secs = (double)Cycles::to_microseconds(res.ticks) / 1000000.0;
+    cout << t
+	 << ": init " << res.init_us << " us"
+	 << ", rss " << res.rss << " bytes"
+	 << ", " << res.ops << " allocs in " << secs << " s"
+	 << " (" << (double)res.ops / secs << " allocs/s, "
+	 << Cycles::to_nanoseconds(res.ticks) / MAX(1, res.ops) << " ns/alloc)"
+	 << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,192 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Unit tests for the BlueStore Allocator implementations.
+ */
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "global/global_init.h"
+#include "global/global_context.h"
+#include "common/config.h"
+#include "common/ceph_argparse.h"
+#include "include/interval_set.h"
+#include "os/bluestore/Allocator.h"
+
+class AllocTest : public ::testing::TestWithParam<const char*> {
+public:
+  Allocator *alloc;
+  AllocTest() : alloc(NULL) {}
+  void init_alloc(int64_t size, uint64_t block_size) {
+    alloc = Allocator::create(string(GetParam()), size, block_size);
+    ASSERT_TRUE(alloc != NULL);
+  }
+  void TearDown() {
+    if (alloc) {
+      alloc->shutdown();
+      delete alloc;
+    }
+  }
+};
+
+TEST_P(AllocTest, test_alloc_init)
+{
+  int64_t blocks = 1024 * 3;
+  int64_t block_size = 65536;
+  init_alloc(blocks * block_size, block_size);
+  ASSERT_EQ(0u, alloc->get_free());
+  alloc->init_add_free(0, blocks * block_size);
+  ASSERT_EQ((uint64_t)(blocks * block_size), alloc->get_free());
+  alloc->init_rm_free(block_size * 10, block_size * 20);
+  ASSERT_EQ((uint64_t)((blocks - 20) * block_size), alloc->get_free());
+  ASSERT_EQ(-ENOSPC, alloc->reserve(blocks * block_size));
+}
+
+TEST_P(AllocTest, test_alloc_all)
+{
+  int64_t blocks = 1024 * 3 + 17;
+  int64_t block_size = 65536;
+  init_alloc(blocks * block_size, block_size);
+  alloc->init_add_free(0, blocks * block_size);
+
+  interval_set<uint64_t> allocated;
+  uint64_t total = 0;
+  while (alloc->get_free() > 0) {
+    uint64_t want = MIN((uint64_t)(rand() % 32 + 1) * block_size,
+			alloc->get_free());
+    ASSERT_EQ(0, alloc->reserve(want));
+    while (want > 0) {
+      uint64_t offset;
+      uint32_t length;
+      ASSERT_EQ(0, alloc->allocate(want, block_size, 0, &offset, &length));
+      ASSERT_GT(length, 0u);
+      ASSERT_LE(length, want);
+      ASSERT_EQ(0u, offset % block_size);
+      ASSERT_LE(offset + length, (uint64_t)(blocks * block_size));
+      ASSERT_FALSE(allocated.intersects(offset, length));
+      allocated.insert(offset, length);
+      total += length;
+      want -= length;
+    }
+  }
+  ASSERT_EQ((uint64_t)(blocks * block_size), total);
+  ASSERT_EQ(-ENOSPC, alloc->reserve(block_size));
+
+  // released space only comes back once committed
+  for (auto p = allocated.begin(); p != allocated.end(); ++p) {
+    alloc->release(p.get_start(), p.get_len());
+  }
+  ASSERT_EQ(0u, alloc->get_free());
+  alloc->commit_start();
+  alloc->commit_finish();
+  ASSERT_EQ((uint64_t)(blocks * block_size), alloc->get_free());
+}
+
+TEST_P(AllocTest, test_alloc_aligned)
+{
+  int64_t blocks = 4096;
+  int64_t block_size = 4096;
+  uint64_t alloc_unit = 65536;
+  init_alloc(blocks * block_size, block_size);
+  // free space starts off of an alloc_unit boundary
+  alloc->init_add_free(block_size, (blocks - 1) * block_size);
+
+  for (int i = 0; i < 10; ++i) {
+    uint64_t offset;
+    uint32_t length;
+    ASSERT_EQ(0, alloc->reserve(alloc_unit * 2));
+    ASSERT_EQ(0, alloc->allocate(alloc_unit * 2, alloc_unit, 0,
+				 &offset, &length));
+    ASSERT_EQ(0u, offset % alloc_unit);
+    ASSERT_EQ(alloc_unit * 2, length);
+  }
+}
+
+TEST_P(AllocTest, test_alloc_fragmented)
+{
+  int64_t blocks = 1024 * 4;
+  int64_t block_size = 65536;
+  init_alloc(blocks * block_size, block_size);
+  // every other block is free
+  for (int64_t i = 0; i < blocks; i += 2) {
+    alloc->init_add_free(i * block_size, block_size);
+  }
+  ASSERT_EQ((uint64_t)(blocks / 2 * block_size), alloc->get_free());
+
+  // a large request is satisfied piecemeal
+  uint64_t want = 16 * block_size;
+  ASSERT_EQ(0, alloc->reserve(want));
+  uint64_t got = 0;
+  while (got < want) {
+    uint64_t offset;
+    uint32_t length;
+    ASSERT_EQ(0, alloc->allocate(want - got, block_size, 0, &offset, &length));
+    ASSERT_EQ((uint64_t)block_size, length);
+    ASSERT_EQ(0u, (offset / block_size) % 2);
+    got += length;
+  }
+}
+
+TEST_P(AllocTest, test_alloc_concurrent)
+{
+  int64_t blocks = 1024 * 64;
+  int64_t block_size = 65536;
+  init_alloc(blocks * block_size, block_size);
+  alloc->init_add_free(0, blocks * block_size);
+
+  const int num_threads = 4;
+  const int num_allocs = 1000;
+  std::vector<interval_set<uint64_t> > allocated(num_threads);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; ++t) {
+    threads.push_back(std::thread([&, t]() {
+	  for (int i = 0; i < num_allocs; ++i) {
+	    uint64_t want = 4 * block_size;
+	    int r = alloc->reserve(want);
+	    assert(r == 0);
+	    while (want > 0) {
+	      uint64_t offset;
+	      uint32_t length;
+	      r = alloc->allocate(want, block_size, 0, &offset, &length);
+	      assert(r == 0);
+	      allocated[t].insert(offset, length);
+	      want -= length;
+	    }
+	  }
+	}));
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  interval_set<uint64_t> all;
+  for (auto& a : allocated) {
+    for (auto p = a.begin(); p != a.end(); ++p) {
+      ASSERT_FALSE(all.intersects(p.get_start(), p.get_len()));
+    }
+    all.union_of(a);
+  }
+  uint64_t used = all.size();
+  ASSERT_EQ((uint64_t)num_threads * num_allocs * 4 * block_size, used);
+  ASSERT_EQ((uint64_t)(blocks * block_size) - used, alloc->get_free());
+}
+
+INSTANTIATE_TEST_CASE_P(
+  Allocator,
+  AllocTest,
+  ::testing::Values("stupid", "bitmap"));
+
+int main(int argc, char **argv) {
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+  env_to_vec(args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+  g_ceph_context->_conf->set_val("bluestore_min_alloc_size", "65536");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -18,6 +18,7 @@
 #include <stdint.h>
 #include <string>
 #include <iostream>
+#include <new>
 
 using namespace std;
 
@@ -27,6 +28,35 @@ using namespace std;
 #include "global/global_init.h"
 #include "os/ObjectStore.h"
 
+// count every heap allocation so the per-op figures include them; the
+// benchmark is single threaded
+static uint64_t allocs = 0;
+
+void *operator new(size_t size)
+{
+  ++allocs;
+  void *p = malloc(size);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+void *operator new[](size_t size)
+{
+  ++allocs;
+  void *p = malloc(size);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+void operator delete(void *p) noexcept
+{
+  free(p);
+}
+void operator delete[](void *p) noexcept
+{
+  free(p);
+}
+
 class Transaction {
  private:
   ObjectStore::Transaction t;
@@ -34,56 +64,73 @@ class Transaction {
  public:
   struct Tick {
     uint64_t ticks;
+    uint64_t allocs;
     uint64_t count;
-    Tick(): ticks(0), count(0) {}
-    void add(uint64_t a) {
+    Tick(): ticks(0), allocs(0), count(0) {}
+    void add(uint64_t a, uint64_t n) {
       ticks += a;
+      allocs += n;
       count++;
     }
+    void dump(const char *name) const {
+      cerr << " " << name << " op: " << Cycles::to_microseconds(ticks)
+	   << "us count: " << count;
+      if (count)
+	cerr << " ns/op: " << Cycles::to_nanoseconds(ticks) / count
+	     << " allocs/op: " << (double)allocs / count;
+      cerr << std::endl;
+    }
   };
   static Tick write_ticks, setattr_ticks, omap_setkeys_ticks, omap_rmkeys_ticks;
   static Tick encode_ticks, decode_ticks, iterate_ticks;
 
   void write(coll_t cid, const ghobject_t& oid, uint64_t off, uint64_t len,
              const bufferlist& data) {
+    uint64_t start_allocs = allocs;
     uint64_t start_time = Cycles::rdtsc();
     t.write(cid, oid, off, len, data);
-    write_ticks.add(Cycles::rdtsc() - start_time);
+    write_ticks.add(Cycles::rdtsc() - start_time, allocs - start_allocs);
   }
   void setattr(coll_t cid, const ghobject_t& oid, const string &name,
                bufferlist& val) {
+    uint64_t start_allocs = allocs;
     uint64_t start_time = Cycles::rdtsc();
     t.setattr(cid, oid, name, val);
-    setattr_ticks.add(Cycles::rdtsc() - start_time);
+    setattr_ticks.add(Cycles::rdtsc() - start_time, allocs - start_allocs);
   }
   void omap_setkeys(coll_t cid, const ghobject_t &oid,
                     const map<string, bufferlist> &attrset) {
 
+    uint64_t start_allocs = allocs;
     uint64_t start_time = Cycles::rdtsc();
     t.omap_setkeys(cid, oid, attrset);
-    omap_setkeys_ticks.add(Cycles::rdtsc() - start_time);
+    omap_setkeys_ticks.add(Cycles::rdtsc() - start_time, allocs - start_allocs);
   }
   void omap_rmkeys(coll_t cid, const ghobject_t &oid,
                    const set<string> &keys) {
+    uint64_t start_allocs = allocs;
     uint64_t start_time = Cycles::rdtsc();
     t.omap_rmkeys(cid, oid, keys);
-    omap_rmkeys_ticks.add(Cycles::rdtsc() - start_time);
+    omap_rmkeys_ticks.add(Cycles::rdtsc() - start_time, allocs - start_allocs);
   }
 
   void apply_encode_decode() {
     bufferlist bl;
     ObjectStore::Transaction d;
+    uint64_t start_allocs = allocs;
     uint64_t start_time = Cycles::rdtsc();
     t.encode(bl);
-    encode_ticks.add(Cycles::rdtsc() - start_time);
+    encode_ticks.add(Cycles::rdtsc() - start_time, allocs - start_allocs);
 
     bufferlist::iterator bliter = bl.begin();
+    start_allocs = allocs;
     start_time = Cycles::rdtsc();
     d.decode(bliter);
-    decode_ticks.add(Cycles::rdtsc() - start_time);
+    decode_ticks.add(Cycles::rdtsc() - start_time, allocs - start_allocs);
   }
 
   void apply_iterate() {
+    uint64_t start_allocs = allocs;
     uint64_t start_time = Cycles::rdtsc();
     ObjectStore::Transaction::iterator i = t.begin();
     while (i.have_op()) {
@@ -123,17 +170,17 @@ class Transaction {
         break;
       }
     }
-    iterate_ticks.add(Cycles::rdtsc() - start_time);
+    iterate_ticks.add(Cycles::rdtsc() - start_time, allocs - start_allocs);
   }
 
   static void dump_stat() {
-    cerr << " write op: " << Cycles::to_microseconds(write_ticks.ticks) << "us count: " << write_ticks.count << std::endl;
-    cerr << " setattr op: " << Cycles::to_microseconds(setattr_ticks.ticks) << "us count: " << setattr_ticks.count << std::endl;
-    cerr << " omap_setkeys op: " << Cycles::to_microseconds(Transaction::omap_setkeys_ticks.ticks) << "us count: " << Transaction::omap_setkeys_ticks.count << std::endl;
-    cerr << " omap_rmkeys op: " << Cycles::to_microseconds(Transaction::omap_rmkeys_ticks.ticks) << "us count: " << Transaction::omap_rmkeys_ticks.count << std::endl;
-    cerr << " encode op: " << Cycles::to_microseconds(Transaction::encode_ticks.ticks) << "us count: " << Transaction::encode_ticks.count << std::endl;
-    cerr << " decode op: " << Cycles::to_microseconds(Transaction::decode_ticks.ticks) << "us count: " << Transaction::decode_ticks.count << std::endl;
-    cerr << " iterate op: " << Cycles::to_microseconds(Transaction::iterate_ticks.ticks) << "us count: " << Transaction::iterate_ticks.count << std::endl;
+    write_ticks.dump("write");
+    setattr_ticks.dump("setattr");
+    omap_setkeys_ticks.dump("omap_setkeys");
+    omap_rmkeys_ticks.dump("omap_rmkeys");
+    encode_ticks.dump("encode");
+    decode_ticks.dump("decode");
+    iterate_ticks.dump("iterate");
   }
 };
 
@@ -187,14 +234,16 @@ class PerfCase {
     data[info_info_attr] = generate_random(560, 1);
   }
 
-  uint64_t rados_write_4k(int times) {
+  uint64_t rados_write_4k(int times, uint64_t *op_allocs) {
     uint64_t ticks = 0;
+    *op_allocs = 0;
     uint64_t len = Kib *4;
     for (int i = 0; i < times; i++) {
       uint64_t start_time = 0;
       {
         Transaction t;
         ghobject_t oid = create_object();
+        uint64_t start_allocs = allocs;
         start_time = Cycles::rdtsc();
         t.write(cid, oid, 0, len, data["4k"]);
         t.setattr(cid, oid, attr, data[attr]);
@@ -202,6 +251,7 @@ class PerfCase {
         t.apply_encode_decode();
         t.apply_iterate();
         ticks += Cycles::rdtsc() - start_time;
+        *op_allocs += allocs - start_allocs;
       }
       {
         Transaction t;
@@ -212,6 +262,7 @@ class PerfCase {
         pglog_attrset[pglog_attr] = data[pglog_attr];
         info_attrset[info_epoch_attr] = data[info_epoch_attr];
         info_attrset[info_info_attr] = data[info_info_attr];
+        uint64_t start_allocs = allocs;
         start_time = Cycles::rdtsc();
         t.omap_setkeys(meta_cid, pglog_oid, pglog_attrset);
         t.omap_setkeys(meta_cid, info_oid, info_attrset);
@@ -219,6 +270,7 @@ class PerfCase {
         t.apply_encode_decode();
         t.apply_iterate();
         ticks += Cycles::rdtsc() - start_time;
+        *op_allocs += allocs - start_allocs;
       }
     }
     return ticks;
@@ -259,9 +311,13 @@ int main(int argc, char **argv)
 
   uint64_t times = atoi(args[0]);
   PerfCase c;
-  uint64_t ticks = c.rados_write_4k(times);
+  uint64_t op_allocs;
+  uint64_t ticks = c.rados_write_4k(times, &op_allocs);
   Transaction::dump_stat();
   cerr << " Total rados op " << times << " run time " << Cycles::to_microseconds(ticks) << "us." << std::endl;
+  if (times)
+    cerr << " per rados op: " << Cycles::to_nanoseconds(ticks) / times << "ns "
+	 << (double)op_allocs / times << " allocs" << std::endl;
 
   return 0;
 }
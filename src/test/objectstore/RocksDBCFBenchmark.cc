@@ -0,0 +1,327 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * Compare rocksdb write amplification with all prefixes in one column
+ * family and with some split into their own (bluestore_rocksdb_cfs),
+ * under the metadata load BlueStore sees for RBD small overwrites.
+ * Each op
+ *
+ *  - puts a wal record (L) carrying the data, removed again a few ops
+ *    later once it has been applied,
+ *  - rewrites the object's onode (O), and
+ *  - appends a pg log entry and rewrites the pg info in the pg's omap
+ *    (M), trimming the log to --log-entries per pg.
+ *
+ * Write amplification is the bytes rocksdb writes to sst files (flushes
+ * plus compaction) over the bytes of keys and values submitted.  The
+ * rocksdb wal is reported separately; it is the same in both layouts.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <string>
+#include <deque>
+#include <iostream>
+#include <atomic>
+
+using namespace std;
+
+#include "rocksdb/env.h"
+#include "common/ceph_argparse.h"
+#include "common/debug.h"
+#include "common/Cycles.h"
+#include "common/errno.h"
+#include "common/strtol.h"
+#include "global/global_init.h"
+#include "kv/RocksDBStore.h"
+
+struct WriteStats {
+  std::atomic<uint64_t> sst = {0};
+  std::atomic<uint64_t> wal = {0};
+  std::atomic<uint64_t> other = {0};
+};
+
+class CountingFile : public rocksdb::WritableFile {
+  std::unique_ptr<rocksdb::WritableFile> f;
+  std::atomic<uint64_t> *bytes;
+public:
+  CountingFile(std::unique_ptr<rocksdb::WritableFile>&& f,
+	       std::atomic<uint64_t> *b)
+    : f(std::move(f)), bytes(b) {}
+
+  rocksdb::Status Append(const rocksdb::Slice& data) override {
+    *bytes += data.size();
+    return f->Append(data);
+  }
+  rocksdb::Status Close() override { return f->Close(); }
+  rocksdb::Status Flush() override { return f->Flush(); }
+  rocksdb::Status Sync() override { return f->Sync(); }
+  rocksdb::Status Fsync() override { return f->Fsync(); }
+  uint64_t GetFileSize() override { return f->GetFileSize(); }
+};
+
+/// counts what rocksdb writes, by file type
+class CountingEnv : public rocksdb::EnvWrapper {
+  WriteStats *stats;
+
+  rocksdb::Status wrap(const std::string& fname, rocksdb::Status s,
+		       std::unique_ptr<rocksdb::WritableFile> *result) {
+    if (!s.ok())
+      return s;
+    std::atomic<uint64_t> *b = &stats->other;
+    size_t pos = fname.rfind('.');
+    if (pos != string::npos) {
+      string ext = fname.substr(pos + 1);
+      if (ext == "sst")
+	b = &stats->sst;
+      else if (ext == "log")
+	b = &stats->wal;
+    }
+    result->reset(new CountingFile(std::move(*result), b));
+    return s;
+  }
+
+public:
+  explicit CountingEnv(WriteStats *s)
+    : rocksdb::EnvWrapper(rocksdb::Env::Default()), stats(s) {}
+
+  rocksdb::Status NewWritableFile(
+    const std::string& fname,
+    std::unique_ptr<rocksdb::WritableFile> *result,
+    const rocksdb::EnvOptions& options) override {
+    return wrap(fname, target()->NewWritableFile(fname, result, options),
+		result);
+  }
+  rocksdb::Status ReuseWritableFile(
+    const std::string& fname,
+    const std::string& old_fname,
+    std::unique_ptr<rocksdb::WritableFile> *result,
+    const rocksdb::EnvOptions& options) override {
+    return wrap(fname, target()->ReuseWritableFile(fname, old_fname, result,
+						   options),
+		result);
+  }
+};
+
+struct Workload {
+  uint64_t ops = 200000;
+  unsigned objects = 100000;  ///< 4M rbd objects, i.e. a 400G image
+  unsigned pgs = 128;
+  unsigned log_entries = 3000;  ///< per pg
+  unsigned wal_lag = 32;        ///< ops before a wal record is applied
+  unsigned io_size = 4096;
+  unsigned onode_size = 400;
+  unsigned log_entry_size = 180;
+  unsigned info_size = 600;
+};
+
+struct Result {
+  uint64_t user_bytes = 0;
+  uint64_t ticks = 0;
+  uint64_t live_bytes = 0;
+};
+
+static string u64_key(uint64_t v)
+{
+  // big endian so that keys sort numerically
+  char buf[8];
+  for (int i = 7; i >= 0; --i) {
+    buf[i] = v & 0xff;
+    v >>= 8;
+  }
+  return string(buf, 8);
+}
+
+static int run(const string& path, const string& cfs, const Workload& w,
+	       WriteStats *stats, Result *res)
+{
+  int r = ::mkdir(path.c_str(), 0755);
+  if (r < 0 && errno != EEXIST) {
+    r = -errno;
+    cerr << "unable to create " << path << ": " << cpp_strerror(r)
+	 << std::endl;
+    return r;
+  }
+  // the store owns (and deletes) the env
+  RocksDBStore *db = new RocksDBStore(g_ceph_context, path,
+				      new CountingEnv(stats));
+  vector<KeyValueDB::ColumnFamily> cf_specs;
+  r = KeyValueDB::parse_column_families(cfs, &cf_specs);
+  if (r == 0 && !cf_specs.empty())
+    r = db->set_column_families(cf_specs);
+  if (r == 0)
+    r = db->init(g_conf->bluestore_rocksdb_options);
+  if (r == 0)
+    r = db->create_and_open(cerr);
+  if (r < 0) {
+    cerr << "failed to open " << path << " with column families '" << cfs
+	 << "': " << cpp_strerror(r) << std::endl;
+    delete db;
+    return r;
+  }
+
+  // incompressible filler to slice values from
+  bufferptr junk(1 << 20);
+  for (unsigned i = 0; i < junk.length(); ++i)
+    junk.c_str()[i] = rand();
+  auto value = [&](unsigned len) {
+    bufferlist bl;
+    bl.append(junk, rand() % (junk.length() - len), len);
+    return bl;
+  };
+
+  vector<uint64_t> pg_head(w.pgs), pg_tail(w.pgs);
+  deque<uint64_t> wal;
+  uint64_t wal_seq = 0;
+  srand(0);
+  uint64_t start = Cycles::rdtsc();
+  for (uint64_t i = 0; i < w.ops; ++i) {
+    KeyValueDB::Transaction t = db->get_transaction();
+    unsigned obj = rand() % w.objects;
+    unsigned pg = obj % w.pgs;
+    char okey[64];
+    snprintf(okey, sizeof(okey), "%08x.rbd_data.%016x", pg, obj);
+    char pgkey[16];
+    snprintf(pgkey, sizeof(pgkey), "%08x.", pg);
+
+    string k = u64_key(++wal_seq);
+    bufferlist bl = value(w.io_size + 100);
+    t->set("L", k, bl);
+    res->user_bytes += k.length() + bl.length();
+    wal.push_back(wal_seq);
+    if (wal.size() > w.wal_lag) {
+      k = u64_key(wal.front());
+      wal.pop_front();
+      t->rmkey("L", k);
+      res->user_bytes += k.length();
+    }
+
+    bl = value(w.onode_size);
+    t->set("O", okey, bl);
+    res->user_bytes += strlen(okey) + bl.length();
+
+    k = string(pgkey) + u64_key(++pg_head[pg]);
+    bl = value(w.log_entry_size);
+    t->set("M", k, bl);
+    res->user_bytes += k.length() + bl.length();
+    if (pg_head[pg] - pg_tail[pg] > w.log_entries) {
+      k = string(pgkey) + u64_key(++pg_tail[pg]);
+      t->rmkey("M", k);
+      res->user_bytes += k.length();
+    }
+    k = string(pgkey) + "_info";
+    bl = value(w.info_size);
+    t->set("M", k, bl);
+    res->user_bytes += k.length() + bl.length();
+
+    db->submit_transaction(t);
+  }
+  res->ticks = Cycles::rdtsc() - start;
+  res->live_bytes = db->get_int_property("rocksdb.estimate-live-data-size");
+  delete db;
+  return 0;
+}
+
+void usage(const string &name) {
+  cerr << "Usage: " << name << " [options] <empty dir>\n"
+       << "  --cfs <spec>           column families to compare against a"
+       << " single one\n"
+       << "                         (default bluestore_rocksdb_cfs, or"
+       << " \"L O M\")\n"
+       << "  --ops <n>              ops to perform (default 200000)\n"
+       << "  --objects <n>          4M objects written to (default 100000)\n"
+       << "  --pgs <n>              pgs (default 128)\n"
+       << "  --log-entries <n>      pg log entries kept per pg"
+       << " (default 3000)\n"
+       << "  --io-size <bytes>      data carried by each wal record"
+       << " (default 4K)\n"
+       << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+  env_to_vec(args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+  g_ceph_context->_conf->apply_changes(NULL);
+  Cycles::init();
+
+  Workload w;
+  string cfs = g_conf->bluestore_rocksdb_cfs;
+  if (cfs.empty())
+    cfs = "L O M";
+
+  string val, e;
+  std::ostringstream err;
+  vector<const char*> dirs;
+  for (auto i = args.begin(); i != args.end(); ) {
+    if (ceph_argparse_double_dash(args, i)) {
+      break;
+    } else if (ceph_argparse_flag(args, i, "-h", "--help", (char*)NULL)) {
+      usage(argv[0]);
+      return 0;
+    } else if (ceph_argparse_witharg(args, i, &val, "--cfs", (char*)NULL)) {
+      cfs = val;
+    } else if (ceph_argparse_witharg(args, i, &val, "--ops", (char*)NULL)) {
+      w.ops = strtoull(val.c_str(), NULL, 10);
+    } else if (ceph_argparse_witharg(args, i, &val, "--objects",
+				     (char*)NULL)) {
+      w.objects = strtoul(val.c_str(), NULL, 10);
+    } else if (ceph_argparse_witharg(args, i, &val, "--pgs", (char*)NULL)) {
+      w.pgs = strtoul(val.c_str(), NULL, 10);
+    } else if (ceph_argparse_witharg(args, i, &val, "--log-entries",
+				     (char*)NULL)) {
+      w.log_entries = strtoul(val.c_str(), NULL, 10);
+    } else if (ceph_argparse_witharg(args, i, &val, "--io-size",
+				     (char*)NULL)) {
+      w.io_size = strict_sistrtoll(val.c_str(), &e);
+    } else if ((*i)[0] == '-') {
+      cerr << "unrecognized argument " << *i << std::endl;
+      usage(argv[0]);
+      return 1;
+    } else {
+      dirs.push_back(*i);
+      i = args.erase(i);
+    }
+  }
+  if (!e.empty() || dirs.size() != 1 || !w.objects || !w.pgs) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  string dir = dirs[0];
+  vector<pair<string,string> > layouts;
+  layouts.push_back(make_pair(string("single"), string()));
+  layouts.push_back(make_pair(string("split"), cfs));
+  for (auto& l : layouts) {
+    WriteStats stats;
+    Result res;
+    int r = run(dir + "/" + l.first, l.second, w, &stats, &res);
+    if (r < 0)
+      return 1;
+    double secs = (double)Cycles::to_microseconds(res.ticks) / 1000000.0;
+    cout << l.first << " (" << (l.second.empty() ? "-" : l.second) << "): "
+	 << w.ops << " ops in " << secs << " s (" << (double)w.ops / secs
+	 << " ops/s), submitted " << res.user_bytes << " bytes"
+	 << ", sst " << stats.sst.load() << " bytes"
+	 << ", wal " << stats.wal.load() << " bytes"
+	 << ", write amp " << (double)stats.sst.load() / res.user_bytes
+	 << ", live " << res.live_bytes << " bytes"
+	 << std::endl;
+  }
+  return 0;
+}
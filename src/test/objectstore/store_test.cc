@@ -19,6 +19,9 @@
 #include <sys/mount.h>
 #include "os/ObjectStore.h"
 #include "os/filestore/FileStore.h"
+#if defined(HAVE_LIBAIO)
+#include "os/bluestore/BlueStore.h"
+#endif
 #include "include/Context.h"
 #include "common/ceph_argparse.h"
 #include "global/global_init.h"
@@ -423,6 +426,250 @@ TEST_P(StoreTest, SimpleColPreHashTest) {
   }
 }
 
+TEST_P(StoreTest, ColPresplitTest) {
+  ObjectStore::Sequencer osr("test");
+  int r;
+  coll_t cid(spg_t(pg_t(7, 15), shard_id_t::NO_SHARD));
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 5);
+    r = apply_transaction(store, &osr, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  // Enough objects to cross the background split point of the root
+  int objs_per_folder = abs(g_ceph_context->_conf->filestore_merge_threshold) *
+    16 * g_ceph_context->_conf->filestore_split_multiple;
+  set<ghobject_t, ghobject_t::BitwiseComparator> created;
+  for (int i = 0; i < objs_per_folder + 10; ++i) {
+    ObjectStore::Transaction t;
+    char buf[100];
+    snprintf(buf, sizeof(buf), "presplit_%d", i);
+    ghobject_t hoid(hobject_t(sobject_t(buf, CEPH_NOSNAP)));
+    t.touch(cid, hoid);
+    created.insert(hoid);
+    r = apply_transaction(store, &osr, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  {
+    // Hint a non-empty collection, splitting it while we keep writing
+    ObjectStore::Transaction t;
+    bufferlist hint;
+    uint32_t pg_num = 128;
+    uint64_t expected_num_objs = (uint64_t)objs_per_folder * 1000;
+    ::encode(pg_num, hint);
+    ::encode(expected_num_objs, hint);
+    t.collection_hint(cid, ObjectStore::Transaction::COLL_HINT_EXPECTED_NUM_OBJECTS, hint);
+    r = apply_transaction(store, &osr, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  // Stop part way through the presplit; mount picks it up again
+  {
+    store->umount();
+    r = store->mount();
+    ASSERT_EQ(0, r);
+  }
+  for (int i = 0; i < objs_per_folder; ++i) {
+    ObjectStore::Transaction t;
+    char buf[100];
+    snprintf(buf, sizeof(buf), "presplit_more_%d", i);
+    ghobject_t hoid(hobject_t(sobject_t(buf, CEPH_NOSNAP)));
+    t.touch(cid, hoid);
+    created.insert(hoid);
+    r = apply_transaction(store, &osr, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  for (set<ghobject_t, ghobject_t::BitwiseComparator>::iterator i = created.begin();
+       i != created.end();
+       ++i) {
+    struct stat buf;
+    ASSERT_TRUE(!store->stat(cid, *i, &buf));
+  }
+  vector<ghobject_t> objects;
+  r = store->collection_list(cid, ghobject_t(), ghobject_t::get_max(), true,
+			     INT_MAX, &objects, 0);
+  ASSERT_EQ(r, 0);
+  ASSERT_EQ(created.size(), objects.size());
+  {
+    ObjectStore::Transaction t;
+    for (set<ghobject_t, ghobject_t::BitwiseComparator>::iterator i = created.begin();
+	 i != created.end();
+	 ++i)
+      t.remove(cid, *i);
+    t.remove_collection(cid);
+    r = apply_transaction(store, &osr, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_P(StoreTest, SmallOverwriteTest) {
+  ObjectStore::Sequencer osr("test");
+  // small blobs and little slack, so kstore splits and compacts a lot
+  g_conf->set_val("kstore_max_blob_size", "16384");
+  g_conf->set_val("kstore_max_extents", "4");
+  g_ceph_context->_conf->apply_changes(NULL);
+  int r;
+  coll_t cid;
+  ghobject_t a(hobject_t(sobject_t("overwrite_a", CEPH_NOSNAP)));
+  ghobject_t b(hobject_t(sobject_t("overwrite_b", CEPH_NOSNAP)));
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = apply_transaction(store, &osr, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  string model(65536, 'a');
+  {
+    bufferlist bl;
+    bl.append(model);
+    ObjectStore::Transaction t;
+    t.write(cid, a, 0, bl.length(), bl);
+    r = apply_transaction(store, &osr, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  for (unsigned i = 0; i < 40; ++i) {
+    uint64_t off = (i * 7919) % 70000;
+    uint64_t len = 1 + (i * 131) % 5000;
+    ObjectStore::Transaction t;
+    if (i % 10 == 9 && off < model.size()) {
+      len = MIN(len, model.size() - off);
+      t.zero(cid, a, off, len);
+      model.replace(off, len, string(len, 0));
+    } else if (i % 10 == 5) {
+      t.truncate(cid, a, off);
+      model.resize(off, 0);
+    } else {
+      string data(len, 'b' + i % 20);
+      bufferlist bl;
+      bl.append(data);
+      t.write(cid, a, off, len, bl);
+      if (off + len > model.size())
+	model.resize(off + len, 0);
+      model.replace(off, len, data);
+    }
+    r = apply_transaction(store, &osr, std::move(t));
+    ASSERT_EQ(r, 0);
+
+    bufferlist in, expected;
+    expected.append(model);
+    r = store->read(cid, a, 0, model.size(), in);
+    ASSERT_EQ((int)model.size(), r);
+    ASSERT_TRUE(in.contents_equal(expected));
+    // and a small read from the middle
+    if (model.size() > 3000) {
+      in.clear();
+      expected.clear();
+      expected.append(model.substr(1000, 2000));
+      r = store->read(cid, a, 1000, 2000, in);
+      ASSERT_EQ(2000, r);
+      ASSERT_TRUE(in.contents_equal(expected));
+    }
+  }
+  {
+    // overwrite and clone in the same transaction
+    string data(3000, 'z');
+    bufferlist bl;
+    bl.append(data);
+    ObjectStore::Transaction t;
+    t.write(cid, a, 100, bl.length(), bl);
+    t.clone(cid, a, b);
+    r = apply_transaction(store, &osr, std::move(t));
+    ASSERT_EQ(r, 0);
+    if (model.size() < 3100)
+      model.resize(3100, 0);
+    model.replace(100, 3000, data);
+
+    bufferlist in, expected;
+    expected.append(model);
+    r = store->read(cid, b, 0, model.size(), in);
+    ASSERT_EQ((int)model.size(), r);
+    ASSERT_TRUE(in.contents_equal(expected));
+  }
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, a);
+    t.remove(cid, b);
+    t.remove_collection(cid);
+    r = apply_transaction(store, &osr, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  g_conf->set_val("kstore_max_blob_size", "65536");
+  g_conf->set_val("kstore_max_extents", "64");
+  g_ceph_context->_conf->apply_changes(NULL);
+}
+
+TEST_P(StoreTest, ReadMultiTest) {
+  ObjectStore::Sequencer osr("test");
+  int r;
+  coll_t cid;
+  ghobject_t a(hobject_t(sobject_t("multi_a", CEPH_NOSNAP)));
+  ghobject_t b(hobject_t(sobject_t("multi_b", CEPH_NOSNAP)));
+  ghobject_t missing(hobject_t(sobject_t("multi_missing", CEPH_NOSNAP)));
+  string adata, bdata;
+  for (unsigned i = 0; i < 10000; ++i)
+    adata.push_back('a' + i % 26);
+  bdata = string(3000, 'b');
+  {
+    bufferlist abl, bbl;
+    abl.append(adata);
+    bbl.append(bdata);
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    t.write(cid, a, 0, abl.length(), abl);
+    t.write(cid, b, 0, bbl.length(), bbl);
+    r = apply_transaction(store, &osr, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  {
+    vector<ObjectStore::read_multi_op_t> ops;
+    ops.push_back(ObjectStore::read_multi_op_t(a));
+    // back-to-back, disjoint, whole object and past the end
+    ops.back().extents.push_back(ObjectStore::read_extent_t(0, 100));
+    ops.back().extents.push_back(ObjectStore::read_extent_t(100, 200));
+    ops.back().extents.push_back(ObjectStore::read_extent_t(5000, 100));
+    ops.back().extents.push_back(ObjectStore::read_extent_t(0, 0));
+    ops.back().extents.push_back(ObjectStore::read_extent_t(9900, 1000));
+    ops.push_back(ObjectStore::read_multi_op_t(missing));
+    ops.back().extents.push_back(ObjectStore::read_extent_t(0, 100));
+    ops.push_back(ObjectStore::read_multi_op_t(b));
+    ops.back().extents.push_back(ObjectStore::read_extent_t(0, 0));
+    r = store->read_multi(cid, ops);
+    ASSERT_EQ(0, r);
+
+    ASSERT_EQ(0, ops[0].r);
+    ASSERT_EQ(5u, ops[0].bls.size());
+    uint64_t want[5][2] = {{0, 100}, {100, 200}, {5000, 100}, {0, 10000},
+			   {9900, 100}};
+    for (unsigned i = 0; i < 5; ++i) {
+      bufferlist expected;
+      expected.append(adata.substr(want[i][0], want[i][1]));
+      ASSERT_TRUE(ops[0].bls[i].contents_equal(expected));
+    }
+    ASSERT_EQ(-ENOENT, ops[1].r);
+    ASSERT_EQ(0, ops[2].r);
+    bufferlist expected;
+    expected.append(bdata);
+    ASSERT_TRUE(ops[2].bls[0].contents_equal(expected));
+
+    // and through a collection handle
+    ObjectStore::CollectionHandle ch = store->open_collection(cid);
+    ASSERT_TRUE(ch);
+    for (auto& op : ops)
+      op.bls.clear();
+    r = store->read_multi(ch, ops);
+    ASSERT_EQ(0, r);
+    ASSERT_EQ(-ENOENT, ops[1].r);
+    ASSERT_TRUE(ops[2].bls[0].contents_equal(expected));
+  }
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, a);
+    t.remove(cid, b);
+    t.remove_collection(cid);
+    r = apply_transaction(store, &osr, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
 TEST_P(StoreTest, SimpleObjectTest) {
   ObjectStore::Sequencer osr("test");
   int r;
@@ -804,6 +1051,284 @@ TEST_P(StoreTest, AppendZeroTrailingSharedBlock) {
   }
 }
 
+TEST_P(StoreTest, CompressionOverwrites) {
+  ObjectStore::Sequencer osr("test");
+  int r;
+  coll_t cid;
+  ghobject_t a(hobject_t(sobject_t("fooo", CEPH_NOSNAP)));
+  ghobject_t b(hobject_t(sobject_t("fooo", 1)));
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    cerr << "Creating collection " << cid << std::endl;
+    r = store->apply_transaction(&osr, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  pool_opts_t opts;
+  opts.set(pool_opts_t::COMPRESSION_MODE, std::string("force"));
+  r = store->set_collection_opts(cid, opts);
+  if (r == -EOPNOTSUPP) {
+    ObjectStore::Transaction t;
+    t.remove_collection(cid);
+    r = store->apply_transaction(&osr, std::move(t));
+    ASSERT_EQ(r, 0);
+    return;
+  }
+  ASSERT_EQ(0, r);
+
+  unsigned blob_size = g_conf->bluestore_compression_blob_size;
+  unsigned size = blob_size * 4 + 1234;
+  string expected;
+  while (expected.size() < size)
+    expected += stringify(expected.size() % 1000) + " ";
+  expected.resize(size);
+  auto check = [&](const ghobject_t& o, const string& want) {
+    bufferlist actual;
+    ASSERT_EQ((int)want.size(),
+	      store->read(cid, o, 0, want.size() + 1, actual));
+    bufferlist w;
+    w.append(want);
+    ASSERT_TRUE(w.contents_equal(actual));
+  };
+  {
+    bufferlist bl;
+    bl.append(expected);
+    ObjectStore::Transaction t;
+    t.write(cid, a, 0, bl.length(), bl, 0);
+    r = store->apply_transaction(&osr, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  check(a, expected);
+  {
+    // partial overwrite of a compressed blob
+    string s(100, 'x');
+    bufferlist bl;
+    bl.append(s);
+    ObjectStore::Transaction t;
+    t.write(cid, a, blob_size + 10, bl.length(), bl, 0);
+    r = store->apply_transaction(&osr, std::move(t));
+    ASSERT_EQ(r, 0);
+    expected.replace(blob_size + 10, s.size(), s);
+  }
+  check(a, expected);
+  {
+    ObjectStore::Transaction t;
+    t.zero(cid, a, blob_size * 2 - 5, 500);
+    r = store->apply_transaction(&osr, std::move(t));
+    ASSERT_EQ(r, 0);
+    expected.replace(blob_size * 2 - 5, 500, string(500, '\0'));
+  }
+  check(a, expected);
+  string cloned = expected;
+  {
+    ObjectStore::Transaction t;
+    t.clone(cid, a, b);
+    t.truncate(cid, a, blob_size * 3 + 17);
+    r = store->apply_transaction(&osr, std::move(t));
+    ASSERT_EQ(r, 0);
+    expected.resize(blob_size * 3 + 17);
+  }
+  check(a, expected);
+  check(b, cloned);
+  {
+    // overwrite a shared blob in the clone
+    string s(blob_size / 2, 'y');
+    bufferlist bl;
+    bl.append(s);
+    ObjectStore::Transaction t;
+    t.write(cid, b, blob_size * 3 + 7, bl.length(), bl, 0);
+    r = store->apply_transaction(&osr, std::move(t));
+    ASSERT_EQ(r, 0);
+    cloned.replace(blob_size * 3 + 7, s.size(), s);
+  }
+  check(a, expected);
+  check(b, cloned);
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, a);
+    t.remove(cid, b);
+    t.remove_collection(cid);
+    cerr << "Cleaning" << std::endl;
+    r = store->apply_transaction(&osr, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_P(StoreTest, CachedReadsAfterOverwrite) {
+  ObjectStore::Sequencer osr("test");
+  int r;
+  coll_t cid;
+  ghobject_t a(hobject_t(sobject_t("fooo", CEPH_NOSNAP)));
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    cerr << "Creating collection " << cid << std::endl;
+    r = store->apply_transaction(&osr, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  unsigned size = 65536 * 3 + 100;
+  string expected;
+  while (expected.size() < size)
+    expected += stringify(expected.size() % 1000) + " ";
+  expected.resize(size);
+  auto check = [&](uint64_t off, uint64_t len) {
+    bufferlist actual;
+    ASSERT_EQ((int)len, store->read(cid, a, off, len, actual));
+    bufferlist w;
+    w.append(expected.substr(off, len));
+    ASSERT_TRUE(w.contents_equal(actual));
+  };
+  auto write = [&](uint64_t off, const string& s, uint32_t flags) {
+    bufferlist bl;
+    bl.append(s);
+    ObjectStore::Transaction t;
+    t.write(cid, a, off, bl.length(), bl, flags);
+    ASSERT_EQ(0, store->apply_transaction(&osr, std::move(t)));
+    if (off + s.size() > expected.size())
+      expected.resize(off + s.size());
+    expected.replace(off, s.size(), s);
+  };
+  write(0, expected, 0);
+  check(0, expected.size());
+  check(0, expected.size());
+  write(1000, string(4000, 'x'), 0);
+  check(0, expected.size());
+  check(900, 200);
+  {
+    ObjectStore::Transaction t;
+    t.zero(cid, a, 70000, 10000);
+    ASSERT_EQ(0, store->apply_transaction(&osr, std::move(t)));
+    expected.replace(70000, 10000, string(10000, '\0'));
+  }
+  check(65536, 65536);
+  {
+    ObjectStore::Transaction t;
+    t.truncate(cid, a, 100000);
+    ASSERT_EQ(0, store->apply_transaction(&osr, std::move(t)));
+    expected.resize(100000);
+  }
+  check(0, expected.size());
+  write(50000, string(100, 'y'), CEPH_OSD_OP_FLAG_FADVISE_DONTNEED);
+  write(expected.size() - 10, string(50, 'z'), 0);
+  check(0, expected.size());
+
+  // squeeze the cache so reads have to evict
+  string old_size = stringify(g_conf->bluestore_cache_size);
+  g_conf->set_val("bluestore_cache_size", "65536");
+  g_ceph_context->_conf->apply_changes(NULL);
+  for (unsigned i = 0; i < 3; ++i) {
+    for (uint64_t off = 0; off < expected.size(); off += 7000) {
+      check(off, MIN(9000, expected.size() - off));
+    }
+  }
+  write(12345, string(3000, 'w'), 0);
+  check(0, expected.size());
+  g_conf->set_val("bluestore_cache_size", old_size.c_str());
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  {
+    store->umount();
+    ASSERT_EQ(0, store->mount());
+  }
+  check(0, expected.size());
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, a);
+    t.remove_collection(cid);
+    cerr << "Cleaning" << std::endl;
+    r = store->apply_transaction(&osr, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_P(StoreTest, WALBatchSmallOverwrites) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  g_conf->set_val("bluestore_sync_wal_apply", "false");
+  g_conf->set_val("bluestore_wal_batch_ops", "4");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  ObjectStore::Sequencer osr_a("test_a"), osr_b("test_b");
+  int r;
+  coll_t cid_a(spg_t(pg_t(0, 1), shard_id_t::NO_SHARD));
+  coll_t cid_b(spg_t(pg_t(1, 1), shard_id_t::NO_SHARD));
+  ghobject_t a(hobject_t(sobject_t("Object a", CEPH_NOSNAP)));
+  ghobject_t b(hobject_t(sobject_t("Object b", CEPH_NOSNAP)));
+  unsigned size = 65536 * 2;
+  string expected_a(size, 'a'), expected_b(size, 'b');
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid_a, 0);
+    bufferlist bl;
+    bl.append(expected_a);
+    t.write(cid_a, a, 0, bl.length(), bl, 0);
+    r = store->apply_transaction(&osr_a, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid_b, 0);
+    bufferlist bl;
+    bl.append(expected_b);
+    t.write(cid_b, b, 0, bl.length(), bl, 0);
+    r = store->apply_transaction(&osr_b, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+
+  // lots of small, overlapping, unaligned overwrites from two sequencers
+  auto overwrite = [&](ObjectStore::Sequencer *osr, coll_t cid,
+		       ghobject_t& o, string& expected, unsigned i) {
+    ObjectStore::Transaction t;
+    uint64_t off = rand() % (size - 5000);
+    if (i % 7 == 0) {
+      uint64_t len = rand() % 5000 + 1;
+      t.zero(cid, o, off, len);
+      expected.replace(off, len, string(len, '\0'));
+    } else {
+      string s(rand() % 3000 + 1, 'A' + i % 26);
+      bufferlist bl;
+      bl.append(s);
+      t.write(cid, o, off, bl.length(), bl, 0);
+      expected.replace(off, s.size(), s);
+    }
+    ASSERT_EQ(0, store->queue_transaction(osr, std::move(t), nullptr));
+  };
+  for (unsigned i = 0; i < 200; ++i) {
+    overwrite(&osr_a, cid_a, a, expected_a, i);
+    overwrite(&osr_b, cid_b, b, expected_b, i + 13);
+  }
+  osr_a.flush();
+  osr_b.flush();
+
+  auto check = [&](coll_t cid, ghobject_t& o, const string& expected) {
+    bufferlist actual, want;
+    ASSERT_EQ((int)size, store->read(cid, o, 0, size, actual));
+    want.append(expected);
+    ASSERT_TRUE(want.contents_equal(actual));
+  };
+  check(cid_a, a, expected_a);
+  check(cid_b, b, expected_b);
+  {
+    store->umount();
+    ASSERT_EQ(0, store->mount());
+  }
+  check(cid_a, a, expected_a);
+  check(cid_b, b, expected_b);
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid_a, a);
+    t.remove_collection(cid_a);
+    t.remove(cid_b, b);
+    t.remove_collection(cid_b);
+    cerr << "Cleaning" << std::endl;
+    r = store->apply_transaction(&osr_a, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  g_conf->set_val("bluestore_sync_wal_apply", "true");
+  g_conf->set_val("bluestore_wal_batch_ops", "32");
+  g_ceph_context->_conf->apply_changes(NULL);
+}
+
 TEST_P(StoreTest, SmallSequentialUnaligned) {
   ObjectStore::Sequencer osr("test");
   int r;
@@ -3612,6 +4137,250 @@ TEST_P(StoreTest, SetAllocHint) {
   }
 }
 
+#if defined(HAVE_LIBAIO)
+static string wait_for_online_fsck(BlueStore *bstore)
+{
+  JSONFormatter f(false);
+  while (true) {
+    f.reset();
+    f.open_object_section("fsck");
+    bstore->dump_online_fsck(&f);
+    f.close_section();
+    stringstream ss;
+    f.flush(ss);
+    if (ss.str().find("\"state\":\"finished\"") != string::npos)
+      return ss.str();
+    usleep(10000);
+  }
+}
+
+TEST_P(StoreTest, OnlineFsck) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  g_conf->set_val("bluestore_fsck_online_batch", "4");
+  g_conf->set_val("bluestore_fsck_online_objects_per_sec", "0");
+  g_ceph_context->_conf->apply_changes(NULL);
+  BlueStore *bstore = static_cast<BlueStore*>(store.get());
+
+  ObjectStore::Sequencer osr("test");
+  vector<coll_t> cids;
+  for (unsigned i = 0; i < 3; ++i) {
+    coll_t cid(spg_t(pg_t(i, 1), shard_id_t::NO_SHARD));
+    cids.push_back(cid);
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    for (unsigned j = 0; j < 20; ++j) {
+      ghobject_t o(hobject_t(sobject_t("obj" + stringify(j), CEPH_NOSNAP)));
+      bufferlist bl;
+      bl.append(string(8192 * (j % 3 + 1), 'a' + j));
+      t.write(cid, o, 0, bl.length(), bl, 0);
+      if (j % 4 == 0) {
+	map<string,bufferlist> m;
+	m["k"] = bl;
+	t.omap_setkeys(cid, o, m);
+      }
+    }
+    ASSERT_EQ(0, apply_transaction(store, &osr, std::move(t)));
+  }
+
+  // keep writing while the check runs
+  ASSERT_EQ(0, bstore->start_online_fsck());
+  ASSERT_EQ(-EBUSY, bstore->start_online_fsck());
+  for (unsigned i = 0; i < 50; ++i) {
+    ObjectStore::Transaction t;
+    coll_t& cid = cids[i % cids.size()];
+    ghobject_t o(hobject_t(sobject_t("obj" + stringify(i % 20), CEPH_NOSNAP)));
+    if (i % 5 == 0) {
+      t.remove(cid, o);
+    } else {
+      bufferlist bl;
+      bl.append(string(4096, 'A' + i % 26));
+      t.write(cid, o, (i % 4) * 4096, bl.length(), bl, 0);
+    }
+    ASSERT_EQ(0, store->queue_transaction(&osr, std::move(t), nullptr));
+  }
+  osr.flush();
+
+  string status = wait_for_online_fsck(bstore);
+  cout << status << std::endl;
+  ASSERT_NE(string::npos, status.find("\"errors\":0,"));
+  ASSERT_EQ(string::npos, status.find("\"objects\":0,"));
+
+  // can be stopped part way, and started again
+  g_conf->set_val("bluestore_fsck_online_objects_per_sec", "10");
+  g_ceph_context->_conf->apply_changes(NULL);
+  ASSERT_EQ(0, bstore->start_online_fsck());
+  bstore->stop_online_fsck();
+  ASSERT_EQ(0, bstore->start_online_fsck());
+
+  g_conf->set_val("bluestore_fsck_online_batch", "64");
+  g_conf->set_val("bluestore_fsck_online_objects_per_sec", "1000");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  for (auto& cid : cids) {
+    vector<ghobject_t> objects;
+    ASSERT_EQ(0, store->collection_list(cid, ghobject_t(),
+					ghobject_t::get_max(), true, INT_MAX,
+					&objects, 0));
+    ObjectStore::Transaction t;
+    for (auto& o : objects)
+      t.remove(cid, o);
+    t.remove_collection(cid);
+    ASSERT_EQ(0, apply_transaction(store, &osr, std::move(t)));
+  }
+}
+
+TEST_P(StoreTest, CsumCoverageSurvivesOverwrites) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  // with the default crc32c over 4k chunks
+  BlueStore *bstore = static_cast<BlueStore*>(store.get());
+
+  ObjectStore::Sequencer osr("test");
+  coll_t cid;
+  ghobject_t a(hobject_t(sobject_t("a", CEPH_NOSNAP)));
+  ghobject_t b(hobject_t(sobject_t("b", CEPH_NOSNAP)));
+  const uint64_t size = 256 * 1024;
+  const size_t nchunks = size / 4096;
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    bufferlist bl;
+    bl.append(string(size, 'a'));
+    t.write(cid, a, 0, bl.length(), bl, 0);
+    ASSERT_EQ(0, apply_transaction(store, &osr, std::move(t)));
+  }
+  ObjectStore::CollectionHandle ch = store->open_collection(cid);
+  size_t valid, chunks;
+  ASSERT_EQ(0, bstore->get_csum_coverage(cid, a, &valid, &chunks));
+  ASSERT_EQ(nchunks, chunks);
+  ASSERT_EQ(nchunks, valid);
+  ASSERT_TRUE(store->has_builtin_csum(ch, a));
+
+  // block-sized overwrites in place keep every chunk covered
+  for (unsigned i = 0; i < 40; ++i) {
+    ObjectStore::Transaction t;
+    bufferlist bl;
+    bl.append(string(4096, 'b' + i % 20));
+    t.write(cid, a, ((i * 7) % nchunks) * 4096, bl.length(), bl, 0);
+    ASSERT_EQ(0, apply_transaction(store, &osr, std::move(t)));
+  }
+  ASSERT_EQ(0, bstore->get_csum_coverage(cid, a, &valid, &chunks));
+  ASSERT_EQ(nchunks, valid);
+
+  // a partial overwrite only drops the chunk it touches...
+  {
+    ObjectStore::Transaction t;
+    bufferlist bl;
+    bl.append(string(100, 'x'));
+    t.write(cid, a, 10 * 4096 + 300, bl.length(), bl, 0);
+    ASSERT_EQ(0, apply_transaction(store, &osr, std::move(t)));
+  }
+  ASSERT_EQ(0, bstore->get_csum_coverage(cid, a, &valid, &chunks));
+  ASSERT_EQ(nchunks - 1, valid);
+  ASSERT_FALSE(store->has_builtin_csum(ch, a));
+  // ...until that chunk is written whole again
+  {
+    ObjectStore::Transaction t;
+    bufferlist bl;
+    bl.append(string(4096, 'y'));
+    t.write(cid, a, 10 * 4096, bl.length(), bl, 0);
+    ASSERT_EQ(0, apply_transaction(store, &osr, std::move(t)));
+  }
+  ASSERT_EQ(0, bstore->get_csum_coverage(cid, a, &valid, &chunks));
+  ASSERT_EQ(nchunks, valid);
+  ASSERT_TRUE(store->has_builtin_csum(ch, a));
+
+  // overwriting a clone copies the shared data with its checksums
+  {
+    ObjectStore::Transaction t;
+    t.clone(cid, a, b);
+    bufferlist bl;
+    bl.append(string(4096, 'z'));
+    t.write(cid, b, 5 * 4096, bl.length(), bl, 0);
+    ASSERT_EQ(0, apply_transaction(store, &osr, std::move(t)));
+  }
+  ASSERT_EQ(0, bstore->get_csum_coverage(cid, b, &valid, &chunks));
+  ASSERT_EQ(nchunks, valid);
+  ASSERT_TRUE(store->has_builtin_csum(ch, b));
+  {
+    bufferlist bl;
+    ASSERT_EQ((int)size, store->read(cid, b, 0, size, bl));
+    ASSERT_EQ('z', bl[5 * 4096]);
+    ASSERT_EQ('y', bl[10 * 4096]);
+  }
+
+  // a tail sub-chunk is never read whole, so it is not covered
+  {
+    ObjectStore::Transaction t;
+    bufferlist bl;
+    bl.append(string(100, 't'));
+    t.write(cid, b, size, bl.length(), bl, 0);
+    ASSERT_EQ(0, apply_transaction(store, &osr, std::move(t)));
+  }
+  ASSERT_FALSE(store->has_builtin_csum(ch, b));
+
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, a);
+    t.remove(cid, b);
+    t.remove_collection(cid);
+    ASSERT_EQ(0, apply_transaction(store, &osr, std::move(t)));
+  }
+}
+
+TEST_P(StoreTest, OnlineFsckFindsErrors) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  g_conf->set_val("bluestore_fsck_online_batch", "4");
+  g_conf->set_val("bluestore_fsck_online_objects_per_sec", "0");
+  g_ceph_context->_conf->apply_changes(NULL);
+  BlueStore *bstore = static_cast<BlueStore*>(store.get());
+
+  ObjectStore::Sequencer osr("test");
+  coll_t cid(spg_t(pg_t(0, 1), shard_id_t::NO_SHARD));
+  ghobject_t bad(hobject_t(sobject_t("obj3", CEPH_NOSNAP)));
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    for (unsigned j = 0; j < 10; ++j) {
+      ghobject_t o(hobject_t(sobject_t("obj" + stringify(j), CEPH_NOSNAP)));
+      bufferlist bl;
+      bl.append(string(65536, 'a' + j));
+      t.write(cid, o, 0, bl.length(), bl, 0);
+    }
+    ASSERT_EQ(0, apply_transaction(store, &osr, std::move(t)));
+  }
+
+  // space the object still uses is marked free
+  bstore->inject_false_free(cid, bad);
+  ASSERT_EQ(0, bstore->start_online_fsck());
+  string status = wait_for_online_fsck(bstore);
+  cout << status << std::endl;
+  ASSERT_EQ(string::npos, status.find("\"errors\":0,"));
+  ASSERT_NE(string::npos, status.find("obj3"));
+
+  // put it back; a clean store checks clean again
+  bstore->inject_false_free(cid, bad, false);
+  ASSERT_EQ(0, bstore->start_online_fsck());
+  status = wait_for_online_fsck(bstore);
+  ASSERT_NE(string::npos, status.find("\"errors\":0,"));
+
+  g_conf->set_val("bluestore_fsck_online_batch", "64");
+  g_conf->set_val("bluestore_fsck_online_objects_per_sec", "1000");
+  g_ceph_context->_conf->apply_changes(NULL);
+  {
+    ObjectStore::Transaction t;
+    for (unsigned j = 0; j < 10; ++j)
+      t.remove(cid,
+	       ghobject_t(hobject_t(sobject_t("obj" + stringify(j),
+					      CEPH_NOSNAP))));
+    t.remove_collection(cid);
+    ASSERT_EQ(0, apply_transaction(store, &osr, std::move(t)));
+  }
+}
+#endif
+
 TEST_P(StoreTest, TryMoveRename) {
   ObjectStore::Sequencer osr("test");
   coll_t cid;
@@ -0,0 +1,210 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <stdio.h>
+#include <string.h>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include "global/global_init.h"
+#include "common/ceph_argparse.h"
+#include "common/WorkQueue.h"
+#include <gtest/gtest.h>
+
+#include "os/bluestore/PolledQueue.h"
+
+/*
+ * NVMEDevice keeps its per-thread nvme queue pairs in a PolledQueueSet:
+ * op shard worker threads claim one with bind() when they start, and
+ * aio_submit() uses get() to pick the polled or the shared path.  These
+ * tests drive that claiming code directly, with a queue that remembers
+ * which thread built it, since queue pairs have to be created in the
+ * thread that uses them.
+ */
+struct TestQueue : public PolledQueue {
+  std::thread::id owner;
+  TestQueue() : owner(std::this_thread::get_id()) {}
+  int poll(unsigned max) override { return 0; }
+};
+
+static PolledQueueSet::factory_t test_factory(std::atomic<int> *created)
+{
+  return [created]() -> PolledQueue* {
+    ++*created;
+    return new TestQueue;
+  };
+}
+
+static bool built_here(PolledQueue *q)
+{
+  return q &&
+    static_cast<TestQueue*>(q)->owner == std::this_thread::get_id();
+}
+
+TEST(PolledQueueSet, bind)
+{
+  std::atomic<int> created = {0};
+  PolledQueueSet qs(2, test_factory(&created));
+
+  // threads that never bind, like this one, use the shared path
+  ASSERT_FALSE(qs.get());
+  ASSERT_EQ(0, created.load());
+
+  std::vector<PolledQueue*> got(3);
+  std::vector<bool> ok(3);
+  std::vector<std::thread> threads;
+  for (unsigned slot = 0; slot < got.size(); ++slot) {
+    threads.push_back(std::thread([&, slot]() {
+	  got[slot] = qs.bind(slot);
+	  ok[slot] = got[slot] == qs.get() &&
+	    (!got[slot] || built_here(got[slot]));
+	}));
+  }
+  for (auto& t : threads)
+    t.join();
+  for (unsigned slot = 0; slot < got.size(); ++slot)
+    ASSERT_TRUE(ok[slot]);
+  ASSERT_TRUE(got[0]);
+  ASSERT_TRUE(got[1]);
+  ASSERT_NE(got[0], got[1]);
+  ASSERT_FALSE(got[2]);  // past max_queues
+  ASSERT_EQ(2, created.load());
+  ASSERT_EQ(2u, qs.get_num_queues());
+  ASSERT_EQ(2u, qs.get_num_shared());  // this thread and slot 2
+}
+
+TEST(PolledQueueSet, slot_taken)
+{
+  std::atomic<int> created = {0};
+  PolledQueueSet qs(4, test_factory(&created));
+  PolledQueue *mine = qs.bind(1);
+  ASSERT_TRUE(built_here(mine));
+  ASSERT_EQ(mine, qs.bind(1));
+  ASSERT_EQ(mine, qs.bind(2));  // a thread keeps the queue it has
+
+  PolledQueue *other = nullptr, *other_get = nullptr;
+  std::thread t([&]() {
+      other = qs.bind(1);
+      other_get = qs.get();
+    });
+  t.join();
+  ASSERT_FALSE(other);
+  ASSERT_FALSE(other_get);
+  ASSERT_EQ(1, created.load());
+  ASSERT_EQ(1u, qs.get_num_shared());
+}
+
+TEST(PolledQueueSet, get_then_bind)
+{
+  std::atomic<int> created = {0};
+  PolledQueueSet qs(1, test_factory(&created));
+  ASSERT_FALSE(qs.get());
+  ASSERT_EQ(1u, qs.get_num_shared());
+  PolledQueue *q = qs.bind(0);
+  ASSERT_TRUE(built_here(q));
+  ASSERT_EQ(q, qs.get());
+  ASSERT_EQ(0u, qs.get_num_shared());
+}
+
+TEST(PolledQueueSet, per_set)
+{
+  std::atomic<int> created = {0};
+  PolledQueueSet a(1, test_factory(&created));
+  PolledQueueSet b(1, test_factory(&created));
+  ASSERT_TRUE(a.bind(0));
+  ASSERT_FALSE(b.get());
+  ASSERT_TRUE(b.bind(0));
+  ASSERT_NE(a.get(), b.get());
+}
+
+TEST(PolledQueueSet, factory_failure)
+{
+  PolledQueueSet none(0, []() -> PolledQueue* {
+      assert(0 == "not reached");
+      return nullptr;
+    });
+  ASSERT_FALSE(none.bind(0));
+  ASSERT_FALSE(none.get());
+  ASSERT_EQ(1u, none.get_num_shared());
+
+  PolledQueueSet failing(4, []() -> PolledQueue* { return nullptr; });
+  ASSERT_FALSE(failing.bind(0));
+  ASSERT_FALSE(failing.get());
+  ASSERT_EQ(0u, failing.get_num_queues());
+  ASSERT_EQ(1u, failing.get_num_shared());
+}
+
+/*
+ * A sharded work queue that binds its workers the way the OSD's op
+ * queue does, and records what each worker then gets from the set.
+ */
+class BindingWQ : public ShardedThreadPool::ShardedWQ<int> {
+public:
+  PolledQueueSet &qs;
+  std::mutex lock;
+  std::map<uint32_t, bool> polled;   ///< thread_index -> got a queue
+  std::map<uint32_t, bool> own;      ///< thread_index -> built by itself
+
+  BindingWQ(PolledQueueSet &q, ShardedThreadPool *tp)
+    : ShardedThreadPool::ShardedWQ<int>(60, 120, tp), qs(q) {}
+
+  void _thread_start(uint32_t thread_index) override {
+    qs.bind(thread_index);
+  }
+  void _process(uint32_t thread_index, heartbeat_handle_d *hb) override {
+    PolledQueue *q = qs.get();
+    {
+      std::lock_guard<std::mutex> l(lock);
+      polled[thread_index] = q != nullptr;
+      own[thread_index] = !q || built_here(q);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  void _enqueue(int) override {}
+  void _enqueue_front(int) override {}
+  void return_waiting_threads() override {}
+  bool is_shard_empty(uint32_t thread_index) override { return true; }
+};
+
+TEST(PolledQueueSet, op_threads)
+{
+  const unsigned num_threads = 6, max_queues = 4;
+  std::atomic<int> created = {0};
+  PolledQueueSet qs(max_queues, test_factory(&created));
+  ShardedThreadPool tp(g_ceph_context, "test_bdev_polled", "tp_test",
+		       num_threads);
+  BindingWQ wq(qs, &tp);
+  tp.start();
+  while (true) {
+    {
+      std::lock_guard<std::mutex> l(wq.lock);
+      if (wq.polled.size() == num_threads)
+	break;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  tp.stop();
+
+  for (uint32_t i = 0; i < num_threads; ++i) {
+    ASSERT_EQ(i < max_queues, wq.polled[i]) << "thread " << i;
+    ASSERT_TRUE(wq.own[i]) << "thread " << i;
+  }
+  ASSERT_EQ((int)max_queues, created.load());
+  ASSERT_EQ(max_queues, qs.get_num_queues());
+
+  // and a thread outside the pool stays on the shared path
+  ASSERT_FALSE(qs.get());
+}
+
+int main(int argc, char **argv) {
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+  env_to_vec(args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
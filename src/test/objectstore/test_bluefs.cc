@@ -131,6 +131,115 @@ TEST(BlueFS, small_appends) {
   rm_temp_bdev(fn);
 }
 
+static void write_file(BlueFS& fs, const string& dir, const string& name,
+		       uint64_t len, char c)
+{
+  BlueFS::FileWriter *h;
+  ASSERT_EQ(0, fs.open_for_write(dir, name, &h, false));
+  bufferptr bp(1048576);
+  memset(bp.c_str(), c, bp.length());
+  for (uint64_t i = 0; i < len; i += bp.length()) {
+    bufferlist bl;
+    bl.append(bp);
+    h->append(bl);
+  }
+  fs.fsync(h);
+  fs.close_writer(h);
+}
+
+static void verify_file(BlueFS& fs, const string& dir, const string& name,
+			uint64_t len, char c)
+{
+  BlueFS::FileReader *h;
+  ASSERT_EQ(0, fs.open_for_read(dir, name, &h));
+  BlueFS::FileReaderBuffer buf(1048576);
+  for (uint64_t off = 0; off < len; off += 1048576) {
+    bufferlist bl;
+    ASSERT_EQ(1048576, fs.read(h, &buf, off, 1048576, &bl, NULL));
+    const char *p = bl.c_str();
+    for (unsigned i = 0; i < bl.length(); ++i) {
+      ASSERT_EQ(c, p[i]);
+    }
+  }
+  delete h;
+}
+
+TEST(BlueFS, spillover) {
+  uint64_t db_size = 1048576 * 16;
+  uint64_t slow_size = 1048576 * 128;
+  string db_fn = get_temp_bdev(db_size);
+  string slow_fn = get_temp_bdev(slow_size);
+  BlueFS fs;
+  ASSERT_EQ(0, fs.add_block_device(BlueFS::BDEV_DB, db_fn));
+  fs.add_block_extent(BlueFS::BDEV_DB, 1048576, db_size - 1048576);
+  ASSERT_EQ(0, fs.add_block_device(BlueFS::BDEV_SLOW, slow_fn));
+  fs.add_block_extent(BlueFS::BDEV_SLOW, 0, slow_size);
+  uuid_d fsid;
+  ASSERT_EQ(0, fs.mkfs(fsid));
+  ASSERT_EQ(0, fs.mount());
+  ASSERT_EQ(0, fs.mkdir("db"));
+  // more than the db device can hold
+  write_file(fs, "db", "big", 1048576 * 32, 'a');
+  ASSERT_LT(fs.get_free(BlueFS::BDEV_SLOW), slow_size);
+  verify_file(fs, "db", "big", 1048576 * 32, 'a');
+  fs.umount();
+
+  ASSERT_EQ(0, fs.mount());
+  verify_file(fs, "db", "big", 1048576 * 32, 'a');
+  fs.umount();
+  rm_temp_bdev(db_fn);
+  rm_temp_bdev(slow_fn);
+}
+
+TEST(BlueFS, tier_demote) {
+  uint64_t db_size = 1048576 * 64;
+  uint64_t slow_size = 1048576 * 128;
+  string db_fn = get_temp_bdev(db_size);
+  string slow_fn = get_temp_bdev(slow_size);
+  g_ceph_context->_conf->set_val("bluefs_tier_interval", "0.1");
+  g_ceph_context->_conf->set_val("bluefs_tier_high_ratio", "0.5");
+  g_ceph_context->_conf->set_val("bluefs_tier_low_ratio", "0.25");
+  g_ceph_context->_conf->apply_changes(NULL);
+  BlueFS fs;
+  ASSERT_EQ(0, fs.add_block_device(BlueFS::BDEV_DB, db_fn));
+  fs.add_block_extent(BlueFS::BDEV_DB, 1048576, db_size - 1048576);
+  ASSERT_EQ(0, fs.add_block_device(BlueFS::BDEV_SLOW, slow_fn));
+  fs.add_block_extent(BlueFS::BDEV_SLOW, 0, slow_size);
+  uuid_d fsid;
+  ASSERT_EQ(0, fs.mkfs(fsid));
+  ASSERT_EQ(0, fs.mount());
+  ASSERT_EQ(0, fs.mkdir("db"));
+  uint64_t total = fs.get_total(BlueFS::BDEV_DB);
+  for (unsigned i = 0; i < 6; ++i) {
+    write_file(fs, "db", stringify(i), 1048576 * 8, 'a' + i);
+  }
+  ASSERT_GT(total - fs.get_free(BlueFS::BDEV_DB), total / 2);
+
+  // cold files move to the slow device
+  for (unsigned i = 0; i < 100; ++i) {
+    if (total - fs.get_free(BlueFS::BDEV_DB) <= total / 4)
+      break;
+    usleep(100000);
+  }
+  ASSERT_LE(total - fs.get_free(BlueFS::BDEV_DB), total / 4);
+  for (unsigned i = 0; i < 6; ++i) {
+    verify_file(fs, "db", stringify(i), 1048576 * 8, 'a' + i);
+  }
+  fs.umount();
+
+  ASSERT_EQ(0, fs.mount());
+  for (unsigned i = 0; i < 6; ++i) {
+    verify_file(fs, "db", stringify(i), 1048576 * 8, 'a' + i);
+  }
+  fs.umount();
+  g_ceph_context->_conf->set_val("bluefs_tier_interval", "5");
+  g_ceph_context->_conf->set_val("bluefs_tier_high_ratio", ".9");
+  g_ceph_context->_conf->set_val("bluefs_tier_low_ratio", ".75");
+  g_ceph_context->_conf->apply_changes(NULL);
+  rm_temp_bdev(db_fn);
+  rm_temp_bdev(slow_fn);
+}
+
 int main(int argc, char **argv) {
   vector<const char*> args;
   argv_to_vec(argc, (const char **)argv, args);
@@ -155,3 +155,171 @@ TEST(bluestore_extent_ref_map_t, contains)
   ASSERT_FALSE(m.contains(40, 3000));
   ASSERT_FALSE(m.contains(4000, 30));
 }
+
+TEST(bluestore_csum_t, update)
+{
+  bluestore_csum_t c;
+  c.init(bluestore_csum_t::CSUM_CRC32C, 12);
+  ASSERT_EQ(4096u, c.get_chunk_size());
+  bufferlist bl;
+  bl.append(string(4096 * 3, 'a'));
+
+  // unaligned: only the two middle chunks are fully covered
+  c.update(100, bl);
+  cout << c << std::endl;
+  ASSERT_EQ(4u, c.get_num_chunks());
+  ASSERT_FALSE(c.is_valid(0));
+  ASSERT_TRUE(c.is_valid(1));
+  ASSERT_TRUE(c.is_valid(2));
+  ASSERT_FALSE(c.is_valid(3));
+
+  c.update(0, bl);
+  ASSERT_TRUE(c.is_valid(0));
+  ASSERT_TRUE(c.is_valid(2));
+  ASSERT_FALSE(c.is_valid(3));
+
+  c.invalidate(4095, 2);
+  ASSERT_FALSE(c.is_valid(0));
+  ASSERT_FALSE(c.is_valid(1));
+  ASSERT_TRUE(c.is_valid(2));
+  ASSERT_TRUE(c.has_valid(0, 4096 * 3));
+  ASSERT_FALSE(c.has_valid(0, 4096 * 2));
+
+  c.update_zero(4096 * 8, 4096);
+  ASSERT_EQ(9u, c.get_num_chunks());
+  ASSERT_TRUE(c.is_valid(8));
+  ASSERT_FALSE(c.is_valid(5));
+
+  c.truncate(4096 * 2 + 1);
+  ASSERT_EQ(3u, c.get_num_chunks());
+  c.truncate(0);
+  ASSERT_EQ(0u, c.get_num_chunks());
+  ASSERT_FALSE(c.has_valid(0, 4096));
+}
+
+TEST(bluestore_csum_t, verify)
+{
+  for (unsigned t = bluestore_csum_t::CSUM_CRC32C;
+       t < bluestore_csum_t::CSUM_MAX;
+       ++t) {
+    cout << bluestore_csum_t::get_type_name(t) << std::endl;
+    bluestore_csum_t c;
+    c.init(t, 12);
+    bufferlist bl;
+    for (unsigned i = 0; i < 4096 * 4; ++i)
+      bl.append((char)(i * 7));
+    c.update(0, bl);
+    c.update_zero(4096 * 4, 4096);
+
+    uint64_t bad = 0;
+    ASSERT_EQ(0, c.verify(0, bl, &bad));
+    bufferlist z;
+    z.append_zero(4096);
+    ASSERT_EQ(0, c.verify(4096 * 4, z, &bad));
+    ASSERT_EQ(-EIO, c.verify(0, z, &bad));
+    ASSERT_EQ(0u, bad);
+
+    // partial chunks in the buffer are not checked
+    bufferlist sub;
+    sub.substr_of(bl, 100, 4096 * 2);
+    ASSERT_EQ(0, c.verify(100, sub, &bad));
+
+    bufferlist corrupt;
+    corrupt.append(bl.c_str(), bl.length());
+    corrupt.c_str()[4096 * 2 + 17] ^= 1;
+    ASSERT_EQ(-EIO, c.verify(0, corrupt, &bad));
+    ASSERT_EQ(4096u * 2, bad);
+
+    // ...unless the chunk is not valid
+    c.invalidate(4096 * 2, 1);
+    ASSERT_EQ(0, c.verify(0, corrupt, &bad));
+
+    bufferlist enc;
+    ::encode(c, enc);
+    bluestore_csum_t d;
+    bufferlist::iterator p = enc.begin();
+    ::decode(d, p);
+    ASSERT_EQ(c.type, d.type);
+    ASSERT_EQ(c.chunk_order, d.chunk_order);
+    ASSERT_EQ(c.values, d.values);
+    ASSERT_EQ(c.valid, d.valid);
+  }
+}
+
+TEST(bluestore_onode_t, seek_blob)
+{
+  bluestore_onode_t on;
+  ASSERT_TRUE(on.seek_blob(0) == on.blob_map.end());
+  on.blob_map[0x10000].length = 0x20000;
+  on.blob_map[0x40000].length = 0x10000;
+  ASSERT_EQ(0x10000u, on.seek_blob(0)->first);
+  ASSERT_EQ(0x10000u, on.seek_blob(0x10000)->first);
+  ASSERT_EQ(0x10000u, on.seek_blob(0x2ffff)->first);
+  ASSERT_EQ(0x40000u, on.seek_blob(0x30000)->first);
+  ASSERT_EQ(0x40000u, on.seek_blob(0x4ffff)->first);
+  ASSERT_TRUE(on.seek_blob(0x50000) == on.blob_map.end());
+}
+
+TEST(bluestore_onode_t, is_csum_covered)
+{
+  bluestore_onode_t on;
+  on.size = 0x6000;
+  on.block_map[0] = bluestore_extent_t(0x100000, 0x4000);
+  on.blob_map[0x4000].length = 0x2000;
+  ASSERT_FALSE(on.is_csum_covered());  // no csum type
+
+  on.csum.init(bluestore_csum_t::CSUM_CRC32C, 12);
+  bufferlist bl;
+  bl.append(string(on.size, 'a'));
+  on.csum.update(0, bl);
+  ASSERT_TRUE(on.is_csum_covered());
+
+  // a chunk left invalid by a partial write
+  on.csum.invalidate(0x2100, 10);
+  ASSERT_FALSE(on.is_csum_covered());
+  on.csum.update(0, bl);
+  ASSERT_TRUE(on.is_csum_covered());
+
+  // a tail chunk
+  on.size = 0x5800;
+  ASSERT_FALSE(on.is_csum_covered());
+  on.size = 0x6000;
+
+  // a chunk split across extents
+  on.block_map[0].length = 0x2800;
+  on.block_map[0x2800] = bluestore_extent_t(0x200000, 0x1800);
+  ASSERT_FALSE(on.is_csum_covered());
+  on.block_map.erase(0x2800);
+  on.block_map[0].length = 0x4000;
+
+  // unwritten extents read as zeros, so they need no alignment
+  on.block_map[0x6000] = bluestore_extent_t(0x300000, 0x800,
+					    bluestore_extent_t::FLAG_UNWRITTEN);
+  ASSERT_TRUE(on.is_csum_covered());
+
+  on.overlay_map[0x1000] = bluestore_overlay_t(1, 0, 0x100);
+  ASSERT_FALSE(on.is_csum_covered());
+}
+
+TEST(bluestore_compressed_blob_t, encode_decode)
+{
+  bluestore_compressed_blob_t b;
+  b.length = 0x40000;
+  b.compressed_length = 0x12345;
+  b.alg = 1;
+  b.extents.push_back(bluestore_extent_t(0x100000, 0x10000));
+  b.extents.push_back(bluestore_extent_t(0x300000, 0x10000));
+  ASSERT_EQ(0x20000u, b.get_allocated());
+
+  bufferlist bl;
+  ::encode(b, bl);
+  bluestore_compressed_blob_t d;
+  bufferlist::iterator p = bl.begin();
+  ::decode(d, p);
+  ASSERT_EQ(b.length, d.length);
+  ASSERT_EQ(b.compressed_length, d.compressed_length);
+  ASSERT_EQ(b.alg, d.alg);
+  ASSERT_EQ(2u, d.extents.size());
+  ASSERT_EQ(0x300000u, d.extents[1].offset);
+  ASSERT_EQ(0x10000u, d.extents[1].length);
+}
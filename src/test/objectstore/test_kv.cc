@@ -113,6 +113,83 @@ TEST_P(KVTest, PutReopen) {
   fini();
 }
 
+TEST_P(KVTest, RmRangeKeys) {
+  ASSERT_EQ(0, db->create_and_open(cout));
+  bufferlist value;
+  value.append("value");
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    for (char c = 'a'; c <= 'f'; ++c)
+      t->set("prefix", string(1, c), value);
+    t->set("prefiy", "a", value);
+    t->set("prefiy", "c", value);
+    db->submit_transaction_sync(t);
+  }
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    t->rm_range_keys("prefix", "b", "e");
+    t->rm_range_keys("prefiy", "a", "b");
+    t->rm_range_keys("prefix", "f", "a");  // empty
+    db->submit_transaction_sync(t);
+  }
+  {
+    bufferlist v;
+    ASSERT_EQ(0, db->get("prefix", "a", &v));
+    for (char c = 'b'; c < 'e'; ++c) {
+      v.clear();
+      ASSERT_EQ(-ENOENT, db->get("prefix", string(1, c), &v));
+    }
+    v.clear();
+    ASSERT_EQ(0, db->get("prefix", "e", &v));
+    v.clear();
+    ASSERT_EQ(0, db->get("prefix", "f", &v));
+    v.clear();
+    ASSERT_EQ(-ENOENT, db->get("prefiy", "a", &v));
+    v.clear();
+    ASSERT_EQ(0, db->get("prefiy", "c", &v));
+  }
+  fini();
+}
+
+TEST_P(KVTest, BoundedIterator) {
+  ASSERT_EQ(0, db->create_and_open(cout));
+  bufferlist value;
+  value.append("value");
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    for (char c = 'a'; c <= 'f'; ++c)
+      t->set("prefix", string(1, c), value);
+    t->set("prefiy", "a", value);
+    db->submit_transaction_sync(t);
+  }
+  {
+    // leave tombstones after the bound
+    KeyValueDB::Transaction t = db->get_transaction();
+    t->rmkey("prefix", "e");
+    db->submit_transaction_sync(t);
+  }
+  {
+    KeyValueDB::Iterator it = db->get_iterator("prefix", "d");
+    string keys;
+    for (it->seek_to_first(); it->valid(); it->next())
+      keys += it->key();
+    ASSERT_EQ("abc", keys);
+    it->lower_bound("b");
+    ASSERT_TRUE(it->valid());
+    ASSERT_EQ("b", it->key());
+    it->upper_bound("c");
+    ASSERT_FALSE(it->valid());
+  }
+  {
+    KeyValueDB::Iterator it = db->get_iterator("prefix", "z");
+    string keys;
+    for (it->seek_to_first(); it->valid(); it->next())
+      keys += it->key();
+    ASSERT_EQ("abcdf", keys);
+  }
+  fini();
+}
+
 TEST_P(KVTest, BenchCommit) {
   int n = 1024;
   ASSERT_EQ(0, db->create_and_open(cout));
@@ -146,6 +223,341 @@ TEST_P(KVTest, BenchCommit) {
        << std::endl;
 }
 
+struct AppendMOP : public KeyValueDB::MergeOperator {
+  virtual void merge_nonexistent(
+    const char *rdata, size_t rlen, std::string *new_value) {
+    *new_value = "?" + std::string(rdata, rlen);
+  }
+  virtual void merge(
+    const char *ldata, size_t llen,
+    const char *rdata, size_t rlen,
+    std::string *new_value) {
+    *new_value = std::string(ldata, llen) + std::string(rdata, rlen);
+  }
+  virtual string name() const {
+    return "Append";
+  }
+};
+
+string tostr(bufferlist& b) {
+  return string(b.c_str(), b.length());
+}
+
+TEST_P(KVTest, Merge) {
+  shared_ptr<KeyValueDB::MergeOperator> p(new AppendMOP);
+  int r = db->set_merge_operator("A", p);
+  if (r < 0)
+    return; // No merge operators for this database type
+  ASSERT_EQ(0, db->create_and_open(cout));
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    bufferlist v1, v2, v3;
+    v1.append(string("1"));
+    v2.append(string("2"));
+    v3.append(string("3"));
+    t->set("P", "K1", v1);
+    t->set("A", "A1", v2);
+    t->rmkey("A", "A2");
+    t->merge("A", "A2", v3);
+    db->submit_transaction_sync(t);
+  }
+  {
+    bufferlist v1, v2, v3;
+    ASSERT_EQ(0, db->get("P", "K1", &v1));
+    ASSERT_EQ(tostr(v1), "1");
+    ASSERT_EQ(0, db->get("A", "A1", &v2));
+    ASSERT_EQ(tostr(v2), "2");
+    ASSERT_EQ(0, db->get("A", "A2", &v3));
+    ASSERT_EQ(tostr(v3), "?3");
+  }
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    bufferlist v1;
+    v1.append(string("1"));
+    t->merge("A", "A2", v1);
+    db->submit_transaction_sync(t);
+  }
+  {
+    bufferlist v;
+    ASSERT_EQ(0, db->get("A", "A2", &v));
+    ASSERT_EQ(tostr(v), "?31");
+  }
+  fini();
+}
+
+TEST_P(KVTest, MergeInTransaction) {
+  shared_ptr<KeyValueDB::MergeOperator> p(new AppendMOP);
+  int r = db->set_merge_operator("A", p);
+  if (r < 0)
+    return; // No merge operators for this database type
+  ASSERT_EQ(0, db->create_and_open(cout));
+  bufferlist a, b, c;
+  a.append(string("a"));
+  b.append(string("b"));
+  c.append(string("c"));
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    t->set("A", "K1", a);
+    t->set("A", "K3", a);
+    t->set("A", "K4", a);
+    t->set("A", "K5", a);
+    db->submit_transaction_sync(t);
+  }
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    // several merges into the same key
+    t->merge("A", "K1", b);
+    t->merge("A", "K1", c);
+    // merge after set
+    t->set("A", "K2", a);
+    t->merge("A", "K2", b);
+    // set after merge
+    t->merge("A", "K3", b);
+    t->set("A", "K3", c);
+    // merge after rmkey
+    t->rmkey("A", "K4");
+    t->merge("A", "K4", b);
+    // rmkey after merge
+    t->merge("A", "K5", b);
+    t->rmkey("A", "K5");
+    // rmkeys_by_prefix of another prefix leaves pending merges alone
+    t->merge("A", "K6", a);
+    t->rmkeys_by_prefix("B");
+    t->merge("A", "K6", b);
+    db->submit_transaction_sync(t);
+  }
+  {
+    bufferlist v;
+    ASSERT_EQ(0, db->get("A", "K1", &v));
+    ASSERT_EQ(tostr(v), "abc");
+  }
+  {
+    bufferlist v;
+    ASSERT_EQ(0, db->get("A", "K2", &v));
+    ASSERT_EQ(tostr(v), "ab");
+  }
+  {
+    bufferlist v;
+    ASSERT_EQ(0, db->get("A", "K3", &v));
+    ASSERT_EQ(tostr(v), "c");
+  }
+  {
+    bufferlist v;
+    ASSERT_EQ(0, db->get("A", "K4", &v));
+    ASSERT_EQ(tostr(v), "?b");
+  }
+  {
+    bufferlist v;
+    ASSERT_EQ(-ENOENT, db->get("A", "K5", &v));
+  }
+  {
+    bufferlist v;
+    ASSERT_EQ(0, db->get("A", "K6", &v));
+    ASSERT_EQ(tostr(v), "?ab");
+  }
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    t->merge("A", "K6", c);
+    t->rmkeys_by_prefix("A");
+    db->submit_transaction_sync(t);
+  }
+  {
+    bufferlist v;
+    ASSERT_EQ(-ENOENT, db->get("A", "K6", &v));
+  }
+  fini();
+}
+
+static vector<string> dump_cf_keys(KeyValueDB::WholeSpaceIterator it)
+{
+  // only the keys this test wrote; the dir is shared with other tests
+  vector<string> keys;
+  for (; it->valid(); it->next()) {
+    pair<string,string> k = it->raw_key();
+    if (k.first.compare(0, 2, "cf") == 0)
+      keys.push_back(k.first + "/" + k.second);
+  }
+  return keys;
+}
+
+TEST_P(KVTest, ColumnFamilies) {
+  vector<KeyValueDB::ColumnFamily> cfs;
+  ASSERT_EQ(-EINVAL, KeyValueDB::parse_column_families(":x", &cfs));
+  cfs.clear();
+  ASSERT_EQ(-EINVAL, KeyValueDB::parse_column_families("cfb cfb", &cfs));
+  cfs.clear();
+  ASSERT_EQ(0, KeyValueDB::parse_column_families(
+	      "cfb  cfc:write_buffer_size=1048576,bloom_bits=10", &cfs));
+  ASSERT_EQ(2u, cfs.size());
+  ASSERT_EQ("cfb", cfs[0].prefix);
+  ASSERT_EQ("", cfs[0].options);
+  ASSERT_EQ("cfc", cfs[1].prefix);
+  ASSERT_EQ("write_buffer_size=1048576,bloom_bits=10", cfs[1].options);
+
+  vector<KeyValueDB::ColumnFamily> bad;
+  bad.push_back(KeyValueDB::ColumnFamily("cfx", "no_such_option=1"));
+  ASSERT_GT(0, db->set_column_families(bad));
+  int r = db->set_column_families(cfs);
+  if (r < 0)
+    return; // No column families for this database type
+  ASSERT_EQ(0, db->create_and_open(cout));
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    bufferlist v;
+    v.append("v");
+    t->set("cfd", "d1", v);
+    t->set("cfc", "c1", v);
+    t->set("cfb", "b2", v);
+    t->set("cfa", "a2", v);
+    t->set("cfb", "b1", v);
+    t->set("cfa", "a1", v);
+    db->submit_transaction_sync(t);
+  }
+  {
+    // whole-space iteration is in key order across column families
+    KeyValueDB::WholeSpaceIterator it = db->get_iterator();
+    it->seek_to_first();
+    vector<string> keys = dump_cf_keys(it);
+    vector<string> expected = {
+      "cfa/a1", "cfa/a2", "cfb/b1", "cfb/b2", "cfc/c1", "cfd/d1" };
+    ASSERT_EQ(expected, keys);
+
+    it = db->get_snapshot_iterator();
+    it->seek_to_first();
+    ASSERT_EQ(expected, dump_cf_keys(it));
+  }
+  {
+    // change direction in the middle
+    KeyValueDB::WholeSpaceIterator it = db->get_iterator();
+    it->lower_bound("cfb", "b2");
+    ASSERT_TRUE(it->valid());
+    ASSERT_EQ(make_pair(string("cfb"), string("b2")), it->raw_key());
+    it->prev();
+    ASSERT_EQ(make_pair(string("cfb"), string("b1")), it->raw_key());
+    it->prev();
+    ASSERT_EQ(make_pair(string("cfa"), string("a2")), it->raw_key());
+    it->next();
+    ASSERT_EQ(make_pair(string("cfb"), string("b1")), it->raw_key());
+    it->next();
+    it->next();
+    ASSERT_EQ(make_pair(string("cfc"), string("c1")), it->raw_key());
+    it->seek_to_last("cfb");
+    ASSERT_EQ(make_pair(string("cfb"), string("b2")), it->raw_key());
+    it->upper_bound("cfc", "c1");
+    ASSERT_EQ(make_pair(string("cfd"), string("d1")), it->raw_key());
+  }
+  {
+    KeyValueDB::Iterator it = db->get_iterator("cfb");
+    it->seek_to_first();
+    ASSERT_TRUE(it->valid());
+    ASSERT_EQ("b1", it->key());
+    it->next();
+    ASSERT_EQ("b2", it->key());
+    it->next();
+    ASSERT_FALSE(it->valid());
+  }
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    t->rmkeys_by_prefix("cfb");
+    db->submit_transaction_sync(t);
+  }
+  fini();
+
+  // the column families stay without being asked for again
+  init();
+  ASSERT_EQ(0, db->open(cout));
+  {
+    bufferlist v;
+    ASSERT_EQ(-ENOENT, db->get("cfb", "b1", &v));
+    ASSERT_EQ(0, db->get("cfc", "c1", &v));
+    KeyValueDB::WholeSpaceIterator it = db->get_iterator();
+    it->seek_to_first();
+    vector<string> expected = { "cfa/a1", "cfa/a2", "cfc/c1", "cfd/d1" };
+    ASSERT_EQ(expected, dump_cf_keys(it));
+  }
+  fini();
+}
+
+TEST_P(KVTest, ColumnFamilyIteratorWalk) {
+  // a fresh db, so that the only keys are ours and the column families
+  // are the ones asked for here
+  fini();
+  ASSERT_EQ(0, ::system("rm -rf kv_test_temp_dir"));
+  ASSERT_EQ(0, ::mkdir("kv_test_temp_dir", 0777));
+  init();
+
+  // cwa, cwc and cwf share the default column family and sit on either
+  // side of the others; cwe has a column family but no keys
+  vector<KeyValueDB::ColumnFamily> cfs;
+  ASSERT_EQ(0, KeyValueDB::parse_column_families("cwb cwd cwe", &cfs));
+  if (db->set_column_families(cfs) < 0)
+    return; // No column families for this database type
+  ASSERT_EQ(0, db->create_and_open(cout));
+
+  const char *prefixes[] = { "cwa", "cwb", "cwc", "cwd", "cwe", "cwf" };
+  const int num_keys[] = { 3, 2, 1, 3, 0, 2 };
+  set<pair<string,string> > model;
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    bufferlist v;
+    v.append("v");
+    for (int p = 0; p < 6; ++p) {
+      for (int k = 0; k < num_keys[p]; ++k) {
+	string key = "k" + stringify(k * 2);
+	t->set(prefixes[p], key, v);
+	model.insert(make_pair(string(prefixes[p]), key));
+      }
+    }
+    db->submit_transaction_sync(t);
+  }
+
+  // Walk the merged iterator at random, checking every step against
+  // the model: next/prev from every position, and each kind of seek
+  // in between so that both directions meet every boundary
+  typedef set<pair<string,string> >::iterator model_iter;
+  KeyValueDB::WholeSpaceIterator it = db->get_iterator();
+  model_iter m = model.end();
+  srand(1234);
+  for (int step = 0; step < 5000; ++step) {
+    string prefix = prefixes[rand() % 6];
+    string key = "k" + stringify(rand() % 6);
+    int op = rand() % 10;
+    if (op == 0) {
+      it->seek_to_first();
+      m = model.begin();
+    } else if (op == 1) {
+      it->seek_to_last();
+      m = model.empty() ? model.end() : --model.end();
+    } else if (op == 2) {
+      it->seek_to_first(prefix);
+      m = model.lower_bound(make_pair(prefix, string()));
+    } else if (op == 3) {
+      it->seek_to_last(prefix);
+      m = model.upper_bound(make_pair(prefix + '\1', string()));
+      m = m == model.begin() ? model.end() : --m;
+    } else if (op == 4) {
+      it->lower_bound(prefix, key);
+      m = model.lower_bound(make_pair(prefix, key));
+    } else if (op == 5) {
+      it->upper_bound(prefix, key);
+      m = model.upper_bound(make_pair(prefix, key));
+    } else if (m == model.end()) {
+      // next/prev on an exhausted iterator are not defined
+      continue;
+    } else if (op < 8) {
+      it->next();
+      ++m;
+    } else {
+      it->prev();
+      m = m == model.begin() ? model.end() : --m;
+    }
+    ASSERT_EQ(0, it->status());
+    ASSERT_EQ(m != model.end(), it->valid()) << "step " << step << " op " << op;
+    if (m != model.end())
+      ASSERT_EQ(*m, it->raw_key()) << "step " << step << " op " << op;
+  }
+  fini();
+}
 
 INSTANTIATE_TEST_CASE_P(
   KeyValueDB,
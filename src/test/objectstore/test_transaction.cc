@@ -151,6 +151,67 @@ TEST(Transaction, GetNumBytes)
   ASSERT_TRUE(a.get_encoded_bytes() == a.get_encoded_bytes_test());
 }
 
+static ghobject_t make_oid(int i)
+{
+  char buf[32];
+  snprintf(buf, sizeof(buf), "obj_%d", i);
+  return ghobject_t(hobject_t(object_t(buf), "", CEPH_NOSNAP, i, 0, ""));
+}
+
+static void check_touches(ObjectStore::Transaction &t,
+			  const vector<pair<coll_t, ghobject_t> > &expect)
+{
+  ObjectStore::Transaction::iterator i = t.begin();
+  for (auto p = expect.begin(); p != expect.end(); ++p) {
+    ASSERT_TRUE(i.have_op());
+    ObjectStore::Transaction::Op *op = i.decode_op();
+    ASSERT_EQ((int)ObjectStore::Transaction::OP_TOUCH, (int)op->op);
+    ASSERT_EQ(p->first, i.get_cid(op->cid));
+    ASSERT_EQ(p->second, i.get_oid(op->oid));
+  }
+  ASSERT_FALSE(i.have_op());
+}
+
+TEST(Transaction, AppendAndEncodeManyObjects)
+{
+  coll_t cid(spg_t(pg_t(1, 1), shard_id_t::NO_SHARD));
+  coll_t acid(spg_t(pg_t(2, 1), shard_id_t::NO_SHARD));
+  vector<pair<coll_t, ghobject_t> > expect;
+
+  // enough objects to go past the linear scan, some of them repeated
+  ObjectStore::Transaction a;
+  for (int i = 0; i < 3 * OBJECT_INDEX_LINEAR_MAX; ++i) {
+    coll_t c = i % 3 ? cid : acid;
+    a.touch(c, make_oid(i % (2 * OBJECT_INDEX_LINEAR_MAX)));
+    expect.push_back(make_pair(c, make_oid(i % (2 * OBJECT_INDEX_LINEAR_MAX))));
+  }
+  ASSERT_EQ(a.get_encoded_bytes(), a.get_encoded_bytes_test());
+
+  // appended to an empty transaction the ops are shared as they are
+  ObjectStore::Transaction b;
+  b.append(a);
+  // ids in c differ from b's, so these get remapped
+  ObjectStore::Transaction c;
+  c.touch(acid, make_oid(1000));
+  c.touch(cid, make_oid(5));
+  b.append(c);
+  expect.push_back(make_pair(acid, make_oid(1000)));
+  expect.push_back(make_pair(cid, make_oid(5)));
+  b.touch(cid, make_oid(1001));
+  expect.push_back(make_pair(cid, make_oid(1001)));
+  ASSERT_EQ(b.get_encoded_bytes(), b.get_encoded_bytes_test());
+
+  bufferlist bl;
+  b.encode(bl);
+  ObjectStore::Transaction d(bl);
+  check_touches(b, expect);
+  check_touches(d, expect);
+
+  // a is left alone by the appends
+  expect.resize(3 * OBJECT_INDEX_LINEAR_MAX);
+  check_touches(a, expect);
+}
+
 void bench_num_bytes(bool legacy)
 {
   const int max = 2500000;
@@ -0,0 +1,208 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <stdio.h>
+#include <sys/stat.h>
+#include "os/filestore/HashIndex.h"
+#include "os/filestore/chain_xattr.h"
+#include "common/ceph_argparse.h"
+#include "global/global_init.h"
+#include <gtest/gtest.h>
+
+#define INDEX_PATH "PATH_HASHINDEX"
+
+/*
+ * merge_threshold 2 and split_multiple 2 split a subdir inline above
+ * 64 objects and queue it for a background split above
+ * max(64 * 0.8, 16 * 2) = 51.
+ */
+class TestHashIndex : public ::testing::Test {
+public:
+  static const int MERGE_AT = 2;
+  static const int SPLIT_MULTIPLE = 2;
+  static const int SPLIT_AHEAD_POINT = 51;
+
+  virtual void SetUp() {
+    ASSERT_EQ(0, ::system("rm -fr " INDEX_PATH));
+    ASSERT_EQ(0, ::mkdir(INDEX_PATH, 0700));
+    HashIndex index(coll_t(), INDEX_PATH, MERGE_AT, SPLIT_MULTIPLE,
+		    CollectionIndex::HOBJECT_WITH_POOL);
+    ASSERT_LE(0, index.init());
+  }
+
+  virtual void TearDown() {
+    ASSERT_EQ(0, ::system("rm -fr " INDEX_PATH));
+  }
+
+  HashIndex *open_index(double split_ahead) {
+    return new HashIndex(coll_t(), INDEX_PATH, MERGE_AT, SPLIT_MULTIPLE,
+			 CollectionIndex::HOBJECT_WITH_POOL, 0, split_ahead);
+  }
+
+  ghobject_t make_oid(int i) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "obj_%d", i);
+    return ghobject_t(hobject_t(object_t(buf), "", CEPH_NOSNAP,
+				(uint32_t)i * 0x9E3779B1u, 0, ""));
+  }
+
+  /// create objects [from, to) the way FileStore does
+  void create(HashIndex *index, int from, int to) {
+    for (int i = from; i < to; ++i) {
+      CollectionIndex::IndexedPath path;
+      int exists = 0;
+      ASSERT_EQ(0, index->lookup(make_oid(i), &path, &exists));
+      ASSERT_EQ(0, exists);
+      int fd = ::open(path->path(), O_CREAT|O_WRONLY, 0644);
+      ASSERT_LE(0, fd);
+      ::close(fd);
+      ASSERT_EQ(0, index->created(make_oid(i), path->path()));
+    }
+  }
+
+  /// every object in [0, n) is found where lookup says it is
+  void check(HashIndex *index, int n) {
+    for (int i = 0; i < n; ++i) {
+      CollectionIndex::IndexedPath path;
+      int exists = 0;
+      ASSERT_EQ(0, index->lookup(make_oid(i), &path, &exists));
+      ASSERT_EQ(1, exists) << make_oid(i);
+      struct stat st;
+      ASSERT_EQ(0, ::stat(path->path(), &st)) << path->path();
+    }
+    vector<ghobject_t> ls;
+    ASSERT_EQ(0, index->collection_list_partial(ghobject_t(),
+						ghobject_t::get_max(),
+						true, INT_MAX, &ls, NULL));
+    ASSERT_EQ((unsigned)n, ls.size());
+  }
+
+  int count_subdirs() {
+    int n = 0;
+    for (int i = 0; i < 16; ++i) {
+      char buf[64];
+      snprintf(buf, sizeof(buf), INDEX_PATH "/DIR_%X", i);
+      struct stat st;
+      if (::stat(buf, &st) == 0)
+	++n;
+    }
+    return n;
+  }
+};
+
+TEST_F(TestHashIndex, split_ahead_in_steps) {
+  ceph::shared_ptr<HashIndex> index(open_index(.8));
+  create(index.get(), 0, SPLIT_AHEAD_POINT);
+  ASSERT_FALSE(index->split_pending());
+  create(index.get(), SPLIT_AHEAD_POINT, SPLIT_AHEAD_POINT + 1);
+  ASSERT_TRUE(index->split_pending());
+  ASSERT_EQ(0, count_subdirs());
+
+  // One child per step, and the index is usable between steps
+  int steps = 0;
+  uint64_t total = 0;
+  while (index->split_pending()) {
+    uint64_t moved = 0;
+    ASSERT_EQ(0, index->split_next(&moved));
+    if (moved) {
+      ++steps;
+      total += moved;
+      ASSERT_EQ(steps, count_subdirs());
+      check(index.get(), SPLIT_AHEAD_POINT + 1);
+    }
+  }
+  ASSERT_LT(1, steps);
+  ASSERT_LT(SPLIT_AHEAD_POINT + 1 - 16 * MERGE_AT, (int)total);
+
+  // Writes keep going to the split tree, without queueing it again
+  create(index.get(), SPLIT_AHEAD_POINT + 1, SPLIT_AHEAD_POINT + 10);
+  ASSERT_FALSE(index->split_pending());
+  check(index.get(), SPLIT_AHEAD_POINT + 10);
+}
+
+TEST_F(TestHashIndex, split_ahead_past_the_point) {
+  {
+    // Get past the point without it being watched
+    ceph::shared_ptr<HashIndex> index(open_index(0));
+    create(index.get(), 0, SPLIT_AHEAD_POINT + 5);
+    ASSERT_FALSE(index->split_pending());
+  }
+  ceph::shared_ptr<HashIndex> index(open_index(.8));
+  create(index.get(), SPLIT_AHEAD_POINT + 5, SPLIT_AHEAD_POINT + 6);
+  ASSERT_TRUE(index->split_pending());
+}
+
+TEST_F(TestHashIndex, split_queue_survives_restart) {
+  {
+    ceph::shared_ptr<HashIndex> index(open_index(.8));
+    create(index.get(), 0, SPLIT_AHEAD_POINT + 1);
+    ASSERT_TRUE(index->split_pending());
+    uint64_t moved = 0;
+    ASSERT_EQ(0, index->split_next(&moved));
+    ASSERT_LT(0u, moved);
+  }
+  ceph::shared_ptr<HashIndex> index(open_index(.8));
+  ASSERT_FALSE(index->split_pending());
+  ASSERT_EQ(0, index->cleanup());
+  ASSERT_TRUE(index->split_pending());
+  while (index->split_pending()) {
+    uint64_t moved = 0;
+    ASSERT_EQ(0, index->split_next(&moved));
+  }
+  check(index.get(), SPLIT_AHEAD_POINT + 1);
+
+  // Drained, so nothing is requeued by the next mount
+  ceph::shared_ptr<HashIndex> again(open_index(.8));
+  ASSERT_EQ(0, again->cleanup());
+  ASSERT_FALSE(again->split_pending());
+}
+
+TEST_F(TestHashIndex, presplit) {
+  ceph::shared_ptr<HashIndex> index(open_index(0));
+  create(index.get(), 0, 40);
+  ASSERT_EQ(0, index->presplit(40 * 100));
+  ASSERT_TRUE(index->split_pending());
+  while (index->split_pending()) {
+    uint64_t moved = 0;
+    ASSERT_EQ(0, index->split_next(&moved));
+  }
+  ASSERT_LT(1, count_subdirs());
+  check(index.get(), 40);
+}
+
+int main(int argc, char **argv) {
+  int fd = ::creat("detect", 0600);
+  int ret = chain_fsetxattr(fd, "user.test", "A", 1);
+  ::close(fd);
+  ::unlink("detect");
+  if (ret < 0) {
+    cerr << "SKIP HashIndex because unable to test for xattr" << std::endl;
+  } else {
+    vector<const char*> args;
+    argv_to_vec(argc, (const char **)argv, args);
+
+    global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+    common_init_finish(g_ceph_context);
+
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+  }
+}
+
+/*
+ * Local Variables:
+ * compile-command: "cd ../.. ;
+ *   make unittest_hashindex &&
+ *   valgrind --tool=memcheck ./unittest_hashindex \
+ *   # --gtest_filter=TestHashIndex.* --log-to-stderr=true --debug-filestore=20"
+ * End:
+ */
@@ -1,6 +1,7 @@
 // -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
 #include "gtest/gtest.h"
 #include "osd/OSDMap.h"
+#include "osd/OSDMapMapping.h"
 
 #include "global/global_context.h"
 #include "global/global_init.h"
@@ -400,3 +401,251 @@ TEST_F(OSDMapTest, PrimaryAffinity) {
     osdmap.set_primary_affinity(1, 0x10000);
   }
 }
+
+TEST_F(OSDMapTest, PrecomputedMapping) {
+  set_up_map();
+
+  // a pg_temp longer than the pool size, and a primary_temp
+  pg_t pgid = osdmap.raw_pg_to_pg(pg_t(0, 0, -1));
+  {
+    OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+    for (unsigned i = 0; i < get_num_osds(); ++i)
+      inc.new_pg_temp[pgid].push_back(i);
+    inc.new_primary_temp[osdmap.raw_pg_to_pg(pg_t(1, 0, -1))] = 2;
+    osdmap.apply_incremental(inc);
+  }
+
+  // expected answers, computed before any table is attached
+  map<pg_t, vector<int> > ups, actings;
+  map<pg_t, pair<int,int> > primaries;
+  for (auto& p : osdmap.get_pools()) {
+    for (unsigned ps = 0; ps < p.second.get_pg_num(); ++ps) {
+      pg_t pg(ps, p.first);
+      int up_primary, acting_primary;
+      osdmap.pg_to_up_acting_osds(pg, &ups[pg], &up_primary,
+				  &actings[pg], &acting_primary);
+      primaries[pg] = make_pair(up_primary, acting_primary);
+    }
+  }
+
+  ThreadPool tp(g_ceph_context, "mapping_tp", "tp_map", 3);
+  tp.start();
+  for (int parallel = 0; parallel < 2; ++parallel) {
+    ceph::shared_ptr<OSDMapMapping> m(new OSDMapMapping);
+    if (parallel) {
+      ParallelPGMapper mapper(&tp);
+      mapper.map(osdmap, m.get(), 5);
+    } else {
+      m->update(osdmap);
+    }
+    ASSERT_EQ(osdmap.get_epoch(), m->get_epoch());
+    ASSERT_EQ(ups.size(), m->get_num_pgs());
+    osdmap.set_mapping(m);
+    for (auto& p : ups) {
+      vector<int> up, acting;
+      int up_primary, acting_primary;
+      ASSERT_TRUE(m->get(p.first, &up, &up_primary, &acting, &acting_primary));
+      osdmap.pg_to_up_acting_osds(p.first, &up, &up_primary,
+				  &acting, &acting_primary);
+      ASSERT_EQ(p.second, up);
+      ASSERT_EQ(actings[p.first], acting);
+      ASSERT_EQ(primaries[p.first].first, up_primary);
+      ASSERT_EQ(primaries[p.first].second, acting_primary);
+    }
+    // pgs outside the table fall back to computing
+    ASSERT_FALSE(m->get(pg_t(1000, 0), NULL, NULL, NULL, NULL));
+  }
+  tp.stop();
+
+  // modifying the map drops the table
+  ceph::shared_ptr<OSDMapMapping> m(new OSDMapMapping);
+  m->update(osdmap);
+  osdmap.set_mapping(m);
+  osdmap.set_weight(0, CEPH_OSD_OUT);
+  ASSERT_FALSE(osdmap.get_mapping());
+  osdmap.set_mapping(m);
+  osdmap.set_state(0, osdmap.get_state(0));
+  ASSERT_FALSE(osdmap.get_mapping());
+  osdmap.set_mapping(m);
+  osdmap.clear_temp();
+  ASSERT_FALSE(osdmap.get_mapping());
+  osdmap.set_mapping(m);
+  OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+  osdmap.apply_incremental(inc);
+  ASSERT_FALSE(osdmap.get_mapping());
+}
+
+TEST_F(OSDMapTest, UpmapItems) {
+  set_up_map();
+
+  pg_t pgid = osdmap.raw_pg_to_pg(pg_t(0, 0, -1));
+  vector<int> up;
+  int up_primary;
+  osdmap.pg_to_up_acting_osds(pgid, &up, &up_primary, NULL, NULL);
+  int from = up[0], to = -1;
+  for (unsigned i = 0; i < get_num_osds(); ++i) {
+    if (std::find(up.begin(), up.end(), (int)i) == up.end()) {
+      to = i;
+      break;
+    }
+  }
+  ASSERT_NE(-1, to);
+
+  // the exception replaces 'from' in place
+  {
+    OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+    inc.new_pg_upmap_items[pgid].push_back(make_pair(from, to));
+    osdmap.apply_incremental(inc);
+  }
+  vector<int> new_up;
+  osdmap.pg_to_up_acting_osds(pgid, &new_up, &up_primary, NULL, NULL);
+  ASSERT_EQ(up.size(), new_up.size());
+  ASSERT_EQ(to, new_up[0]);
+  ASSERT_EQ(to, up_primary);
+  ASSERT_TRUE(osdmap.get_features(CEPH_ENTITY_TYPE_OSD, NULL) &
+	      CEPH_FEATURE_OSDMAP_PG_UPMAP);
+
+  // and survives an encode/decode round trip
+  {
+    bufferlist bl;
+    osdmap.encode(bl, CEPH_FEATURES_ALL);
+    OSDMap decoded;
+    decoded.decode(bl);
+    ASSERT_EQ(osdmap.get_pg_upmap_items(), decoded.get_pg_upmap_items());
+  }
+
+  // an exception naming an out osd is ignored
+  {
+    OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+    inc.new_weight[to] = CEPH_OSD_OUT;
+    osdmap.apply_incremental(inc);
+  }
+  osdmap.pg_to_up_acting_osds(pgid, &new_up, &up_primary, NULL, NULL);
+  ASSERT_EQ(up, new_up);
+  {
+    OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+    inc.new_weight[to] = CEPH_OSD_IN;
+    inc.old_pg_upmap_items.insert(pgid);
+    osdmap.apply_incremental(inc);
+  }
+  ASSERT_TRUE(osdmap.get_pg_upmap_items().empty());
+  osdmap.pg_to_up_acting_osds(pgid, &new_up, &up_primary, NULL, NULL);
+  ASSERT_EQ(up, new_up);
+}
+
+TEST_F(OSDMapTest, CalcPGUpmaps) {
+  set_up_map();
+
+  set<int64_t> pools;
+  pools.insert(0);
+  const pg_pool_t *pool = osdmap.get_pg_pool(0);
+  ASSERT_TRUE(pool);
+
+  // the most pgs on any one osd, checking every pg stays fully mapped
+  struct {
+    int operator()(OSDMap& m, const pg_pool_t *pool) {
+      map<int,int> count;
+      for (unsigned ps = 0; ps < pool->get_pg_num(); ++ps) {
+	vector<int> up;
+	int up_primary;
+	m.pg_to_up_acting_osds(pg_t(ps, 0), &up, &up_primary, NULL, NULL);
+	EXPECT_EQ(pool->get_size(), up.size());
+	set<int> distinct(up.begin(), up.end());
+	EXPECT_EQ(up.size(), distinct.size());
+	for (vector<int>::iterator p = up.begin(); p != up.end(); ++p)
+	  ++count[*p];
+      }
+      int most = 0;
+      for (map<int,int>::iterator p = count.begin(); p != count.end(); ++p)
+	most = MAX(most, p->second);
+      return most;
+    }
+  } max_pgs;
+
+  int before = max_pgs(osdmap, pool);
+  OSDMap::Incremental pending_inc(osdmap.get_epoch() + 1);
+  pending_inc.fsid = osdmap.get_fsid();
+  int changed = osdmap.calc_pg_upmaps(g_ceph_context, 0, 20, pools,
+				      &pending_inc);
+  ASSERT_LE(changed, 20);
+  osdmap.apply_incremental(pending_inc);
+  ASSERT_LE(max_pgs(osdmap, pool), before);
+
+  // other pools are left alone
+  for (auto& p : osdmap.get_pg_upmap_items())
+    ASSERT_EQ(0, p.first.pool());
+}
+
+TEST_F(OSDMapTest, CopyForIncremental) {
+  set_up_map();
+
+  pg_t pgid = osdmap.raw_pg_to_pg(pg_t(0, 0, -1));
+  entity_addr_t addr;
+  addr.nonce = 100;
+  vector<OSDMap::Incremental> incs;
+  {
+    OSDMap::Incremental inc;
+    inc.new_pg_temp[pgid].push_back(1);
+    inc.new_pg_temp[pgid].push_back(2);
+    inc.new_primary_temp[pgid] = 2;
+    incs.push_back(inc);
+  }
+  {
+    OSDMap::Incremental inc;
+    inc.new_state[1] = CEPH_OSD_UP;
+    incs.push_back(inc);
+  }
+  {
+    OSDMap::Incremental inc;
+    inc.new_up_client[1] = addr;
+    inc.new_up_cluster[1] = addr;
+    inc.new_hb_back_up[1] = addr;
+    inc.new_hb_front_up[1] = addr;
+    inc.new_uuid[1].generate_random();
+    incs.push_back(inc);
+  }
+  {
+    OSDMap::Incremental inc;
+    inc.new_primary_affinity[2] = 0x8000;
+    incs.push_back(inc);
+  }
+  {
+    OSDMap::Incremental inc;
+    inc.new_max_osd = get_num_osds() + 2;
+    inc.new_weight[0] = CEPH_OSD_OUT;
+    incs.push_back(inc);
+  }
+  {
+    // nothing but an epoch bump: everything is shared
+    OSDMap::Incremental inc;
+    incs.push_back(inc);
+  }
+
+  ceph::shared_ptr<OSDMap> base(new OSDMap);
+  base->deepish_copy_from(osdmap);
+  for (auto& inc : incs) {
+    inc.epoch = base->get_epoch() + 1;
+    inc.fsid = base->get_fsid();
+
+    bufferlist before;
+    base->encode(before, CEPH_FEATURES_ALL);
+
+    OSDMap deep;
+    deep.deepish_copy_from(*base);
+    ASSERT_EQ(0, deep.apply_incremental(inc));
+
+    ceph::shared_ptr<OSDMap> cow(new OSDMap);
+    cow->copy_for_incremental(*base, inc);
+    ASSERT_EQ(0, cow->apply_incremental(inc));
+
+    // same result, and the map we shared with is untouched
+    bufferlist deep_bl, cow_bl, after;
+    deep.encode(deep_bl, CEPH_FEATURES_ALL);
+    cow->encode(cow_bl, CEPH_FEATURES_ALL);
+    base->encode(after, CEPH_FEATURES_ALL);
+    ASSERT_TRUE(deep_bl.contents_equal(cow_bl));
+    ASSERT_TRUE(before.contents_equal(after));
+    ASSERT_GT(cow->get_approx_size(), 0u);
+    base = cow;
+  }
+}
@@ -188,6 +188,64 @@ TEST(PerfCounters, MultiplePerfCounters) {
   ASSERT_EQ("{}", msg);
 }
 
+enum {
+  TEST_PERFCOUNTERS3_ELEMENT_FIRST = 600,
+  TEST_PERFCOUNTERS3_ELEMENT_HIST,
+  TEST_PERFCOUNTERS3_ELEMENT_LAST,
+};
+
+static std::string hist_dump(uint64_t count, const char *sum,
+			     const vector<uint64_t>& buckets)
+{
+  std::ostringstream ss;
+  ss << "{\"test_perfcounter_3\":{\"hist\":{\"avgcount\":" << count
+     << ",\"sum\":" << sum << ",\"histogram\":[";
+  for (unsigned i = 0; i < buckets.size(); ++i) {
+    if (i)
+      ss << ",";
+    ss << buckets[i];
+  }
+  ss << "]}}}";
+  return ss.str();
+}
+
+TEST(PerfCounters, TimeHistogram) {
+  PerfCountersCollection *coll = g_ceph_context->get_perfcounters_collection();
+  coll->clear();
+  PerfCountersBuilder bld(g_ceph_context, "test_perfcounter_3",
+	  TEST_PERFCOUNTERS3_ELEMENT_FIRST, TEST_PERFCOUNTERS3_ELEMENT_LAST);
+  bld.add_time_hist(TEST_PERFCOUNTERS3_ELEMENT_HIST, "hist");
+  PerfCounters *fake_pf = bld.create_perf_counters();
+  coll->add(fake_pf);
+  AdminSocketClient client(get_rand_socket_path());
+  std::string msg;
+
+  vector<uint64_t> buckets(PERFCOUNTER_HISTOGRAM_BUCKETS, 0);
+  ASSERT_EQ("", client.do_request("{ \"prefix\": \"perf dump\", \"format\": \"json\" }", &msg));
+  ASSERT_EQ(hist_dump(0, "0.000000000", buckets), msg);
+
+  fake_pf->tinc(TEST_PERFCOUNTERS3_ELEMENT_HIST, utime_t(0, 500));     // < 1us
+  fake_pf->tinc(TEST_PERFCOUNTERS3_ELEMENT_HIST, utime_t(0, 1000));    // [1, 2) us
+  fake_pf->tinc(TEST_PERFCOUNTERS3_ELEMENT_HIST, utime_t(0, 3000));    // [2, 4) us
+  fake_pf->tinc(TEST_PERFCOUNTERS3_ELEMENT_HIST, utime_t(0, 3500));    // [2, 4) us
+  fake_pf->tinc(TEST_PERFCOUNTERS3_ELEMENT_HIST, utime_t(1000, 0));    // overflow
+  buckets[0] = 1;
+  buckets[1] = 1;
+  buckets[2] = 2;
+  buckets[PERFCOUNTER_HISTOGRAM_BUCKETS - 1] = 1;
+  ASSERT_EQ("", client.do_request("{ \"prefix\": \"perf dump\", \"format\": \"json\" }", &msg));
+  ASSERT_EQ(hist_dump(5, "1000.000008000", buckets), msg);
+
+  ASSERT_EQ("", client.do_request("{ \"prefix\": \"perf schema\", \"format\": \"json\" }", &msg));
+  ASSERT_EQ(sd("{\"test_perfcounter_3\":{\"hist\":{\"type\":21,\"description\":\"\",\"nick\":\"\"}}}"), msg);
+
+  fake_pf->reset();
+  buckets.assign(PERFCOUNTER_HISTOGRAM_BUCKETS, 0);
+  ASSERT_EQ("", client.do_request("{ \"prefix\": \"perf dump\", \"format\": \"json\" }", &msg));
+  ASSERT_EQ(hist_dump(0, "0.000000000", buckets), msg);
+  coll->clear();
+}
+
 TEST(PerfCounters, CephContextPerfCounters) {
   // Enable the perf counter
   g_ceph_context->enable_perf_counter();
@@ -281,3 +281,30 @@ TEST(PageSet, FreeHoles)
   pages.get_range(0, 8, range);
   ASSERT_EQ(0u, range.size());
 }
+
+#if defined(__GLIBCXX__)
+TEST(PageSet, PoolReuse)
+{
+  Page::pool_bytes() = 1 << 20;
+  char *data;
+  {
+    PageSet pages(4096);
+    PageSet::page_vector range;
+    pages.alloc_range(0, 4096, range);
+    ASSERT_EQ(1u, range.size());
+    data = range[0]->data;
+    std::fill(data, data + 4096, 'x');
+  }
+  {
+    // the freed page comes back, and the part we won't write is zeroed
+    PageSet pages(4096);
+    PageSet::page_vector range;
+    pages.alloc_range(16, 16, range);
+    ASSERT_EQ(1u, range.size());
+    ASSERT_EQ(data, range[0]->data);
+    ASSERT_EQ(0, range[0]->data[0]);
+    ASSERT_EQ(0, range[0]->data[4095]);
+  }
+  Page::pool_bytes() = 0;
+}
+#endif
@@ -21,6 +21,8 @@
 #include "global/global_init.h"
 #include "osd/OSDMap.h"
 
+#include <fstream>
+
 using namespace std;
 
 void usage()
@@ -36,6 +38,20 @@ void usage()
   cout << "   --test-map-pg <pgid>    map a pgid to osds" << std::endl;
   cout << "   --test-map-object <objectname> [--pool <poolid>] map an object to osds"
        << std::endl;
+  cout << "   --upmap <file>          calculate pg upmap entries to balance pg layout"
+       << std::endl;
+  cout << "                           writing commands to <file> [default: - for stdout]"
+       << std::endl;
+  cout << "   --upmap-max <max-count> set max upmap entries to calculate [default: 100]"
+       << std::endl;
+  cout << "   --upmap-deviation <max-deviation>"
+       << std::endl;
+  cout << "                           max deviation from target [default: .01]"
+       << std::endl;
+  cout << "   --upmap-pool <poolname> restrict upmap balancing to 1 or more pools"
+       << std::endl;
+  cout << "   --upmap-save            write modified OSDMap with upmap changes"
+       << std::endl;
   exit(1);
 }
 
@@ -73,6 +89,11 @@ int main(int argc, const char **argv)
   bool test_map_pgs = false;
   bool test_map_pgs_dump = false;
   bool test_random = false;
+  std::string upmap_file;
+  int upmap_max = 100;
+  float upmap_deviation = .01;
+  std::set<std::string> upmap_pools;
+  bool upmap_save = false;
 
   std::string val;
   std::ostringstream err;
@@ -111,6 +132,22 @@ int main(int argc, const char **argv)
       test_map_pgs_dump = true;
     } else if (ceph_argparse_flag(args, i, "--test-random", (char*)NULL)) {
       test_random = true;
+    } else if (ceph_argparse_witharg(args, i, &val, err, "--upmap", (char*)NULL)) {
+      upmap_file = val;
+    } else if (ceph_argparse_witharg(args, i, &upmap_max, err, "--upmap-max", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << err.str() << std::endl;
+	exit(EXIT_FAILURE);
+      }
+    } else if (ceph_argparse_witharg(args, i, &upmap_deviation, err, "--upmap-deviation", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << err.str() << std::endl;
+	exit(EXIT_FAILURE);
+      }
+    } else if (ceph_argparse_witharg(args, i, &val, "--upmap-pool", (char*)NULL)) {
+      upmap_pools.insert(val);
+    } else if (ceph_argparse_flag(args, i, "--upmap-save", (char*)NULL)) {
+      upmap_save = true;
     } else if (ceph_argparse_flag(args, i, "--clobber", (char*)NULL)) {
       clobber = true;
     } else if (ceph_argparse_witharg(args, i, &pg_bits, err, "--pg_bits", (char*)NULL)) {
@@ -278,6 +315,61 @@ int main(int argc, const char **argv)
     cout << me << ": exported crush map to " << export_crush << std::endl;
   }  
 
+  if (!upmap_file.empty()) {
+    std::ofstream fout;
+    std::ostream *out = &cout;
+    if (upmap_file != "-") {
+      fout.open(upmap_file.c_str());
+      if (!fout) {
+	cerr << me << ": unable to open " << upmap_file << std::endl;
+	exit(1);
+      }
+      out = &fout;
+    }
+    set<int64_t> pools;
+    for (set<string>::iterator p = upmap_pools.begin();
+	 p != upmap_pools.end();
+	 ++p) {
+      int64_t pid = osdmap.lookup_pg_pool_name(*p);
+      if (pid < 0) {
+	cerr << " pool " << *p << " does not exist" << std::endl;
+	exit(1);
+      }
+      pools.insert(pid);
+    }
+    if (!pools.empty())
+      cout << " limiting to pools " << upmap_pools << " (" << pools << ")"
+	   << std::endl;
+
+    OSDMap::Incremental pending_inc(osdmap.get_epoch() + 1);
+    pending_inc.fsid = osdmap.get_fsid();
+    int changed = osdmap.calc_pg_upmaps(g_ceph_context, upmap_deviation,
+					upmap_max, pools, &pending_inc);
+    cout << me << ": " << changed << " upmap changes" << std::endl;
+    for (set<pg_t>::iterator p = pending_inc.old_pg_upmap_items.begin();
+	 p != pending_inc.old_pg_upmap_items.end();
+	 ++p) {
+      *out << "ceph osd rm-pg-upmap-items " << *p << std::endl;
+    }
+    for (map<pg_t,vector<pair<int32_t,int32_t> > >::iterator p =
+	   pending_inc.new_pg_upmap_items.begin();
+	 p != pending_inc.new_pg_upmap_items.end();
+	 ++p) {
+      *out << "ceph osd pg-upmap-items " << p->first;
+      for (vector<pair<int32_t,int32_t> >::iterator q = p->second.begin();
+	   q != p->second.end();
+	   ++q) {
+	*out << " " << q->first << " " << q->second;
+      }
+      *out << std::endl;
+    }
+    if (changed) {
+      osdmap.apply_incremental(pending_inc);
+      if (upmap_save)
+	modified = true;
+    }
+  }
+
   if (!test_map_object.empty()) {
     object_t oid(test_map_object);
     if (pool == -1) {
@@ -460,7 +552,7 @@ int main(int argc, const char **argv)
   if (!print && !tree && !modified &&
       export_crush.empty() && import_crush.empty() && 
       test_map_pg.empty() && test_map_object.empty() &&
-      !test_map_pgs && !test_map_pgs_dump) {
+      !test_map_pgs && !test_map_pgs_dump && upmap_file.empty()) {
     cerr << me << ": no action specified?" << std::endl;
     usage();
   }